@@ -0,0 +1,683 @@
+/**
+ * @file bench_core.c
+ * @brief Microbenchmarks of the core library operations.
+ *
+ * For every database size and churn level, fills a scratch database with
+ * distinct synthetic JPEG images, then times each operation and prints one
+ * CSV line per size, churn level and operation:
+ *
+ *     size,churn,operation,count,ops_per_sec,p50_us,p99_us
+ *
+ * The churn level is the percentage of pictures deleted then inserted again
+ * after the fill, leaving dead space and scattered offsets behind. Reads
+ * are "warm" once the file is in the page cache, and "cold" when its pages
+ * are dropped (posix_fadvise) before each read; "into" reads reuse one
+ * buffer and "async" reads are all submitted at once to a pool of
+ * ASYNC_BENCH_THREADS threads. Durability is off, the cost of each level
+ * is measured by bench_durability.
+ *
+ * The measures run on the storage given (see db_backend.h). In memory,
+ * they leave the disk out, and skip cold reads and garbage collection;
+ * "open" then times the load of the file.
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "pictDB.h"
+#include "dedup.h"
+#include "image_content.h"
+#include "db_async.h"
+
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <fcntl.h>
+#include <vips/vips.h>
+
+#define DEFAULT_SIZES "10,100,1000,10000,100000"
+#define DEFAULT_CHURNS "0,50"
+#define DEFAULT_OPS 1000
+#define LIST_DELIM ","
+#define MAX_LEVELS 16
+#define REPEAT_BUDGET 100000 // slots visited by the whole-database operations (open, list)
+#define IMAGE_SIDE 48
+#define GRAY_LEVELS 256
+#define COMMENT_MAX 32 // JPEG comment segment making each image distinct
+#define ID_PREFIX "bench_"
+#define ID_FORMAT ID_PREFIX "%06zu"
+#define TMP_SUFFIX ".gc"
+#define RANDOM_SEED 0x9e3779b97f4a7c15ULL
+#define ASYNC_BENCH_THREADS 8
+#define DEFAULT_STORAGE "file"
+
+/**
+ * @brief Synthetic images: a few encoded JPEGs, made distinct by a comment.
+ */
+struct image_pool {
+    void *base[GRAY_LEVELS]; /**< encoded gray images */
+    size_t base_size[GRAY_LEVELS]; /**< size of each encoded image */
+    char *scratch; /**< last image made by pool_image */
+    size_t generation; /**< images made so far, the next one's number */
+};
+
+/**
+ * @brief State of the runs of one size and churn level.
+ */
+struct bench_run {
+    const char *db_filename; /**< scratch database */
+    struct pictdb_file db_file; /**< scratch database, opened */
+    enum pictdb_storage storage; /**< storage of the measures, the fill is on file */
+    struct image_pool *pool; /**< images to insert */
+    uint32_t size; /**< slots of the database, all in use */
+    uint32_t churn; /**< percentage of pictures replaced after the fill */
+    size_t ops; /**< timed operations per measure */
+    uint32_t *order; /**< slots, shuffled */
+    double *latencies; /**< latencies of the current measure */
+    uint64_t random; /**< state of the generator */
+};
+
+/********************************************************************//**
+ * Monotonic time in microseconds.
+ ********************************************************************** */
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e6 + (double) ts.tv_nsec / 1e3;
+}
+
+/********************************************************************//**
+ * Orders latencies for percentiles.
+ ********************************************************************** */
+static int compare_double(const void *a, const void *b)
+{
+    const double x = *(const double *) a;
+    const double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/********************************************************************//**
+ * Next value of a xorshift64* generator, so that runs are reproducible.
+ ********************************************************************** */
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+/********************************************************************//**
+ * Parses the name of a storage.
+ ********************************************************************** */
+static int parse_storage(const char *name, enum pictdb_storage *storage)
+{
+    if (!strcmp(name, "file")) {
+        *storage = STORAGE_FILE;
+    } else if (!strcmp(name, "mmap")) {
+        *storage = STORAGE_MMAP;
+    } else if (!strcmp(name, "memory")) {
+        *storage = STORAGE_MEMORY;
+    } else {
+        return ERR_INVALID_ARGUMENT;
+    }
+    return 0;
+}
+
+/********************************************************************//**
+ * Parses a comma separated list of numbers.
+ ********************************************************************** */
+static size_t parse_levels(const char *list, uint32_t levels[], size_t max)
+{
+    char copy[MAX_LEVELS * 8];
+    strncpy(copy, list, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+
+    size_t count = 0;
+    for (char *token = strtok(copy, LIST_DELIM); token != NULL && count < max; token = strtok(NULL, LIST_DELIM)) {
+        levels[count++] = (uint32_t) strtoul(token, NULL, 10);
+    }
+    return count;
+}
+
+/********************************************************************//**
+ * Encodes one gray JPEG image per gray level.
+ ********************************************************************** */
+static int pool_init(struct image_pool *pool)
+{
+    memset(pool, 0, sizeof(struct image_pool));
+
+    int status = 0;
+    size_t max_size = 0;
+    for (size_t i = 0; i < GRAY_LEVELS && status == 0; ++i) {
+        VipsObject *process = VIPS_OBJECT(vips_image_new());
+        VipsImage **t = (VipsImage **) vips_object_local_array(process, 2);
+
+        if (vips_black(&t[0], IMAGE_SIDE, IMAGE_SIDE, NULL) != 0 ||
+            vips_linear1(t[0], &t[1], 1.0, (double) i, NULL) != 0 ||
+            vips_jpegsave_buffer(t[1], &pool->base[i], &pool->base_size[i], NULL) != 0) {
+            status = ERR_VIPS;
+        } else if (pool->base_size[i] > max_size) {
+            max_size = pool->base_size[i];
+        }
+        g_object_unref(process);
+    }
+
+    if (status == 0) {
+        pool->scratch = malloc(max_size + COMMENT_MAX + 4);
+        status = pool->scratch == NULL ? ERR_OUT_OF_MEMORY : 0;
+    }
+    return status;
+}
+
+/********************************************************************//**
+ * Releases the images of a pool.
+ ********************************************************************** */
+static void pool_free(struct image_pool *pool)
+{
+    for (size_t i = 0; i < GRAY_LEVELS; ++i) {
+        g_free(pool->base[i]);
+        pool->base[i] = NULL;
+    }
+    free(pool->scratch);
+    pool->scratch = NULL;
+}
+
+/********************************************************************//**
+ * Makes an image never made before: a gray image with its number in a
+ * comment (COM) segment right after the start of image marker.
+ ********************************************************************** */
+static size_t pool_image(struct image_pool *pool)
+{
+    const size_t n = pool->generation++;
+    const void *base = pool->base[n % GRAY_LEVELS];
+    const size_t base_size = pool->base_size[n % GRAY_LEVELS];
+
+    char comment[COMMENT_MAX];
+    const size_t comment_len = (size_t) snprintf(comment, sizeof(comment), "pictDB bench %zu", n);
+    const size_t segment_len = comment_len + 2;
+
+    unsigned char *out = (unsigned char *) pool->scratch;
+    memcpy(out, base, 2); // SOI
+    out[2] = 0xFF;
+    out[3] = 0xFE;
+    out[4] = (unsigned char) (segment_len >> 8);
+    out[5] = (unsigned char) (segment_len & 0xFF);
+    memcpy(out + 6, comment, comment_len);
+    memcpy(out + 6 + comment_len, (const char *) base + 2, base_size - 2);
+    return base_size + 4 + comment_len;
+}
+
+/********************************************************************//**
+ * Inserts a new image under the picture number n.
+ ********************************************************************** */
+static int insert_picture(struct bench_run *run, size_t n)
+{
+    char pict_id[MAX_PIC_ID + 1];
+    snprintf(pict_id, sizeof(pict_id), ID_FORMAT, n);
+    const size_t size = pool_image(run->pool);
+    return do_insert(run->pool->scratch, size, pict_id, &run->db_file);
+}
+
+/********************************************************************//**
+ * Prints the report line of one measure that took total_us overall.
+ ********************************************************************** */
+static void report_total(const struct bench_run *run, const char *operation, double latencies[], size_t count,
+                         double total_us)
+{
+    qsort(latencies, count, sizeof(double), compare_double);
+    printf("%" PRIu32 ",%" PRIu32 ",%s,%zu,%.1f,%.1f,%.1f\n", run->size, run->churn, operation, count,
+           total_us > 0 ? (double) count * 1e6 / total_us : 0.0,
+           latencies[count / 2], latencies[count * 99 / 100]);
+    fflush(stdout);
+}
+
+/********************************************************************//**
+ * Prints the report line of one measure of sequential operations.
+ ********************************************************************** */
+static void report(const struct bench_run *run, const char *operation, double latencies[], size_t count)
+{
+    double total_us = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        total_us += latencies[i];
+    }
+    report_total(run, operation, latencies, count, total_us);
+}
+
+/********************************************************************//**
+ * Number of repetitions of an operation visiting every slot.
+ ********************************************************************** */
+static size_t whole_repeats(const struct bench_run *run)
+{
+    const size_t repeats = REPEAT_BUDGET / run->size;
+    return repeats == 0 ? 1 : (repeats > run->ops ? run->ops : repeats);
+}
+
+/********************************************************************//**
+ * Creates the database, fills every slot then replaces churn percent of
+ * the pictures. Slots are then shuffled for the measures.
+ ********************************************************************** */
+static int bench_setup(struct bench_run *run)
+{
+    run->db_file.header.max_files = run->size;
+    run->db_file.header.res_resized[2 * RES_THUMB] = DEFAULT_THUMB_RES;
+    run->db_file.header.res_resized[2 * RES_THUMB + 1] = DEFAULT_THUMB_RES;
+    run->db_file.header.res_resized[2 * RES_SMALL] = DEFAULT_SMALL_RES;
+    run->db_file.header.res_resized[2 * RES_SMALL + 1] = DEFAULT_SMALL_RES;
+
+    int status = do_create(run->db_filename, &run->db_file);
+    if (status != 0) {
+        return status;
+    }
+    status = do_set_durability(&run->db_file, DURABILITY_NONE, 0);
+
+    for (size_t i = 0; i < run->size && status == 0; ++i) {
+        status = insert_picture(run, i);
+    }
+
+    char pict_id[MAX_PIC_ID + 1];
+    const size_t replaced = (size_t) run->size * run->churn / 100;
+    for (size_t i = 0; i < replaced && status == 0; ++i) {
+        const size_t n = (size_t) (next_random(&run->random) % run->size);
+        snprintf(pict_id, sizeof(pict_id), ID_FORMAT, n);
+        status = do_delete(pict_id, &run->db_file);
+        if (status == 0) {
+            status = insert_picture(run, n);
+        }
+    }
+
+    for (uint32_t i = 0; i < run->size; ++i) {
+        run->order[i] = i;
+    }
+    for (uint32_t i = run->size - 1; i > 0; --i) {
+        const uint32_t j = (uint32_t) (next_random(&run->random) % (i + 1));
+        const uint32_t swap = run->order[i];
+        run->order[i] = run->order[j];
+        run->order[j] = swap;
+    }
+
+    do_close(&run->db_file);
+    return status;
+}
+
+/********************************************************************//**
+ * Times do_open, each followed by an untimed do_close.
+ ********************************************************************** */
+static int bench_open(struct bench_run *run)
+{
+    const size_t count = whole_repeats(run);
+    int status = 0;
+    for (size_t i = 0; i < count && status == 0; ++i) {
+        const double start = now_us();
+        status = do_open_storage(run->db_filename, "r+b", run->storage, &run->db_file);
+        run->latencies[i] = now_us() - start;
+        if (status == 0) {
+            do_close(&run->db_file);
+        }
+    }
+
+    if (status == 0) {
+        report(run, "open", run->latencies, count);
+    }
+    return status;
+}
+
+/********************************************************************//**
+ * Times do_read of random originals, dropping the cached file pages
+ * before each one when cold.
+ ********************************************************************** */
+static int bench_read(struct bench_run *run, int cold)
+{
+    int status = 0;
+    for (size_t i = 0; i < run->ops && status == 0; ++i) {
+        const uint32_t slot = (uint32_t) (next_random(&run->random) % run->size);
+        if (cold) {
+            fflush(run->db_file.fpdb);
+            (void) posix_fadvise(fileno(run->db_file.fpdb), 0, 0, POSIX_FADV_DONTNEED);
+        }
+
+        char *image = NULL;
+        uint32_t size = 0;
+        const double start = now_us();
+        status = do_read(run->db_file.metadata[slot].pict_id, RES_ORIG, &image, &size, &run->db_file);
+        run->latencies[i] = now_us() - start;
+        free(image);
+    }
+
+    if (status == 0) {
+        report(run, cold ? "read_cold" : "read_warm", run->latencies, run->ops);
+    }
+    return status;
+}
+
+/********************************************************************//**
+ * Times warm random reads of originals into one buffer, grown when a read
+ * comes back short.
+ ********************************************************************** */
+static int bench_read_into(struct bench_run *run)
+{
+    char *buffer = NULL;
+    size_t capacity = 0;
+    int status = 0;
+    for (size_t i = 0; i < run->ops && status == 0; ++i) {
+        const uint32_t slot = (uint32_t) (next_random(&run->random) % run->size);
+        const char *pict_id = run->db_file.metadata[slot].pict_id;
+
+        uint32_t size = 0;
+        const double start = now_us();
+        status = do_read_into(pict_id, RES_ORIG, buffer, capacity, &size, &run->db_file);
+        if (status == 0 && size > capacity) {
+            char *grown = realloc(buffer, size);
+            if (grown == NULL) {
+                status = ERR_OUT_OF_MEMORY;
+            } else {
+                buffer = grown;
+                capacity = size;
+                status = do_read_into(pict_id, RES_ORIG, buffer, capacity, &size, &run->db_file);
+            }
+        }
+        run->latencies[i] = now_us() - start;
+    }
+    free(buffer);
+
+    if (status == 0) {
+        report(run, "read_into", run->latencies, run->ops);
+    }
+    return status;
+}
+
+/********************************************************************//**
+ * Times random reads of originals submitted all at once to an async pool:
+ * latencies run from submission to completion, the rate is over the whole
+ * batch.
+ ********************************************************************** */
+static int bench_read_async(struct bench_run *run)
+{
+    struct pictdb_async *async = NULL;
+    int status = async_open(&run->db_file, ASYNC_BENCH_THREADS, &async);
+    if (status != 0) {
+        return status;
+    }
+
+    const double start = now_us();
+    for (size_t i = 0; i < run->ops && status == 0; ++i) {
+        const uint32_t slot = (uint32_t) (next_random(&run->random) % run->size);
+        run->latencies[i] = now_us();
+        status = async_read(async, run->db_file.metadata[slot].pict_id, RES_ORIG, NULL, (void *) i);
+    }
+
+    struct async_completion completions[ASYNC_BENCH_THREADS];
+    size_t taken = 0;
+    while ((taken = async_wait(async, completions, ASYNC_BENCH_THREADS)) > 0) {
+        const double end = now_us();
+        for (size_t i = 0; i < taken; ++i) {
+            const size_t op = (size_t) completions[i].token;
+            run->latencies[op] = end - run->latencies[op];
+            free(completions[i].image);
+            status = status == 0 ? completions[i].status : status;
+        }
+    }
+    const double total_us = now_us() - start;
+    async_close(async);
+
+    if (status == 0) {
+        report_total(run, "read_async", run->latencies, run->ops, total_us);
+    }
+    return status;
+}
+
+/********************************************************************//**
+ * Times the duplicates scan of random pictures. It forgets the offset of
+ * pictures without duplicate, so the slot is restored after each call.
+ ********************************************************************** */
+static int bench_dedup(struct bench_run *run)
+{
+    int status = 0;
+    for (size_t i = 0; i < run->ops && status == 0; ++i) {
+        const uint32_t slot = (uint32_t) (next_random(&run->random) % run->size);
+        const struct pict_metadata saved = run->db_file.metadata[slot];
+
+        const double start = now_us();
+        status = do_name_and_content_dedup(&run->db_file, slot);
+        run->latencies[i] = now_us() - start;
+        run->db_file.metadata[slot] = saved;
+    }
+
+    if (status == 0) {
+        report(run, "dedup", run->latencies, run->ops);
+    }
+    return status;
+}
+
+/********************************************************************//**
+ * Times the JSON listing of the whole database.
+ ********************************************************************** */
+static int bench_list(struct bench_run *run)
+{
+    const size_t count = whole_repeats(run);
+    int status = 0;
+    for (size_t i = 0; i < count && status == 0; ++i) {
+        const double start = now_us();
+        char *listing = do_list(&run->db_file, JSON);
+        run->latencies[i] = now_us() - start;
+        status = listing == NULL ? ERR_OUT_OF_MEMORY : 0;
+        free(listing);
+    }
+
+    if (status == 0) {
+        report(run, "list_json", run->latencies, count);
+    }
+    return status;
+}
+
+/********************************************************************//**
+ * Times the creation of the thumbnails of distinct pictures.
+ ********************************************************************** */
+static int bench_resize(struct bench_run *run)
+{
+    const size_t count = run->ops < run->size ? run->ops : run->size;
+    int status = 0;
+    for (size_t i = 0; i < count && status == 0; ++i) {
+        const double start = now_us();
+        status = lazy_resize(RES_THUMB, &run->db_file, run->order[i]);
+        run->latencies[i] = now_us() - start;
+    }
+
+    if (status == 0) {
+        report(run, "lazy_resize", run->latencies, count);
+    }
+    return status;
+}
+
+/********************************************************************//**
+ * Times the deletion of distinct pictures, then the insertion of new
+ * images under their names.
+ ********************************************************************** */
+static int bench_delete_insert(struct bench_run *run)
+{
+    const size_t count = run->ops < run->size ? run->ops : run->size;
+    size_t *numbers = calloc(count, sizeof(size_t));
+    if (numbers == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    int status = 0;
+    char pict_id[MAX_PIC_ID + 1];
+    for (size_t i = 0; i < count && status == 0; ++i) {
+        strncpy(pict_id, run->db_file.metadata[run->order[i]].pict_id, MAX_PIC_ID);
+        pict_id[MAX_PIC_ID] = '\0';
+        numbers[i] = strtoul(pict_id + strlen(ID_PREFIX), NULL, 10);
+
+        const double start = now_us();
+        status = do_delete(pict_id, &run->db_file);
+        run->latencies[i] = now_us() - start;
+    }
+    if (status == 0) {
+        report(run, "delete", run->latencies, count);
+    }
+
+    for (size_t i = 0; i < count && status == 0; ++i) {
+        const double start = now_us();
+        status = insert_picture(run, numbers[i]);
+        run->latencies[i] = now_us() - start;
+    }
+    if (status == 0) {
+        report(run, "insert", run->latencies, count);
+    }
+
+    free(numbers);
+    return status;
+}
+
+/********************************************************************//**
+ * Times one garbage collection, which leaves the database closed.
+ ********************************************************************** */
+static int bench_gbcollect(struct bench_run *run)
+{
+    char tmp_filename[FILENAME_MAX];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s" TMP_SUFFIX, run->db_filename);
+
+    const double start = now_us();
+    int status = do_gbcollect(&run->db_file, run->db_filename, tmp_filename);
+    run->latencies[0] = now_us() - start;
+    do_close(&run->db_file);
+
+    if (status == 0) {
+        report(run, "gc", run->latencies, 1);
+    }
+    return status;
+}
+
+/********************************************************************//**
+ * Runs every measure on one size and churn level.
+ ********************************************************************** */
+static int bench_run(struct bench_run *run)
+{
+    int status = bench_setup(run);
+    if (status == 0) {
+        status = bench_open(run);
+    }
+    if (status == 0) {
+        status = do_open_storage(run->db_filename, "r+b", run->storage, &run->db_file);
+    }
+    if (status != 0) {
+        remove(run->db_filename);
+        return status;
+    }
+
+    status = do_set_durability(&run->db_file, DURABILITY_NONE, 0);
+    if (status == 0) {
+        status = bench_read(run, 0);
+    }
+    if (status == 0 && run->storage == STORAGE_FILE) {
+        status = bench_read(run, 1);
+    }
+    if (status == 0) {
+        status = bench_read_into(run);
+    }
+    if (status == 0) {
+        status = bench_read_async(run);
+    }
+    if (status == 0) {
+        status = bench_dedup(run);
+    }
+    if (status == 0) {
+        status = bench_list(run);
+    }
+    if (status == 0) {
+        status = bench_resize(run);
+    }
+    if (status == 0) {
+        status = bench_delete_insert(run);
+    }
+    if (status == 0 && run->storage != STORAGE_MEMORY) {
+        status = bench_gbcollect(run);
+    } else {
+        do_close(&run->db_file);
+    }
+
+    remove(run->db_filename);
+    return status;
+}
+
+/********************************************************************//**
+ * MAIN
+ ********************************************************************** */
+int main(int argc, char *argv[])
+{
+    if (VIPS_INIT(argv[0])) {
+        vips_error_exit("unable to start VIPS");
+    }
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <scratch dbfilename> [sizes [churns [ops [storage]]]]\n", argv[0]);
+        fprintf(stderr, "  sizes: database sizes, default " DEFAULT_SIZES "\n");
+        fprintf(stderr, "  churns: percentages of pictures replaced after the fill, default " DEFAULT_CHURNS "\n");
+        fprintf(stderr, "  ops: timed operations per measure, default %d\n", DEFAULT_OPS);
+        fprintf(stderr, "  storage: file, mmap or memory, default " DEFAULT_STORAGE "\n");
+        return ERR_NOT_ENOUGH_ARGUMENTS;
+    }
+
+    uint32_t sizes[MAX_LEVELS];
+    uint32_t churns[MAX_LEVELS];
+    const size_t size_count = parse_levels(argc > 2 ? argv[2] : DEFAULT_SIZES, sizes, MAX_LEVELS);
+    const size_t churn_count = parse_levels(argc > 3 ? argv[3] : DEFAULT_CHURNS, churns, MAX_LEVELS);
+    const size_t ops = argc > 4 ? strtoul(argv[4], NULL, 10) : DEFAULT_OPS;
+
+    uint32_t max_size = 0;
+    for (size_t i = 0; i < size_count; ++i) {
+        if (sizes[i] == 0 || sizes[i] > MAX_MAX_FILES) {
+            return ERR_MAX_FILES;
+        }
+        max_size = sizes[i] > max_size ? sizes[i] : max_size;
+    }
+    if (ops == 0 || size_count == 0 || churn_count == 0) {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    enum pictdb_storage storage = STORAGE_FILE;
+    if (parse_storage(argc > 5 ? argv[5] : DEFAULT_STORAGE, &storage) != 0) {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    struct image_pool pool;
+    struct bench_run run = {
+        .db_filename = argv[1],
+        .storage = storage,
+        .pool = &pool,
+        .ops = ops,
+        .order = calloc(max_size, sizeof(uint32_t)),
+        .latencies = calloc(ops, sizeof(double))
+    };
+
+    int status = pool_init(&pool);
+    if (status == 0 && (run.order == NULL || run.latencies == NULL)) {
+        status = ERR_OUT_OF_MEMORY;
+    }
+    if (status == 0) {
+        puts("size,churn,operation,count,ops_per_sec,p50_us,p99_us");
+    }
+
+    for (size_t i = 0; i < size_count && status == 0; ++i) {
+        for (size_t j = 0; j < churn_count && status == 0; ++j) {
+            run.size = sizes[i];
+            run.churn = churns[j];
+            run.random = RANDOM_SEED;
+            status = bench_run(&run);
+        }
+    }
+
+    if (status != 0) {
+        fprintf(stderr, "ERROR: %s\n", ERROR_MESSAGES[status]);
+    }
+
+    pool_free(&pool);
+    free(run.order);
+    free(run.latencies);
+
+    vips_shutdown();
+    return status;
+}
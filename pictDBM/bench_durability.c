@@ -0,0 +1,205 @@
+/**
+ * @file bench_durability.c
+ * @brief Measures the throughput and latency cost of each durability level.
+ *
+ * For every level, creates a scratch database, inserts then deletes a set
+ * of synthetic JPEG images and prints one CSV line per level and operation:
+ *
+ *     level,operation,count,ops_per_sec,p50_us,p99_us,close_us
+ *
+ * close_us is the time taken by do_close, which commits whatever the level
+ * left pending.
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "pictDB.h"
+
+#include <string.h>
+#include <time.h>
+#include <vips/vips.h>
+
+#define DEFAULT_COUNT 200
+#define IMAGE_SIDE 48
+#define GRAY_LEVELS 256
+#define ID_FORMAT "bench_%06zu"
+
+struct level {
+    const char *name; /**< level name in the report */
+    enum pictdb_durability durability; /**< level */
+    uint32_t param; /**< do_set_durability parameter */
+};
+
+static const struct level LEVELS[] = {
+    {"none",      DURABILITY_NONE,      0},
+    {"batch",     DURABILITY_BATCH,     DEFAULT_GROUP_COMMIT},
+    {"operation", DURABILITY_OPERATION, 0},
+    {"interval",  DURABILITY_INTERVAL,  DEFAULT_SYNC_INTERVAL}
+};
+
+/********************************************************************//**
+ * Monotonic time in microseconds.
+ ********************************************************************** */
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e6 + (double) ts.tv_nsec / 1e3;
+}
+
+/********************************************************************//**
+ * Orders latencies for percentiles.
+ ********************************************************************** */
+static int compare_double(const void *a, const void *b)
+{
+    const double x = *(const double *) a;
+    const double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/********************************************************************//**
+ * Encodes count distinct gray JPEG images.
+ ********************************************************************** */
+static int make_images(void *images[], size_t sizes[], size_t count)
+{
+    int status = 0;
+    for (size_t i = 0; i < count && status == 0; ++i) {
+        VipsObject *process = VIPS_OBJECT(vips_image_new());
+        VipsImage **t = (VipsImage **) vips_object_local_array(process, 2);
+        const int side = IMAGE_SIDE + (int) (i / GRAY_LEVELS);
+
+        if (vips_black(&t[0], side, side, NULL) != 0 ||
+            vips_linear1(t[0], &t[1], 1.0, (double) (i % GRAY_LEVELS), NULL) != 0 ||
+            vips_jpegsave_buffer(t[1], &images[i], &sizes[i], NULL) != 0) {
+            status = ERR_VIPS;
+        }
+        g_object_unref(process);
+    }
+    return status;
+}
+
+/********************************************************************//**
+ * Prints the report line of one timed phase.
+ ********************************************************************** */
+static void report(const char *level, const char *operation, double latencies[], size_t count, double total_us,
+                   double close_us)
+{
+    qsort(latencies, count, sizeof(double), compare_double);
+    printf("%s,%s,%zu,%.1f,%.1f,%.1f,%.1f\n", level, operation, count,
+           total_us > 0 ? (double) count * 1e6 / total_us : 0.0,
+           latencies[count / 2], latencies[count * 99 / 100], close_us);
+}
+
+/********************************************************************//**
+ * Runs the insert then delete phases of one durability level.
+ ********************************************************************** */
+static int bench_level(const struct level *level, const char *db_filename, void *images[], size_t sizes[],
+                       size_t count, double latencies[])
+{
+    struct pictdb_file db_file;
+    db_file.header.max_files = (uint32_t) count;
+    db_file.header.res_resized[RES_THUMB] = DEFAULT_THUMB_RES;
+    db_file.header.res_resized[RES_THUMB + 1] = DEFAULT_THUMB_RES;
+    db_file.header.res_resized[2 * RES_SMALL] = DEFAULT_SMALL_RES;
+    db_file.header.res_resized[2 * RES_SMALL + 1] = DEFAULT_SMALL_RES;
+
+    int status = do_create(db_filename, &db_file);
+    do_close(&db_file);
+
+    if (status == 0) {
+        status = do_open(db_filename, "r+b", &db_file);
+    }
+    if (status == 0) {
+        status = do_set_durability(&db_file, level->durability, level->param);
+    }
+
+    char pict_id[MAX_PIC_ID + 1];
+    double start = now_us();
+    for (size_t i = 0; i < count && status == 0; ++i) {
+        snprintf(pict_id, sizeof(pict_id), ID_FORMAT, i);
+        const double op_start = now_us();
+        status = do_insert(images[i], sizes[i], pict_id, &db_file);
+        latencies[i] = now_us() - op_start;
+    }
+    double total = now_us() - start;
+    double close_start = now_us();
+    do_close(&db_file);
+    if (status == 0) {
+        report(level->name, "insert", latencies, count, total, now_us() - close_start);
+        status = do_open(db_filename, "r+b", &db_file);
+    }
+
+    if (status == 0) {
+        status = do_set_durability(&db_file, level->durability, level->param);
+        start = now_us();
+        for (size_t i = 0; i < count && status == 0; ++i) {
+            snprintf(pict_id, sizeof(pict_id), ID_FORMAT, i);
+            const double op_start = now_us();
+            status = do_delete(pict_id, &db_file);
+            latencies[i] = now_us() - op_start;
+        }
+        total = now_us() - start;
+        close_start = now_us();
+        do_close(&db_file);
+        if (status == 0) {
+            report(level->name, "delete", latencies, count, total, now_us() - close_start);
+        }
+    }
+
+    remove(db_filename);
+    return status;
+}
+
+/********************************************************************//**
+ * MAIN
+ ********************************************************************** */
+int main(int argc, char *argv[])
+{
+    if (VIPS_INIT(argv[0])) {
+        vips_error_exit("unable to start VIPS");
+    }
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <scratch dbfilename> [count]\n", argv[0]);
+        return ERR_NOT_ENOUGH_ARGUMENTS;
+    }
+
+    const char *db_filename = argv[1];
+    const size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_COUNT;
+    if (count == 0 || count > MAX_MAX_FILES) {
+        return ERR_MAX_FILES;
+    }
+
+    void **images = calloc(count, sizeof(void *));
+    size_t *sizes = calloc(count, sizeof(size_t));
+    double *latencies = calloc(count, sizeof(double));
+
+    int status = images == NULL || sizes == NULL || latencies == NULL ? ERR_OUT_OF_MEMORY : 0;
+    if (status == 0) {
+        status = make_images(images, sizes, count);
+    }
+
+    if (status == 0) {
+        puts("level,operation,count,ops_per_sec,p50_us,p99_us,close_us");
+    }
+    for (size_t i = 0; i < sizeof(LEVELS) / sizeof(LEVELS[0]) && status == 0; ++i) {
+        status = bench_level(&LEVELS[i], db_filename, images, sizes, count, latencies);
+    }
+
+    if (status != 0) {
+        fprintf(stderr, "ERROR: %s\n", ERROR_MESSAGES[status]);
+    }
+
+    for (size_t i = 0; images != NULL && i < count; ++i) {
+        g_free(images[i]);
+    }
+    free(images);
+    free(sizes);
+    free(latencies);
+
+    vips_shutdown();
+    return status;
+}
@@ -0,0 +1,264 @@
+/**
+ * @file dataset.c
+ * @implementation of the synthetic dataset generator
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#include "dataset.h"
+
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <vips/vips.h>
+
+#define BANDS 3
+#define MAX_SHAPES 4 // rectangles drawn over the gradient
+#define ALBUM_SKEW 3 // albums are drawn as ALBUMS * u^ALBUM_SKEW: the first ones are the largest
+#define ID_SEQUENTIAL "img_%06" PRIu32
+#define ID_RANDOM "%016" PRIx64
+#define ID_ALBUM "album%02" PRIu32 "_%06" PRIu32
+
+/**
+ * @brief Drawn parameters of one image.
+ */
+struct dataset_image {
+    uint32_t width; /**< width */
+    uint32_t height; /**< height */
+    int quality; /**< JPEG quality */
+    uint32_t noise; /**< noise amplitude */
+};
+
+/********************************************************************//**
+ * Next value of a splitmix64 generator: good enough streams from seeds
+ * as close as consecutive integers.
+ */
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/********************************************************************//**
+ * Uniform integer in [min, max].
+ */
+static uint32_t uniform(uint64_t *state, uint32_t min, uint32_t max)
+{
+    return min + (uint32_t) (next_random(state) % ((uint64_t) max - min + 1));
+}
+
+/********************************************************************//**
+ * Uniform real in [0, 1).
+ */
+static double unit(uint64_t *state)
+{
+    return (double) (next_random(state) >> 11) / (double) (1ULL << 53);
+}
+
+/********************************************************************//**
+ * Dimension in [min, max] following the distribution of the dataset.
+ */
+static uint32_t dimension(uint64_t *state, enum dataset_dims dims, uint32_t min, uint32_t max)
+{
+    if (dims == DATASET_DIMS_LOG) {
+        const double lo = log((double) min);
+        const double hi = log((double) max + 1);
+        const uint32_t value = (uint32_t) exp(lo + unit(state) * (hi - lo));
+        return value < min ? min : (value > max ? max : value);
+    }
+    return uniform(state, min, max);
+}
+
+/********************************************************************//**
+ * Seed of the image at a position, independent of the other images.
+ */
+static uint64_t image_seed(uint64_t seed, uint32_t position)
+{
+    uint64_t state = seed ^ ((uint64_t) position << 32 | position);
+    return next_random(&state);
+}
+
+/********************************************************************//**
+ * Clamps a pixel value.
+ */
+static unsigned char clamp(int value)
+{
+    return (unsigned char) (value < 0 ? 0 : (value > UINT8_MAX ? UINT8_MAX : value));
+}
+
+/********************************************************************//**
+ * Computes the pixels of an image: a gradient, a few flat rectangles and
+ * noise, all drawn from state.
+ */
+static void draw_pixels(uint64_t *state, const struct dataset_image *image, unsigned char *pixels)
+{
+    int base[BANDS], dx[BANDS], dy[BANDS];
+    for (size_t c = 0; c < BANDS; ++c) {
+        base[c] = (int) uniform(state, 0, UINT8_MAX);
+        dx[c] = (int) uniform(state, 0, 2 * UINT8_MAX) - UINT8_MAX;
+        dy[c] = (int) uniform(state, 0, 2 * UINT8_MAX) - UINT8_MAX;
+    }
+
+    for (uint32_t y = 0; y < image->height; ++y) {
+        for (uint32_t x = 0; x < image->width; ++x) {
+            unsigned char *pixel = &pixels[((size_t) y * image->width + x) * BANDS];
+            for (size_t c = 0; c < BANDS; ++c) {
+                pixel[c] = clamp(base[c] + dx[c] * (int) x / (int) image->width +
+                                 dy[c] * (int) y / (int) image->height);
+            }
+        }
+    }
+
+    const uint32_t shapes = uniform(state, 0, MAX_SHAPES);
+    for (uint32_t s = 0; s < shapes; ++s) {
+        const uint32_t x0 = uniform(state, 0, image->width - 1);
+        const uint32_t y0 = uniform(state, 0, image->height - 1);
+        const uint32_t x1 = uniform(state, x0, image->width - 1);
+        const uint32_t y1 = uniform(state, y0, image->height - 1);
+        unsigned char color[BANDS];
+        for (size_t c = 0; c < BANDS; ++c) {
+            color[c] = (unsigned char) uniform(state, 0, UINT8_MAX);
+        }
+        for (uint32_t y = y0; y <= y1; ++y) {
+            for (uint32_t x = x0; x <= x1; ++x) {
+                memcpy(&pixels[((size_t) y * image->width + x) * BANDS], color, BANDS);
+            }
+        }
+    }
+
+    if (image->noise > 0) {
+        const size_t len = (size_t) image->width * image->height * BANDS;
+        for (size_t i = 0; i < len; ++i) {
+            const int delta = (int) uniform(state, 0, 2 * image->noise) - (int) image->noise;
+            pixels[i] = clamp(pixels[i] + delta);
+        }
+    }
+}
+
+/********************************************************************//**
+ * Draws and encodes the image of a seed.
+ */
+static int make_image(const struct dataset_spec *spec, uint64_t seed, void **jpeg, size_t *size)
+{
+    uint64_t state = seed;
+    struct dataset_image image;
+    image.width = dimension(&state, spec->dims, spec->width[0], spec->width[1]);
+    image.height = dimension(&state, spec->dims, spec->height[0], spec->height[1]);
+    image.quality = (int) uniform(&state, spec->quality[0], spec->quality[1]);
+    image.noise = uniform(&state, spec->noise[0], spec->noise[1]);
+
+    const size_t len = (size_t) image.width * image.height * BANDS;
+    unsigned char *pixels = malloc(len);
+    if (pixels == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    draw_pixels(&state, &image, pixels);
+
+    int status = 0;
+    VipsImage *vips_image = vips_image_new_from_memory(pixels, len, (int) image.width, (int) image.height, BANDS,
+                                                       VIPS_FORMAT_UCHAR);
+    if (vips_image == NULL ||
+        vips_jpegsave_buffer(vips_image, jpeg, size, "Q", image.quality, NULL) != 0) {
+        status = ERR_VIPS;
+    }
+
+    if (vips_image != NULL) {
+        g_object_unref(vips_image);
+    }
+    free(pixels);
+    return status;
+}
+
+/********************************************************************//**
+ * Identifier of the picture at a position.
+ */
+static void make_id(const struct dataset_spec *spec, uint32_t position, char pict_id[MAX_PIC_ID + 1])
+{
+    uint64_t state = image_seed(~spec->seed, position);
+
+    switch (spec->ids) {
+    case DATASET_IDS_RANDOM:
+        snprintf(pict_id, MAX_PIC_ID + 1, ID_RANDOM, next_random(&state));
+        break;
+    case DATASET_IDS_ALBUMS: {
+        const uint32_t album = (uint32_t) (DATASET_ALBUMS * pow(unit(&state), ALBUM_SKEW));
+        snprintf(pict_id, MAX_PIC_ID + 1, ID_ALBUM, album, position);
+        break;
+    }
+    case DATASET_IDS_SEQUENTIAL:
+    default:
+        snprintf(pict_id, MAX_PIC_ID + 1, ID_SEQUENTIAL, position);
+        break;
+    }
+}
+
+void dataset_default(struct dataset_spec *spec, uint32_t count)
+{
+    if (spec == NULL) {
+        return;
+    }
+
+    memset(spec, 0, sizeof(struct dataset_spec));
+    spec->seed = DATASET_DEFAULT_SEED;
+    spec->count = count;
+    spec->width[0] = DATASET_DEFAULT_MIN_WIDTH;
+    spec->width[1] = DATASET_DEFAULT_MAX_WIDTH;
+    spec->height[0] = DATASET_DEFAULT_MIN_HEIGHT;
+    spec->height[1] = DATASET_DEFAULT_MAX_HEIGHT;
+    spec->dims = DATASET_DIMS_LOG;
+    spec->quality[0] = DATASET_DEFAULT_MIN_QUALITY;
+    spec->quality[1] = DATASET_DEFAULT_MAX_QUALITY;
+    spec->noise[0] = DATASET_DEFAULT_MIN_NOISE;
+    spec->noise[1] = DATASET_DEFAULT_MAX_NOISE;
+    spec->duplicates = 0;
+    spec->ids = DATASET_IDS_SEQUENTIAL;
+}
+
+int dataset_generate(const struct dataset_spec *spec, dataset_writer writer, void *arg)
+{
+    M_REQUIRE_NON_NULL(spec);
+    M_REQUIRE_NON_NULL(writer);
+
+    if (spec->width[0] == 0 || spec->height[0] == 0 ||
+        spec->width[0] > spec->width[1] || spec->height[0] > spec->height[1] ||
+        spec->width[1] > DATASET_MAX_SIDE || spec->height[1] > DATASET_MAX_SIDE) {
+        return ERR_RESOLUTIONS;
+    }
+    if (spec->quality[0] == 0 || spec->quality[0] > spec->quality[1] || spec->quality[1] > 100 ||
+        spec->noise[0] > spec->noise[1] || spec->noise[1] > DATASET_MAX_NOISE ||
+        spec->duplicates > 100) {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // position of the image each one repeats, itself when not a duplicate
+    uint32_t *origin = calloc(spec->count > 0 ? spec->count : 1, sizeof(uint32_t));
+    if (origin == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    uint64_t state = spec->seed;
+    char pict_id[MAX_PIC_ID + 1];
+    int status = 0;
+
+    for (uint32_t i = 0; i < spec->count && status == 0; ++i) {
+        origin[i] = i;
+        if (i > 0 && uniform(&state, 1, 100) <= spec->duplicates) {
+            origin[i] = origin[uniform(&state, 0, i - 1)];
+        }
+
+        void *jpeg = NULL;
+        size_t size = 0;
+        status = make_image(spec, image_seed(spec->seed, origin[i]), &jpeg, &size);
+        if (status == 0) {
+            make_id(spec, i, pict_id);
+            status = writer(arg, pict_id, jpeg, size, origin[i] != i);
+        }
+        g_free(jpeg);
+    }
+
+    free(origin);
+    return status;
+}
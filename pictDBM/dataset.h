@@ -0,0 +1,101 @@
+/**
+ * @file dataset.h
+ * @brief pictDB library: seeded generator of synthetic JPEG datasets.
+ *
+ * Every image is drawn from its own generator, seeded from the dataset
+ * seed and its position, so a dataset is the same on every run and every
+ * machine (given the same libjpeg): pixels are computed here, only the
+ * JPEG encoding is left to vips. Duplicates repeat the seed of an earlier
+ * image and are thus byte for byte identical to it.
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#ifndef PICTDBPRJ_DATASET_H
+#define PICTDBPRJ_DATASET_H
+
+#include "pictDB.h"
+
+#define DATASET_DEFAULT_SEED 1
+#define DATASET_DEFAULT_MIN_WIDTH 320
+#define DATASET_DEFAULT_MAX_WIDTH 1920
+#define DATASET_DEFAULT_MIN_HEIGHT 240
+#define DATASET_DEFAULT_MAX_HEIGHT 1080
+#define DATASET_DEFAULT_MIN_QUALITY 60
+#define DATASET_DEFAULT_MAX_QUALITY 95
+#define DATASET_DEFAULT_MIN_NOISE 0
+#define DATASET_DEFAULT_MAX_NOISE 32
+#define DATASET_MAX_SIDE 8192 // max. width or height of a generated image
+#define DATASET_MAX_NOISE 128
+#define DATASET_ALBUMS 32 // albums of DATASET_IDS_ALBUMS
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Distribution of the image dimensions, between their min and max.
+ */
+enum dataset_dims {
+    DATASET_DIMS_UNIFORM, /**< uniform */
+    DATASET_DIMS_LOG /**< log-uniform: as many images within each doubling */
+};
+
+/**
+ * @brief Picture identifiers.
+ */
+enum dataset_ids {
+    DATASET_IDS_SEQUENTIAL, /**< img_000000, img_000001, ... */
+    DATASET_IDS_RANDOM, /**< 16 random hex digits */
+    DATASET_IDS_ALBUMS /**< albumNN_<position>, albums of skewed sizes */
+};
+
+/**
+ * @brief Dataset description. Ranges are inclusive.
+ */
+struct dataset_spec {
+    uint64_t seed; /**< seed of the whole dataset */
+    uint32_t count; /**< number of images */
+    uint16_t width[2]; /**< min. and max. width */
+    uint16_t height[2]; /**< min. and max. height */
+    enum dataset_dims dims; /**< distribution of width and height */
+    uint8_t quality[2]; /**< min. and max. JPEG quality */
+    uint8_t noise[2]; /**< min. and max. noise amplitude, the more the larger the file */
+    uint32_t duplicates; /**< percentage of images repeating an earlier one */
+    enum dataset_ids ids; /**< picture identifiers */
+};
+
+/**
+ * @brief Receives each generated image.
+ *
+ * @param arg Opaque argument given to dataset_generate.
+ * @param pict_id Identifier of the picture.
+ * @param image JPEG image.
+ * @param size Size of the image.
+ * @param duplicate Whether the image repeats an earlier one.
+ * @return 0 to continue, or an error code stopping the generation.
+ */
+typedef int (*dataset_writer)(void *arg, const char *pict_id, const char *image, size_t size, int duplicate);
+
+/**
+ * @brief Fills a description with the default values, for count images.
+ */
+void dataset_default(struct dataset_spec *spec, uint32_t count);
+
+/**
+ * @brief Generates the images of a dataset, in order.
+ *
+ * @param spec Dataset description.
+ * @param writer Receives each image.
+ * @param arg Opaque argument passed to writer.
+ * @return 0, ERR_INVALID_ARGUMENT or ERR_RESOLUTIONS for an invalid
+ *         description, or the first error of the writer.
+ */
+int dataset_generate(const struct dataset_spec *spec, dataset_writer writer, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,351 @@
+/**
+ * @file db_async.c
+ * @implementation of the asynchronous reads, insertions and deletions
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "db_async.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief Submitted request, then its completion.
+ */
+struct async_request {
+    struct async_request *next; /**< next in the pending or completed queue */
+    char pict_id[MAX_PIC_ID + 1]; /**< copy of the picture name */
+    unsigned int res; /**< resolution of a read */
+    const char *image_buffer; /**< image of an insertion, owned by the caller */
+    size_t image_size; /**< size of image_buffer */
+    async_callback callback; /**< NULL if the completion is queued */
+    struct async_completion completion; /**< outcome */
+};
+
+/**
+ * @brief Pool of threads and its queues.
+ */
+struct pictdb_async {
+    struct pictdb_file *db_file; /**< database the requests run on */
+    pthread_mutex_t lock; /**< protects the queues and counters */
+    pthread_cond_t submitted; /**< signaled on submission and on close */
+    pthread_cond_t completed; /**< signaled when a completion is queued */
+    struct async_request *pending; /**< requests to run, oldest first */
+    struct async_request *pending_last; /**< last of pending */
+    struct async_request *done; /**< queued completions, oldest first */
+    struct async_request *done_last; /**< last of done */
+    size_t awaited; /**< requests without callback not taken yet */
+    int closing; /**< whether async_close() was called */
+    int notify[2]; /**< pipe readable while completions are queued */
+    unsigned int threads; /**< number of started threads */
+    pthread_t workers[ASYNC_MAX_THREADS]; /**< pool threads */
+};
+
+/********************************************************************//**
+ * Runs one request synchronously.
+ */
+static void run_request(struct pictdb_file *db_file, struct async_request *request)
+{
+    struct async_completion *completion = &request->completion;
+    switch (completion->op) {
+    case ASYNC_READ:
+        completion->status = do_read(request->pict_id, request->res, &completion->image, &completion->size,
+                                     db_file);
+        break;
+    case ASYNC_INSERT:
+        completion->status = do_insert(request->image_buffer, request->image_size, request->pict_id, db_file);
+        break;
+    case ASYNC_DELETE:
+        completion->status = do_delete(request->pict_id, db_file);
+        break;
+    default:
+        completion->status = ERR_INVALID_ARGUMENT;
+        break;
+    }
+}
+
+/********************************************************************//**
+ * Hands a completion to its callback, or queues it.
+ */
+static void complete(struct pictdb_async *async, struct async_request *request)
+{
+    if (request->callback != NULL) {
+        request->callback(&request->completion);
+        free(request);
+        return;
+    }
+
+    pthread_mutex_lock(&async->lock);
+    request->next = NULL;
+    if (async->done_last != NULL) {
+        async->done_last->next = request;
+    } else {
+        async->done = request;
+    }
+    async->done_last = request;
+    pthread_cond_broadcast(&async->completed);
+    pthread_mutex_unlock(&async->lock);
+
+    // written after queueing: a reader draining the pipe never misses it
+    const char byte = 0;
+    (void) write(async->notify[1], &byte, 1);
+}
+
+/********************************************************************//**
+ * Pool thread: runs pending requests until the pool is closed and none
+ * is left.
+ */
+static void *async_worker(void *arg)
+{
+    struct pictdb_async *async = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&async->lock);
+        while (async->pending == NULL && !async->closing) {
+            pthread_cond_wait(&async->submitted, &async->lock);
+        }
+        struct async_request *request = async->pending;
+        if (request != NULL) {
+            async->pending = request->next;
+            if (async->pending == NULL) {
+                async->pending_last = NULL;
+            }
+        }
+        pthread_mutex_unlock(&async->lock);
+
+        if (request == NULL) {
+            return NULL;
+        }
+        run_request(async->db_file, request);
+        complete(async, request);
+    }
+}
+
+/********************************************************************//**
+ * Starts a pool running the requests on db_file.
+ */
+int async_open(struct pictdb_file *db_file, unsigned int threads, struct pictdb_async **async)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(async);
+
+    struct pictdb_async *pool = calloc(1, sizeof(struct pictdb_async));
+    if (pool == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    pool->db_file = db_file;
+
+    if (pipe(pool->notify) != 0) {
+        free(pool);
+        return ERR_IO;
+    }
+    // completions are never held back by a full pipe
+    (void) fcntl(pool->notify[0], F_SETFL, O_NONBLOCK);
+    (void) fcntl(pool->notify[1], F_SETFL, O_NONBLOCK);
+
+    if (pthread_mutex_init(&pool->lock, NULL) != 0 ||
+        pthread_cond_init(&pool->submitted, NULL) != 0 ||
+        pthread_cond_init(&pool->completed, NULL) != 0) {
+        close(pool->notify[0]);
+        close(pool->notify[1]);
+        free(pool);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    if (threads == 0) {
+        const long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (unsigned int) online : 1;
+    }
+    threads = threads > ASYNC_MAX_THREADS ? ASYNC_MAX_THREADS : threads;
+
+    while (pool->threads < threads &&
+           pthread_create(&pool->workers[pool->threads], NULL, async_worker, pool) == 0) {
+        ++pool->threads;
+    }
+    if (pool->threads == 0) {
+        async_close(pool);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    *async = pool;
+    return 0;
+}
+
+/********************************************************************//**
+ * Runs the submitted requests and stops the pool.
+ */
+void async_close(struct pictdb_async *async)
+{
+    if (async == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&async->lock);
+    async->closing = 1;
+    pthread_cond_broadcast(&async->submitted);
+    pthread_mutex_unlock(&async->lock);
+
+    for (unsigned int i = 0; i < async->threads; ++i) {
+        pthread_join(async->workers[i], NULL);
+    }
+
+    while (async->done != NULL) {
+        struct async_request *request = async->done;
+        async->done = request->next;
+        free(request->completion.image);
+        free(request);
+    }
+
+    pthread_cond_destroy(&async->completed);
+    pthread_cond_destroy(&async->submitted);
+    pthread_mutex_destroy(&async->lock);
+    close(async->notify[0]);
+    close(async->notify[1]);
+    free(async);
+}
+
+/********************************************************************//**
+ * Allocates a request for the pool.
+ */
+static int new_request(struct pictdb_async *async, enum async_op op, const char *pict_id,
+                       async_callback callback, void *token, struct async_request **created)
+{
+    M_REQUIRE_NON_NULL(async);
+    M_REQUIRE_NON_NULL(pict_id);
+    M_REQUIRE_VALID_PIC_ID(pict_id);
+
+    struct async_request *request = calloc(1, sizeof(struct async_request));
+    if (request == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    strncpy(request->pict_id, pict_id, MAX_PIC_ID);
+    request->callback = callback;
+    request->completion.op = op;
+    request->completion.token = token;
+    *created = request;
+    return 0;
+}
+
+/********************************************************************//**
+ * Hands a filled request to the pool.
+ */
+static int enqueue(struct pictdb_async *async, struct async_request *request)
+{
+    pthread_mutex_lock(&async->lock);
+    if (async->closing) {
+        pthread_mutex_unlock(&async->lock);
+        free(request);
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    if (async->pending_last != NULL) {
+        async->pending_last->next = request;
+    } else {
+        async->pending = request;
+    }
+    async->pending_last = request;
+    if (request->callback == NULL) {
+        ++async->awaited;
+    }
+    pthread_cond_signal(&async->submitted);
+    pthread_mutex_unlock(&async->lock);
+    return 0;
+}
+
+int async_read(struct pictdb_async *async, const char *pict_id, unsigned int res,
+               async_callback callback, void *token)
+{
+    struct async_request *request = NULL;
+    const int status = new_request(async, ASYNC_READ, pict_id, callback, token, &request);
+    if (status != 0) {
+        return status;
+    }
+    request->res = res;
+    return enqueue(async, request);
+}
+
+int async_insert(struct pictdb_async *async, const char *image_buffer, size_t image_size, const char *pict_id,
+                 async_callback callback, void *token)
+{
+    M_REQUIRE_NON_NULL(image_buffer);
+
+    struct async_request *request = NULL;
+    const int status = new_request(async, ASYNC_INSERT, pict_id, callback, token, &request);
+    if (status != 0) {
+        return status;
+    }
+    request->image_buffer = image_buffer;
+    request->image_size = image_size;
+    return enqueue(async, request);
+}
+
+int async_delete(struct pictdb_async *async, const char *pict_id, async_callback callback, void *token)
+{
+    struct async_request *request = NULL;
+    const int status = new_request(async, ASYNC_DELETE, pict_id, callback, token, &request);
+    if (status != 0) {
+        return status;
+    }
+    return enqueue(async, request);
+}
+
+/********************************************************************//**
+ * Takes up to max queued completions. Requires the lock.
+ */
+static size_t take_completions(struct pictdb_async *async, struct async_completion completions[], size_t max)
+{
+    size_t taken = 0;
+    while (taken < max && async->done != NULL) {
+        struct async_request *request = async->done;
+        async->done = request->next;
+        completions[taken++] = request->completion;
+        free(request);
+    }
+    if (async->done == NULL) {
+        async->done_last = NULL;
+        // empty queue: the descriptor stops being readable
+        char bytes[64];
+        while (read(async->notify[0], bytes, sizeof(bytes)) > 0) {
+        }
+    }
+    async->awaited -= taken;
+    return taken;
+}
+
+size_t async_poll(struct pictdb_async *async, struct async_completion completions[], size_t max)
+{
+    if (async == NULL || completions == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&async->lock);
+    const size_t taken = take_completions(async, completions, max);
+    pthread_mutex_unlock(&async->lock);
+    return taken;
+}
+
+size_t async_wait(struct pictdb_async *async, struct async_completion completions[], size_t max)
+{
+    if (async == NULL || completions == NULL || max == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&async->lock);
+    while (async->done == NULL && async->awaited > 0) {
+        pthread_cond_wait(&async->completed, &async->lock);
+    }
+    const size_t taken = take_completions(async, completions, max);
+    pthread_mutex_unlock(&async->lock);
+    return taken;
+}
+
+int async_fd(const struct pictdb_async *async)
+{
+    return async == NULL ? -1 : async->notify[0];
+}
@@ -0,0 +1,142 @@
+/**
+ * @file db_async.h
+ * @brief pictDB library: asynchronous reads, insertions and deletions.
+ *
+ * Requests are submitted without blocking and run by a pool of threads on
+ * an opened database: reads in parallel with each other and with the
+ * writers, insertions and deletions one at a time (see db_latch.h). Each
+ * request completes either through its callback, called from a pool
+ * thread, or, without callback, in a completion queue the caller polls or
+ * waits on. The queue has a file descriptor that is readable while it
+ * holds completions, for event loops.
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#ifndef PICTDBPRJ_DB_ASYNC_H
+#define PICTDBPRJ_DB_ASYNC_H
+
+#include "pictDB.h"
+
+#define ASYNC_MAX_THREADS 64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Kind of an asynchronous request.
+ */
+enum async_op {
+    ASYNC_READ, /**< do_read */
+    ASYNC_INSERT, /**< do_insert */
+    ASYNC_DELETE /**< do_delete */
+};
+
+/**
+ * @brief Outcome of an asynchronous request.
+ */
+struct async_completion {
+    enum async_op op; /**< kind of the request */
+    int status; /**< what the synchronous call returned */
+    void *token; /**< given at submission */
+    char *image; /**< read image, to be freed by the receiver; NULL otherwise */
+    uint32_t size; /**< size of the read image */
+};
+
+/**
+ * @brief Receives a completion on a pool thread. The image of a read
+ *        belongs to the callback.
+ */
+typedef void (*async_callback)(const struct async_completion *completion);
+
+struct pictdb_async;
+
+/**
+ * @brief Starts a pool running the requests on db_file, which must stay
+ *        open until async_close().
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param threads Number of pool threads, 0 for one per online CPU.
+ * @param async Set to the pool.
+ */
+int async_open(struct pictdb_file *db_file, unsigned int threads, struct pictdb_async **async);
+
+/**
+ * @brief Runs the submitted requests, stops the pool and drops the
+ *        completions left in the queue.
+ *
+ * @param async The pool.
+ */
+void async_close(struct pictdb_async *async);
+
+/**
+ * @brief Submits a read of pict_id at resolution res.
+ *
+ * @param async The pool.
+ * @param pict_id Picture to read, copied.
+ * @param res Resolution to read.
+ * @param callback Receives the completion, NULL to queue it.
+ * @param token Given back in the completion.
+ */
+int async_read(struct pictdb_async *async, const char *pict_id, unsigned int res,
+               async_callback callback, void *token);
+
+/**
+ * @brief Submits an insertion.
+ *
+ * @param async The pool.
+ * @param image_buffer Image to insert, to be kept valid until completion.
+ * @param image_size Size of the image.
+ * @param pict_id Name of the picture, copied.
+ * @param callback Receives the completion, NULL to queue it.
+ * @param token Given back in the completion.
+ */
+int async_insert(struct pictdb_async *async, const char *image_buffer, size_t image_size, const char *pict_id,
+                 async_callback callback, void *token);
+
+/**
+ * @brief Submits a deletion.
+ *
+ * @param async The pool.
+ * @param pict_id Picture to delete, copied.
+ * @param callback Receives the completion, NULL to queue it.
+ * @param token Given back in the completion.
+ */
+int async_delete(struct pictdb_async *async, const char *pict_id, async_callback callback, void *token);
+
+/**
+ * @brief Takes the queued completions without blocking.
+ *
+ * @param async The pool.
+ * @param completions Receives up to max completions.
+ * @param max Capacity of completions.
+ * @return The number of completions taken.
+ */
+size_t async_poll(struct pictdb_async *async, struct async_completion completions[], size_t max);
+
+/**
+ * @brief Waits for at least one completion, unless no request without
+ *        callback is pending, and takes the queued ones.
+ *
+ * @param async The pool.
+ * @param completions Receives up to max completions.
+ * @param max Capacity of completions.
+ * @return The number of completions taken, 0 if none can come.
+ */
+size_t async_wait(struct pictdb_async *async, struct async_completion completions[], size_t max);
+
+/**
+ * @brief File descriptor readable while completions are queued, to wait
+ *        in poll() or select() along with other sources.
+ *
+ * @param async The pool.
+ */
+int async_fd(const struct pictdb_async *async);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
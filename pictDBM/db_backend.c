@@ -0,0 +1,685 @@
+/**
+ * @file db_backend.c
+ * @implementation of the storage backends of a database
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "db_backend.h"
+#include "db_wal.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/********************************************************************//**
+ * Reads bytes scattered over buffers with the read operation of the
+ * backend, one buffer at a time.
+ */
+static int scatter_read(struct pictdb_backend *backend, uint64_t offset, size_t size, const struct iovec iov[],
+                        size_t iovcnt)
+{
+    size_t done = 0;
+    for (size_t i = 0; i < iovcnt && done < size; ++i) {
+        const size_t len = iov[i].iov_len < size - done ? iov[i].iov_len : size - done;
+        const int status = backend->ops->read(backend, offset + done, iov[i].iov_base, len);
+        if (status != 0) {
+            return status;
+        }
+        done += len;
+    }
+    return done == size ? 0 : ERR_INVALID_ARGUMENT;
+}
+
+/********************************************************************//**
+ * Reads bytes of the file with pread().
+ */
+static int file_read(struct pictdb_backend *backend, uint64_t offset, void *buffer, size_t size)
+{
+    const int fd = fileno(backend->fp);
+    size_t done = 0;
+    while (done < size) {
+        const ssize_t len = pread(fd, (char *) buffer + done, size - done, (off_t) (offset + done));
+        if (len > 0) {
+            done += (size_t) len;
+        } else if (len == 0 || errno != EINTR) {
+            return ERR_IO;
+        }
+    }
+    return 0;
+}
+
+/********************************************************************//**
+ * Reads bytes of the file with preadv(), BACKEND_IOV_BATCH buffers at a
+ * time.
+ */
+static int file_readv(struct pictdb_backend *backend, uint64_t offset, size_t size, const struct iovec iov[],
+                      size_t iovcnt)
+{
+    const int fd = fileno(backend->fp);
+    size_t done = 0;
+    size_t index = 0; // buffer receiving byte done
+    size_t skip = 0; // bytes of iov[index] already filled
+    while (done < size) {
+        struct iovec part[BACKEND_IOV_BATCH];
+        size_t count = 0;
+        size_t wanted = 0;
+        for (size_t i = index; i < iovcnt && count < BACKEND_IOV_BATCH && wanted < size - done; ++i) {
+            const size_t first = i == index ? skip : 0;
+            const size_t left = size - done - wanted;
+            part[count].iov_base = (char *) iov[i].iov_base + first;
+            part[count].iov_len = iov[i].iov_len - first < left ? iov[i].iov_len - first : left;
+            wanted += part[count].iov_len;
+            ++count;
+        }
+        if (wanted == 0) {
+            return ERR_INVALID_ARGUMENT;
+        }
+
+        ssize_t len = preadv(fd, part, (int) count, (off_t) (offset + done));
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            return ERR_IO;
+        }
+
+        done += (size_t) len;
+        for (len += (ssize_t) skip; index < iovcnt && (size_t) len >= iov[index].iov_len; ++index) {
+            len -= (ssize_t) iov[index].iov_len;
+        }
+        skip = (size_t) len;
+    }
+    return 0;
+}
+
+/********************************************************************//**
+ * Writes bytes through the stream.
+ */
+static int file_write(struct pictdb_backend *backend, uint64_t offset, const void *data, size_t size)
+{
+    return fseek(backend->fp, (long) offset, SEEK_SET) != 0 ||
+           (size > 0 && fwrite(data, size, 1, backend->fp) != 1) ? ERR_IO : 0;
+}
+
+/********************************************************************//**
+ * Writes bytes at the end of the file through the stream.
+ */
+static int file_append(struct pictdb_backend *backend, const void *data, size_t size, uint64_t *offset)
+{
+    if (fseek(backend->fp, 0, SEEK_END) != 0) {
+        return ERR_IO;
+    }
+    const long end_offset = ftell(backend->fp);
+    if (end_offset == -1 || (size > 0 && fwrite(data, size, 1, backend->fp) != 1)) {
+        return ERR_IO;
+    }
+    *offset = (uint64_t) end_offset;
+    return 0;
+}
+
+/********************************************************************//**
+ * Size of the file once the stream is flushed.
+ */
+static int file_size(struct pictdb_backend *backend, uint64_t *size)
+{
+    struct stat st;
+    if (fflush(backend->fp) != 0 || fstat(fileno(backend->fp), &st) != 0) {
+        return ERR_IO;
+    }
+    *size = (uint64_t) st.st_size;
+    return 0;
+}
+
+/********************************************************************//**
+ * Truncates the file once the stream is flushed.
+ */
+static int file_truncate(struct pictdb_backend *backend, uint64_t size)
+{
+    return fflush(backend->fp) == 0 && ftruncate(fileno(backend->fp), (off_t) size) == 0 ? 0 : ERR_IO;
+}
+
+/********************************************************************//**
+ * Flushes the stream, and forces it to disk if asked to.
+ */
+static int file_flush(struct pictdb_backend *backend, int durable)
+{
+    if (durable) {
+        return sync_file(backend->fp);
+    }
+    return fflush(backend->fp) == 0 ? 0 : ERR_IO;
+}
+
+/********************************************************************//**
+ * Nothing to release: the stream belongs to the database.
+ */
+static void file_close(struct pictdb_backend *backend)
+{
+    (void) backend;
+}
+
+static const struct backend_ops file_ops = {
+    .read = file_read,
+    .readv = file_readv,
+    .write = file_write,
+    .append = file_append,
+    .size = file_size,
+    .truncate = file_truncate,
+    .flush = file_flush,
+    .close = file_close,
+};
+
+/**
+ * @brief Mapping of the file. Replaced mappings stay valid until close,
+ *        for the readers still copying from them.
+ */
+struct mmap_view {
+    struct mmap_view *previous; /**< replaced mapping, NULL if first */
+    char *base; /**< first byte of the file */
+    size_t length; /**< mapped bytes, possibly past the end of the file */
+};
+
+/**
+ * @brief State of STORAGE_MMAP.
+ */
+struct mmap_state {
+    pthread_mutex_t lock; /**< taken to map the file again */
+    struct mmap_view *view; /**< current mapping, NULL until the first read */
+    uint64_t size; /**< bytes of the file safe to map: flushed and not truncated */
+};
+
+/********************************************************************//**
+ * Takes the size of the file, once flushed, as the end of the bytes
+ * read from the mapping.
+ */
+static int mmap_refresh(struct pictdb_backend *backend)
+{
+    struct mmap_state *state = backend->state;
+    struct stat st;
+    if (fstat(fileno(backend->fp), &st) != 0) {
+        return ERR_IO;
+    }
+    __atomic_store_n(&state->size, (uint64_t) st.st_size, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/********************************************************************//**
+ * Maps the file again so that it covers end, at least doubling the
+ * mapping. NULL if the file is shorter or on failure.
+ */
+static struct mmap_view *mmap_grow(struct pictdb_backend *backend, uint64_t end)
+{
+    struct mmap_state *state = backend->state;
+    pthread_mutex_lock(&state->lock);
+
+    struct mmap_view *view = state->view;
+    struct stat st;
+    if ((view == NULL || view->length < end) &&
+        fstat(fileno(backend->fp), &st) == 0 && (uint64_t) st.st_size >= end) {
+
+        size_t length = view == NULL ? BACKEND_MAP_MIN : 2 * view->length;
+        while (length < (uint64_t) st.st_size) {
+            length *= 2;
+        }
+
+        // pages past the end of the file are never touched: only bytes
+        // written and flushed before are read
+        struct mmap_view *grown = malloc(sizeof(struct mmap_view));
+        void *base = grown == NULL ? MAP_FAILED :
+                     mmap(NULL, length, PROT_READ, MAP_SHARED, fileno(backend->fp), 0);
+        if (base != MAP_FAILED) {
+            grown->previous = view;
+            grown->base = base;
+            grown->length = length;
+            __atomic_store_n(&state->view, grown, __ATOMIC_RELEASE);
+            view = grown;
+        } else {
+            free(grown);
+        }
+    }
+
+    pthread_mutex_unlock(&state->lock);
+    return view != NULL && view->length >= end ? view : NULL;
+}
+
+/********************************************************************//**
+ * Copies bytes out of the mapping, with pread() if it cannot cover them.
+ * Pages of the mapping past the end of the file fault (SIGBUS): bytes past
+ * the known size, such as those of a corrupt slot or written by another
+ * process, are read with pread(), which fails cleanly.
+ */
+static int mmap_read(struct pictdb_backend *backend, uint64_t offset, void *buffer, size_t size)
+{
+    struct mmap_state *state = backend->state;
+    if (offset + size > __atomic_load_n(&state->size, __ATOMIC_ACQUIRE)) {
+        return file_read(backend, offset, buffer, size);
+    }
+
+    const struct mmap_view *view = __atomic_load_n(&state->view, __ATOMIC_ACQUIRE);
+    if (view == NULL || view->length < offset + size) {
+        view = mmap_grow(backend, offset + size);
+    }
+    if (view == NULL) {
+        return file_read(backend, offset, buffer, size);
+    }
+
+    memcpy(buffer, view->base + offset, size);
+    return 0;
+}
+
+/********************************************************************//**
+ * Size of the file once the stream is flushed, then known to readers.
+ */
+static int mmap_size(struct pictdb_backend *backend, uint64_t *size)
+{
+    const int status = file_size(backend, size);
+    if (status == 0) {
+        __atomic_store_n(&((struct mmap_state *) backend->state)->size, *size, __ATOMIC_RELEASE);
+    }
+    return status;
+}
+
+/********************************************************************//**
+ * Truncates the file. Readers stop mapping the bytes cut before they go.
+ */
+static int mmap_truncate(struct pictdb_backend *backend, uint64_t size)
+{
+    struct mmap_state *state = backend->state;
+    if (size < __atomic_load_n(&state->size, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&state->size, size, __ATOMIC_RELEASE);
+    }
+    const int status = file_truncate(backend, size);
+    return mmap_refresh(backend) == 0 ? status : ERR_IO;
+}
+
+/********************************************************************//**
+ * Flushes the stream, then lets readers map the bytes written.
+ */
+static int mmap_flush(struct pictdb_backend *backend, int durable)
+{
+    const int status = file_flush(backend, durable);
+    return mmap_refresh(backend) == 0 ? status : ERR_IO;
+}
+
+/********************************************************************//**
+ * Unmaps every mapping of the file.
+ */
+static void mmap_close(struct pictdb_backend *backend)
+{
+    struct mmap_state *state = backend->state;
+    while (state->view != NULL) {
+        struct mmap_view *view = state->view;
+        state->view = view->previous;
+        munmap(view->base, view->length);
+        free(view);
+    }
+    pthread_mutex_destroy(&state->lock);
+    free(state);
+}
+
+static const struct backend_ops mmap_ops = {
+    .read = mmap_read,
+    .readv = scatter_read,
+    .write = file_write,
+    .append = file_append,
+    .size = mmap_size,
+    .truncate = mmap_truncate,
+    .flush = mmap_flush,
+    .close = mmap_close,
+};
+
+/**
+ * @brief Directory of the chunks of STORAGE_MEMORY. A NULL chunk reads as
+ *        zeros. Replaced directories stay valid until close, for the
+ *        readers still walking them.
+ */
+struct memory_chunks {
+    struct memory_chunks *previous; /**< replaced directory, NULL if first */
+    size_t count; /**< number of entries */
+    char *chunk[]; /**< BACKEND_CHUNK_SIZE bytes each, or NULL */
+};
+
+/**
+ * @brief State of STORAGE_MEMORY.
+ */
+struct memory_state {
+    struct memory_chunks *chunks; /**< current directory, NULL while empty */
+    uint64_t size; /**< bytes stored */
+};
+
+/********************************************************************//**
+ * Copies bytes out of the chunks.
+ */
+static int memory_read(struct pictdb_backend *backend, uint64_t offset, void *buffer, size_t size)
+{
+    struct memory_state *state = backend->state;
+    if (offset + size > __atomic_load_n(&state->size, __ATOMIC_ACQUIRE)) {
+        return ERR_IO;
+    }
+
+    const struct memory_chunks *chunks = __atomic_load_n(&state->chunks, __ATOMIC_ACQUIRE);
+    size_t done = 0;
+    while (done < size) {
+        const uint64_t at = offset + done;
+        const size_t index = (size_t) (at / BACKEND_CHUNK_SIZE);
+        const size_t within = (size_t) (at % BACKEND_CHUNK_SIZE);
+        const size_t len = BACKEND_CHUNK_SIZE - within < size - done ? BACKEND_CHUNK_SIZE - within : size - done;
+
+        const char *chunk = chunks != NULL && index < chunks->count ?
+                            __atomic_load_n(&chunks->chunk[index], __ATOMIC_ACQUIRE) : NULL;
+        if (chunk != NULL) {
+            memcpy((char *) buffer + done, chunk + within, len);
+        } else {
+            memset((char *) buffer + done, 0, len);
+        }
+        done += len;
+    }
+    return 0;
+}
+
+/********************************************************************//**
+ * Makes the directory hold at least count entries.
+ */
+static int memory_reserve(struct memory_state *state, size_t count)
+{
+    struct memory_chunks *chunks = state->chunks;
+    const size_t current = chunks == NULL ? 0 : chunks->count;
+    if (count <= current) {
+        return 0;
+    }
+
+    size_t grown_count = current < 16 ? 16 : 2 * current;
+    while (grown_count < count) {
+        grown_count *= 2;
+    }
+
+    struct memory_chunks *grown = calloc(1, sizeof(struct memory_chunks) + grown_count * sizeof(char *));
+    if (grown == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    grown->previous = chunks;
+    grown->count = grown_count;
+    if (current > 0) {
+        memcpy(grown->chunk, chunks->chunk, current * sizeof(char *));
+    }
+    __atomic_store_n(&state->chunks, grown, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/********************************************************************//**
+ * Copies bytes into the chunks, allocating the missing ones.
+ */
+static int memory_write(struct pictdb_backend *backend, uint64_t offset, const void *data, size_t size)
+{
+    struct memory_state *state = backend->state;
+    const uint64_t end = offset + size;
+    int status = memory_reserve(state, (size_t) ((end + BACKEND_CHUNK_SIZE - 1) / BACKEND_CHUNK_SIZE));
+    if (status != 0) {
+        return status;
+    }
+
+    struct memory_chunks *chunks = state->chunks;
+    size_t done = 0;
+    while (done < size) {
+        const uint64_t at = offset + done;
+        const size_t index = (size_t) (at / BACKEND_CHUNK_SIZE);
+        const size_t within = (size_t) (at % BACKEND_CHUNK_SIZE);
+        const size_t len = BACKEND_CHUNK_SIZE - within < size - done ? BACKEND_CHUNK_SIZE - within : size - done;
+
+        if (chunks->chunk[index] == NULL) {
+            char *chunk = calloc(1, BACKEND_CHUNK_SIZE);
+            if (chunk == NULL) {
+                return ERR_OUT_OF_MEMORY;
+            }
+            __atomic_store_n(&chunks->chunk[index], chunk, __ATOMIC_RELEASE);
+        }
+        memcpy(chunks->chunk[index] + within, (const char *) data + done, len);
+        done += len;
+    }
+
+    if (end > state->size) {
+        __atomic_store_n(&state->size, end, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+/********************************************************************//**
+ * Copies bytes after the last ones.
+ */
+static int memory_append(struct pictdb_backend *backend, const void *data, size_t size, uint64_t *offset)
+{
+    const struct memory_state *state = backend->state;
+    const uint64_t end = state->size;
+    const int status = memory_write(backend, end, data, size);
+    if (status == 0) {
+        *offset = end;
+    }
+    return status;
+}
+
+/********************************************************************//**
+ * Number of bytes stored.
+ */
+static int memory_size(struct pictdb_backend *backend, uint64_t *size)
+{
+    const struct memory_state *state = backend->state;
+    *size = __atomic_load_n(&state->size, __ATOMIC_ACQUIRE);
+    return 0;
+}
+
+/********************************************************************//**
+ * Drops the bytes past size, or extends with zeros. Dropped bytes were
+ * never published to readers.
+ */
+static int memory_truncate(struct pictdb_backend *backend, uint64_t size)
+{
+    struct memory_state *state = backend->state;
+    struct memory_chunks *chunks = state->chunks;
+    if (size < state->size && chunks != NULL) {
+        const size_t kept = (size_t) ((size + BACKEND_CHUNK_SIZE - 1) / BACKEND_CHUNK_SIZE);
+        const size_t within = (size_t) (size % BACKEND_CHUNK_SIZE);
+        if (within != 0 && kept - 1 < chunks->count && chunks->chunk[kept - 1] != NULL) {
+            memset(chunks->chunk[kept - 1] + within, 0, BACKEND_CHUNK_SIZE - within);
+        }
+        for (size_t i = kept; i < chunks->count; ++i) {
+            free(chunks->chunk[i]);
+            chunks->chunk[i] = NULL;
+        }
+    }
+    __atomic_store_n(&state->size, size, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/********************************************************************//**
+ * Writes are seen at once, and never durable.
+ */
+static int memory_flush(struct pictdb_backend *backend, int durable)
+{
+    (void) backend;
+    (void) durable;
+    return 0;
+}
+
+/********************************************************************//**
+ * Frees the chunks and every directory.
+ */
+static void memory_close(struct pictdb_backend *backend)
+{
+    struct memory_state *state = backend->state;
+    if (state->chunks != NULL) {
+        for (size_t i = 0; i < state->chunks->count; ++i) {
+            free(state->chunks->chunk[i]);
+        }
+    }
+    while (state->chunks != NULL) {
+        struct memory_chunks *chunks = state->chunks;
+        state->chunks = chunks->previous;
+        free(chunks);
+    }
+    free(state);
+}
+
+static const struct backend_ops memory_ops = {
+    .read = memory_read,
+    .readv = scatter_read,
+    .write = memory_write,
+    .append = memory_append,
+    .size = memory_size,
+    .truncate = memory_truncate,
+    .flush = memory_flush,
+    .close = memory_close,
+};
+
+/********************************************************************//**
+ * Sets up the backend of db_file.
+ */
+int backend_open(struct pictdb_file *db_file, enum pictdb_storage storage)
+{
+    M_REQUIRE_NON_NULL(db_file);
+
+    db_file->backend = NULL;
+    if (storage != STORAGE_MEMORY && db_file->fpdb == NULL) {
+        return ERR_IO;
+    }
+
+    struct pictdb_backend *backend = calloc(1, sizeof(struct pictdb_backend));
+    if (backend == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    backend->storage = storage;
+    backend->fp = storage == STORAGE_MEMORY ? NULL : db_file->fpdb;
+
+    switch (storage) {
+    case STORAGE_FILE:
+        backend->ops = &file_ops;
+        break;
+    case STORAGE_MMAP: {
+        struct mmap_state *state = calloc(1, sizeof(struct mmap_state));
+        if (state == NULL || pthread_mutex_init(&state->lock, NULL) != 0) {
+            free(state);
+            free(backend);
+            return ERR_OUT_OF_MEMORY;
+        }
+        backend->ops = &mmap_ops;
+        backend->state = state;
+        if (mmap_refresh(backend) != 0) {
+            pthread_mutex_destroy(&state->lock);
+            free(state);
+            free(backend);
+            return ERR_IO;
+        }
+        break;
+    }
+    case STORAGE_MEMORY:
+        backend->ops = &memory_ops;
+        backend->state = calloc(1, sizeof(struct memory_state));
+        if (backend->state == NULL) {
+            free(backend);
+            return ERR_OUT_OF_MEMORY;
+        }
+        break;
+    default:
+        free(backend);
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    db_file->backend = backend;
+    return 0;
+}
+
+/********************************************************************//**
+ * Releases the backend of db_file.
+ */
+void backend_close(struct pictdb_file *db_file)
+{
+    if (db_file == NULL || db_file->backend == NULL) {
+        return;
+    }
+
+    db_file->backend->ops->close(db_file->backend);
+    free(db_file->backend);
+    db_file->backend = NULL;
+}
+
+int backend_read(const struct pictdb_file *db_file, uint64_t offset, void *buffer, size_t size)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(buffer);
+
+    if (db_file->backend == NULL) {
+        return ERR_IO;
+    }
+    return db_file->backend->ops->read(db_file->backend, offset, buffer, size);
+}
+
+int backend_readv(const struct pictdb_file *db_file, uint64_t offset, size_t size, const struct iovec iov[],
+                  size_t iovcnt)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(iov);
+
+    if (db_file->backend == NULL) {
+        return ERR_IO;
+    }
+    return db_file->backend->ops->readv(db_file->backend, offset, size, iov, iovcnt);
+}
+
+int backend_write(struct pictdb_file *db_file, uint64_t offset, const void *data, size_t size)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(data);
+
+    if (db_file->backend == NULL) {
+        return ERR_IO;
+    }
+    return db_file->backend->ops->write(db_file->backend, offset, data, size);
+}
+
+int backend_append(struct pictdb_file *db_file, const void *data, size_t size, uint64_t *offset)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(data);
+    M_REQUIRE_NON_NULL(offset);
+
+    if (db_file->backend == NULL) {
+        return ERR_IO;
+    }
+    return db_file->backend->ops->append(db_file->backend, data, size, offset);
+}
+
+int backend_size(struct pictdb_file *db_file, uint64_t *size)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(size);
+
+    if (db_file->backend == NULL) {
+        return ERR_IO;
+    }
+    return db_file->backend->ops->size(db_file->backend, size);
+}
+
+int backend_truncate(struct pictdb_file *db_file, uint64_t size)
+{
+    M_REQUIRE_NON_NULL(db_file);
+
+    if (db_file->backend == NULL) {
+        return ERR_IO;
+    }
+    return db_file->backend->ops->truncate(db_file->backend, size);
+}
+
+int backend_flush(struct pictdb_file *db_file, int durable)
+{
+    M_REQUIRE_NON_NULL(db_file);
+
+    if (db_file->backend == NULL) {
+        return ERR_IO;
+    }
+    return db_file->backend->ops->flush(db_file->backend, durable);
+}
@@ -0,0 +1,160 @@
+/**
+ * @file db_backend.h
+ * @brief pictDB library: storage of the bytes of a database.
+ *
+ * The core reads and writes the database through a backend, chosen when
+ * the database is created or opened (see enum pictdb_storage):
+ *  - STORAGE_FILE reads the database file with pread(), so that readers
+ *    never move the stream the writer appends through;
+ *  - STORAGE_MMAP copies reads out of a shared mapping of the file, mapped
+ *    again larger as the file grows; writes go through the stream;
+ *  - STORAGE_MEMORY keeps the bytes in chunks of memory dropped on close,
+ *    so that benchmarks measure CPU costs only and tests or caches need no
+ *    disk.
+ *
+ * Writes only come from the writer (under the writer lock, see
+ * db_latch.h), reads from any thread at any time: bytes written are seen
+ * by reads once flushed. A database in memory has none of the features
+ * built on its file: log file, index file, sharing between processes,
+ * io_uring, check and garbage collection.
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#ifndef PICTDBPRJ_DB_BACKEND_H
+#define PICTDBPRJ_DB_BACKEND_H
+
+#include "pictDB.h"
+
+#define BACKEND_CHUNK_SIZE (1 << 20) // bytes per chunk of STORAGE_MEMORY
+#define BACKEND_IOV_BATCH 64 // buffers passed to one preadv() by STORAGE_FILE
+#define BACKEND_MAP_MIN (16 << 20) // smallest mapping of STORAGE_MMAP
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct pictdb_backend;
+
+/**
+ * @brief Operations of a backend. Each returns 0 or an error code.
+ */
+struct backend_ops {
+    /** Reads size bytes at offset, all of them or fails. */
+    int (*read)(struct pictdb_backend *backend, uint64_t offset, void *buffer, size_t size);
+    /** Like read, scattering the bytes over buffers filled in turn. */
+    int (*readv)(struct pictdb_backend *backend, uint64_t offset, size_t size, const struct iovec iov[],
+                 size_t iovcnt);
+    /** Writes size bytes at offset, growing the storage if needed. */
+    int (*write)(struct pictdb_backend *backend, uint64_t offset, const void *data, size_t size);
+    /** Writes size bytes at the end and tells where. */
+    int (*append)(struct pictdb_backend *backend, const void *data, size_t size, uint64_t *offset);
+    /** Tells the number of bytes stored. */
+    int (*size)(struct pictdb_backend *backend, uint64_t *size);
+    /** Shrinks or extends (with zeros) the storage to size bytes. */
+    int (*truncate)(struct pictdb_backend *backend, uint64_t size);
+    /** Makes the writes seen by reads, and durable if asked to. */
+    int (*flush)(struct pictdb_backend *backend, int durable);
+    /** Releases the state of the backend, not the stream. */
+    void (*close)(struct pictdb_backend *backend);
+};
+
+/**
+ * @brief Backend of a database.
+ */
+struct pictdb_backend {
+    const struct backend_ops *ops; /**< implementation */
+    enum pictdb_storage storage; /**< kind of implementation */
+    FILE *fp; /**< stream of the database file, owned by db_file; NULL in memory */
+    void *state; /**< owned by the implementation */
+};
+
+/**
+ * @brief Sets up the backend of db_file: on its stream for the file
+ *        storages, empty for STORAGE_MEMORY.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param storage Kind of backend.
+ */
+int backend_open(struct pictdb_file *db_file, enum pictdb_storage storage);
+
+/**
+ * @brief Releases the backend of db_file, before its stream is closed.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+void backend_close(struct pictdb_file *db_file);
+
+/**
+ * @brief Reads bytes of the database. Safe alongside the writer.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param offset First byte to read.
+ * @param buffer Receives the bytes.
+ * @param size Number of bytes to read.
+ */
+int backend_read(const struct pictdb_file *db_file, uint64_t offset, void *buffer, size_t size);
+
+/**
+ * @brief Like backend_read(), scattering the bytes over buffers filled in
+ *        turn.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param offset First byte to read.
+ * @param size Number of bytes to read, at most the total of the buffers.
+ * @param iov The buffers.
+ * @param iovcnt Number of buffers.
+ */
+int backend_readv(const struct pictdb_file *db_file, uint64_t offset, size_t size, const struct iovec iov[],
+                  size_t iovcnt);
+
+/**
+ * @brief Writes bytes of the database. Requires the writer lock.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param offset First byte to write.
+ * @param data The bytes.
+ * @param size Number of bytes.
+ */
+int backend_write(struct pictdb_file *db_file, uint64_t offset, const void *data, size_t size);
+
+/**
+ * @brief Writes bytes at the end of the database. Requires the writer lock.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param data The bytes.
+ * @param size Number of bytes.
+ * @param offset Set to the position of the first byte.
+ */
+int backend_append(struct pictdb_file *db_file, const void *data, size_t size, uint64_t *offset);
+
+/**
+ * @brief Tells the size of the database, flushed writes included.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param size Set to the number of bytes.
+ */
+int backend_size(struct pictdb_file *db_file, uint64_t *size);
+
+/**
+ * @brief Shrinks or extends the database. Requires the writer lock.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param size New number of bytes.
+ */
+int backend_truncate(struct pictdb_file *db_file, uint64_t size);
+
+/**
+ * @brief Makes the writes so far seen by reads, and durable if asked to.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param durable Whether to force the bytes to disk.
+ */
+int backend_flush(struct pictdb_file *db_file, int durable);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,482 @@
+/**
+ * @file db_check.c
+ * @implementation of do_check to verify (and repair) a database
+ *
+ * Structure is validated in a single pass over the metadata. Original
+ * images are then re-hashed by a pool of threads that claim blobs in
+ * increasing offset order, so that the disk is read (almost) sequentially
+ * while hashing runs on all cores.
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "pictDB.h"
+#include "db_index.h"
+#include "db_columns.h"
+#include "db_wal.h"
+
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+
+#define CHECK_MAX_THREADS 16
+#define CHECK_CHUNK (1 << 20) // bytes hashed per read
+
+/* Problems found on a slot */
+#define BAD_PICT_ID    (1 << 0)
+#define DUPLICATE_ID   (1 << 1)
+#define BAD_ORIGINAL   (1 << 2)
+#define SHA_MISMATCH   (1 << 3)
+#define BAD_THUMB      (1 << 4)
+#define BAD_SMALL      (1 << 5)
+
+#define BAD_RESIZED(res) ((res) == RES_THUMB ? BAD_THUMB : BAD_SMALL)
+#define INVALIDATING (BAD_PICT_ID | DUPLICATE_ID | BAD_ORIGINAL | SHA_MISMATCH)
+
+/**
+ * @brief A blob referenced by one or more slots.
+ */
+struct extent {
+    uint64_t offset; /**< blob position */
+    uint32_t size; /**< blob size */
+    uint32_t slot; /**< metadata index */
+    unsigned int res; /**< resolution of the blob in the slot */
+};
+
+/**
+ * @brief State shared by the hashing threads.
+ */
+struct hash_pool {
+    int fd; /**< database file descriptor */
+    const struct pictdb_file *db_file; /**< database being checked */
+    const struct extent *extents; /**< original blobs sorted by offset */
+    size_t count; /**< number of extents */
+    size_t next; /**< next extent to hash */
+    pthread_mutex_t lock; /**< protects next and status */
+    int status; /**< first I/O error met */
+    unsigned char *problems; /**< problems per slot */
+};
+
+/********************************************************************//**
+ * Orders extents by position, then size, then slot.
+ */
+static int compare_extents(const void *a, const void *b)
+{
+    const struct extent *x = a;
+    const struct extent *y = b;
+    if (x->offset != y->offset) {
+        return x->offset < y->offset ? -1 : 1;
+    }
+    if (x->size != y->size) {
+        return x->size < y->size ? -1 : 1;
+    }
+    return (x->slot > y->slot) - (x->slot < y->slot);
+}
+
+/********************************************************************//**
+ * Orders (hash, slot) pairs stored in extents.
+ */
+static int compare_ids(const void *a, const void *b)
+{
+    const struct extent *x = a;
+    const struct extent *y = b;
+    if (x->offset != y->offset) {
+        return x->offset < y->offset ? -1 : 1;
+    }
+    return (x->slot > y->slot) - (x->slot < y->slot);
+}
+
+/********************************************************************//**
+ * Hashes one blob with positional reads, safe to share between threads.
+ */
+static int hash_extent(int fd, const struct extent *extent, unsigned char *buffer,
+                       unsigned char sha[SHA256_DIGEST_LENGTH])
+{
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    if (ctx == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    int status = EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) == 1 ? 0 : ERR_IO;
+    uint64_t done = 0;
+
+    while (status == 0 && done < extent->size) {
+        const size_t len = extent->size - done < CHECK_CHUNK ? (size_t) (extent->size - done) : CHECK_CHUNK;
+        const ssize_t got = pread(fd, buffer, len, (off_t) (extent->offset + done));
+        if (got <= 0 || EVP_DigestUpdate(ctx, buffer, (size_t) got) != 1) {
+            status = ERR_IO;
+        } else {
+            done += (uint64_t) got;
+        }
+    }
+
+    if (status == 0 && EVP_DigestFinal_ex(ctx, sha, NULL) != 1) {
+        status = ERR_IO;
+    }
+    EVP_MD_CTX_free(ctx);
+    return status;
+}
+
+/********************************************************************//**
+ * Hashing thread: claims the next group of identical extents (dedup-ed
+ * slots share a blob) and compares its hash with each slot SHA.
+ */
+static void *hash_worker(void *arg)
+{
+    struct hash_pool *pool = arg;
+    unsigned char *buffer = malloc(CHECK_CHUNK);
+    unsigned char sha[SHA256_DIGEST_LENGTH];
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        size_t first = pool->next;
+        size_t end = first;
+        while (end < pool->count && pool->extents[end].offset == pool->extents[first].offset &&
+               pool->extents[end].size == pool->extents[first].size) {
+            ++end;
+        }
+        pool->next = end;
+        if (buffer == NULL && pool->status == 0) {
+            pool->status = ERR_OUT_OF_MEMORY;
+        }
+        const int stop = first == pool->count || pool->status != 0;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (stop) {
+            break;
+        }
+
+        const int status = hash_extent(pool->fd, &pool->extents[first], buffer, sha);
+        if (status != 0) {
+            pthread_mutex_lock(&pool->lock);
+            pool->status = pool->status == 0 ? status : pool->status;
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+
+        // slots are distinct: no two threads ever write the same problem byte
+        for (size_t i = first; i < end; ++i) {
+            const uint32_t slot = pool->extents[i].slot;
+            if (memcmp(sha, pool->db_file->metadata[slot].SHA, SHA256_DIGEST_LENGTH) != 0) {
+                pool->problems[slot] |= SHA_MISMATCH;
+            }
+        }
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+/********************************************************************//**
+ * Re-hashes all original blobs on a pool of threads.
+ */
+static int check_contents(const struct pictdb_file *db_file, const struct extent *originals, size_t count,
+                          unsigned int threads, unsigned char *problems)
+{
+    if (count == 0) {
+        return 0;
+    }
+
+    // buffered writes must reach the file before positional reads
+    if (fflush(db_file->fpdb) != 0) {
+        return ERR_IO;
+    }
+
+    struct hash_pool pool = {
+        .fd = fileno(db_file->fpdb),
+        .db_file = db_file,
+        .extents = originals,
+        .count = count,
+        .next = 0,
+        .status = 0,
+        .problems = problems
+    };
+    if (pthread_mutex_init(&pool.lock, NULL) != 0) {
+        return ERR_IO;
+    }
+
+    if (threads == 0) {
+        const long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (unsigned int) online : 1;
+    }
+    threads = threads > CHECK_MAX_THREADS ? CHECK_MAX_THREADS : threads;
+
+    pthread_t workers[CHECK_MAX_THREADS];
+    unsigned int started = 0;
+    while (started < threads && pthread_create(&workers[started], NULL, hash_worker, &pool) == 0) {
+        ++started;
+    }
+    if (started == 0) {
+        (void) hash_worker(&pool);
+    }
+    for (unsigned int i = 0; i < started; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool.lock);
+    return pool.status;
+}
+
+/********************************************************************//**
+ * Whether a blob lies entirely in the data region of the file.
+ */
+static int extent_in_file(uint64_t offset, uint32_t size, uint64_t data_start, uint64_t file_size)
+{
+    return offset >= data_start && offset <= file_size && size <= file_size - offset;
+}
+
+/********************************************************************//**
+ * Single pass over the metadata: identifiers and blob bounds. Collects
+ * the blobs of valid slots for the overlap and content checks.
+ */
+static void check_structure(const struct pictdb_file *db_file, uint64_t file_size, unsigned char *problems,
+                            struct extent *ids, size_t *id_count, struct extent *blobs, size_t *blob_count)
+{
+    const uint64_t data_start = sizeof(struct pictdb_header) +
+                                (uint64_t) db_file->header.max_files * sizeof(struct pict_metadata);
+
+    for (uint32_t i = 0; i < db_file->header.max_files; ++i) {
+        const struct pict_metadata *pict = &db_file->metadata[i];
+        if (pict->is_valid != NON_EMPTY) {
+            continue;
+        }
+
+        const size_t id_len = strnlen(pict->pict_id, MAX_PIC_ID + 1);
+        if (id_len == 0 || id_len > MAX_PIC_ID) {
+            problems[i] |= BAD_PICT_ID;
+        } else {
+            ids[*id_count].offset = pict_id_hash(pict->pict_id);
+            ids[*id_count].slot = i;
+            ++*id_count;
+        }
+
+        if (pict->size[RES_ORIG] == 0 ||
+            !extent_in_file(pict->offset[RES_ORIG], pict->size[RES_ORIG], data_start, file_size)) {
+            problems[i] |= BAD_ORIGINAL;
+        }
+
+        for (unsigned int res = 0; res < NB_RES; ++res) {
+            const int absent = pict->offset[res] == 0 && pict->size[res] == 0;
+            if (res != RES_ORIG && !absent &&
+                (pict->offset[res] == 0 || pict->size[res] == 0 ||
+                 !extent_in_file(pict->offset[res], pict->size[res], data_start, file_size))) {
+                problems[i] |= BAD_RESIZED(res);
+            }
+            if (!absent && (problems[i] & (res == RES_ORIG ? BAD_ORIGINAL : BAD_RESIZED(res))) == 0) {
+                blobs[*blob_count].offset = pict->offset[res];
+                blobs[*blob_count].size = pict->size[res];
+                blobs[*blob_count].slot = i;
+                blobs[*blob_count].res = res;
+                ++*blob_count;
+            }
+        }
+    }
+}
+
+/********************************************************************//**
+ * Flags duplicated identifiers (all but the first slot holding them).
+ */
+static void check_duplicates(const struct pictdb_file *db_file, struct extent *ids, size_t count,
+                             unsigned char *problems)
+{
+    qsort(ids, count, sizeof(struct extent), compare_ids);
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t j = i + 1; j < count && ids[j].offset == ids[i].offset; ++j) {
+            if ((problems[ids[j].slot] & DUPLICATE_ID) == 0 &&
+                !strncmp(db_file->metadata[ids[i].slot].pict_id, db_file->metadata[ids[j].slot].pict_id, MAX_PIC_ID)) {
+                problems[ids[j].slot] |= DUPLICATE_ID;
+            }
+        }
+    }
+}
+
+/********************************************************************//**
+ * Flags blobs overlapping another one. Identical extents are legitimately
+ * shared by de-duplicated pictures. An overlapping resized image is always
+ * blamed; between two originals, the content check tells which is wrong.
+ */
+static size_t check_overlaps(struct extent *blobs, size_t count, unsigned char *problems)
+{
+    qsort(blobs, count, sizeof(struct extent), compare_extents);
+
+    size_t overlaps = 0;
+    size_t owner = 0; // extent reaching the furthest so far
+    for (size_t i = 1; i < count; ++i) {
+        const struct extent *prev = &blobs[owner];
+        const uint64_t prev_end = prev->offset + prev->size;
+        const int shared = blobs[i].offset == prev->offset && blobs[i].size == prev->size;
+
+        if (!shared && blobs[i].offset < prev_end) {
+            ++overlaps;
+            if (blobs[i].res != RES_ORIG) {
+                problems[blobs[i].slot] |= BAD_RESIZED(blobs[i].res);
+            } else if (prev->res != RES_ORIG) {
+                problems[prev->slot] |= BAD_RESIZED(prev->res);
+            }
+        }
+        if (blobs[i].offset + blobs[i].size > prev_end) {
+            owner = i;
+        }
+    }
+    return overlaps;
+}
+
+/********************************************************************//**
+ * Prints the problems found on a slot.
+ */
+static void report_slot(const struct pict_metadata *pict, uint32_t slot, unsigned char problems)
+{
+    static const struct {
+        unsigned char flag;
+        const char *message;
+    } messages[] = {
+        {BAD_PICT_ID,  "invalid picture ID"},
+        {DUPLICATE_ID, "duplicated picture ID"},
+        {BAD_ORIGINAL, "original image outside of the data region"},
+        {SHA_MISMATCH, "original image does not match its SHA"},
+        {BAD_THUMB,    "invalid or overlapping thumbnail"},
+        {BAD_SMALL,    "invalid or overlapping small image"}
+    };
+
+    for (size_t i = 0; i < sizeof(messages) / sizeof(messages[0]); ++i) {
+        if (problems & messages[i].flag) {
+            printf("slot %" PRIu32 " (%.*s): %s\n", slot, MAX_PIC_ID, pict->pict_id, messages[i].message);
+        }
+    }
+}
+
+/********************************************************************//**
+ * Fixes the slots that have problems and the image count, through the
+ * write-ahead log like any other mutation.
+ */
+static int repair(struct pictdb_file *db_file, const unsigned char *problems, uint32_t valid_count)
+{
+    int status = 0;
+    uint32_t changed = 0;
+
+    for (uint32_t i = 0; i < db_file->header.max_files; ++i) {
+        if (problems[i] == 0) {
+            continue;
+        }
+
+        struct pict_metadata *pict = &db_file->metadata[i];
+        if (problems[i] & INVALIDATING) {
+            pict->is_valid = EMPTY;
+            --valid_count;
+        } else {
+            for (unsigned int res = 0; res < NB_RES; ++res) {
+                if (res != RES_ORIG && (problems[i] & BAD_RESIZED(res))) {
+                    // will be resized again on demand
+                    pict->offset[res] = 0;
+                    pict->size[res] = 0;
+                }
+            }
+        }
+        columns_update(db_file, i);
+        ++changed;
+    }
+
+    if (changed == 0 && db_file->header.num_files == valid_count) {
+        return 0;
+    }
+
+    db_file->header.db_version += 1;
+    db_file->header.num_files = valid_count;
+
+    // the header travels with each record: an untouched slot carries it alone
+    for (uint32_t i = 0; i < db_file->header.max_files && status == 0; ++i) {
+        if (problems[i] != 0 || (changed == 0 && i == 0)) {
+            status = wal_log(db_file, i);
+        }
+    }
+    for (uint32_t i = 0; i < db_file->header.max_files && status == 0; ++i) {
+        if (problems[i] != 0) {
+            index_update(db_file, i);
+        }
+    }
+    return status == 0 ? do_sync(db_file) : status;
+}
+
+/********************************************************************//**
+ * Verifies the consistency of db_file, optionally repairing it.
+ */
+int do_check(struct pictdb_file *db_file, int repair_db, unsigned int threads)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(db_file->fpdb);
+    M_REQUIRE_NON_NULL(db_file->metadata);
+
+    struct stat st;
+    if (fstat(fileno(db_file->fpdb), &st) != 0) {
+        return ERR_IO;
+    }
+
+    const uint32_t max_files = db_file->header.max_files;
+    unsigned char *problems = calloc(max_files, 1);
+    struct extent *ids = calloc(max_files, sizeof(struct extent));
+    struct extent *blobs = calloc((size_t) max_files * NB_RES, sizeof(struct extent));
+    struct extent *originals = calloc(max_files, sizeof(struct extent));
+
+    int status = problems == NULL || ids == NULL || blobs == NULL || originals == NULL ? ERR_OUT_OF_MEMORY : 0;
+    uint32_t found = 0;
+
+    if (status == 0) {
+        size_t id_count = 0;
+        size_t blob_count = 0;
+        check_structure(db_file, (uint64_t) st.st_size, problems, ids, &id_count, blobs, &blob_count);
+        check_duplicates(db_file, ids, id_count, problems);
+        const size_t overlaps = check_overlaps(blobs, blob_count, problems);
+        if (overlaps > 0) {
+            printf("%zu overlapping image(s)\n", overlaps);
+        }
+
+        // blobs are sorted by offset: originals keep that order for hashing
+        size_t original_count = 0;
+        for (size_t i = 0; i < blob_count; ++i) {
+            if (blobs[i].res == RES_ORIG) {
+                originals[original_count++] = blobs[i];
+            }
+        }
+        status = check_contents(db_file, originals, original_count, threads, problems);
+    }
+
+    if (status == 0) {
+        uint32_t valid_count = 0;
+        for (uint32_t i = 0; i < max_files; ++i) {
+            if (db_file->metadata[i].is_valid == NON_EMPTY) {
+                ++valid_count;
+            }
+            if (problems[i] != 0) {
+                report_slot(&db_file->metadata[i], i, problems[i]);
+                ++found;
+            }
+        }
+        if (db_file->header.num_files != valid_count) {
+            printf("header: image count is %" PRIu32 " but %" PRIu32 " slot(s) are valid\n",
+                   db_file->header.num_files, valid_count);
+            ++found;
+        }
+
+        if (found > 0 && repair_db) {
+            status = repair(db_file, problems, valid_count);
+        }
+        printf("%" PRIu32 " inconsistenc%s found%s\n", found, found == 1 ? "y" : "ies",
+               found > 0 && repair_db && status == 0 ? ", repaired" : "");
+    }
+
+    if (status == 0 && found > 0 && !repair_db) {
+        status = ERR_CORRUPT_DATABASE;
+    }
+
+    free(problems);
+    free(ids);
+    free(blobs);
+    free(originals);
+    return status;
+}
@@ -0,0 +1,242 @@
+/**
+ * @file db_columns.c
+ * @implementation of the columnar mirror of hot metadata
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#include "db_columns.h"
+#include "db_index.h"
+
+#include <string.h>
+
+#define ALL_VALID UINT64_MAX
+
+/********************************************************************//**
+ * Reads the 8 first bytes of a SHA as a 64-bit key.
+ */
+uint64_t sha_prefix(const unsigned char *SHA)
+{
+    uint64_t prefix = 0;
+    if (SHA != NULL) {
+        memcpy(&prefix, SHA, sizeof(prefix));
+    }
+    return prefix;
+}
+
+/********************************************************************//**
+ * Copies the hot fields of a slot into the columns.
+ */
+static void fill_slot(struct pictdb_columns *columns, const struct pict_metadata *metadata, uint32_t index)
+{
+    const uint64_t bit = (uint64_t) 1 << (index % COLUMN_BLOCK);
+
+    if (metadata->is_valid == NON_EMPTY) {
+        columns->valid[index / COLUMN_BLOCK] |= bit;
+        columns->id_hash[index] = pict_id_hash(metadata->pict_id);
+        columns->sha_prefix[index] = sha_prefix(metadata->SHA);
+    } else {
+        columns->valid[index / COLUMN_BLOCK] &= ~bit;
+    }
+
+    for (int res = 0; res < NB_RES; ++res) {
+        columns->offset[res][index] = metadata->offset[res];
+        columns->size[res][index] = metadata->size[res];
+    }
+    columns->res_orig[0][index] = metadata->res_orig[0];
+    columns->res_orig[1][index] = metadata->res_orig[1];
+}
+
+/********************************************************************//**
+ * Builds the columnar mirror of db_file if not built yet.
+ * All columns share a single allocation.
+ */
+int columns_ensure(struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(db_file->metadata);
+
+    if (db_file->columns != NULL) {
+        return 0;
+    }
+
+    const uint32_t max_files = db_file->header.max_files;
+    const uint32_t blocks = (max_files + COLUMN_BLOCK - 1) / COLUMN_BLOCK;
+    // columns are padded to whole blocks so that scans never need a tail loop
+    const size_t slots = (size_t) blocks * COLUMN_BLOCK;
+    const size_t bytes = sizeof(struct pictdb_columns) +
+                         blocks * sizeof(uint64_t) +
+                         slots * (2 + NB_RES) * sizeof(uint64_t) +
+                         slots * (NB_RES + 2) * sizeof(uint32_t);
+
+    struct pictdb_columns *columns = calloc(1, bytes);
+    if (columns == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    columns->max_files = max_files;
+    columns->blocks = blocks;
+    columns->valid = (uint64_t *) (columns + 1);
+    columns->id_hash = columns->valid + blocks;
+    columns->sha_prefix = columns->id_hash + slots;
+    for (int res = 0; res < NB_RES; ++res) {
+        columns->offset[res] = columns->sha_prefix + slots * (size_t) (res + 1);
+    }
+    uint32_t *sizes = (uint32_t *) (columns->offset[NB_RES - 1] + slots);
+    for (int res = 0; res < NB_RES; ++res) {
+        columns->size[res] = sizes + slots * (size_t) res;
+    }
+    columns->res_orig[0] = sizes + slots * NB_RES;
+    columns->res_orig[1] = columns->res_orig[0] + slots;
+
+    for (uint32_t i = 0; i < max_files; ++i) {
+        fill_slot(columns, &db_file->metadata[i], i);
+    }
+
+    // published once filled: readers scan the mirror without the writer lock
+    __atomic_store_n(&db_file->columns, columns, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/********************************************************************//**
+ * Releases the columnar mirror of db_file.
+ */
+void columns_free(struct pictdb_file *db_file)
+{
+    if (db_file == NULL) {
+        return;
+    }
+    free(db_file->columns);
+    db_file->columns = NULL;
+}
+
+/********************************************************************//**
+ * Refreshes the hot fields of a slot from the row store.
+ */
+void columns_update(struct pictdb_file *db_file, uint32_t index)
+{
+    if (db_file == NULL || db_file->columns == NULL || index >= db_file->columns->max_files) {
+        return;
+    }
+
+    fill_slot(db_file->columns, &db_file->metadata[index], index);
+}
+
+/********************************************************************//**
+ * Returns the first valid slot at or after from, max_files if none.
+ */
+uint32_t columns_next_valid(const struct pictdb_columns *columns, uint32_t from)
+{
+    if (columns == NULL || from >= columns->max_files) {
+        return columns == NULL ? 0 : columns->max_files;
+    }
+
+    uint32_t block = from / COLUMN_BLOCK;
+    uint64_t word = columns->valid[block] & (ALL_VALID << (from % COLUMN_BLOCK));
+
+    while (word == 0) {
+        if (++block == columns->blocks) {
+            return columns->max_files;
+        }
+        word = columns->valid[block];
+    }
+
+    return block * COLUMN_BLOCK + (uint32_t) __builtin_ctzll(word);
+}
+
+/********************************************************************//**
+ * Returns the first empty slot, max_files if the database is full.
+ */
+uint32_t columns_find_free(const struct pictdb_columns *columns)
+{
+    if (columns == NULL) {
+        return 0;
+    }
+
+    for (uint32_t block = 0; block < columns->blocks; ++block) {
+        if (columns->valid[block] != ALL_VALID) {
+            const uint32_t index = block * COLUMN_BLOCK + (uint32_t) __builtin_ctzll(~columns->valid[block]);
+            return index < columns->max_files ? index : columns->max_files;
+        }
+    }
+    return columns->max_files;
+}
+
+/********************************************************************//**
+ * Returns the first valid slot at or after from whose key matches.
+ * Each block of 64 keys is compared without branches into a bitmask that
+ * is then and-ed with the validity word; compilers vectorize the inner
+ * loop, so a block costs a handful of wide compares.
+ */
+uint32_t columns_match(const struct pictdb_columns *columns, const uint64_t *column, uint64_t key, uint32_t from)
+{
+    if (columns == NULL || column == NULL) {
+        return columns == NULL ? 0 : columns->max_files;
+    }
+
+    for (uint32_t block = from / COLUMN_BLOCK; block < columns->blocks; ++block) {
+        uint64_t candidates = columns->valid[block];
+        if (block == from / COLUMN_BLOCK) {
+            candidates &= ALL_VALID << (from % COLUMN_BLOCK);
+        }
+        if (candidates == 0) {
+            continue;
+        }
+
+        const uint64_t *keys = column + (size_t) block * COLUMN_BLOCK;
+        uint64_t matches = 0;
+        for (uint32_t j = 0; j < COLUMN_BLOCK; ++j) {
+            matches |= (uint64_t) (keys[j] == key) << j;
+        }
+
+        matches &= candidates;
+        if (matches != 0) {
+            return block * COLUMN_BLOCK + (uint32_t) __builtin_ctzll(matches);
+        }
+    }
+    return columns->max_files;
+}
+
+/* One branchless loop per operator and column width: the switch stays out
+ * of the inner loops, which compilers turn into wide compares. */
+#define FILTER_BLOCK(keys, op, value, mask) \
+    for (uint32_t j = 0; j < COLUMN_BLOCK; ++j) { \
+        mask |= (uint64_t) (keys[j] op value) << j; \
+    }
+
+#define FILTER_OPS(keys, predicate, mask) \
+    switch (predicate->op) { \
+    case QUERY_LT: FILTER_BLOCK(keys, <, predicate->value, mask); break; \
+    case QUERY_LE: FILTER_BLOCK(keys, <=, predicate->value, mask); break; \
+    case QUERY_EQ: FILTER_BLOCK(keys, ==, predicate->value, mask); break; \
+    case QUERY_NE: FILTER_BLOCK(keys, !=, predicate->value, mask); break; \
+    case QUERY_GE: FILTER_BLOCK(keys, >=, predicate->value, mask); break; \
+    case QUERY_GT: FILTER_BLOCK(keys, >, predicate->value, mask); break; \
+    default: break; \
+    }
+
+/********************************************************************//**
+ * Evaluates a predicate on the slots of a block.
+ */
+uint64_t columns_filter(const struct pictdb_columns *columns, uint32_t block,
+                        const struct query_predicate *predicate)
+{
+    if (columns == NULL || predicate == NULL || block >= columns->blocks || predicate->res >= NB_RES) {
+        return 0;
+    }
+
+    const size_t first = (size_t) block * COLUMN_BLOCK;
+    uint64_t mask = 0;
+
+    if (predicate->field == QUERY_OFFSET) {
+        const uint64_t *keys = columns->offset[predicate->res] + first;
+        FILTER_OPS(keys, predicate, mask);
+    } else {
+        const uint32_t *keys = predicate->field == QUERY_WIDTH ? columns->res_orig[0] + first :
+                               predicate->field == QUERY_HEIGHT ? columns->res_orig[1] + first :
+                               columns->size[predicate->res] + first;
+        FILTER_OPS(keys, predicate, mask);
+    }
+    return mask;
+}
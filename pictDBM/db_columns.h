@@ -0,0 +1,114 @@
+/**
+ * @file db_columns.h
+ * @brief pictDB library: in memory columnar mirror of the hot metadata.
+ *
+ * Scans only need a few bytes of each 200+ bytes metadata slot. The mirror
+ * keeps those fields in separate arrays (validity bitmap, pict_id hash, SHA
+ * prefix, original resolution, offsets and sizes) so that scans stream
+ * through dense memory and only touch the row store (full pict_id, SHA) to
+ * confirm a candidate.
+ *
+ * The mirror is built on the first scan and must be refreshed with
+ * columns_update() whenever a metadata slot is modified.
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#ifndef PICTDBPRJ_DB_COLUMNS_H
+#define PICTDBPRJ_DB_COLUMNS_H
+
+#include "pictDB.h"
+
+#define COLUMN_BLOCK 64 // slots per validity bitmap word
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Hot metadata fields stored column-wise.
+ */
+struct pictdb_columns {
+    uint32_t max_files; /**< number of slots */
+    uint32_t blocks; /**< number of validity bitmap words */
+    uint64_t *valid; /**< validity bitmap, bit i set when slot i is NON_EMPTY */
+    uint64_t *id_hash; /**< pict_id_hash() of each slot */
+    uint64_t *sha_prefix; /**< first 8 bytes of each SHA */
+    uint64_t *offset[NB_RES]; /**< blob offsets per resolution */
+    uint32_t *size[NB_RES]; /**< blob sizes per resolution */
+    uint32_t *res_orig[2]; /**< original image width and height */
+};
+
+/**
+ * @brief Builds the columnar mirror of db_file if not built yet.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+int columns_ensure(struct pictdb_file *db_file);
+
+/**
+ * @brief Releases the columnar mirror of db_file.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+void columns_free(struct pictdb_file *db_file);
+
+/**
+ * @brief Refreshes the hot fields of a slot from the row store.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param index The metadata index that changed.
+ */
+void columns_update(struct pictdb_file *db_file, uint32_t index);
+
+/**
+ * @brief Returns the first valid slot at or after from, max_files if none.
+ *
+ * @param columns The columnar mirror.
+ * @param from First slot to consider.
+ */
+uint32_t columns_next_valid(const struct pictdb_columns *columns, uint32_t from);
+
+/**
+ * @brief Returns the first empty slot, max_files if the database is full.
+ *
+ * @param columns The columnar mirror.
+ */
+uint32_t columns_find_free(const struct pictdb_columns *columns);
+
+/**
+ * @brief Returns the first valid slot at or after from whose 64-bit key
+ *        in column equals key, max_files if none.
+ *
+ * @param columns The columnar mirror.
+ * @param column Either columns->id_hash or columns->sha_prefix.
+ * @param key The value to look for.
+ * @param from First slot to consider.
+ */
+uint32_t columns_match(const struct pictdb_columns *columns, const uint64_t *column, uint64_t key, uint32_t from);
+
+/**
+ * @brief Evaluates a predicate on the COLUMN_BLOCK slots of a block.
+ *
+ * @param columns The columnar mirror.
+ * @param block Index of the block.
+ * @param predicate The condition to evaluate.
+ * @return Bit i is set when slot block * COLUMN_BLOCK + i satisfies the
+ *         predicate, whether the slot is valid or not.
+ */
+uint64_t columns_filter(const struct pictdb_columns *columns, uint32_t block,
+                        const struct query_predicate *predicate);
+
+/**
+ * @brief Reads the 8 first bytes of a SHA as a 64-bit key.
+ *
+ * @param SHA The hash of an image.
+ */
+uint64_t sha_prefix(const unsigned char *SHA);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
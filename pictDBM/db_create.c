@@ -7,6 +7,10 @@
  */
 
 #include "pictDB.h"
+#include "db_index.h"
+#include "db_wal.h"
+#include "db_latch.h"
+#include "db_backend.h"
 
 #include <string.h>  // for strncpy
 
@@ -14,6 +18,14 @@
  * Create a new picture database in db_file.
  */
 int do_create (const char* filename, struct pictdb_file* db_file)
+{
+    return do_create_storage(filename, STORAGE_FILE, db_file);
+}
+
+/********************************************************************//**
+ * Create a new picture database in db_file, kept as storage tells.
+ */
+int do_create_storage (const char* filename, enum pictdb_storage storage, struct pictdb_file* db_file)
 {
     M_REQUIRE_NON_NULL(filename);
     M_REQUIRE_NON_NULL(db_file);
@@ -29,6 +41,19 @@ int do_create (const char* filename, struct pictdb_file* db_file)
     db_file->header.unused_32 = 0;
     db_file->header.unused_64 = 0;
 
+    db_file->fpdb = NULL;
+    db_file->map_size = 0;
+    db_file->index = NULL;
+    db_file->columns = NULL;
+    db_file->wal = NULL;
+    db_file->durability = DURABILITY_OPERATION;
+    db_file->group_commit = DEFAULT_GROUP_COMMIT;
+    db_file->sync_interval = DEFAULT_SYNC_INTERVAL;
+    db_file->latch = NULL;
+    db_file->share = NULL;
+    db_file->io = NULL;
+    db_file->backend = NULL;
+
     // now we set all the metadata to 0 so we don't have any surprise and all
     // isValid fields are set to 0
     db_file->metadata = (struct pict_metadata*) calloc(db_file->header.max_files, sizeof(struct pict_metadata));
@@ -36,16 +61,35 @@ int do_create (const char* filename, struct pictdb_file* db_file)
         return ERR_OUT_OF_MEMORY;
     }
 
-    int status = 0;
-    db_file->fpdb = fopen(filename, "w+b");
+    // an index or a log left over by a previous database of the same name is meaningless
+    char idx_filename[FILENAME_MAX];
+    if (storage != STORAGE_MEMORY && index_filename(idx_filename, filename) == 0) {
+        remove(idx_filename);
+    }
+    if (storage != STORAGE_MEMORY && wal_filename(idx_filename, filename) == 0) {
+        remove(idx_filename);
+    }
+
+    int status = latch_open(db_file);
+    if (status != 0) {
+        return status;
+    }
+
+    if (storage != STORAGE_MEMORY) {
+        db_file->fpdb = fopen(filename, "w+b");
+        if (db_file->fpdb == NULL) {
+            return ERR_IO;
+        }
+    }
 
-    if (db_file->fpdb == NULL) {
-        status = ERR_IO;
-    } else {
-        if (fwrite(&db_file->header, sizeof(struct pictdb_header), 1, db_file->fpdb) != 1 ||
-            fwrite(db_file->metadata, sizeof(struct pict_metadata), db_file->header.max_files, db_file->fpdb)
-            != db_file->header.max_files) {
+    status = backend_open(db_file, storage);
+    if (status == 0) {
+        const size_t metadata_size = db_file->header.max_files * sizeof(struct pict_metadata);
+        if (backend_write(db_file, 0, &db_file->header, sizeof(struct pictdb_header)) != 0 ||
+            backend_write(db_file, sizeof(struct pictdb_header), db_file->metadata, metadata_size) != 0) {
             status = ERR_IO;
+        } else if ((status = backend_flush(db_file, 1)) == 0) {
+            status = wal_open(filename, 1, db_file);
         }
     }
 
@@ -8,6 +8,10 @@
 
 #include <string.h>
 #include "pictDB.h"
+#include "db_index.h"
+#include "db_columns.h"
+#include "db_wal.h"
+#include "db_latch.h"
 
 /********************************************************************//**
  * Remove a picture included in db_file.
@@ -19,55 +23,48 @@ int do_delete (const char* pict_id, struct pictdb_file* db_file)
     M_REQUIRE_NON_NULL(db_file->metadata);
     M_REQUIRE_VALID_PIC_ID(pict_id);
 
-    if (db_file->header.num_files == 0) {
-        return ERR_FILE_NOT_FOUND;
-    }
-
-    if (db_file->fpdb == NULL) {
+    if (db_file->backend == NULL) {
         return ERR_IO;
     }
 
-    size_t pict_delete_offset = 0;
-    struct pict_metadata* pict_to_delete = NULL;
-
-    // The ending condition also ensures that once we found the correct metadata
-    // we do not iterate over the others
-    for (size_t i = 0; pict_to_delete == NULL && i < db_file->header.max_files; ++i) {
-        if (db_file->metadata[i].is_valid == NON_EMPTY &&
-            strncmp(db_file->metadata[i].pict_id, pict_id, MAX_PIC_ID) == 0) {
-
-            pict_to_delete = &db_file->metadata[i];
-            pict_delete_offset = i;
-        }
-    }
+    latch_lock(db_file);
+    uint32_t pict_delete_offset = 0;
+    int status = db_file->header.num_files == 0 ? ERR_FILE_NOT_FOUND :
+                 find_pict_index(db_file, pict_id, &pict_delete_offset);
 
-    if (pict_to_delete == NULL) {
-        return ERR_FILE_NOT_FOUND;
-    }
-    pict_to_delete->is_valid = EMPTY;
+    if (status == 0) {
+        struct pict_metadata* pict_to_delete = &db_file->metadata[pict_delete_offset];
+        latch_slot_begin(db_file, pict_delete_offset);
+        pict_to_delete->is_valid = EMPTY;
+        latch_slot_end(db_file, pict_delete_offset);
 
-    // The writing step is done in two parts :
-    // 1) Set the new metadata accordingly to what we've done before
-    // 2) Update the header
+        // Slot and header are logged as a single record: a failure can no
+        // longer leave one updated without the other
+        latch_tables_begin(db_file);
+        columns_update(db_file, pict_delete_offset);
+        db_file->header.db_version += 1;
+        db_file->header.num_files -= 1;
+        latch_tables_end(db_file);
+        status = wal_append(db_file, pict_delete_offset);
 
-    // By default fwrite start writing at the begining of the stream. Therefore, we
-    // need to move the cursor to the position of where we want to delete
-    if (fseek(db_file->fpdb, (long) (sizeof(struct pictdb_header) + pict_delete_offset * sizeof(struct pict_metadata)),
-              SEEK_SET)
-        != 0 ||
-        fwrite(pict_to_delete, sizeof(struct pict_metadata), 1, db_file->fpdb) != 1) {
-        return ERR_IO;
-    }
+        if (status != 0) {
+            // nothing logged: the picture is given back
+            latch_slot_begin(db_file, pict_delete_offset);
+            pict_to_delete->is_valid = NON_EMPTY;
+            latch_slot_end(db_file, pict_delete_offset);
 
-    // Here we ask ourselves what to do if one fwrite succeeds and one doesn't :
-    // this is going to lead to a corruption of the database but TAs say we do not
-    // need to handle this corner case : therefore we directly return
-    db_file->header.db_version += 1;
-    db_file->header.num_files -= 1;
-    if (fseek(db_file->fpdb, 0, SEEK_SET) != 0 ||
-        fwrite(&db_file->header, sizeof(struct pictdb_header), 1, db_file->fpdb) != 1) {
-        return ERR_IO;
+            latch_tables_begin(db_file);
+            columns_update(db_file, pict_delete_offset);
+            db_file->header.db_version -= 1;
+            db_file->header.num_files += 1;
+            latch_tables_end(db_file);
+        } else {
+            latch_tables_begin(db_file);
+            index_update(db_file, pict_delete_offset);
+            latch_tables_end(db_file);
+            status = wal_settle(db_file);
+        }
     }
-
-    return 0;
+    latch_unlock(db_file);
+    return status;
 }
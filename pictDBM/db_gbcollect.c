@@ -6,9 +6,43 @@
  * @date 20 May 2016
  */
 
+#define _DEFAULT_SOURCE
+
 #include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "pictDB.h"
 #include "image_content.h"
+#include "db_index.h"
+#include "db_columns.h"
+#include "db_wal.h"
+
+/********************************************************************//**
+ * Forces the directory entry of filename to disk, making a rename durable.
+ */
+static int sync_parent_dir(const char *filename)
+{
+    char dirname[FILENAME_MAX] = ".";
+    const char *slash = strrchr(filename, '/');
+    if (slash != NULL) {
+        const size_t len = slash == filename ? 1 : (size_t) (slash - filename);
+        if (len >= FILENAME_MAX) {
+            return ERR_INVALID_FILENAME;
+        }
+        memcpy(dirname, filename, len);
+        dirname[len] = '\0';
+    }
+
+    int fd = open(dirname, O_RDONLY);
+    if (fd == -1) {
+        return ERR_IO;
+    }
+    const int status = fsync(fd) == 0 ? 0 : ERR_IO;
+    close(fd);
+    return status;
+}
 
 int do_gbcollect(struct pictdb_file *db_file, const char *db_filename, const char *tmp_db_filename)
 {
@@ -16,6 +50,11 @@ int do_gbcollect(struct pictdb_file *db_file, const char *db_filename, const cha
     M_REQUIRE_NON_NULL(db_filename);
     M_REQUIRE_NON_NULL(tmp_db_filename);
 
+    // the copy replaces the database file, which a database in memory lacks
+    if (db_file->fpdb == NULL) {
+        return ERR_IO;
+    }
+
     uint32_t modification_count = 0;
     struct pictdb_file tmp_db_file;
 
@@ -26,42 +65,51 @@ int do_gbcollect(struct pictdb_file *db_file, const char *db_filename, const cha
     tmp_db_file.header.res_resized[RES_SMALL << 1] = db_file->header.res_resized[RES_THUMB << 1];
     tmp_db_file.header.res_resized[(RES_SMALL << 1) + 1] = db_file->header.res_resized[(RES_THUMB << 1) + 1];
 
-    int status = do_create(tmp_db_filename, &tmp_db_file);
+    int status = columns_ensure(db_file);
     if (status != 0) {
         return status;
     }
 
-    if (db_file->header.num_files > 0) {
-        for (size_t i = 0; i < db_file->header.max_files && status == 0; ++i) {
-            if (db_file->metadata[i].is_valid == NON_EMPTY) {
+    status = do_create(tmp_db_filename, &tmp_db_file);
+    if (status != 0) {
+        return status;
+    }
 
-                // starts by RES_ORIG to insert it and then resize, otherwise resizing may failed
-                // as the original image is not yet there
-                for (int res = RES_ORIG; res >= 0; --res) {
+    // the copy is worthless until renamed: it only needs to be durable once
+    // complete, which the final checkpoint ensures unless durability is off
+    status = do_set_durability(&tmp_db_file, db_file->durability == DURABILITY_NONE ? DURABILITY_NONE : DURABILITY_BATCH,
+                               UINT32_MAX);
 
-                    uint64_t offset = db_file->metadata[i].offset[res];
-                    uint32_t size = 0;
+    const struct pictdb_columns *columns = db_file->columns;
+    if (db_file->header.num_files > 0) {
+        for (uint32_t i = columns_next_valid(columns, 0); i < columns->max_files && status == 0;
+             i = columns_next_valid(columns, i + 1)) {
+            // starts by RES_ORIG to insert it and then resize, otherwise resizing may failed
+            // as the original image is not yet there
+            for (int res = RES_ORIG; res >= 0; --res) {
 
-                    if (offset != 0) {
-                        modification_count += 1;
+                uint64_t offset = columns->offset[res][i];
+                uint32_t size = 0;
 
-                        if (res == RES_ORIG) {
-                            char *image_buffer = NULL;
-                            status = do_read(db_file->metadata[i].pict_id, (unsigned int) res, &image_buffer, &size, db_file);
+                if (offset != 0) {
+                    modification_count += 1;
 
-                            if (status == 0) {
-                                assert(image_buffer != NULL);
-                                status = do_insert(image_buffer, size, db_file->metadata[i].pict_id, &tmp_db_file);
-                            }
+                    if (res == RES_ORIG) {
+                        char *image_buffer = NULL;
+                        status = do_read(db_file->metadata[i].pict_id, (unsigned int) res, &image_buffer, &size, db_file);
 
-                            if (image_buffer != NULL) {
-                                free(image_buffer);
-                                image_buffer = NULL;
-                            }
+                        if (status == 0) {
+                            assert(image_buffer != NULL);
+                            status = do_insert(image_buffer, size, db_file->metadata[i].pict_id, &tmp_db_file);
+                        }
 
-                        } else {
-                            status = lazy_resize((unsigned int) res, &tmp_db_file, i);
+                        if (image_buffer != NULL) {
+                            free(image_buffer);
+                            image_buffer = NULL;
                         }
+
+                    } else {
+                        status = lazy_resize((unsigned int) res, &tmp_db_file, i);
                     }
                 }
             }
@@ -78,6 +126,11 @@ int do_gbcollect(struct pictdb_file *db_file, const char *db_filename, const cha
         }
     }
 
+    // the copy must be complete on disk before it replaces the database
+    if (status == 0) {
+        status = wal_checkpoint(&tmp_db_file);
+    }
+
     do_close(&tmp_db_file);
 
     // Now remove and rename the tmp file in case of success
@@ -86,10 +139,27 @@ int do_gbcollect(struct pictdb_file *db_file, const char *db_filename, const cha
         if (modification_count == 0) {
             status = remove(tmp_db_filename);
         } else {
-            status = remove(db_filename);
+            // slots are compacted, the index of the old file no longer applies:
+            // dropped first, as it would still match the version of the new
+            // file if a crash came between the rename and its removal
+            char idx_filename[FILENAME_MAX];
+            if (index_filename(idx_filename, db_filename) == 0 &&
+                remove(idx_filename) != 0 && errno != ENOENT) {
+                status = ERR_IO;
+            }
+
+            // rename atomically replaces the database: no window without one
             if (status == 0) {
                 status = rename(tmp_db_filename, db_filename);
             }
+            if (status == 0 && db_file->durability != DURABILITY_NONE) {
+                status = sync_parent_dir(db_filename);
+            }
+
+            // the log names the inode of the old file: a leftover is ignored
+            if (status == 0 && wal_filename(idx_filename, db_filename) == 0) {
+                remove(idx_filename);
+            }
         }
     }
 
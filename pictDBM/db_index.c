@@ -0,0 +1,478 @@
+/**
+ * @file db_index.c
+ * @implementation of the optional persisted pict_id index
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "db_index.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/********************************************************************//**
+ * 64-bit FNV-1a hash of a picture identifier.
+ */
+uint64_t pict_id_hash(const char *pict_id)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (size_t i = 0; pict_id != NULL && i < MAX_PIC_ID && pict_id[i] != '\0'; ++i) {
+        hash ^= (unsigned char) pict_id[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/********************************************************************//**
+ * Appends the index extension to the database filename.
+ */
+int index_filename(char *index_filename, const char *db_filename)
+{
+    M_REQUIRE_NON_NULL(index_filename);
+    M_REQUIRE_NON_NULL(db_filename);
+
+    if (strlen(db_filename) + strlen(INDEX_EXT) >= FILENAME_MAX) {
+        return ERR_INVALID_FILENAME;
+    }
+
+    strcpy(index_filename, db_filename);
+    strcat(index_filename, INDEX_EXT);
+    return 0;
+}
+
+/********************************************************************//**
+ * Smallest power of two holding twice max_files.
+ */
+static uint32_t index_capacity(uint32_t max_files)
+{
+    uint32_t capacity = INDEX_MIN_CAPACITY;
+    while (capacity < 2 * max_files) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+/********************************************************************//**
+ * Size of the index file of a database: header, hash table, sorted run.
+ */
+static size_t index_size(uint32_t max_files)
+{
+    return sizeof(struct pictdb_index_header) +
+           index_capacity(max_files) * sizeof(struct pictdb_index_entry) +
+           max_files * sizeof(uint32_t);
+}
+
+/********************************************************************//**
+ * Maps an index file descriptor into a freshly allocated handle.
+ */
+static struct pictdb_index *index_map(int fd, int writable, uint32_t max_files)
+{
+    const size_t map_size = index_size(max_files);
+    struct pictdb_index *index = malloc(sizeof(struct pictdb_index));
+    if (index == NULL) {
+        return NULL;
+    }
+
+    void *base = mmap(NULL, map_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        free(index);
+        return NULL;
+    }
+
+    index->fd = fd;
+    index->writable = writable;
+    index->map_size = map_size;
+    index->header = (struct pictdb_index_header *) base;
+    index->entries = (struct pictdb_index_entry *) ((char *) base + sizeof(struct pictdb_index_header));
+    index->sorted = (uint32_t *) (index->entries + index_capacity(max_files));
+    return index;
+}
+
+/********************************************************************//**
+ * Releases an index handle.
+ */
+static void index_unmap(struct pictdb_index *index)
+{
+    if (index == NULL) {
+        return;
+    }
+    munmap(index->header, index->map_size);
+    close(index->fd);
+    free(index);
+}
+
+/********************************************************************//**
+ * Whether the index still describes the database.
+ */
+int index_is_fresh(const struct pictdb_file *db_file)
+{
+    const struct pictdb_index *index = db_file->index;
+    return index != NULL &&
+           index->header->db_version == db_file->header.db_version &&
+           index->header->max_files == db_file->header.max_files;
+}
+
+/********************************************************************//**
+ * Maps the index of an opened database if it exists and is up to date.
+ */
+int index_open(const char *db_filename, int writable, struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(db_filename);
+    M_REQUIRE_NON_NULL(db_file);
+
+    db_file->index = NULL;
+
+    char filename[FILENAME_MAX];
+    int status = index_filename(filename, db_filename);
+    if (status != 0) {
+        return status;
+    }
+
+    int fd = open(filename, writable ? O_RDWR : O_RDONLY);
+    if (fd == -1) {
+        return ERR_FILE_NOT_FOUND;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size != index_size(db_file->header.max_files)) {
+        close(fd);
+        status = ERR_IO;
+    } else if ((db_file->index = index_map(fd, writable, db_file->header.max_files)) == NULL) {
+        close(fd);
+        status = ERR_IO;
+    } else if (memcmp(db_file->index->header->magic, INDEX_MAGIC, INDEX_MAGIC_LEN) != 0 ||
+               !index_is_fresh(db_file)) {
+        index_close(db_file);
+        status = ERR_IO;
+    }
+
+    // a stale index would only be ignored on every open, drop it
+    if (status == ERR_IO && writable) {
+        remove(filename);
+    }
+
+    return status;
+}
+
+/********************************************************************//**
+ * Unmaps the index of db_file if any.
+ */
+void index_close(struct pictdb_file *db_file)
+{
+    if (db_file == NULL) {
+        return;
+    }
+    index_unmap(db_file->index);
+    db_file->index = NULL;
+}
+
+/********************************************************************//**
+ * Looks up a valid picture through the index.
+ */
+int index_find(const struct pictdb_file *db_file, const char *pict_id, uint32_t *index)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(pict_id);
+    M_REQUIRE_NON_NULL(index);
+
+    if (!index_is_fresh(db_file)) {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    const struct pictdb_index_entry *entries = db_file->index->entries;
+    const uint32_t mask = db_file->index->header->capacity - 1;
+    const uint64_t hash = pict_id_hash(pict_id);
+
+    for (uint32_t pos = (uint32_t) hash & mask; entries[pos].slot != 0; pos = (pos + 1) & mask) {
+        const uint32_t slot = entries[pos].slot - 1;
+        if (entries[pos].hash == hash && slot < db_file->header.max_files &&
+            db_file->metadata[slot].is_valid == NON_EMPTY &&
+            !strncmp(db_file->metadata[slot].pict_id, pict_id, MAX_PIC_ID)) {
+            *index = slot;
+            return 0;
+        }
+    }
+
+    return ERR_FILE_NOT_FOUND;
+}
+
+/********************************************************************//**
+ * Bisects the sorted run for the first identifier not lower than pict_id
+ * (greater than pict_id when strict).
+ */
+uint32_t index_lower_bound(const struct pictdb_file *db_file, const char *pict_id, int strict)
+{
+    if (db_file == NULL || db_file->index == NULL || pict_id == NULL) {
+        return 0;
+    }
+
+    const uint32_t *sorted = db_file->index->sorted;
+    uint32_t low = 0;
+    uint32_t high = db_file->index->header->count;
+
+    while (low < high) {
+        const uint32_t middle = low + (high - low) / 2;
+        const int cmp = strncmp(db_file->metadata[sorted[middle]].pict_id, pict_id, MAX_PIC_ID);
+        if (cmp < 0 || (strict && cmp == 0)) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/********************************************************************//**
+ * Orders metadata by picture identifier.
+ */
+static int compare_pict_ids(const void *a, const void *b)
+{
+    const struct pict_metadata *x = *(const struct pict_metadata * const *) a;
+    const struct pict_metadata *y = *(const struct pict_metadata * const *) b;
+    return strncmp(x->pict_id, y->pict_id, MAX_PIC_ID);
+}
+
+/********************************************************************//**
+ * Inserts a slot at its place in the sorted run.
+ */
+static void sorted_insert(struct pictdb_file *db_file, uint32_t slot)
+{
+    struct pictdb_index *index = db_file->index;
+    const uint32_t pos = index_lower_bound(db_file, db_file->metadata[slot].pict_id, 0);
+
+    if (index->header->count >= db_file->header.max_files ||
+        (pos < index->header->count && index->sorted[pos] == slot)) {
+        return;
+    }
+
+    memmove(&index->sorted[pos + 1], &index->sorted[pos], (index->header->count - pos) * sizeof(uint32_t));
+    index->sorted[pos] = slot;
+    ++index->header->count;
+}
+
+/********************************************************************//**
+ * Removes a slot from the sorted run. The slot still holds its pict_id.
+ */
+static void sorted_erase(struct pictdb_file *db_file, uint32_t slot)
+{
+    struct pictdb_index *index = db_file->index;
+    const char *pict_id = db_file->metadata[slot].pict_id;
+    uint32_t pos = index_lower_bound(db_file, pict_id, 0);
+
+    // the run may hold equal identifiers of other (invalidated) slots
+    while (pos < index->header->count && index->sorted[pos] != slot &&
+           !strncmp(db_file->metadata[index->sorted[pos]].pict_id, pict_id, MAX_PIC_ID)) {
+        ++pos;
+    }
+    if (pos == index->header->count || index->sorted[pos] != slot) {
+        return;
+    }
+
+    --index->header->count;
+    memmove(&index->sorted[pos], &index->sorted[pos + 1], (index->header->count - pos) * sizeof(uint32_t));
+}
+
+/********************************************************************//**
+ * Inserts a slot in the hash table.
+ */
+static void index_insert(struct pictdb_index *index, uint64_t hash, uint32_t slot)
+{
+    const uint32_t mask = index->header->capacity - 1;
+    uint32_t pos = (uint32_t) hash & mask;
+
+    while (index->entries[pos].slot != 0 && index->entries[pos].slot != slot + 1) {
+        pos = (pos + 1) & mask;
+    }
+    index->entries[pos].hash = hash;
+    index->entries[pos].slot = slot + 1;
+}
+
+/********************************************************************//**
+ * Removes a slot from the hash table using backward shift deletion,
+ * so that no tombstone is ever needed.
+ */
+static void index_erase(struct pictdb_index *index, uint64_t hash, uint32_t slot)
+{
+    struct pictdb_index_entry *entries = index->entries;
+    const uint32_t mask = index->header->capacity - 1;
+    uint32_t pos = (uint32_t) hash & mask;
+
+    while (entries[pos].slot != 0 && entries[pos].slot != slot + 1) {
+        pos = (pos + 1) & mask;
+    }
+    if (entries[pos].slot == 0) {
+        return;
+    }
+
+    for (uint32_t next = (pos + 1) & mask; entries[next].slot != 0; next = (next + 1) & mask) {
+        const uint32_t home = (uint32_t) entries[next].hash & mask;
+        // the entry can fill the hole only if its home is not between the hole and itself
+        if (((next - home) & mask) >= ((next - pos) & mask)) {
+            entries[pos] = entries[next];
+            pos = next;
+        }
+    }
+    memset(&entries[pos], 0, sizeof(struct pictdb_index_entry));
+}
+
+/********************************************************************//**
+ * Reflects a slot change in the index. The version is written last so that
+ * an interrupted update leaves a stale, hence ignored, index.
+ */
+void index_update(struct pictdb_file *db_file, uint32_t index)
+{
+    if (db_file == NULL || db_file->index == NULL || !db_file->index->writable ||
+        index >= db_file->header.max_files) {
+        return;
+    }
+
+    const struct pict_metadata *metadata = &db_file->metadata[index];
+    const uint64_t hash = pict_id_hash(metadata->pict_id);
+
+    if (metadata->is_valid == NON_EMPTY) {
+        index_insert(db_file->index, hash, index);
+        sorted_insert(db_file, index);
+    } else {
+        index_erase(db_file->index, hash, index);
+        sorted_erase(db_file, index);
+    }
+    db_file->index->header->db_version = db_file->header.db_version;
+}
+
+/********************************************************************//**
+ * Builds (or rebuilds) the persisted index of db_file.
+ */
+int do_index(const char *db_filename, struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(db_filename);
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(db_file->metadata);
+
+    char filename[FILENAME_MAX];
+    int status = index_filename(filename, db_filename);
+    if (status != 0) {
+        return status;
+    }
+
+    index_close(db_file);
+
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return ERR_IO;
+    }
+
+    const uint32_t max_files = db_file->header.max_files;
+    const size_t map_size = index_size(max_files);
+    const struct pict_metadata **by_id = calloc(max_files, sizeof(struct pict_metadata *));
+
+    if (by_id == NULL || ftruncate(fd, (off_t) map_size) != 0 ||
+        (db_file->index = index_map(fd, 1, max_files)) == NULL) {
+        free(by_id);
+        close(fd);
+        remove(filename);
+        return by_id == NULL ? ERR_OUT_OF_MEMORY : ERR_IO;
+    }
+
+    struct pictdb_index_header *header = db_file->index->header;
+    memcpy(header->magic, INDEX_MAGIC, INDEX_MAGIC_LEN);
+    header->max_files = max_files;
+    header->capacity = index_capacity(max_files);
+    header->count = 0;
+
+    for (uint32_t i = 0; i < max_files; ++i) {
+        if (db_file->metadata[i].is_valid == NON_EMPTY) {
+            index_insert(db_file->index, pict_id_hash(db_file->metadata[i].pict_id), i);
+            by_id[header->count++] = &db_file->metadata[i];
+        }
+    }
+
+    // the run is sorted once: inserting slots one by one would be quadratic
+    qsort(by_id, header->count, sizeof(struct pict_metadata *), compare_pict_ids);
+    for (uint32_t i = 0; i < header->count; ++i) {
+        db_file->index->sorted[i] = (uint32_t) (by_id[i] - db_file->metadata);
+    }
+    free(by_id);
+    header->db_version = db_file->header.db_version;
+
+    if (msync(header, map_size, MS_SYNC) != 0) {
+        status = ERR_IO;
+    }
+    return status;
+}
+
+/********************************************************************//**
+ * Whether a picture identifier lies in a range.
+ */
+static int in_range(const char *pict_id, const struct pict_range *range)
+{
+    return (range->prefix == NULL || !strncmp(pict_id, range->prefix, strnlen(range->prefix, MAX_PIC_ID))) &&
+           (range->from == NULL || strncmp(pict_id, range->from, MAX_PIC_ID) >= 0) &&
+           (range->to == NULL || strncmp(pict_id, range->to, MAX_PIC_ID) < 0) &&
+           (range->after == NULL || strncmp(pict_id, range->after, MAX_PIC_ID) > 0);
+}
+
+/********************************************************************//**
+ * Finds the pictures of a range of identifiers, in pict_id order.
+ */
+int do_find_range(const struct pictdb_file *db_file, const struct pict_range *range, uint32_t *slots,
+                  uint32_t max_count, uint32_t *count)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(db_file->metadata);
+    M_REQUIRE_NON_NULL(range);
+    M_REQUIRE_NON_NULL(slots);
+    M_REQUIRE_NON_NULL(count);
+
+    *count = 0;
+
+    if (index_is_fresh(db_file)) {
+        // start at the greatest lower bound, then stop at the first identifier out of range
+        const char *lower = range->prefix;
+        if (range->from != NULL && (lower == NULL || strncmp(range->from, lower, MAX_PIC_ID) > 0)) {
+            lower = range->from;
+        }
+        uint32_t pos = lower == NULL ? 0 : index_lower_bound(db_file, lower, 0);
+        if (range->after != NULL) {
+            const uint32_t after = index_lower_bound(db_file, range->after, 1);
+            pos = after > pos ? after : pos;
+        }
+
+        const uint32_t *sorted = db_file->index->sorted;
+        for (; pos < db_file->index->header->count && *count < max_count; ++pos) {
+            if (!in_range(db_file->metadata[sorted[pos]].pict_id, range)) {
+                break;
+            }
+            slots[(*count)++] = sorted[pos];
+        }
+        return 0;
+    }
+
+    const struct pict_metadata **by_id = calloc(db_file->header.max_files, sizeof(struct pict_metadata *));
+    if (by_id == NULL && db_file->header.max_files > 0) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    uint32_t matches = 0;
+    for (uint32_t i = 0; i < db_file->header.max_files; ++i) {
+        if (db_file->metadata[i].is_valid == NON_EMPTY && in_range(db_file->metadata[i].pict_id, range)) {
+            by_id[matches++] = &db_file->metadata[i];
+        }
+    }
+
+    qsort(by_id, matches, sizeof(struct pict_metadata *), compare_pict_ids);
+    for (; *count < matches && *count < max_count; ++*count) {
+        slots[*count] = (uint32_t) (by_id[*count] - db_file->metadata);
+    }
+
+    free(by_id);
+    return 0;
+}
@@ -0,0 +1,137 @@
+/**
+ * @file db_index.h
+ * @brief pictDB library: optional persisted pict_id index.
+ *
+ * The index lives next to the database in "<dbfilename>.idx". It is an
+ * open-addressing hash table (linear probing) mapping the hash of a pict_id
+ * to its metadata slot, followed by a sorted run: the valid slots ordered by
+ * pict_id, searched by bisection for prefix and range queries. It is memory
+ * mapped on open so lookups only fault the pages they touch, and it is kept
+ * up to date by insert and delete. An index whose db_version does not match
+ * the database header is ignored.
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#ifndef PICTDBPRJ_DB_INDEX_H
+#define PICTDBPRJ_DB_INDEX_H
+
+#include "pictDB.h"
+
+#define INDEX_EXT ".idx"
+#define INDEX_MAGIC "PDBIDX2"
+#define INDEX_MAGIC_LEN 8
+#define INDEX_MIN_CAPACITY 16
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Index file header.
+ */
+struct pictdb_index_header {
+    char magic[INDEX_MAGIC_LEN]; /**< INDEX_MAGIC */
+    uint32_t db_version; /**< database version the index reflects */
+    uint32_t max_files; /**< database max image count */
+    uint32_t capacity; /**< number of hash entries (power of two) */
+    uint32_t count; /**< number of slots in the sorted run */
+};
+
+/**
+ * @brief Index hash table entry.
+ */
+struct pictdb_index_entry {
+    uint64_t hash; /**< pict_id hash */
+    uint32_t slot; /**< metadata index + 1, 0 if the entry is free */
+    uint32_t unused_32; /**< unused or temporary information */
+};
+
+/**
+ * @brief In memory handle on a mapped index file.
+ */
+struct pictdb_index {
+    int fd; /**< index file descriptor */
+    int writable; /**< whether the mapping can be updated */
+    size_t map_size; /**< size of the mapping */
+    struct pictdb_index_header *header; /**< mapped header */
+    struct pictdb_index_entry *entries; /**< mapped hash entries */
+    uint32_t *sorted; /**< mapped sorted run of max_files slots */
+};
+
+/**
+ * @brief Hashes a picture identifier (64-bit FNV-1a).
+ *
+ * @param pict_id The picture identifier.
+ */
+uint64_t pict_id_hash(const char *pict_id);
+
+/**
+ * @brief Builds the index file name of a database.
+ *
+ * @param index_filename Output buffer of FILENAME_MAX bytes.
+ * @param db_filename Name of the database file.
+ */
+int index_filename(char *index_filename, const char *db_filename);
+
+/**
+ * @brief Maps the index of an opened database if it exists and is up to date.
+ *        A stale index is removed when the database is writable.
+ *
+ * @param db_filename Name of the database file.
+ * @param writable Whether the database was opened for writing.
+ * @param db_file In memory structure with header and metadata.
+ */
+int index_open(const char *db_filename, int writable, struct pictdb_file *db_file);
+
+/**
+ * @brief Unmaps the index of db_file if any.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+void index_close(struct pictdb_file *db_file);
+
+/**
+ * @brief Looks up a valid picture through the index.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param pict_id Name of the image to find.
+ * @param index Set to the metadata index when found.
+ * @return 0 if found, ERR_FILE_NOT_FOUND if absent, ERR_INVALID_ARGUMENT if
+ *         the index cannot be used.
+ */
+int index_find(const struct pictdb_file *db_file, const char *pict_id, uint32_t *index);
+
+/**
+ * @brief Whether the index describes the current state of the database.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+int index_is_fresh(const struct pictdb_file *db_file);
+
+/**
+ * @brief Bisects the sorted run of a fresh index.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param pict_id Identifier to look for.
+ * @param strict Whether to skip identifiers equal to pict_id.
+ * @return Position of the first identifier not lower than (strict: greater
+ *         than) pict_id, the run length if none.
+ */
+uint32_t index_lower_bound(const struct pictdb_file *db_file, const char *pict_id, int strict);
+
+/**
+ * @brief Reflects a slot change (insertion or deletion) in the index.
+ *        Must be called after the database header has been written.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param index The metadata index that changed.
+ */
+void index_update(struct pictdb_file *db_file, uint32_t index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
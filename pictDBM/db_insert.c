@@ -11,45 +11,122 @@
 #include "pictDB.h"
 #include "dedup.h"
 #include "image_content.h"
+#include "db_index.h"
+#include "db_columns.h"
+#include "db_wal.h"
+#include "db_latch.h"
+#include "db_backend.h"
+#include "trace.h"
 
-int do_insert(const char image_buffer[], size_t image_size, const char *pict_id, struct pictdb_file *db_file)
+/********************************************************************//**
+ * Persists a freshly filled slot and the header that accounts for it.
+ * The slot is emptied, and the header restored, if they cannot be
+ * logged.
+ */
+static int commit_slot(struct pictdb_file *db_file, uint32_t index)
 {
-    M_REQUIRE_NON_NULL(image_buffer);
-    M_REQUIRE_NON_NULL(pict_id);
-    M_REQUIRE_NON_NULL(db_file);
-
-    if (db_file->fpdb == NULL) {
+    // readers read the image as soon as the slot is published
+    if (backend_flush(db_file, 0) != 0) {
+        db_file->metadata[index].is_valid = EMPTY;
         return ERR_IO;
     }
 
-    if (db_file->header.num_files >= db_file->header.max_files) {
-        return ERR_FULL_DATABASE;
+    // 4) Update database: header and slot are logged together, so either
+    // both or none of them survive a crash
+    TRACE_START(start_us);
+    latch_tables_begin(db_file);
+    db_file->header.db_version += 1;
+    db_file->header.num_files += 1;
+    latch_tables_end(db_file);
+
+    int status = wal_append(db_file, index);
+    if (status != 0) {
+        latch_tables_begin(db_file);
+        db_file->header.db_version -= 1;
+        db_file->header.num_files -= 1;
+        latch_tables_end(db_file);
+        db_file->metadata[index].is_valid = EMPTY;
+        return status;
     }
-    // We assume the file is already opened from the outside so we don't do it here
-    // 1) Find a free position at the index
-    uint32_t index = db_file->header.max_files;
-    for (uint32_t i = 0; index == db_file->header.max_files && i < db_file->header.max_files; ++i) {
-        if (db_file->metadata[i].is_valid == EMPTY) {
 
-            index = i;
+    latch_tables_begin(db_file);
+    index_update(db_file, index);
+    latch_tables_end(db_file);
+    status = wal_settle(db_file);
+    TRACE_STOP(TRACE_INSERT_METADATA, start_us);
+    return status;
+}
 
-            unsigned char *sha = malloc(SHA256_DIGEST_LENGTH);
-            SHA256((const unsigned char *) image_buffer, image_size, sha);
+/********************************************************************//**
+ * Hands a slot taken by take_slot back to readers, whether its picture
+ * was committed or not, and refreshes the mirror.
+ */
+static void publish_slot(struct pictdb_file *db_file, uint32_t index)
+{
+    latch_slot_end(db_file, index);
+    latch_tables_begin(db_file);
+    columns_update(db_file, index);
+    latch_tables_end(db_file);
+}
 
-            memcpy(db_file->metadata[i].SHA, sha, SHA256_DIGEST_LENGTH);
-            strncpy(db_file->metadata[i].pict_id, pict_id, MAX_PIC_ID);
+/********************************************************************//**
+ * Takes a free slot for pict_id (1), its image and sizes are left to the
+ * caller. Readers skip the slot until publish_slot.
+ */
+static int take_slot(struct pictdb_file *db_file, const char *pict_id, const unsigned char SHA[], size_t image_size,
+                     uint32_t *index)
+{
+    if (db_file->header.num_files >= db_file->header.max_files) {
+        return ERR_FULL_DATABASE;
+    }
 
-            db_file->metadata[i].pict_id[MAX_PIC_ID] = '\0';
-            db_file->metadata[i].size[RES_ORIG] = (uint32_t) image_size;
-            db_file->metadata[i].is_valid = NON_EMPTY;
+    TRACE_START(start_us);
+    int status = columns_ensure(db_file);
+    if (status != 0) {
+        return status;
+    }
 
-            free(sha);
-            sha = NULL;
-        }
+    // We assume the file is already opened from the outside so we don't do it here
+    // 1) Find a free position at the index
+    *index = columns_find_free(db_file->columns);
+    TRACE_STOP(TRACE_INSERT_SLOT, start_us);
+    if (*index >= db_file->header.max_files) {
+        return ERR_FULL_DATABASE;
     }
 
+    latch_slot_fill(db_file, *index);
+    struct pict_metadata *pict = &db_file->metadata[*index];
+    memcpy(pict->SHA, SHA, SHA256_DIGEST_LENGTH);
+    strncpy(pict->pict_id, pict_id, MAX_PIC_ID);
+
+    pict->pict_id[MAX_PIC_ID] = '\0';
+    pict->size[RES_ORIG] = (uint32_t) image_size;
+    pict->is_valid = NON_EMPTY;
+    return 0;
+}
+
+/********************************************************************//**
+ * De-duplicates, writes and commits the picture of a freshly taken slot.
+ * The slot is emptied on failure, so that publish_slot hands back a free
+ * slot.
+ */
+static int insert_at(const char image_buffer[], size_t image_size, struct pictdb_file *db_file, uint32_t index)
+{
     // 2) Image de-duplication
+    TRACE_START(dedup_us);
     int status = do_name_and_content_dedup(db_file, index);
+    TRACE_STOP(TRACE_INSERT_DEDUP, dedup_us);
+    if (status != 0) {
+        db_file->metadata[index].is_valid = EMPTY;
+        return status;
+    }
+
+    // an image that cannot be decoded is refused before being written
+    db_file->metadata[index].unused_16 = 0;
+    TRACE_START(resolution_us);
+    status = get_resolution(&db_file->metadata[index].res_orig[1], &db_file->metadata[index].res_orig[0], image_buffer,
+                            image_size);
+    TRACE_STOP(TRACE_INSERT_RESOLUTION, resolution_us);
     if (status != 0) {
         db_file->metadata[index].is_valid = EMPTY;
         return status;
@@ -58,39 +135,285 @@ int do_insert(const char image_buffer[], size_t image_size, const char *pict_id,
     // 3) Write image on disk if it does not exist yet
     if (db_file->metadata[index].offset[RES_ORIG] == 0) {
 
-        if (fseek(db_file->fpdb, 0, SEEK_END) != 0) {
-            return ERR_IO;
-        }
-
-        long end_offset = ftell(db_file->fpdb);
-        if (end_offset == -1 ||
-            fwrite(image_buffer, image_size, 1, db_file->fpdb) != 1) {
+        TRACE_START(write_us);
+        uint64_t end_offset = 0;
+        if (backend_append(db_file, image_buffer, image_size, &end_offset) != 0) {
+            db_file->metadata[index].is_valid = EMPTY;
             return ERR_IO;
         }
+        TRACE_STOP(TRACE_INSERT_WRITE, write_us);
 
         db_file->metadata[index].offset[RES_THUMB] = 0;
         db_file->metadata[index].offset[RES_SMALL] = 0;
-        db_file->metadata[index].offset[RES_ORIG] = (uint64_t) end_offset;
+        db_file->metadata[index].offset[RES_ORIG] = end_offset;
         db_file->metadata[index].size[RES_THUMB] = 0;
         db_file->metadata[index].size[RES_SMALL] = 0;
     }
 
-    db_file->metadata[index].unused_16 = 0;
-    status = get_resolution(&db_file->metadata[index].res_orig[1], &db_file->metadata[index].res_orig[0], image_buffer,
-                            image_size);
+    return commit_slot(db_file, index);
+}
+
+int do_insert(const char image_buffer[], size_t image_size, const char *pict_id, struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(image_buffer);
+    M_REQUIRE_NON_NULL(pict_id);
+    M_REQUIRE_NON_NULL(db_file);
+
+    if (db_file->backend == NULL) {
+        return ERR_IO;
+    }
+
+    unsigned char SHA[SHA256_DIGEST_LENGTH];
+    TRACE_START(start_us);
+    SHA256((const unsigned char *) image_buffer, image_size, SHA);
+    TRACE_STOP(TRACE_INSERT_SHA, start_us);
+
+    latch_lock(db_file);
+    uint32_t index = 0;
+    int status = take_slot(db_file, pict_id, SHA, image_size, &index);
+    if (status == 0) {
+        status = insert_at(image_buffer, image_size, db_file, index);
+
+        // the mirror follows the slot whatever the outcome
+        publish_slot(db_file, index);
+    }
+    latch_unlock(db_file);
+    return status;
+}
+
+/********************************************************************//**
+ * Gives back the reserved space of an upload, but the first keep bytes.
+ * Space followed by other writes is left to the garbage collector.
+ * Requires the writer lock.
+ */
+static void release_upload(struct pictdb_file *db_file, struct pictdb_upload *upload, uint64_t keep)
+{
+    uint64_t size = 0;
+    if (backend_size(db_file, &size) == 0 && size == upload->offset + upload->reserved) {
+        (void) backend_truncate(db_file, upload->offset + keep);
+    }
+
+    EVP_MD_CTX_free(upload->sha);
+    upload->sha = NULL;
+}
+
+/********************************************************************//**
+ * Starts streaming an image at the end of the database file.
+ */
+int do_insert_begin(struct pictdb_file *db_file, uint64_t max_size, struct pictdb_upload *upload)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(upload);
+
+    upload->sha = NULL;
+    if (db_file->backend == NULL) {
+        return ERR_IO;
+    }
+    if (max_size == 0 || max_size > UINT32_MAX) {
+        return ERR_INVALID_ARGUMENT;
+    }
+    latch_lock(db_file);
+    uint64_t end_offset = 0;
+    int status = 0;
+    if (db_file->header.num_files >= db_file->header.max_files) {
+        status = ERR_FULL_DATABASE;
+    } else if (backend_size(db_file, &end_offset) != 0) {
+        status = ERR_IO;
+    } else {
+        upload->offset = end_offset;
+        upload->reserved = max_size < UPLOAD_RESERVE_CHUNK ? max_size : UPLOAD_RESERVE_CHUNK;
+        upload->size = 0;
+        upload->max_size = max_size;
+
+        // the reservation moves the end of file, so appends meanwhile go after it
+        if (backend_truncate(db_file, upload->offset + upload->reserved) != 0) {
+            status = ERR_IO;
+        }
+    }
+    latch_unlock(db_file);
     if (status != 0) {
         return status;
     }
 
-    // 4) Update database
-    db_file->header.db_version += 1;
-    db_file->header.num_files += 1;
-    if (fseek(db_file->fpdb, 0, SEEK_SET) != 0 ||
-        fwrite(&db_file->header, sizeof(struct pictdb_header), 1, db_file->fpdb) != 1 ||
-        fseek(db_file->fpdb, index * sizeof(struct pict_metadata), SEEK_CUR) != 0 ||
-        fwrite(&db_file->metadata[index], sizeof(struct pict_metadata), 1, db_file->fpdb) != 1) {
+    upload->sha = EVP_MD_CTX_new();
+    if (upload->sha == NULL || EVP_DigestInit_ex(upload->sha, EVP_sha256(), NULL) != 1) {
+        latch_lock(db_file);
+        release_upload(db_file, upload, 0);
+        latch_unlock(db_file);
+        return ERR_OUT_OF_MEMORY;
+    }
+    return 0;
+}
+
+/********************************************************************//**
+ * Reserves room for needed bytes of an upload, by whole chunks: the
+ * reservation grows while it ends the file, otherwise the bytes written
+ * so far are moved to the end of the file, the space left behind being
+ * for the garbage collector. Requires the writer lock.
+ */
+static int grow_upload(struct pictdb_file *db_file, struct pictdb_upload *upload, uint64_t needed)
+{
+    uint64_t reserved = upload->reserved;
+    while (reserved < needed) {
+        reserved += UPLOAD_RESERVE_CHUNK;
+    }
+    reserved = reserved < upload->max_size ? reserved : upload->max_size;
+
+    uint64_t end = 0;
+    if (backend_size(db_file, &end) != 0) {
         return ERR_IO;
-    };
+    }
+    if (end == upload->offset + upload->reserved) {
+        if (backend_truncate(db_file, upload->offset + reserved) != 0) {
+            return ERR_IO;
+        }
+        upload->reserved = reserved;
+        return 0;
+    }
+
+    char *block = malloc(UPLOAD_RESERVE_CHUNK);
+    if (block == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    // reads see flushed writes only
+    int status = backend_truncate(db_file, end + reserved) == 0 && backend_flush(db_file, 0) == 0 ? 0 : ERR_IO;
+    for (uint64_t done = 0; status == 0 && done < upload->size; done += UPLOAD_RESERVE_CHUNK) {
+        const size_t len = (size_t) (upload->size - done < UPLOAD_RESERVE_CHUNK ?
+                                     upload->size - done : UPLOAD_RESERVE_CHUNK);
+        if (backend_read(db_file, upload->offset + done, block, len) != 0 ||
+            backend_write(db_file, end + done, block, len) != 0) {
+            status = ERR_IO;
+        }
+    }
+    free(block);
+
+    if (status != 0) {
+        (void) backend_truncate(db_file, end);
+        return status;
+    }
+    upload->offset = end;
+    upload->reserved = reserved;
+    return 0;
+}
+
+/********************************************************************//**
+ * Writes and hashes the next bytes of a streamed image.
+ */
+int do_insert_append(struct pictdb_file *db_file, struct pictdb_upload *upload, const char *data, size_t len)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(upload);
+    M_REQUIRE_NON_NULL(upload->sha);
+    M_REQUIRE_NON_NULL(data);
+
+    if (len > upload->max_size - upload->size) {
+        return ERR_INVALID_ARGUMENT;
+    }
 
+    TRACE_START(write_us);
+    latch_lock(db_file);
+    int status = upload->size + len > upload->reserved ? grow_upload(db_file, upload, upload->size + len) : 0;
+    if (status == 0 && backend_write(db_file, upload->offset + upload->size, data, len) != 0) {
+        status = ERR_IO;
+    }
+    latch_unlock(db_file);
+    if (status != 0) {
+        return status;
+    }
+    TRACE_STOP(TRACE_INSERT_WRITE, write_us);
+
+    TRACE_START(sha_us);
+    if (EVP_DigestUpdate(upload->sha, data, len) != 1) {
+        return ERR_IO;
+    }
+    TRACE_STOP(TRACE_INSERT_SHA, sha_us);
+
+    upload->size += len;
+    return 0;
+}
+
+/********************************************************************//**
+ * Commits a streamed image, de-duplicated like do_insert. Requires the
+ * writer lock.
+ */
+static int finish_upload(struct pictdb_file *db_file, struct pictdb_upload *upload, const char *pict_id)
+{
+    unsigned char SHA[SHA256_DIGEST_LENGTH];
+    uint32_t res_orig[2] = {0, 0};
+
+    int status = EVP_DigestFinal_ex(upload->sha, SHA, NULL) == 1 && backend_flush(db_file, 0) == 0 ? 0 : ERR_IO;
+    if (status == 0) {
+        TRACE_START(resolution_us);
+        status = get_file_resolution(&res_orig[1], &res_orig[0], db_file, upload->offset, upload->size);
+        TRACE_STOP(TRACE_INSERT_RESOLUTION, resolution_us);
+    }
+
+    uint32_t index = db_file->header.max_files;
+    if (status == 0) {
+        status = take_slot(db_file, pict_id, SHA, (size_t) upload->size, &index);
+    }
+
+    // 2) Image de-duplication
+    if (status == 0) {
+        TRACE_START(dedup_us);
+        status = do_name_and_content_dedup(db_file, index);
+        TRACE_STOP(TRACE_INSERT_DEDUP, dedup_us);
+    }
+
+    if (status != 0) {
+        if (index < db_file->header.max_files) {
+            db_file->metadata[index].is_valid = EMPTY;
+            publish_slot(db_file, index);
+        }
+        release_upload(db_file, upload, 0);
+        return status;
+    }
+
+    // 3) The image is already on disk, unless another slot holds the same
+    struct pict_metadata *pict = &db_file->metadata[index];
+    if (pict->offset[RES_ORIG] == 0) {
+        pict->offset[RES_THUMB] = 0;
+        pict->offset[RES_SMALL] = 0;
+        pict->offset[RES_ORIG] = upload->offset;
+        pict->size[RES_THUMB] = 0;
+        pict->size[RES_SMALL] = 0;
+        release_upload(db_file, upload, upload->size);
+    } else {
+        release_upload(db_file, upload, 0);
+    }
+
+    pict->unused_16 = 0;
+    pict->res_orig[0] = res_orig[0];
+    pict->res_orig[1] = res_orig[1];
+
+    status = commit_slot(db_file, index);
+    publish_slot(db_file, index);
     return status;
 }
+
+int do_insert_end(struct pictdb_file *db_file, struct pictdb_upload *upload, const char *pict_id)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(upload);
+    M_REQUIRE_NON_NULL(upload->sha);
+    M_REQUIRE_NON_NULL(pict_id);
+
+    latch_lock(db_file);
+    const int status = finish_upload(db_file, upload, pict_id);
+    latch_unlock(db_file);
+    return status;
+}
+
+/********************************************************************//**
+ * Drops a streamed image.
+ */
+void do_insert_abort(struct pictdb_file *db_file, struct pictdb_upload *upload)
+{
+    if (db_file == NULL || upload == NULL || upload->sha == NULL) {
+        return;
+    }
+    latch_lock(db_file);
+    release_upload(db_file, upload, 0);
+    latch_unlock(db_file);
+}
@@ -0,0 +1,303 @@
+/**
+ * @file db_io.c
+ * @implementation of the batched positioned I/O on the database file
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "db_io.h"
+#include "db_backend.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && !defined(PICTDB_NO_IO_URING)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+// IORING_OP_READ and IORING_OP_WRITE came with this feature (Linux 5.6)
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_RW_CUR_POS)
+#define IO_URING
+#endif
+#endif
+
+#define IO_ENTER_RETRIES 3 // failed io_uring_enter() in a row before giving up a ring
+
+#ifdef IO_URING
+
+/********************************************************************//**
+ * Transfers the rest of a request with pread() or pwrite().
+ */
+static int transfer(int fd, int writing, const struct pictdb_io_request *request, size_t done)
+{
+    while (done < request->size) {
+        char *at = (char *) request->buffer + done;
+        const off_t offset = (off_t) (request->offset + done);
+        const ssize_t len = writing ? pwrite(fd, at, request->size - done, offset) :
+                            pread(fd, at, request->size - done, offset);
+        if (len > 0) {
+            done += (size_t) len;
+        } else if (len == 0 || errno != EINTR) {
+            return ERR_IO;
+        }
+    }
+    return 0;
+}
+
+/********************************************************************//**
+ * Unmaps the queues and closes the ring.
+ */
+static void ring_teardown(struct pictdb_io *io)
+{
+    if (io->sqes != NULL) {
+        munmap(io->sqes, io->sqes_size);
+    }
+    if (io->cq_ring != NULL && io->cq_ring_size != 0) {
+        munmap(io->cq_ring, io->cq_ring_size);
+    }
+    if (io->sq_ring != NULL) {
+        munmap(io->sq_ring, io->sq_ring_size);
+    }
+    close(io->ring_fd);
+}
+
+/********************************************************************//**
+ * Maps one of the queues of a ring, NULL on failure.
+ */
+static void *ring_map(int ring_fd, size_t size, off_t offset)
+{
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+/********************************************************************//**
+ * Creates a ring of IO_QUEUE_DEPTH entries and maps its queues.
+ */
+static int ring_setup(struct pictdb_io *io, int fd)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    const long ring_fd = syscall(__NR_io_uring_setup, IO_QUEUE_DEPTH, &params);
+    if (ring_fd < 0) {
+        return ERR_IO;
+    }
+    io->ring_fd = (int) ring_fd;
+
+    io->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    const size_t cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    const int single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap && cq_ring_size > io->sq_ring_size) {
+        io->sq_ring_size = cq_ring_size;
+    }
+
+    io->sq_ring = ring_map(io->ring_fd, io->sq_ring_size, IORING_OFF_SQ_RING);
+    io->cq_ring = single_mmap ? io->sq_ring : ring_map(io->ring_fd, cq_ring_size, IORING_OFF_CQ_RING);
+    io->cq_ring_size = single_mmap ? 0 : cq_ring_size;
+    io->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    io->sqes = ring_map(io->ring_fd, io->sqes_size, IORING_OFF_SQES);
+
+    if ((params.features & IORING_FEAT_RW_CUR_POS) == 0 ||
+        io->sq_ring == NULL || io->cq_ring == NULL || io->sqes == NULL) {
+        ring_teardown(io);
+        return ERR_IO;
+    }
+
+    char *sq = io->sq_ring;
+    char *cq = io->cq_ring;
+    io->sq_head = (uint32_t *) (sq + params.sq_off.head);
+    io->sq_tail = (uint32_t *) (sq + params.sq_off.tail);
+    io->sq_mask = *(uint32_t *) (sq + params.sq_off.ring_mask);
+    io->sq_array = (uint32_t *) (sq + params.sq_off.array);
+    io->cq_head = (uint32_t *) (cq + params.cq_off.head);
+    io->cq_tail = (uint32_t *) (cq + params.cq_off.tail);
+    io->cq_mask = *(uint32_t *) (cq + params.cq_off.ring_mask);
+    io->cqes = cq + params.cq_off.cqes;
+
+    // requests then name the file by its slot in the ring
+    io->fixed = syscall(__NR_io_uring_register, io->ring_fd, IORING_REGISTER_FILES, &fd, 1) == 0 ? fd : -1;
+    return 0;
+}
+
+/********************************************************************//**
+ * Runs a batch on the ring, keeping up to IO_QUEUE_DEPTH requests in
+ * flight. Failed and short transfers are finished with transfer(). A
+ * ring that cannot be drained is torn down, to be used no more: no
+ * request of this batch may complete into a later one.
+ */
+static int ring_batch(struct pictdb_io *io, int fd, int writing, const struct pictdb_io_request requests[],
+                      size_t count)
+{
+    struct io_uring_sqe *sqes = io->sqes;
+    const struct io_uring_cqe *cqes = io->cqes;
+    size_t queued = 0;
+    size_t inflight = 0;
+    unsigned int failures = 0;
+    int status = 0;
+
+    do {
+        // once failed, the batch only waits for what is in flight: the
+        // kernel still transfers from or into the buffers of the caller
+        uint32_t tail = *io->sq_tail;
+        while (status == 0 && queued < count && inflight < IO_QUEUE_DEPTH) {
+            const uint32_t index = tail & io->sq_mask;
+            struct io_uring_sqe *sqe = &sqes[index];
+            memset(sqe, 0, sizeof(struct io_uring_sqe));
+            sqe->opcode = writing ? IORING_OP_WRITE : IORING_OP_READ;
+            sqe->fd = io->fixed == fd ? 0 : fd;
+            sqe->flags = io->fixed == fd ? IOSQE_FIXED_FILE : 0;
+            sqe->off = requests[queued].offset;
+            sqe->addr = (uint64_t) (uintptr_t) requests[queued].buffer;
+            sqe->len = (uint32_t) requests[queued].size;
+            sqe->user_data = queued;
+            io->sq_array[index] = index;
+            ++tail;
+            ++queued;
+            ++inflight;
+        }
+        __atomic_store_n(io->sq_tail, tail, __ATOMIC_RELEASE);
+
+        if (inflight == 0) {
+            break;
+        }
+
+        const uint32_t pending = tail - __atomic_load_n(io->sq_head, __ATOMIC_ACQUIRE);
+        if (syscall(__NR_io_uring_enter, io->ring_fd, pending, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+            errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            status = ERR_IO;
+            if (++failures > IO_ENTER_RETRIES) {
+                ring_teardown(io);
+                io->broken = 1;
+                return status;
+            }
+        } else {
+            failures = 0;
+        }
+
+        uint32_t head = *io->cq_head;
+        const uint32_t completed = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != completed; ++head) {
+            const struct io_uring_cqe *cqe = &cqes[head & io->cq_mask];
+            const struct pictdb_io_request *request = &requests[cqe->user_data];
+            --inflight;
+            if (status == 0 && (cqe->res < 0 || (size_t) cqe->res < request->size)) {
+                status = transfer(fd, writing, request, cqe->res > 0 ? (size_t) cqe->res : 0);
+            }
+        }
+        __atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
+    } while (queued < count || inflight > 0);
+
+    return status;
+}
+
+#endif
+
+/********************************************************************//**
+ * Sets up a ring for db_file if io_uring is available.
+ */
+void io_open(struct pictdb_file *db_file)
+{
+    if (db_file == NULL) {
+        return;
+    }
+
+    db_file->io = NULL;
+#ifdef IO_URING
+    if (db_file->fpdb == NULL) {
+        return;
+    }
+
+    struct pictdb_io *io = calloc(1, sizeof(struct pictdb_io));
+    if (io == NULL) {
+        return;
+    }
+    if (ring_setup(io, fileno(db_file->fpdb)) != 0) {
+        free(io);
+        return;
+    }
+    if (pthread_mutex_init(&io->lock, NULL) != 0) {
+        ring_teardown(io);
+        free(io);
+        return;
+    }
+    db_file->io = io;
+#endif
+}
+
+/********************************************************************//**
+ * Releases the ring of db_file.
+ */
+void io_close(struct pictdb_file *db_file)
+{
+    if (db_file == NULL || db_file->io == NULL) {
+        return;
+    }
+
+#ifdef IO_URING
+    pthread_mutex_destroy(&db_file->io->lock);
+    if (!db_file->io->broken) {
+        ring_teardown(db_file->io);
+    }
+#endif
+    free(db_file->io);
+    db_file->io = NULL;
+}
+
+/********************************************************************//**
+ * Runs a batch on the ring of the handle, if it has one, free and not
+ * torn down. Tells whether it did.
+ */
+static int ring_run(const struct pictdb_file *db_file, int writing, const struct pictdb_io_request requests[],
+                    size_t count, int *ran)
+{
+    *ran = 0;
+#ifdef IO_URING
+    struct pictdb_io *io = db_file->io;
+    if (io != NULL && count > 1 && pthread_mutex_trylock(&io->lock) == 0) {
+        if (io->broken) {
+            pthread_mutex_unlock(&io->lock);
+            return 0;
+        }
+        const int status = ring_batch(io, fileno(db_file->fpdb), writing, requests, count);
+        pthread_mutex_unlock(&io->lock);
+        *ran = 1;
+        return status;
+    }
+#else
+    (void) db_file;
+    (void) writing;
+    (void) requests;
+    (void) count;
+#endif
+    return 0;
+}
+
+int io_read_batch(const struct pictdb_file *db_file, const struct pictdb_io_request requests[], size_t count)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(requests);
+
+    int ran = 0;
+    int status = ring_run(db_file, 0, requests, count, &ran);
+    for (size_t i = 0; !ran && i < count && status == 0; ++i) {
+        status = backend_read(db_file, requests[i].offset, requests[i].buffer, requests[i].size);
+    }
+    return status;
+}
+
+int io_write_batch(struct pictdb_file *db_file, const struct pictdb_io_request requests[], size_t count)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(requests);
+
+    int ran = 0;
+    int status = ring_run(db_file, 1, requests, count, &ran);
+    for (size_t i = 0; !ran && i < count && status == 0; ++i) {
+        status = backend_write(db_file, requests[i].offset, requests[i].buffer, requests[i].size);
+    }
+    return status;
+}
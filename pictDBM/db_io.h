@@ -0,0 +1,112 @@
+/**
+ * @file db_io.h
+ * @brief pictDB library: batched positioned I/O on the database file.
+ *
+ * Reads and writes of several blobs are submitted together. With io_uring
+ * (Linux 5.6 and later), up to IO_QUEUE_DEPTH of them are in flight at
+ * once, so that a batch keeps the device busy at the queue depth it
+ * serves best instead of one request at a time; the database file is
+ * registered with the ring, which saves a file lookup per request.
+ * Without io_uring (older kernels, seccomp filters, other systems, builds
+ * with PICTDB_NO_IO_URING, or storages other than STORAGE_FILE), the same
+ * calls run one blob at a time through the backend (see db_backend.h).
+ *
+ * The ring belongs to the handle and serves one batch at a time: a batch
+ * finding it busy goes through the backend rather than waiting. A ring
+ * that fails for good is torn down, and later batches go through the
+ * backend.
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#ifndef PICTDBPRJ_DB_IO_H
+#define PICTDBPRJ_DB_IO_H
+
+#include "pictDB.h"
+
+#include <pthread.h>
+
+#define IO_QUEUE_DEPTH 64 // requests in flight per batch
+#define IO_BATCH_BYTES (8 << 20) // bytes buffered per batch by do_read_batch
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief One transfer of a batch.
+ */
+struct pictdb_io_request {
+    uint64_t offset; /**< first byte in the database file */
+    void *buffer; /**< bytes to write, or receiving the bytes read */
+    size_t size; /**< number of bytes */
+};
+
+/**
+ * @brief io_uring of a handle: the mapped submission and completion queues.
+ */
+struct pictdb_io {
+    pthread_mutex_t lock; /**< taken by the batch using the ring */
+    int ring_fd; /**< ring file descriptor */
+    int fixed; /**< database file registered with the ring, -1 if none */
+    int broken; /**< ring torn down after a failure, batches use the backend */
+    void *sq_ring; /**< mapped submission ring */
+    size_t sq_ring_size; /**< size of sq_ring */
+    void *sqes; /**< mapped submission entries */
+    size_t sqes_size; /**< size of sqes */
+    void *cq_ring; /**< mapped completion ring, may be sq_ring */
+    size_t cq_ring_size; /**< size of cq_ring, 0 if shared with sq_ring */
+    uint32_t *sq_head; /**< submissions consumed by the kernel */
+    uint32_t *sq_tail; /**< submissions queued */
+    uint32_t sq_mask; /**< submission ring size - 1 */
+    uint32_t *sq_array; /**< submission ring: indices of entries */
+    uint32_t *cq_head; /**< completions consumed */
+    uint32_t *cq_tail; /**< completions posted by the kernel */
+    uint32_t cq_mask; /**< completion ring size - 1 */
+    void *cqes; /**< completion entries */
+};
+
+/**
+ * @brief Sets up a ring for db_file if io_uring is available; db_file->io
+ *        stays NULL otherwise, and batches go through the backend.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+void io_open(struct pictdb_file *db_file);
+
+/**
+ * @brief Releases the ring of db_file.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+void io_close(struct pictdb_file *db_file);
+
+/**
+ * @brief Reads a batch of blobs of the database file, in any order.
+ *        Safe alongside writers, like backend_read().
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param requests The blobs to read.
+ * @param count Number of requests.
+ * @return 0 once all were read, ERR_IO otherwise.
+ */
+int io_read_batch(const struct pictdb_file *db_file, const struct pictdb_io_request requests[], size_t count);
+
+/**
+ * @brief Writes a batch of blobs to the database file, in any order, maybe
+ *        past its stream buffer: the backend must be flushed before, and
+ *        after for the writes to be seen.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param requests The blobs to write.
+ * @param count Number of requests.
+ * @return 0 once all were written, ERR_IO otherwise.
+ */
+int io_write_batch(struct pictdb_file *db_file, const struct pictdb_io_request requests[], size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
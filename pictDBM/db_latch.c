@@ -0,0 +1,268 @@
+/**
+ * @file db_latch.c
+ * @implementation of the reader/writer synchronization of a database
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "db_latch.h"
+#include "db_columns.h"
+#include "db_share.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/********************************************************************//**
+ * Sets up the synchronization of db_file.
+ */
+int latch_open(struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(db_file);
+
+    struct pictdb_latch *latch = calloc(1, sizeof(struct pictdb_latch) +
+                                        db_file->header.max_files * sizeof(uint32_t));
+    if (latch == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    if (pthread_mutex_init(&latch->writer, NULL) != 0) {
+        free(latch);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    db_file->latch = latch;
+    return 0;
+}
+
+/********************************************************************//**
+ * Releases the synchronization of db_file.
+ */
+void latch_close(struct pictdb_file *db_file)
+{
+    if (db_file == NULL || db_file->latch == NULL) {
+        return;
+    }
+
+    pthread_mutex_destroy(&db_file->latch->writer);
+    free(db_file->latch);
+    db_file->latch = NULL;
+}
+
+/********************************************************************//**
+ * Takes the writer lock, then the file lock of a shared database.
+ */
+void latch_lock(struct pictdb_file *db_file)
+{
+    if (db_file != NULL && db_file->latch != NULL) {
+        pthread_mutex_lock(&db_file->latch->writer);
+        share_lock(db_file);
+    }
+}
+
+/********************************************************************//**
+ * Releases the file lock of a shared database, then the writer lock.
+ */
+void latch_unlock(struct pictdb_file *db_file)
+{
+    if (db_file != NULL && db_file->latch != NULL) {
+        share_unlock(db_file);
+        pthread_mutex_unlock(&db_file->latch->writer);
+    }
+}
+
+/********************************************************************//**
+ * Takes the writer lock of the process if it is free.
+ */
+int latch_trylock(struct pictdb_file *db_file)
+{
+    return db_file != NULL && db_file->latch != NULL &&
+           pthread_mutex_trylock(&db_file->latch->writer) == 0;
+}
+
+/********************************************************************//**
+ * Releases the writer lock of the process only.
+ */
+void latch_release(struct pictdb_file *db_file)
+{
+    if (db_file != NULL && db_file->latch != NULL) {
+        pthread_mutex_unlock(&db_file->latch->writer);
+    }
+}
+
+/********************************************************************//**
+ * Sequence of a slot, NULL when db_file is not synchronized.
+ */
+static uint32_t *slot_sequence(const struct pictdb_file *db_file, uint32_t index)
+{
+    if (db_file == NULL || db_file->latch == NULL || index >= db_file->header.max_files) {
+        return NULL;
+    }
+    return &db_file->latch->slots[index];
+}
+
+/********************************************************************//**
+ * Makes a sequence odd before the protected fields are stored: the fence
+ * keeps those stores after it.
+ */
+static void sequence_begin(uint32_t *seq)
+{
+    __atomic_store_n(seq, __atomic_load_n(seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void latch_slot_fill(struct pictdb_file *db_file, uint32_t index)
+{
+    uint32_t *seq = slot_sequence(db_file, index);
+    if (seq != NULL) {
+        __atomic_store_n(seq, __atomic_load_n(seq, __ATOMIC_RELAXED) | LATCH_FILLING, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+}
+
+void latch_slot_begin(struct pictdb_file *db_file, uint32_t index)
+{
+    uint32_t *seq = slot_sequence(db_file, index);
+    if (seq != NULL) {
+        sequence_begin(seq);
+    }
+}
+
+void latch_slot_end(struct pictdb_file *db_file, uint32_t index)
+{
+    uint32_t *seq = slot_sequence(db_file, index);
+    if (seq != NULL) {
+        // back to even, and different from any value read before the change
+        const uint32_t value = __atomic_load_n(seq, __ATOMIC_RELAXED);
+        __atomic_store_n(seq, (value & ~LATCH_FILLING) + ((value & 1) ? 1 : 2), __ATOMIC_RELEASE);
+    }
+}
+
+void latch_tables_begin(struct pictdb_file *db_file)
+{
+    if (db_file != NULL && db_file->latch != NULL) {
+        sequence_begin(&db_file->latch->tables);
+    }
+}
+
+void latch_tables_end(struct pictdb_file *db_file)
+{
+    if (db_file != NULL && db_file->latch != NULL) {
+        uint32_t *seq = &db_file->latch->tables;
+        __atomic_store_n(seq, __atomic_load_n(seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+    }
+}
+
+uint32_t latch_tables_read(const struct pictdb_file *db_file)
+{
+    if (db_file == NULL || db_file->latch == NULL) {
+        return 0;
+    }
+
+    uint32_t seq = 0;
+    // a writer only stores a few fields under an odd sequence
+    while ((seq = __atomic_load_n(&db_file->latch->tables, __ATOMIC_ACQUIRE)) & 1) {
+    }
+    return seq;
+}
+
+int latch_tables_changed(const struct pictdb_file *db_file, uint32_t seq)
+{
+    if (db_file == NULL || db_file->latch == NULL) {
+        return 0;
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&db_file->latch->tables, __ATOMIC_RELAXED) != seq;
+}
+
+void latch_read_header(const struct pictdb_file *db_file, struct pictdb_header *header)
+{
+    if (db_file == NULL || header == NULL) {
+        return;
+    }
+
+    uint32_t seq = 0;
+    do {
+        seq = latch_tables_read(db_file);
+        memcpy(header, &db_file->header, sizeof(struct pictdb_header));
+    } while (latch_tables_changed(db_file, seq));
+}
+
+int latch_read_slot(const struct pictdb_file *db_file, uint32_t index, struct pict_metadata *pict)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(db_file->metadata);
+    M_REQUIRE_NON_NULL(pict);
+
+    if (index >= db_file->header.max_files) {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    const uint32_t *seq = slot_sequence(db_file, index);
+    if (seq == NULL) {
+        memcpy(pict, &db_file->metadata[index], sizeof(struct pict_metadata));
+        return pict->is_valid == NON_EMPTY ? 0 : ERR_FILE_NOT_FOUND;
+    }
+
+    for (;;) {
+        const uint32_t before = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+        if (before & LATCH_FILLING) {
+            return ERR_FILE_NOT_FOUND;
+        }
+        if (before & 1) {
+            continue;
+        }
+
+        memcpy(pict, &db_file->metadata[index], sizeof(struct pict_metadata));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(seq, __ATOMIC_RELAXED) == before) {
+            return pict->is_valid == NON_EMPTY ? 0 : ERR_FILE_NOT_FOUND;
+        }
+    }
+}
+
+/********************************************************************//**
+ * Finds a picture and copies its slot. A lookup racing with a writer may
+ * miss a picture (the index moves entries on deletion) or land on a slot
+ * reused since: it is done again when the tables changed meanwhile.
+ */
+int latch_find(const struct pictdb_file *db_file, const char *pict_id, uint32_t *index, struct pict_metadata *pict)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(pict_id);
+    M_REQUIRE_NON_NULL(index);
+    M_REQUIRE_NON_NULL(pict);
+
+    for (;;) {
+        const uint32_t seq = latch_tables_read(db_file);
+        int status = find_pict_index(db_file, pict_id, index);
+        if (status == 0) {
+            status = latch_read_slot(db_file, *index, pict);
+        }
+        if (status == 0 && strncmp(pict->pict_id, pict_id, MAX_PIC_ID)) {
+            status = ERR_FILE_NOT_FOUND;
+        }
+        if (status != ERR_FILE_NOT_FOUND || !latch_tables_changed(db_file, seq)) {
+            return status;
+        }
+    }
+}
+
+/********************************************************************//**
+ * Builds the columnar mirror under the writer lock, unless it is built.
+ */
+int latch_columns(struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(db_file);
+
+    if (__atomic_load_n(&db_file->columns, __ATOMIC_ACQUIRE) != NULL) {
+        return 0;
+    }
+
+    latch_lock(db_file);
+    const int status = columns_ensure(db_file);
+    latch_unlock(db_file);
+    return status;
+}
@@ -0,0 +1,197 @@
+/**
+ * @file db_latch.h
+ * @brief pictDB library: reader/writer synchronization of a shared database.
+ *
+ * Writers (insertions, deletions, lazy resizes, commits) are serialized by
+ * a mutex. Readers never take it: each metadata slot carries a sequence
+ * number that writers make odd while they change the slot, and readers
+ * copy the slot until they get the same even number before and after the
+ * copy. The header and the lookup structures (index, columnar mirror)
+ * share a single such sequence. Sections under an odd sequence only store
+ * a few fields in memory: no I/O, no resize, so readers retry for at most
+ * a few hundred nanoseconds.
+ *
+ * A slot taken by an insertion is marked LATCH_FILLING until the insertion
+ * is over (which includes writing the image): readers skip it as empty
+ * instead of waiting.
+ *
+ * The metadata table is allocated once for the life of a handle, so a
+ * snapshot never points to reclaimed memory. Images are appended and
+ * never moved while a handle is open; readers load them with pread()
+ * instead of sharing the stream position of the writer.
+ *
+ * do_read, do_locate, do_read_range, do_read_batch and do_list_json may
+ * run in any number of threads alongside writers. Writers of other
+ * processes are excluded by a file lock, see db_share.h. The other commands
+ * (query, sprite, check, index, gc) still need exclusive access.
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#ifndef PICTDBPRJ_DB_LATCH_H
+#define PICTDBPRJ_DB_LATCH_H
+
+#include "pictDB.h"
+
+#include <pthread.h>
+
+#define LATCH_FILLING 0x80000000u // slot sequence flag: taken by an insertion in progress
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct pictdb_latch {
+    pthread_mutex_t writer; /**< serializes writers */
+    uint32_t tables; /**< sequence of the header, index and columnar mirror */
+    uint32_t slots[]; /**< sequence of each metadata slot */
+};
+
+/**
+ * @brief Sets up the synchronization of db_file, once its header is read.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+int latch_open(struct pictdb_file *db_file);
+
+/**
+ * @brief Releases the synchronization of db_file.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+void latch_close(struct pictdb_file *db_file);
+
+/**
+ * @brief Waits for and takes the writer lock of db_file, and the file lock
+ *        when the database is shared with other processes.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+void latch_lock(struct pictdb_file *db_file);
+
+/**
+ * @brief Releases the locks taken by latch_lock().
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+void latch_unlock(struct pictdb_file *db_file);
+
+/**
+ * @brief Takes the writer lock of the process if it is free, without the
+ *        file lock.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @return 1 if taken, to be released with latch_release().
+ */
+int latch_trylock(struct pictdb_file *db_file);
+
+/**
+ * @brief Releases the writer lock taken by latch_trylock().
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+void latch_release(struct pictdb_file *db_file);
+
+/**
+ * @brief Marks a free slot as being filled by an insertion: readers skip
+ *        it until latch_slot_end(). Requires the writer lock.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param index The metadata index taken.
+ */
+void latch_slot_fill(struct pictdb_file *db_file, uint32_t index);
+
+/**
+ * @brief Starts changing a slot in place. Requires the writer lock.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param index The metadata index to change.
+ */
+void latch_slot_begin(struct pictdb_file *db_file, uint32_t index);
+
+/**
+ * @brief Publishes the changes of a slot started by latch_slot_begin()
+ *        or latch_slot_fill().
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param index The metadata index changed.
+ */
+void latch_slot_end(struct pictdb_file *db_file, uint32_t index);
+
+/**
+ * @brief Starts changing the header, index or columnar mirror. Requires
+ *        the writer lock.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+void latch_tables_begin(struct pictdb_file *db_file);
+
+/**
+ * @brief Publishes the changes started by latch_tables_begin().
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+void latch_tables_end(struct pictdb_file *db_file);
+
+/**
+ * @brief Starts reading the header, index or columnar mirror.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @return The sequence to give to latch_tables_changed().
+ */
+uint32_t latch_tables_read(const struct pictdb_file *db_file);
+
+/**
+ * @brief Whether a writer changed the header, index or columnar mirror
+ *        since latch_tables_read() returned seq: what was read may be
+ *        inconsistent and must be read again.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param seq Value returned by latch_tables_read().
+ */
+int latch_tables_changed(const struct pictdb_file *db_file, uint32_t seq);
+
+/**
+ * @brief Copies the header of db_file.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param header Set to a consistent copy of the header.
+ */
+void latch_read_header(const struct pictdb_file *db_file, struct pictdb_header *header);
+
+/**
+ * @brief Copies a metadata slot.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param index The metadata index to copy.
+ * @param pict Set to a consistent copy of the slot.
+ * @return 0 if the slot holds a picture, ERR_FILE_NOT_FOUND if it is empty
+ *         or being filled, ERR_INVALID_ARGUMENT if index is out of range.
+ */
+int latch_read_slot(const struct pictdb_file *db_file, uint32_t index, struct pict_metadata *pict);
+
+/**
+ * @brief Finds a picture and copies its slot.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param pict_id The picture to look for.
+ * @param index Set to the metadata index of the picture.
+ * @param pict Set to a consistent copy of the slot.
+ * @return 0 or ERR_FILE_NOT_FOUND.
+ */
+int latch_find(const struct pictdb_file *db_file, const char *pict_id, uint32_t *index, struct pict_metadata *pict);
+
+/**
+ * @brief Builds the columnar mirror of db_file if not built yet, from a
+ *        reader.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+int latch_columns(struct pictdb_file *db_file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
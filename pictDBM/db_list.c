@@ -6,17 +6,21 @@
  * @date 9 March 2016
  */
 
+#define _DEFAULT_SOURCE
+
 #include <stdlib.h>
 #include "pictDB.h"
-#include <json-c/json.h>
-#include <assert.h>
+#include "db_columns.h"
+#include "db_latch.h"
 #include <string.h>
 
-#define DB_JSON_LABEL_LEN 16
+#define DB_JSON_NUMBER_LEN 16
 
 #define DB_JSON_PICTURES "pictures"
 #define DB_JSON_PIC_ID "id"
 #define DB_JSON_PIC_RES "res"
+#define DB_JSON_NEXT_CURSOR "next_cursor"
+#define DB_JSON_PIC_SIZES "sizes"
 
 #define DB_JSON_HEADER "header"
 #define DB_JSON_DB_NAME "db_name"
@@ -24,90 +28,463 @@
 #define DB_JSON_NUM_FILES "num_files"
 #define DB_JSON_MAX_FILES "max_files"
 
+#define DB_JSON_SPRITE_WIDTH "width"
+#define DB_JSON_SPRITE_HEIGHT "height"
+#define DB_JSON_SPRITE_TILES "tiles"
+#define DB_JSON_TILE_X "x"
+#define DB_JSON_TILE_Y "y"
+
+#define JSON_KEY(key) "\"" key "\":"
+
+#define QUERY_BATCH 256 // slots fetched per do_query call
+
 static const char unknown_mode[] = "unimplemented do_list mode";
 
+/**
+ * @brief JSON output buffered in chunks handed to a writer.
+ */
+struct json_stream {
+    char chunk[LIST_CHUNK]; /**< pending output */
+    size_t len; /**< bytes pending */
+    list_writer writer; /**< chunk output */
+    void *arg; /**< writer argument */
+    int status; /**< first error returned by the writer */
+};
+
+/**
+ * @brief Growing string filled by do_list(JSON).
+ */
+struct json_buffer {
+    char *data; /**< NUL terminated content */
+    size_t len; /**< content length */
+    size_t capacity; /**< allocated bytes */
+};
+
 /********************************************************************//**
- * List all pictures included in db_file.
- * Always return null or an mallocated string.
+ * Returns the first valid slot at or after from, max_files if none.
+ * Skips empty slots through the validity bitmap when it is available.
  */
-char* do_list(const struct pictdb_file* db_file, enum do_list_mode mode)
+static uint32_t next_valid(const struct pictdb_file* db_file, uint32_t from)
 {
+    if (db_file->columns != NULL) {
+        return columns_next_valid(db_file->columns, from);
+    }
 
-    if (db_file == NULL || db_file->metadata == NULL) {
-        return NULL;
+    while (from < db_file->header.max_files && db_file->metadata[from].is_valid != NON_EMPTY) {
+        ++from;
     }
+    return from;
+}
 
-    switch (mode) {
-    case STDOUT: {
-        print_header(&db_file->header);
+/********************************************************************//**
+ * Returns the first slot at or after from holding a picture, max_files if
+ * none, and copies it into pict.
+ */
+static uint32_t next_listed(const struct pictdb_file* db_file, uint32_t from, struct pict_metadata* pict)
+{
+    uint32_t i = next_valid(db_file, from);
+    while (i < db_file->header.max_files && latch_read_slot(db_file, i, pict) != 0) {
+        i = next_valid(db_file, i + 1);
+    }
+    return i;
+}
 
-        if (db_file->header.num_files > 0) {
-            for (size_t i = 0; i < db_file->header.max_files; ++i) {
-                if (db_file->metadata[i].is_valid == NON_EMPTY) {
-                    print_metadata(&db_file->metadata[i]);
-                }
+/********************************************************************//**
+ * Hands the pending output to the writer.
+ */
+static void stream_flush(struct json_stream *stream)
+{
+    if (stream->status == 0 && stream->len > 0) {
+        stream->status = stream->writer(stream->arg, stream->chunk, stream->len);
+    }
+    stream->len = 0;
+}
+
+/********************************************************************//**
+ * Appends raw bytes to the stream.
+ */
+static void stream_write(struct json_stream *stream, const char *data, size_t len)
+{
+    while (len > 0 && stream->status == 0) {
+        if (stream->len == LIST_CHUNK) {
+            stream_flush(stream);
+        }
+        const size_t room = LIST_CHUNK - stream->len;
+        const size_t part = len < room ? len : room;
+        memcpy(stream->chunk + stream->len, data, part);
+        stream->len += part;
+        data += part;
+        len -= part;
+    }
+}
+
+/********************************************************************//**
+ * Appends a NUL terminated string to the stream.
+ */
+static void stream_puts(struct json_stream *stream, const char *str)
+{
+    stream_write(stream, str, strlen(str));
+}
+
+/********************************************************************//**
+ * Appends a quoted and escaped JSON string of at most max_len bytes.
+ */
+static void stream_string(struct json_stream *stream, const char *str, size_t max_len)
+{
+    static const char hex[] = "0123456789abcdef";
+    const size_t len = strnlen(str, max_len);
+    size_t start = 0;
+
+    stream_write(stream, "\"", 1);
+    for (size_t i = 0; i < len; ++i) {
+        const unsigned char c = (unsigned char) str[i];
+        if (c == '"' || c == '\\' || c < 0x20) {
+            stream_write(stream, str + start, i - start);
+            if (c == '"' || c == '\\') {
+                const char quoted[] = {'\\', (char) c};
+                stream_write(stream, quoted, sizeof(quoted));
+            } else {
+                const char escaped[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+                stream_write(stream, escaped, sizeof(escaped));
             }
-        } else {
-            printf("<< empty database >>\n");
+            start = i + 1;
         }
+    }
+    stream_write(stream, str + start, len - start);
+    stream_write(stream, "\"", 1);
+}
 
-        return NULL;
+/********************************************************************//**
+ * Appends a number as a JSON string, like the other header fields.
+ */
+static void stream_number(struct json_stream *stream, uint32_t number)
+{
+    char buffer[DB_JSON_NUMBER_LEN];
+    const int len = snprintf(buffer, sizeof(buffer), "\"%" PRIu32 "\"", number);
+    stream_write(stream, buffer, (size_t) len);
+}
+
+/********************************************************************//**
+ * Appends the JSON object of a picture, preceded by a comma unless first.
+ * With sizes, the byte size of each resolution is included.
+ */
+static void stream_picture(struct json_stream *stream, const struct pict_metadata *pict, int first, int sizes)
+{
+    static const char *const names[NB_RES] = {
+        [RES_THUMB] = NAME_RES_THUMBNAIL,
+        [RES_SMALL] = NAME_RES_SMALL,
+        [RES_ORIG] = NAME_RES_ORIGINAL
+    };
+    char res[2 * DB_JSON_NUMBER_LEN];
+
+    stream_puts(stream, first ? "{" JSON_KEY(DB_JSON_PIC_ID) : ",{" JSON_KEY(DB_JSON_PIC_ID));
+    stream_string(stream, pict->pict_id, MAX_PIC_ID + 1);
+    stream_puts(stream, "," JSON_KEY(DB_JSON_PIC_RES));
+    snprintf(res, sizeof(res), "%" PRIu32 " x %" PRIu32, pict->res_orig[0], pict->res_orig[1]);
+    stream_string(stream, res, sizeof(res));
+
+    if (sizes) {
+        stream_puts(stream, "," JSON_KEY(DB_JSON_PIC_SIZES) "{");
+        for (unsigned int r = 0; r < NB_RES; ++r) {
+            stream_puts(stream, r == 0 ? "\"" : ",\"");
+            stream_puts(stream, names[r]);
+            stream_puts(stream, "\":");
+            stream_number(stream, pict->size[r]);
+        }
+        stream_puts(stream, "}");
     }
-    case JSON: {
+    stream_puts(stream, "}");
+}
+
+/********************************************************************//**
+ * Streams the header of the database and opens the pictures array.
+ */
+static void stream_header(struct json_stream *stream, const struct pictdb_header *header)
+{
+    stream_puts(stream, "{" JSON_KEY(DB_JSON_HEADER) "{" JSON_KEY(DB_JSON_DB_NAME));
+    stream_string(stream, header->db_name, MAX_DB_NAME + 1);
+    stream_puts(stream, "," JSON_KEY(DB_JSON_NUM_FILES));
+    stream_number(stream, header->num_files);
+    stream_puts(stream, "," JSON_KEY(DB_JSON_MAX_FILES));
+    stream_number(stream, header->max_files);
+    stream_puts(stream, "," JSON_KEY(DB_JSON_VERSION));
+    stream_number(stream, header->db_version);
+    stream_puts(stream, "}," JSON_KEY(DB_JSON_PICTURES) "[");
+}
+
+/********************************************************************//**
+ * Streams the pictures of a page in slot order, then the next cursor.
+ */
+static void stream_slot_page(struct json_stream *stream, const struct pictdb_file *db_file,
+                             const struct list_page *page)
+{
+    const uint32_t max_files = db_file->header.max_files;
+    struct pict_metadata pict;
+
+    uint32_t i = next_listed(db_file, page->cursor, &pict);
+    for (uint32_t skipped = 0; skipped < page->offset && i < max_files; ++skipped) {
+        i = next_listed(db_file, i + 1, &pict);
+    }
+
+    for (uint32_t listed = 0; i < max_files && (page->limit == 0 || listed < page->limit);
+         i = next_listed(db_file, i + 1, &pict), ++listed) {
+        stream_picture(stream, &pict, listed == 0, 0);
+    }
+
+    stream_puts(stream, "]," JSON_KEY(DB_JSON_NEXT_CURSOR));
+    if (i < max_files) {
+        stream_number(stream, i);
+    } else {
+        stream_puts(stream, "null");
+    }
+}
+
+/********************************************************************//**
+ * Streams the pictures of a page in pict_id order, then the identifier
+ * to resume after. One more picture than needed tells whether the
+ * listing goes on.
+ */
+static int stream_sorted_page(struct json_stream *stream, const struct pictdb_file *db_file,
+                              const struct list_page *page)
+{
+    const uint64_t needed = page->limit == 0 ? db_file->header.max_files :
+                            (uint64_t) page->offset + page->limit + 1;
+    const uint32_t wanted = needed < db_file->header.max_files ? (uint32_t) needed : db_file->header.max_files;
+    uint32_t *slots = calloc(wanted == 0 ? 1 : wanted, sizeof(uint32_t));
+    if (slots == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    const struct pict_range range = {page->prefix, NULL, NULL, page->after};
+    uint32_t found = 0;
+    int status = 0;
+    uint32_t seq = 0;
+    do {
+        seq = latch_tables_read(db_file);
+        status = do_find_range(db_file, &range, slots, wanted, &found);
+    } while (status == 0 && latch_tables_changed(db_file, seq));
+
+    // slots emptied since the range was found are left out
+    struct pict_metadata pict;
+    char cursor[MAX_PIC_ID + 1] = "";
+    uint32_t last = found;
+    int first = 1;
+    for (uint32_t i = page->offset; status == 0 && i < found && (page->limit == 0 || i - page->offset < page->limit);
+         ++i) {
+        if (latch_read_slot(db_file, slots[i], &pict) == 0) {
+            stream_picture(stream, &pict, first, 0);
+            memcpy(cursor, pict.pict_id, sizeof(cursor));
+            first = 0;
+        }
+        last = i;
+    }
+
+    stream_puts(stream, "]," JSON_KEY(DB_JSON_NEXT_CURSOR));
+    if (status == 0 && last + 1 < found) {
+        // resumes after the last picture listed, or found if all were deleted meanwhile
+        stream_string(stream, first ? db_file->metadata[slots[last]].pict_id : cursor, MAX_PIC_ID + 1);
+    } else {
+        stream_puts(stream, "null");
+    }
+
+    free(slots);
+    return status;
+}
+
+/********************************************************************//**
+ * Streams a page of the pictures included in db_file as JSON.
+ */
+int do_list_json(const struct pictdb_file *db_file, const struct list_page *page, list_writer writer, void *arg)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(db_file->metadata);
+    M_REQUIRE_NON_NULL(writer);
+
+    const struct list_page all = {0, 0, 0, NULL, NULL};
+    if (page == NULL) {
+        page = &all;
+    }
+
+    struct json_stream stream = {.len = 0, .writer = writer, .arg = arg, .status = 0};
+    struct pictdb_header header;
+    latch_read_header(db_file, &header);
+    stream_header(&stream, &header);
+
+    int status = 0;
+    if (page->prefix != NULL || page->after != NULL) {
+        status = stream_sorted_page(&stream, db_file, page);
+    } else {
+        stream_slot_page(&stream, db_file, page);
+    }
+
+    stream_puts(&stream, "}");
+    stream_flush(&stream);
 
-        char buffer[DB_JSON_LABEL_LEN];
+    return status != 0 ? status : stream.status;
+}
+
+/********************************************************************//**
+ * Streams as JSON a page of the pictures satisfying all predicates.
+ * Matches are fetched QUERY_BATCH at a time; one more match than listed
+ * gives the next cursor.
+ */
+int do_query_json(struct pictdb_file *db_file, const struct query_predicate *predicates, size_t count,
+                  const struct list_page *page, list_writer writer, void *arg)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(db_file->metadata);
+    M_REQUIRE_NON_NULL(writer);
 
-        struct json_object *obj = json_object_new_object();
-        struct json_object *arr = json_object_new_array();
+    const struct list_page all = {0, 0, 0, NULL, NULL};
+    if (page == NULL) {
+        page = &all;
+    }
 
-        for (size_t i = 0; i < db_file->header.max_files; ++i) {
-            if (db_file->metadata[i].is_valid == NON_EMPTY) {
-                struct json_object *img = json_object_new_object();
-                struct json_object *id = json_object_new_string(db_file->metadata[i].pict_id);
+    struct json_stream stream = {.len = 0, .writer = writer, .arg = arg, .status = 0};
+    stream_header(&stream, &db_file->header);
 
-                sprintf(buffer, "%" PRIu32 " x %" PRIu32,
-                        db_file->metadata->res_orig[0], db_file->metadata->res_orig[1]);
-                struct json_object *size = json_object_new_string(buffer);
+    uint32_t slots[QUERY_BATCH];
+    uint32_t from = page->cursor;
+    uint32_t skipped = 0;
+    uint32_t listed = 0;
+    uint32_t next = db_file->header.max_files;
+    uint32_t found = QUERY_BATCH;
+    int status = 0;
 
-                json_object_object_add(img, DB_JSON_PIC_ID, id);
-                json_object_object_add(img, DB_JSON_PIC_RES, size);
+    while (status == 0 && stream.status == 0 && found == QUERY_BATCH && next == db_file->header.max_files) {
+        status = do_query(db_file, predicates, count, from, slots, QUERY_BATCH, &found);
 
-                int status = json_object_array_add(arr, img);
-                assert(status == 0);
+        for (uint32_t i = 0; status == 0 && i < found && next == db_file->header.max_files; ++i) {
+            if (skipped < page->offset) {
+                ++skipped;
+            } else if (page->limit != 0 && listed == page->limit) {
+                next = slots[i];
+            } else {
+                stream_picture(&stream, &db_file->metadata[slots[i]], listed == 0, 1);
+                ++listed;
             }
         }
-        json_object_object_add(obj, DB_JSON_PICTURES, arr);
+        if (found > 0) {
+            from = slots[found - 1] + 1;
+        }
+    }
+
+    stream_puts(&stream, "]," JSON_KEY(DB_JSON_NEXT_CURSOR));
+    if (next < db_file->header.max_files) {
+        stream_number(&stream, next);
+    } else {
+        stream_puts(&stream, "null");
+    }
+    stream_puts(&stream, "}");
+    stream_flush(&stream);
+
+    return status != 0 ? status : stream.status;
+}
+
+/********************************************************************//**
+ * Streams where each thumbnail lies on a sprite sheet.
+ */
+int do_sprite_json(const struct pictdb_sprite *sprite, list_writer writer, void *arg)
+{
+    M_REQUIRE_NON_NULL(sprite);
+    M_REQUIRE_NON_NULL(writer);
+
+    struct json_stream stream = {.len = 0, .writer = writer, .arg = arg, .status = 0};
+    stream_puts(&stream, "{" JSON_KEY(DB_JSON_VERSION));
+    stream_number(&stream, sprite->db_version);
+    stream_puts(&stream, "," JSON_KEY(DB_JSON_SPRITE_WIDTH));
+    stream_number(&stream, sprite->width);
+    stream_puts(&stream, "," JSON_KEY(DB_JSON_SPRITE_HEIGHT));
+    stream_number(&stream, sprite->height);
+    stream_puts(&stream, "," JSON_KEY(DB_JSON_SPRITE_TILES) "[");
 
-        struct json_object *header = json_object_new_object();
-        {
-            struct json_object *db_name = json_object_new_string(db_file->header.db_name);
-            json_object_object_add(header, DB_JSON_DB_NAME, db_name);
+    for (size_t i = 0; i < sprite->count; ++i) {
+        const struct sprite_tile *tile = &sprite->tiles[i];
+        stream_puts(&stream, i == 0 ? "{" JSON_KEY(DB_JSON_PIC_ID) : ",{" JSON_KEY(DB_JSON_PIC_ID));
+        stream_string(&stream, tile->pict_id, MAX_PIC_ID + 1);
+        stream_puts(&stream, "," JSON_KEY(DB_JSON_TILE_X));
+        stream_number(&stream, tile->x);
+        stream_puts(&stream, "," JSON_KEY(DB_JSON_TILE_Y));
+        stream_number(&stream, tile->y);
+        stream_puts(&stream, "," JSON_KEY(DB_JSON_SPRITE_WIDTH));
+        stream_number(&stream, tile->width);
+        stream_puts(&stream, "," JSON_KEY(DB_JSON_SPRITE_HEIGHT));
+        stream_number(&stream, tile->height);
+        stream_puts(&stream, "}");
+    }
+
+    stream_puts(&stream, "]," JSON_KEY(DB_JSON_NEXT_CURSOR));
+    if (sprite->more) {
+        stream_number(&stream, sprite->next_cursor);
+    } else {
+        stream_puts(&stream, "null");
+    }
+    stream_puts(&stream, "}");
+    stream_flush(&stream);
 
-            sprintf(buffer, "%" PRIu32, db_file->header.num_files);
-            struct json_object *num_files = json_object_new_string(buffer);
-            json_object_object_add(header, DB_JSON_NUM_FILES, num_files);
+    return stream.status;
+}
 
-            sprintf(buffer, "%" PRIu32, db_file->header.max_files);
-            struct json_object *max_files = json_object_new_string(buffer);
-            json_object_object_add(header, DB_JSON_MAX_FILES, max_files);
+/********************************************************************//**
+ * Appends a chunk to a json_buffer.
+ */
+static int buffer_writer(void *arg, const char *chunk, size_t len)
+{
+    struct json_buffer *buffer = arg;
 
-            sprintf(buffer, "%" PRIu32, db_file->header.db_version);
-            struct json_object *db_version = json_object_new_string(buffer);
-            json_object_object_add(header, DB_JSON_VERSION, db_version);
+    if (buffer->len + len + 1 > buffer->capacity) {
+        size_t capacity = buffer->capacity == 0 ? LIST_CHUNK : buffer->capacity;
+        while (buffer->len + len + 1 > capacity) {
+            capacity *= 2;
+        }
+        char *data = realloc(buffer->data, capacity);
+        if (data == NULL) {
+            return ERR_OUT_OF_MEMORY;
         }
-        json_object_object_add(obj, DB_JSON_HEADER, header);
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
 
-        const char *json = json_object_to_json_string(obj);
+    memcpy(buffer->data + buffer->len, chunk, len);
+    buffer->len += len;
+    buffer->data[buffer->len] = '\0';
+    return 0;
+}
 
-        size_t ret_size = strlen(json);
-        char *ret = malloc(ret_size + 1);
-        strncpy(ret, json, ret_size);
-        ret[ret_size] = '\0';
+/********************************************************************//**
+ * List all pictures included in db_file.
+ * Always return null or an mallocated string.
+ */
+char* do_list(const struct pictdb_file* db_file, enum do_list_mode mode)
+{
 
-        int status = json_object_put(obj);
-        assert(status == 1);
+    if (db_file == NULL || db_file->metadata == NULL) {
+        return NULL;
+    }
 
-        return ret;
+    switch (mode) {
+    case STDOUT: {
+        print_header(&db_file->header);
+
+        if (db_file->header.num_files > 0) {
+            for (uint32_t i = next_valid(db_file, 0); i < db_file->header.max_files; i = next_valid(db_file, i + 1)) {
+                print_metadata(&db_file->metadata[i]);
+            }
+        } else {
+            printf("<< empty database >>\n");
+        }
+
+        return NULL;
+    }
+    case JSON: {
+        struct json_buffer buffer = {NULL, 0, 0};
+
+        if (do_list_json(db_file, NULL, buffer_writer, &buffer) != 0) {
+            free(buffer.data);
+            return NULL;
+        }
+
+        return buffer.data;
     }
     default: {
         size_t ret_size = strlen(unknown_mode);
@@ -0,0 +1,160 @@
+/**
+ * @file db_query.c
+ * @implementation of do_query to filter pictures on their metadata
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#include "pictDB.h"
+#include "db_columns.h"
+
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#define QUERY_FIELD_MAX 32
+#define QUERY_SUFFIX_SIZE "_size"
+#define QUERY_SUFFIX_OFFSET "_offset"
+#define QUERY_NAME_WIDTH "width"
+#define QUERY_NAME_HEIGHT "height"
+
+#define ALL_VALID UINT64_MAX
+
+/**
+ * @brief Textual operators, two characters ones first.
+ */
+static const struct {
+    const char *text;
+    enum query_op op;
+} query_ops[] = {
+    {"<=", QUERY_LE},
+    {">=", QUERY_GE},
+    {"!=", QUERY_NE},
+    {"<",  QUERY_LT},
+    {">",  QUERY_GT},
+    {"=",  QUERY_EQ}
+};
+
+/********************************************************************//**
+ * Finds the valid pictures satisfying all predicates, in slot order.
+ */
+int do_query(struct pictdb_file *db_file, const struct query_predicate *predicates, size_t count, uint32_t from,
+             uint32_t *slots, uint32_t max_count, uint32_t *found)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(slots);
+    M_REQUIRE_NON_NULL(found);
+    if (count > 0) {
+        M_REQUIRE_NON_NULL(predicates);
+    }
+
+    *found = 0;
+
+    int status = columns_ensure(db_file);
+    if (status != 0) {
+        return status;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (predicates[i].res >= NB_RES) {
+            return ERR_INVALID_ARGUMENT;
+        }
+    }
+
+    const struct pictdb_columns *columns = db_file->columns;
+    for (uint32_t block = from / COLUMN_BLOCK; block < columns->blocks && *found < max_count; ++block) {
+        uint64_t matches = columns->valid[block];
+        if (block == from / COLUMN_BLOCK) {
+            matches &= ALL_VALID << (from % COLUMN_BLOCK);
+        }
+
+        // predicates only run on blocks that still have candidates
+        for (size_t i = 0; i < count && matches != 0; ++i) {
+            matches &= columns_filter(columns, block, &predicates[i]);
+        }
+
+        while (matches != 0 && *found < max_count) {
+            slots[(*found)++] = block * COLUMN_BLOCK + (uint32_t) __builtin_ctzll(matches);
+            matches &= matches - 1;
+        }
+    }
+
+    return 0;
+}
+
+/********************************************************************//**
+ * Parses the field name of a predicate.
+ */
+static int parse_field(const char *name, struct query_predicate *predicate)
+{
+    predicate->res = RES_ORIG;
+
+    if (!strcmp(name, QUERY_NAME_WIDTH)) {
+        predicate->field = QUERY_WIDTH;
+        return 0;
+    }
+    if (!strcmp(name, QUERY_NAME_HEIGHT)) {
+        predicate->field = QUERY_HEIGHT;
+        return 0;
+    }
+
+    char *suffix = strrchr(name, '_');
+    if (suffix == NULL) {
+        return ERR_INVALID_ARGUMENT;
+    }
+    if (!strcmp(suffix, QUERY_SUFFIX_SIZE)) {
+        predicate->field = QUERY_SIZE;
+    } else if (!strcmp(suffix, QUERY_SUFFIX_OFFSET)) {
+        predicate->field = QUERY_OFFSET;
+    } else {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    *suffix = '\0';
+    const int res = resolution_atoi(name);
+    if (res == -1) {
+        return ERR_RESOLUTIONS;
+    }
+    predicate->res = (unsigned int) res;
+    return 0;
+}
+
+/********************************************************************//**
+ * Parses a predicate like "width>4000".
+ */
+int parse_predicate(const char *expr, struct query_predicate *predicate)
+{
+    M_REQUIRE_NON_NULL(expr);
+    M_REQUIRE_NON_NULL(predicate);
+
+    const size_t name_len = strcspn(expr, "<>=!");
+    if (name_len == 0 || name_len >= QUERY_FIELD_MAX || expr[name_len] == '\0') {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    size_t op_len = 0;
+    for (size_t i = 0; i < sizeof(query_ops) / sizeof(query_ops[0]) && op_len == 0; ++i) {
+        if (!strncmp(expr + name_len, query_ops[i].text, strlen(query_ops[i].text))) {
+            predicate->op = query_ops[i].op;
+            op_len = strlen(query_ops[i].text);
+        }
+    }
+    if (op_len == 0) {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    const char *value = expr + name_len + op_len;
+    char *end = NULL;
+    errno = 0;
+    const uintmax_t parsed = strtoumax(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' || *value == '-' || parsed > UINT64_MAX) {
+        return ERR_INVALID_ARGUMENT;
+    }
+    predicate->value = (uint64_t) parsed;
+
+    char name[QUERY_FIELD_MAX];
+    memcpy(name, expr, name_len);
+    name[name_len] = '\0';
+    return parse_field(name, predicate);
+}
@@ -11,57 +11,99 @@
 #include <assert.h>
 #include "pictDB.h"
 #include "image_content.h"
+#include "db_index.h"
+#include "db_columns.h"
+#include "db_latch.h"
+#include "db_io.h"
+#include "db_backend.h"
+#include "trace.h"
 
-int do_read(const char *pict_id, unsigned int res, char *image_buffer[], uint32_t *image_size,
-            struct pictdb_file *db_file)
-{
-    M_REQUIRE_NON_NULL(image_buffer);
-    M_REQUIRE_NON_NULL(pict_id);
-    M_REQUIRE_NON_NULL(db_file);
+/**
+ * @brief Requested image of a batch read.
+ */
+struct batch_item {
+    uint64_t key; /**< pict_id hash while resolving, then file offset */
+    size_t position; /**< rank of the identifier in the request */
+    uint32_t slot; /**< metadata slot, max_files if not found */
+    uint32_t size; /**< image size, once resolved */
+};
 
-    if (*image_buffer != NULL || (res != RES_THUMB && res != RES_SMALL && res != RES_ORIG)) {
+/********************************************************************//**
+ * Copies the slot of a picture, once the picture is known to exist at
+ * resolution res. The copy stays valid whatever writers do meanwhile.
+ */
+static int find_resolution(struct pictdb_file *db_file, const char *pict_id, unsigned int res,
+                           struct pict_metadata *pict)
+{
+    if (res != RES_THUMB && res != RES_SMALL && res != RES_ORIG) {
         return ERR_INVALID_ARGUMENT;
     }
 
-    if (db_file->fpdb == NULL) {
+    if (db_file->backend == NULL) {
         return ERR_IO;
     }
 
-    uint32_t index = db_file->header.max_files;
-    for (uint32_t i = 0; i < index; ++i) {
-
-        if (db_file->metadata[i].is_valid == NON_EMPTY && !strncmp(pict_id, db_file->metadata[i].pict_id, MAX_PIC_ID)) {
-            index = i;
-        }
-    }
+    uint32_t index = 0;
+    TRACE_START(lookup_us);
+    int found = latch_find(db_file, pict_id, &index, pict);
+    TRACE_STOP(TRACE_READ_LOOKUP, lookup_us);
 
     // In case we didn't find the invalid corresponding to the given pict_id
-    if (index == db_file->header.max_files) {
-        return ERR_FILE_NOT_FOUND;
+    if (found != 0) {
+        return found;
     }
 
     // In case the image does not yet exists at the given size
-    if (db_file->metadata[index].size[res] == 0) {
+    if (pict->size[res] == 0) {
         assert(res != RES_ORIG);
+        TRACE_START(resize_us);
         int status = lazy_resize(res, db_file, index);
-        if (status != 0) {
-            return status;
+        TRACE_STOP(TRACE_READ_RESIZE, resize_us);
+
+        // the picture may have been deleted since the lookup
+        if (status == ERR_INVALID_PICID) {
+            status = ERR_FILE_NOT_FOUND;
+        } else if (status == 0) {
+            status = latch_read_slot(db_file, index, pict);
+        }
+        if (status == 0 && (strncmp(pict->pict_id, pict_id, MAX_PIC_ID) || pict->size[res] == 0)) {
+            status = ERR_FILE_NOT_FOUND;
         }
+        return status;
+    }
+    return 0;
+}
+
+int do_read(const char *pict_id, unsigned int res, char *image_buffer[], uint32_t *image_size,
+            struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(image_buffer);
+    M_REQUIRE_NON_NULL(pict_id);
+    M_REQUIRE_NON_NULL(db_file);
+
+    if (*image_buffer != NULL) {
+        return ERR_INVALID_ARGUMENT;
     }
 
-    uint32_t size = db_file->metadata[index].size[res];
+    struct pict_metadata pict;
+    int status = find_resolution(db_file, pict_id, res, &pict);
+    if (status != 0) {
+        return status;
+    }
+
+    uint32_t size = pict.size[res];
     *image_buffer = malloc(size);
     if (*image_buffer == NULL) {
         return ERR_OUT_OF_MEMORY;
     }
 
-    int status = 0;
-    if (fseek(db_file->fpdb, (long) db_file->metadata[index].offset[res], SEEK_SET) != 0 ||
-        fread((void *) *image_buffer, size, 1, db_file->fpdb) != 1) {
+    TRACE_START(blob_us);
+    if (backend_read(db_file, pict.offset[res], *image_buffer, size) != 0) {
         status = ERR_IO;
     } else {
         *image_size = size;
     }
+    TRACE_STOP(TRACE_READ_BLOB, blob_us);
 
     if (status != 0) {
         free(*image_buffer);
@@ -70,3 +112,322 @@ int do_read(const char *pict_id, unsigned int res, char *image_buffer[], uint32_
 
     return status;
 }
+
+int do_read_into(const char *pict_id, unsigned int res, char *buffer, size_t capacity, uint32_t *image_size,
+                 struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(pict_id);
+    M_REQUIRE_NON_NULL(image_size);
+    M_REQUIRE_NON_NULL(db_file);
+
+    if (buffer == NULL && capacity > 0) {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    struct pict_metadata pict;
+    const int status = find_resolution(db_file, pict_id, res, &pict);
+    if (status != 0) {
+        return status;
+    }
+
+    const uint32_t size = pict.size[res];
+    if (capacity > 0) {
+        TRACE_START(blob_us);
+        if (backend_read(db_file, pict.offset[res], buffer, size < capacity ? size : capacity) != 0) {
+            return ERR_IO;
+        }
+        TRACE_STOP(TRACE_READ_BLOB, blob_us);
+    }
+    *image_size = size;
+    return 0;
+}
+
+int do_read_iov(const char *pict_id, unsigned int res, const struct iovec iov[], size_t iovcnt,
+                uint32_t *image_size, struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(pict_id);
+    M_REQUIRE_NON_NULL(image_size);
+    M_REQUIRE_NON_NULL(db_file);
+
+    if (iov == NULL && iovcnt > 0) {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    size_t capacity = 0;
+    for (size_t i = 0; i < iovcnt; ++i) {
+        capacity += iov[i].iov_len;
+    }
+
+    struct pict_metadata pict;
+    const int status = find_resolution(db_file, pict_id, res, &pict);
+    if (status != 0) {
+        return status;
+    }
+
+    const uint32_t size = pict.size[res];
+    if (capacity > 0) {
+        TRACE_START(blob_us);
+        if (backend_readv(db_file, pict.offset[res], size < capacity ? size : capacity, iov, iovcnt) != 0) {
+            return ERR_IO;
+        }
+        TRACE_STOP(TRACE_READ_BLOB, blob_us);
+    }
+    *image_size = size;
+    return 0;
+}
+
+int do_stat(const char *pict_id, unsigned int res, uint64_t *offset, uint32_t *size,
+            const struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(pict_id);
+    M_REQUIRE_NON_NULL(offset);
+    M_REQUIRE_NON_NULL(size);
+    M_REQUIRE_NON_NULL(db_file);
+
+    if (res != RES_THUMB && res != RES_SMALL && res != RES_ORIG) {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    if (db_file->backend == NULL) {
+        return ERR_IO;
+    }
+
+    uint32_t index = 0;
+    struct pict_metadata pict;
+    const int status = latch_find(db_file, pict_id, &index, &pict);
+    if (status != 0) {
+        return status;
+    }
+
+    *size = pict.size[res];
+    *offset = pict.size[res] == 0 ? 0 : pict.offset[res];
+    return 0;
+}
+
+int do_locate(const char *pict_id, unsigned int res, struct pict_location *location, struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(pict_id);
+    M_REQUIRE_NON_NULL(location);
+    M_REQUIRE_NON_NULL(db_file);
+
+    struct pict_metadata pict;
+    const int status = find_resolution(db_file, pict_id, res, &pict);
+    if (status != 0) {
+        return status;
+    }
+
+    location->offset = pict.offset[res];
+    location->size = pict.size[res];
+    memcpy(location->SHA, pict.SHA, SHA256_DIGEST_LENGTH);
+    return 0;
+}
+
+int do_read_range(struct pictdb_file *db_file, const struct pict_location *location, uint64_t start,
+                  uint32_t length, char *buffer)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(location);
+    M_REQUIRE_NON_NULL(buffer);
+
+    if (start > location->size || length > location->size - start) {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    if (db_file->backend == NULL) {
+        return ERR_IO;
+    }
+
+    TRACE_START(blob_us);
+    if (backend_read(db_file, location->offset + start, buffer, length) != 0) {
+        return ERR_IO;
+    }
+    TRACE_STOP(TRACE_READ_BLOB, blob_us);
+    return 0;
+}
+
+/********************************************************************//**
+ * Orders batch items by key.
+ */
+static int compare_batch_items(const void *a, const void *b)
+{
+    const uint64_t x = ((const struct batch_item *) a)->key;
+    const uint64_t y = ((const struct batch_item *) b)->key;
+    return (x > y) - (x < y);
+}
+
+/********************************************************************//**
+ * Resolves the slot of each item: through the index when it is fresh,
+ * otherwise with one scan of the valid slots, each hash looked up among
+ * the sorted requested ones. Slots are only candidates, to be checked
+ * against a copy.
+ */
+static int resolve_batch(struct pictdb_file *db_file, const char *pict_ids[], struct batch_item items[],
+                         size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        items[i].key = pict_id_hash(pict_ids[i]);
+        items[i].position = i;
+        items[i].slot = db_file->header.max_files;
+    }
+
+    if (index_is_fresh(db_file)) {
+        for (size_t i = 0; i < count; ++i) {
+            (void) index_find(db_file, pict_ids[i], &items[i].slot);
+        }
+        return 0;
+    }
+
+    int status = latch_columns(db_file);
+    if (status != 0) {
+        return status;
+    }
+
+    qsort(items, count, sizeof(struct batch_item), compare_batch_items);
+
+    const struct pictdb_columns *columns = db_file->columns;
+    for (uint32_t slot = columns_next_valid(columns, 0); slot < columns->max_files;
+         slot = columns_next_valid(columns, slot + 1)) {
+
+        // lower bound of the slot hash among the requested ones
+        size_t low = 0;
+        size_t high = count;
+        while (low < high) {
+            const size_t mid = low + (high - low) / 2;
+            if (items[mid].key < columns->id_hash[slot]) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+
+        for (size_t i = low; i < count && items[i].key == columns->id_hash[slot]; ++i) {
+            if (!strncmp(pict_ids[items[i].position], db_file->metadata[slot].pict_id, MAX_PIC_ID)) {
+                items[i].slot = slot;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int do_read_batch(struct pictdb_file *db_file, const char *pict_ids[], size_t count, unsigned int res,
+                  batch_reader reader, void *arg)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(pict_ids);
+    M_REQUIRE_NON_NULL(reader);
+
+    if (res != RES_THUMB && res != RES_SMALL && res != RES_ORIG) {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    if (db_file->backend == NULL) {
+        return ERR_IO;
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        M_REQUIRE_NON_NULL(pict_ids[i]);
+    }
+
+    struct batch_item *items = calloc(count, sizeof(struct batch_item));
+    if (items == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    // a resolution racing with a writer may miss moved index entries
+    int status = 0;
+    uint32_t seq = 0;
+    do {
+        seq = latch_tables_read(db_file);
+        status = resolve_batch(db_file, pict_ids, items, count);
+    } while (status == 0 && latch_tables_changed(db_file, seq));
+
+    // missing resolutions are created first, so that reads are not
+    // interleaved with the appends of lazy_resize
+    size_t found = 0;
+    uint32_t max_size = 0;
+    uint64_t total_size = 0;
+    for (size_t i = 0; i < count && status == 0; ++i) {
+        const uint32_t slot = items[i].slot;
+        const char *pict_id = pict_ids[items[i].position];
+        struct pict_metadata pict;
+        if (slot >= db_file->header.max_files || latch_read_slot(db_file, slot, &pict) != 0 ||
+            strncmp(pict.pict_id, pict_id, MAX_PIC_ID)) {
+            continue;
+        }
+
+        if (pict.size[res] == 0) {
+            assert(res != RES_ORIG);
+            TRACE_START(resize_us);
+            status = lazy_resize(res, db_file, slot);
+            TRACE_STOP(TRACE_READ_RESIZE, resize_us);
+
+            // skipped like unknown identifiers when deleted meanwhile
+            if (status == ERR_INVALID_PICID) {
+                status = 0;
+                continue;
+            }
+            if (status != 0 || latch_read_slot(db_file, slot, &pict) != 0 ||
+                strncmp(pict.pict_id, pict_id, MAX_PIC_ID) || pict.size[res] == 0) {
+                continue;
+            }
+        }
+
+        items[i].key = pict.offset[res];
+        items[i].size = pict.size[res];
+        if (items[i].size > max_size) {
+            max_size = items[i].size;
+        }
+        total_size += items[i].size;
+        items[found++] = items[i];
+    }
+
+    qsort(items, found, sizeof(struct batch_item), compare_batch_items);
+
+    // images are read by rounds of up to IO_QUEUE_DEPTH in flight, within
+    // IO_BATCH_BYTES unless a single image is larger
+    const size_t capacity = max_size > IO_BATCH_BYTES ? max_size : IO_BATCH_BYTES;
+    char *buffer = NULL;
+    struct pictdb_io_request *requests = NULL;
+    if (status == 0 && found > 0) {
+        buffer = malloc(total_size < capacity ? (size_t) total_size : capacity);
+        requests = calloc(found < IO_QUEUE_DEPTH ? found : IO_QUEUE_DEPTH, sizeof(struct pictdb_io_request));
+        if (buffer == NULL || requests == NULL) {
+            status = ERR_OUT_OF_MEMORY;
+        }
+    }
+
+    size_t first = 0;
+    while (first < found && status == 0) {
+        size_t used = 0;
+        size_t round = 0;
+        while (first + round < found && round < IO_QUEUE_DEPTH &&
+               used + items[first + round].size <= capacity) {
+            requests[round].offset = items[first + round].key;
+            requests[round].buffer = buffer + used;
+            requests[round].size = items[first + round].size;
+            used += items[first + round].size;
+            ++round;
+        }
+
+        TRACE_START(blob_us);
+        if (io_read_batch(db_file, requests, round) != 0) {
+            status = ERR_IO;
+        } else {
+            TRACE_STOP(TRACE_READ_BLOB, blob_us);
+        }
+        for (size_t i = 0; i < round && status == 0; ++i) {
+            status = reader(arg, items[first + i].position, requests[i].buffer, items[first + i].size);
+        }
+        first += round;
+    }
+
+    free(requests);
+    free(buffer);
+    free(items);
+    return status;
+}
@@ -0,0 +1,415 @@
+/**
+ * @file db_share.c
+ * @implementation of the coordination of processes sharing a database
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "db_share.h"
+#include "db_columns.h"
+#include "db_latch.h"
+#include "db_wal.h"
+#include "db_backend.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/********************************************************************//**
+ * Appends the region extension to the database filename.
+ */
+int share_filename(char *share_filename, const char *db_filename)
+{
+    M_REQUIRE_NON_NULL(share_filename);
+    M_REQUIRE_NON_NULL(db_filename);
+
+    if (strlen(db_filename) + strlen(SHARE_EXT) >= FILENAME_MAX) {
+        return ERR_INVALID_FILENAME;
+    }
+
+    strcpy(share_filename, db_filename);
+    strcat(share_filename, SHARE_EXT);
+    return 0;
+}
+
+/********************************************************************//**
+ * flock() retried when interrupted by a signal.
+ */
+static int lock_file(int fd, int operation)
+{
+    while (flock(fd, operation) != 0) {
+        if (errno != EINTR) {
+            return ERR_IO;
+        }
+    }
+    return 0;
+}
+
+/********************************************************************//**
+ * Whether the region was set up for the database.
+ */
+static int region_matches(const struct pictdb_share_region *region, const struct stat *st)
+{
+    return !memcmp(region->magic, SHARE_MAGIC, SHARE_MAGIC_LEN) &&
+           region->db_dev == (uint64_t) st->st_dev && region->db_ino == (uint64_t) st->st_ino;
+}
+
+/********************************************************************//**
+ * Reads the header and the slots published since the table was last
+ * brought up to date, then applies them. Requires the writer lock of the
+ * process. Without the file lock, nothing is applied while a writer
+ * publishes: what was read may be torn.
+ *
+ * @param locked Whether the file lock is held.
+ * @param full Whether to read the whole table.
+ */
+static int apply_changes(struct pictdb_file *db_file, int locked, int full)
+{
+    struct pictdb_share *share = db_file->share;
+    struct pictdb_share_region *region = share->region;
+
+    uint32_t seq = __atomic_load_n(&region->seq, __ATOMIC_ACQUIRE);
+    if (seq == share->seq && !full) {
+        return 0;
+    }
+    if (seq & 1) {
+        if (!locked) {
+            return 0;
+        }
+        // the publisher died: the slots it was recording are read again
+        seq += 1;
+        __atomic_store_n(&region->seq, seq, __ATOMIC_RELEASE);
+        full = 1;
+    }
+
+    const uint64_t changes = __atomic_load_n(&region->changes, __ATOMIC_RELAXED);
+    const uint32_t max_files = db_file->header.max_files;
+    if (changes < share->changes || changes - share->changes > SHARE_LOG) {
+        full = 1;
+    }
+    const uint32_t count = full ? max_files : (uint32_t) (changes - share->changes);
+
+    uint32_t *slots = calloc(count > 0 ? count : 1, sizeof(uint32_t));
+    struct pict_metadata *copies = calloc(count > 0 ? count : 1, sizeof(struct pict_metadata));
+    struct pictdb_header header;
+    int status = slots != NULL && copies != NULL ? 0 : ERR_OUT_OF_MEMORY;
+
+    for (uint32_t i = 0; i < count && status == 0; ++i) {
+        slots[i] = full ? i : __atomic_load_n(&region->changed[(share->changes + i) % SHARE_LOG], __ATOMIC_RELAXED);
+        if (slots[i] >= max_files) {
+            status = ERR_IO;
+        }
+    }
+
+    if (status == 0) {
+        status = backend_read(db_file, 0, &header, sizeof(struct pictdb_header));
+    }
+    if (status == 0 && full) {
+        status = backend_read(db_file, sizeof(struct pictdb_header), copies,
+                              (size_t) max_files * sizeof(struct pict_metadata));
+    }
+    for (uint32_t i = 0; i < count && status == 0 && !full; ++i) {
+        status = backend_read(db_file, sizeof(struct pictdb_header) + (uint64_t) slots[i] * sizeof(struct pict_metadata),
+                              &copies[i], sizeof(struct pict_metadata));
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    const int torn = __atomic_load_n(&region->seq, __ATOMIC_RELAXED) != seq;
+
+    if (status == 0 && !torn && header.max_files != max_files) {
+        status = ERR_IO;
+    }
+    if (status == 0 && !torn) {
+        latch_tables_begin(db_file);
+        for (uint32_t i = 0; i < count; ++i) {
+            if (full || memcmp(&db_file->metadata[slots[i]], &copies[i], sizeof(struct pict_metadata))) {
+                latch_slot_begin(db_file, slots[i]);
+                memcpy(&db_file->metadata[slots[i]], &copies[i], sizeof(struct pict_metadata));
+                latch_slot_end(db_file, slots[i]);
+                columns_update(db_file, slots[i]);
+            }
+        }
+        db_file->header = header;
+        latch_tables_end(db_file);
+
+        __atomic_store_n(&share->seq, seq, __ATOMIC_RELAXED);
+        share->changes = changes;
+    }
+
+    free(copies);
+    free(slots);
+    return status;
+}
+
+/********************************************************************//**
+ * Records the slots logged under the file lock in the region, and writes
+ * them to the database file. The sequence is odd meanwhile.
+ */
+static void publish_changes(struct pictdb_file *db_file)
+{
+    struct pictdb_share *share = db_file->share;
+    struct pictdb_share_region *region = share->region;
+    const struct pictdb_wal *wal = db_file->wal;
+
+    if (wal == NULL || wal->records == 0) {
+        return;
+    }
+
+    const uint32_t seq = __atomic_load_n(&region->seq, __ATOMIC_RELAXED);
+    const int current = seq == share->seq;
+    __atomic_store_n(&region->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    uint64_t changes = __atomic_load_n(&region->changes, __ATOMIC_RELAXED);
+    const uint32_t max_files = db_file->header.max_files;
+    for (uint32_t i = 0; i < max_files; ++i) {
+        if (wal->dirty[i / 64] >> (i % 64) & 1) {
+            __atomic_store_n(&region->changed[changes % SHARE_LOG], i, __ATOMIC_RELAXED);
+            ++changes;
+        }
+    }
+
+    // on failure the slots stay dirty, and are published again next time
+    (void) wal_checkpoint(db_file);
+
+    __atomic_store_n(&region->changes, changes, __ATOMIC_RELAXED);
+    __atomic_store_n(&region->seq, seq + 2, __ATOMIC_RELEASE);
+    if (current) {
+        __atomic_store_n(&share->seq, seq + 2, __ATOMIC_RELAXED);
+        share->changes = changes;
+    }
+}
+
+/********************************************************************//**
+ * Replaces a private mapping of the metadata by anonymous memory at the
+ * same address: pages of a private mapping the process never wrote follow
+ * the file, hence the checkpoints of the other processes, behind the back
+ * of the slot sequences. Requires the file lock.
+ */
+static int own_metadata(struct pictdb_file *db_file)
+{
+    if (db_file->map_size == 0) {
+        return 0;
+    }
+
+    void *copy = malloc(db_file->map_size);
+    if (copy == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    void *base = (char *) db_file->metadata - sizeof(struct pictdb_header);
+    memcpy(copy, base, db_file->map_size);
+    const int status = mmap(base, db_file->map_size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == base ? 0 : ERR_IO;
+    if (status == 0) {
+        memcpy(base, copy, db_file->map_size);
+    }
+    free(copy);
+    return status;
+}
+
+/********************************************************************//**
+ * Opens and maps the region file, locked shared. Leaves share->region
+ * NULL when not creating and no process shares the database.
+ */
+static int attach_region(struct pictdb_share *share, int create)
+{
+    for (;;) {
+        const int fd = open(share->filename, create ? O_RDWR | O_CREAT : O_RDWR, 0644);
+        if (fd < 0) {
+            return create ? ERR_IO : 0;
+        }
+
+        // nobody holds a leftover region
+        if (!create && flock(fd, LOCK_EX | LOCK_NB) == 0) {
+            unlink(share->filename);
+            close(fd);
+            return 0;
+        }
+
+        struct stat named, opened;
+        if (lock_file(fd, LOCK_SH) != 0 || fstat(fd, &opened) != 0) {
+            close(fd);
+            return ERR_IO;
+        }
+        // the last sharer removed it meanwhile
+        if (stat(share->filename, &named) != 0 ||
+            named.st_dev != opened.st_dev || named.st_ino != opened.st_ino) {
+            close(fd);
+            continue;
+        }
+
+        void *region = MAP_FAILED;
+        if ((size_t) opened.st_size >= sizeof(struct pictdb_share_region) ||
+            ftruncate(fd, sizeof(struct pictdb_share_region)) == 0) {
+            region = mmap(NULL, sizeof(struct pictdb_share_region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (region == MAP_FAILED) {
+            close(fd);
+            return ERR_IO;
+        }
+
+        share->fd = fd;
+        share->region = region;
+        return 0;
+    }
+}
+
+/********************************************************************//**
+ * Starts sharing db_file with the other processes.
+ */
+int share_open(const char *db_filename, int create, struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(db_filename);
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(db_file->fpdb);
+
+    if (db_file->share != NULL) {
+        return 0;
+    }
+
+    struct pictdb_share *share = calloc(1, sizeof(struct pictdb_share));
+    if (share == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    const int fd = fileno(db_file->fpdb);
+    struct stat st;
+    int status = share_filename(share->filename, db_filename);
+    if (status == 0 && fstat(fd, &st) != 0) {
+        status = ERR_IO;
+    }
+    if (status == 0) {
+        status = attach_region(share, create);
+    }
+    if (status != 0 || share->region == NULL) {
+        free(share);
+        return status;
+    }
+
+    db_file->share = share;
+    status = lock_file(fd, LOCK_EX);
+    if (status == 0) {
+        if (!region_matches(share->region, &st)) {
+            memset(share->region, 0, sizeof(struct pictdb_share_region));
+            memcpy(share->region->magic, SHARE_MAGIC, SHARE_MAGIC_LEN);
+            share->region->db_dev = (uint64_t) st.st_dev;
+            share->region->db_ino = (uint64_t) st.st_ino;
+        }
+        status = own_metadata(db_file);
+        // the table was loaded before the region was locked
+        if (status == 0) {
+            status = apply_changes(db_file, 1, 1);
+        }
+        (void) flock(fd, LOCK_UN);
+    }
+
+    if (status != 0) {
+        share_close(db_file);
+    }
+    return status;
+}
+
+/********************************************************************//**
+ * Stops sharing db_file.
+ */
+void share_close(struct pictdb_file *db_file)
+{
+    if (db_file == NULL || db_file->share == NULL) {
+        return;
+    }
+
+    struct pictdb_share *share = db_file->share;
+    // the log is removed under the file lock, see wal_revalidate()
+    if (db_file->fpdb != NULL && db_file->wal != NULL &&
+        lock_file(fileno(db_file->fpdb), LOCK_EX) == 0) {
+        (void) wal_revalidate(db_file);
+        publish_changes(db_file);
+        wal_close(db_file);
+        (void) flock(fileno(db_file->fpdb), LOCK_UN);
+    }
+
+    munmap(share->region, sizeof(struct pictdb_share_region));
+    if (flock(share->fd, LOCK_EX | LOCK_NB) == 0) {
+        unlink(share->filename);
+    }
+    close(share->fd);
+    free(share);
+    db_file->share = NULL;
+}
+
+/********************************************************************//**
+ * Takes the file lock and applies the commits of the other processes.
+ */
+void share_lock(struct pictdb_file *db_file)
+{
+    if (db_file == NULL || db_file->share == NULL || db_file->fpdb == NULL ||
+        lock_file(fileno(db_file->fpdb), LOCK_EX) != 0) {
+        return;
+    }
+
+    (void) wal_revalidate(db_file);
+    (void) apply_changes(db_file, 1, 0);
+}
+
+/********************************************************************//**
+ * Publishes the mutations made under the file lock, then releases it.
+ */
+void share_unlock(struct pictdb_file *db_file)
+{
+    if (db_file == NULL || db_file->share == NULL || db_file->fpdb == NULL) {
+        return;
+    }
+
+    publish_changes(db_file);
+    (void) flock(fileno(db_file->fpdb), LOCK_UN);
+}
+
+/********************************************************************//**
+ * Shares db_file with the other processes.
+ */
+int do_share(const char *db_filename, struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(db_filename);
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_VALID_FILENAME(db_filename);
+
+    if (db_file->share != NULL) {
+        return 0;
+    }
+
+    // not shared yet: only the writer lock of the process is taken
+    latch_lock(db_file);
+    const int status = share_open(db_filename, 1, db_file);
+    latch_release(db_file);
+    return status;
+}
+
+/********************************************************************//**
+ * Applies the commits of the other processes, unless one is being
+ * published or a writer of this process is running.
+ */
+int do_refresh(struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(db_file);
+
+    const struct pictdb_share *share = db_file->share;
+    if (share == NULL ||
+        __atomic_load_n(&share->region->seq, __ATOMIC_ACQUIRE) == __atomic_load_n(&share->seq, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    if (!latch_trylock(db_file)) {
+        return 0;
+    }
+
+    const int status = apply_changes(db_file, 0, 0);
+    latch_release(db_file);
+    return status;
+}
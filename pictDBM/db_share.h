@@ -0,0 +1,112 @@
+/**
+ * @file db_share.h
+ * @brief pictDB library: coordination of processes sharing a database.
+ *
+ * Processes sharing "<db_filename>" map a small region file
+ * ("<db_filename>.shm") holding a commit sequence and the slots changed
+ * by the latest commits. Each process keeps its own metadata table:
+ *
+ *  - writers take an exclusive flock() on the database file for each
+ *    mutation, first bring their table up to date, and before releasing
+ *    the lock checkpoint the log (so the database file holds every
+ *    committed slot) and record the changed slots in the region;
+ *  - readers call do_refresh(), which costs one atomic load when nothing
+ *    changed, and otherwise re-reads the header and the changed slots
+ *    from the database file (the whole table if they fell more than
+ *    SHARE_LOG slots behind).
+ *
+ * A database is shared once a process calls do_share(); later opens of
+ * the same file join automatically while a sharing process runs. The log
+ * is emptied at each mutation, so group commit does not apply to shared
+ * databases. Garbage collection and index rebuilds still need exclusive
+ * access.
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#ifndef PICTDBPRJ_DB_SHARE_H
+#define PICTDBPRJ_DB_SHARE_H
+
+#include "pictDB.h"
+
+#define SHARE_EXT ".shm"
+#define SHARE_MAGIC "PDBSHM1"
+#define SHARE_MAGIC_LEN 8
+#define SHARE_LOG 4096 // changed slots remembered by the region
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Region shared by the processes, mapped from the region file.
+ */
+struct pictdb_share_region {
+    char magic[SHARE_MAGIC_LEN]; /**< SHARE_MAGIC */
+    uint64_t db_dev; /**< device of the database file */
+    uint64_t db_ino; /**< inode of the database file */
+    uint32_t seq; /**< commit sequence, odd while a writer publishes */
+    uint32_t unused_32; /**< unused or temporary information */
+    uint64_t changes; /**< number of slot changes published so far */
+    uint32_t changed[SHARE_LOG]; /**< slot of each change, by change number modulo SHARE_LOG */
+};
+
+/**
+ * @brief Sharing state of a process.
+ */
+struct pictdb_share {
+    char filename[FILENAME_MAX]; /**< region file name */
+    int fd; /**< region file, locked shared as long as the process shares */
+    struct pictdb_share_region *region; /**< mapped region */
+    uint32_t seq; /**< region sequence the metadata reflects */
+    uint64_t changes; /**< region changes the metadata reflects */
+};
+
+/**
+ * @brief Appends the region extension to the database filename.
+ *
+ * @param share_filename Output buffer of FILENAME_MAX bytes.
+ * @param db_filename The database file name.
+ */
+int share_filename(char *share_filename, const char *db_filename);
+
+/**
+ * @brief Starts sharing db_file with the other processes.
+ *
+ * @param db_filename The database file name.
+ * @param create Whether to create the region, otherwise db_file is only
+ *        shared if another process currently shares it.
+ * @param db_file In memory structure with header and metadata.
+ */
+int share_open(const char *db_filename, int create, struct pictdb_file *db_file);
+
+/**
+ * @brief Stops sharing db_file: checkpoints and closes its log under the
+ *        file lock. The last process removes the region file.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+void share_close(struct pictdb_file *db_file);
+
+/**
+ * @brief Takes the file lock and applies the commits of the other
+ *        processes. Requires the writer lock of the process.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+void share_lock(struct pictdb_file *db_file);
+
+/**
+ * @brief Publishes the mutations made under the file lock, then releases
+ *        it. Requires the writer lock of the process.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+void share_unlock(struct pictdb_file *db_file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,162 @@
+/**
+ * @file db_sprite.c
+ * @implementation of do_sprite to compose thumbnails into one image
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vips/vips.h>
+#include "pictDB.h"
+#include "db_columns.h"
+
+/**
+ * @brief Thumbnails received from do_read_batch, kept until encoding.
+ */
+struct sprite_buffers {
+    char **images; /**< copy of each thumbnail, by tile */
+    uint32_t *sizes; /**< size of each thumbnail */
+};
+
+/********************************************************************//**
+ * Keeps a copy of a thumbnail read by do_read_batch.
+ */
+static int sprite_reader(void *arg, size_t position, const char *image, uint32_t size)
+{
+    struct sprite_buffers *buffers = arg;
+
+    buffers->images[position] = malloc(size);
+    if (buffers->images[position] == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    memcpy(buffers->images[position], image, size);
+    buffers->sizes[position] = size;
+    return 0;
+}
+
+/********************************************************************//**
+ * Joins the thumbnails in a grid of fixed cells and encodes it.
+ */
+static int sprite_compose(const struct pictdb_file *db_file, const struct sprite_buffers *buffers,
+                          struct pictdb_sprite *sprite)
+{
+    VipsObject *process = VIPS_OBJECT(vips_image_new());
+    VipsImage **t = (VipsImage **) vips_object_local_array(process, (int) sprite->count + 1);
+
+    int status = 0;
+    uint32_t cell_width = db_file->header.res_resized[2 * RES_THUMB];
+    uint32_t cell_height = db_file->header.res_resized[2 * RES_THUMB + 1];
+
+    for (size_t i = 0; i < sprite->count && status == 0; ++i) {
+        if (vips_jpegload_buffer(buffers->images[i], buffers->sizes[i], &t[i], NULL) != 0) {
+            status = ERR_VIPS;
+        } else {
+            sprite->tiles[i].width = (uint32_t) vips_image_get_width(t[i]);
+            sprite->tiles[i].height = (uint32_t) vips_image_get_height(t[i]);
+            cell_width = sprite->tiles[i].width > cell_width ? sprite->tiles[i].width : cell_width;
+            cell_height = sprite->tiles[i].height > cell_height ? sprite->tiles[i].height : cell_height;
+        }
+    }
+
+    const uint32_t across = (uint32_t) ceil(sqrt((double) sprite->count));
+    for (size_t i = 0; i < sprite->count; ++i) {
+        sprite->tiles[i].x = (uint32_t) (i % across) * cell_width;
+        sprite->tiles[i].y = (uint32_t) (i / across) * cell_height;
+    }
+
+    if (status == 0 &&
+        (vips_arrayjoin(t, &t[sprite->count], (int) sprite->count, "across", (int) across,
+                        "hspacing", (int) cell_width, "vspacing", (int) cell_height, NULL) != 0 ||
+         vips_jpegsave_buffer(t[sprite->count], &sprite->jpeg, &sprite->jpeg_size, NULL) != 0)) {
+        status = ERR_VIPS;
+    }
+
+    if (status == 0) {
+        sprite->width = across * cell_width;
+        sprite->height = (uint32_t) ((sprite->count + across - 1) / across) * cell_height;
+    }
+
+    g_object_unref(process);
+    return status;
+}
+
+int do_sprite(struct pictdb_file *db_file, const struct list_page *page, struct pictdb_sprite *sprite)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(page);
+    M_REQUIRE_NON_NULL(sprite);
+
+    memset(sprite, 0, sizeof(struct pictdb_sprite));
+    sprite->db_version = db_file->header.db_version;
+
+    int status = columns_ensure(db_file);
+    if (status != 0) {
+        return status;
+    }
+
+    const uint32_t limit = page->limit == 0 || page->limit > MAX_SPRITE_TILES ? MAX_SPRITE_TILES : page->limit;
+    const char *pict_ids[MAX_SPRITE_TILES];
+    sprite->tiles = calloc(limit, sizeof(struct sprite_tile));
+    if (sprite->tiles == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    const struct pictdb_columns *columns = db_file->columns;
+    uint32_t i = columns_next_valid(columns, page->cursor);
+    for (uint32_t skipped = 0; skipped < page->offset && i < columns->max_files; ++skipped) {
+        i = columns_next_valid(columns, i + 1);
+    }
+    for (; i < columns->max_files && sprite->count < limit; i = columns_next_valid(columns, i + 1)) {
+        strncpy(sprite->tiles[sprite->count].pict_id, db_file->metadata[i].pict_id, MAX_PIC_ID);
+        pict_ids[sprite->count] = sprite->tiles[sprite->count].pict_id;
+        ++sprite->count;
+    }
+    sprite->more = i < columns->max_files;
+    sprite->next_cursor = i;
+
+    if (sprite->count == 0) {
+        return 0;
+    }
+
+    struct sprite_buffers buffers = {
+        .images = calloc(sprite->count, sizeof(char *)),
+        .sizes = calloc(sprite->count, sizeof(uint32_t))
+    };
+    status = buffers.images == NULL || buffers.sizes == NULL ? ERR_OUT_OF_MEMORY : 0;
+
+    if (status == 0) {
+        status = do_read_batch(db_file, pict_ids, sprite->count, RES_THUMB, sprite_reader, &buffers);
+    }
+    if (status == 0) {
+        status = sprite_compose(db_file, &buffers, sprite);
+    }
+
+    for (size_t j = 0; buffers.images != NULL && j < sprite->count; ++j) {
+        free(buffers.images[j]);
+    }
+    free(buffers.images);
+    free(buffers.sizes);
+
+    if (status != 0) {
+        sprite_free(sprite);
+    }
+    return status;
+}
+
+void sprite_free(struct pictdb_sprite *sprite)
+{
+    if (sprite == NULL) {
+        return;
+    }
+
+    free(sprite->tiles);
+    sprite->tiles = NULL;
+    g_free(sprite->jpeg);
+    sprite->jpeg = NULL;
+    sprite->count = 0;
+    sprite->jpeg_size = 0;
+}
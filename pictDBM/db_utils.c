@@ -1,8 +1,20 @@
 
+#define _DEFAULT_SOURCE
+
 #include "pictDB.h"
+#include "db_index.h"
+#include "db_columns.h"
+#include "db_wal.h"
+#include "db_latch.h"
+#include "db_share.h"
+#include "db_io.h"
+#include "db_backend.h"
 
 #include <inttypes.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /********************************************************************//**
  * Human-readable SHA
@@ -66,9 +78,84 @@ void print_metadata(const struct pict_metadata* metadata)
 }
 
 /********************************************************************//**
- * Opens given file, reads header and metadata.
+ * Whether an fopen mode allows writing.
+ */
+static int is_writable_mode(const char* mode)
+{
+    return strpbrk(mode, "wa+") != NULL;
+}
+
+/********************************************************************//**
+ * Copies the whole file into the memory backend of db_file.
+ */
+static int load_memory(struct pictdb_file* db_file)
+{
+    char* block = malloc(BACKEND_CHUNK_SIZE);
+    if (block == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    int status = fseek(db_file->fpdb, 0, SEEK_SET) == 0 ? 0 : ERR_IO;
+    size_t len = 0;
+    uint64_t offset = 0;
+    while (status == 0 && (len = fread(block, 1, BACKEND_CHUNK_SIZE, db_file->fpdb)) > 0) {
+        status = backend_append(db_file, block, len, &offset);
+    }
+    if (status == 0 && ferror(db_file->fpdb)) {
+        status = ERR_IO;
+    }
+
+    free(block);
+    return status;
+}
+
+/********************************************************************//**
+ * Maps header and metadata privately so that pages are only read from disk
+ * when first touched. Modified pages stay private: persisting them is still
+ * done explicitly through the backend. Falls back on reading the whole
+ * table, always for databases in memory.
+ *
+ * Read-only handles always read the table: the pages of a private mapping
+ * that were never written keep following the file, so a later checkpoint
+ * of a writing process would show its slots next to an older header.
+ */
+static int load_metadata(struct pictdb_file* db_file, int writable)
+{
+    const size_t map_size = sizeof(struct pictdb_header) +
+                            db_file->header.max_files * sizeof(struct pict_metadata);
+    const int fd = db_file->fpdb == NULL ? -1 : fileno(db_file->fpdb);
+    struct stat st;
+
+    if (writable && fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (size_t) st.st_size >= map_size) {
+        void* base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (base != MAP_FAILED) {
+            db_file->metadata = (struct pict_metadata *) ((char *) base + sizeof(struct pictdb_header));
+            db_file->map_size = map_size;
+            return 0;
+        }
+    }
+
+    db_file->metadata = (struct pict_metadata *) calloc(db_file->header.max_files, sizeof(struct pict_metadata));
+    if (db_file->metadata == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    return backend_read(db_file, sizeof(struct pictdb_header), db_file->metadata,
+                        db_file->header.max_files * sizeof(struct pict_metadata));
+}
+
+/********************************************************************//**
+ * Opens given file, reads header and maps metadata.
  */
 int do_open (const char* filename, const char* mode, struct pictdb_file* db_file)
+{
+    return do_open_storage(filename, mode, STORAGE_FILE, db_file);
+}
+
+/********************************************************************//**
+ * Opens given file, kept as storage tells, reads header and maps metadata.
+ */
+int do_open_storage (const char* filename, const char* mode, enum pictdb_storage storage,
+                     struct pictdb_file* db_file)
 {
     M_REQUIRE_NON_NULL(filename);
     M_REQUIRE_NON_NULL(mode);
@@ -76,34 +163,79 @@ int do_open (const char* filename, const char* mode, struct pictdb_file* db_file
 
     M_REQUIRE_VALID_FILENAME(filename);
 
-    db_file->fpdb = fopen(filename, mode);
+    // a database in memory only reads its file
+    db_file->fpdb = fopen(filename, storage == STORAGE_MEMORY ? "rb" : mode);
     db_file->metadata = NULL;
+    db_file->map_size = 0;
+    db_file->index = NULL;
+    db_file->columns = NULL;
+    db_file->wal = NULL;
+    db_file->durability = DURABILITY_OPERATION;
+    db_file->group_commit = DEFAULT_GROUP_COMMIT;
+    db_file->sync_interval = DEFAULT_SYNC_INTERVAL;
+    db_file->latch = NULL;
+    db_file->share = NULL;
+    db_file->io = NULL;
+    db_file->backend = NULL;
 
     if (db_file->fpdb == NULL) {
         return ERR_IO;
     }
 
-    int status = 0;
-    if (fread(&db_file->header, sizeof(struct pictdb_header), 1, db_file->fpdb) != 1) {
+    // processes sharing the database do not write it meanwhile
+    const int fd = fileno(db_file->fpdb);
+    const int locked = flock(fd, is_writable_mode(mode) && storage != STORAGE_MEMORY ? LOCK_EX : LOCK_SH) == 0;
+
+    int status = backend_open(db_file, storage);
+    if (status == 0 && storage == STORAGE_MEMORY) {
+        status = load_memory(db_file);
+    }
+
+    if (status == 0 && backend_read(db_file, 0, &db_file->header, sizeof(struct pictdb_header)) != 0) {
         status = ERR_IO;
-    } else {
-        db_file->metadata = (struct pict_metadata *) calloc(db_file->header.max_files, sizeof(struct pict_metadata));
-
-        if (db_file->metadata == NULL) {
-            status = ERR_OUT_OF_MEMORY;
-        } else if (fread(db_file->metadata, sizeof(struct pict_metadata), db_file->header.max_files, db_file->fpdb) !=
-                   db_file->header.max_files) {
-            status = ERR_IO;
-        } else if (db_file->header.max_files > MAX_MAX_FILES) {
-            status = ERR_MAX_FILES;
-        }
+    }
+    if (status == 0 && db_file->header.max_files > MAX_MAX_FILES) {
+        status = ERR_MAX_FILES;
+    }
+    if (status == 0) {
+        status = load_metadata(db_file, is_writable_mode(mode));
+    }
+
+    if (status == 0) {
+        status = latch_open(db_file);
+    }
+
+    if (status == 0 && storage == STORAGE_FILE) {
+        io_open(db_file);
+    }
+
+    if (status == 0) {
+        status = wal_open(filename, is_writable_mode(mode), db_file);
+    }
+
+    if (status == 0 && storage != STORAGE_MEMORY) {
+        // the index is optional: when missing or stale, lookups scan the metadata
+        (void) index_open(filename, is_writable_mode(mode), db_file);
+    }
+    if (locked) {
+        (void) flock(fd, LOCK_UN);
+    }
+
+    // a database in memory is done with its file
+    if (storage == STORAGE_MEMORY) {
+        fclose(db_file->fpdb);
+        db_file->fpdb = NULL;
     }
 
+    if (status == 0 && storage != STORAGE_MEMORY) {
+        // joins the processes already sharing the database, if any
+        status = share_open(filename, 0, db_file);
+    }
     if (status != 0) {
         do_close(db_file);
     }
 
-    return 0;
+    return status;
 }
 
 /********************************************************************//**
@@ -115,17 +247,125 @@ void do_close (struct pictdb_file* db_file)
         return;
     }
 
+    share_close(db_file);
+    wal_close(db_file);
+    index_close(db_file);
+    columns_free(db_file);
+    latch_close(db_file);
+    io_close(db_file);
+    backend_close(db_file);
+
     if (db_file->metadata != NULL) {
-        free(db_file->metadata);
+        if (db_file->map_size != 0) {
+            munmap((char *) db_file->metadata - sizeof(struct pictdb_header), db_file->map_size);
+            db_file->map_size = 0;
+        } else {
+            free(db_file->metadata);
+        }
         db_file->metadata = NULL;
     }
 
     if (db_file->fpdb != NULL) {
         fclose(db_file->fpdb);
+        db_file->fpdb = NULL;
     }
 
 }
 
+/********************************************************************//**
+ * Sets the durability level of db_file.
+ */
+int do_set_durability (struct pictdb_file* db_file, enum pictdb_durability durability, uint32_t param)
+{
+    M_REQUIRE_NON_NULL(db_file);
+
+    switch (durability) {
+    case DURABILITY_BATCH:
+        db_file->group_commit = param == 0 ? DEFAULT_GROUP_COMMIT : param;
+        break;
+    case DURABILITY_INTERVAL:
+        db_file->sync_interval = param == 0 ? DEFAULT_SYNC_INTERVAL : param;
+        break;
+    case DURABILITY_NONE:
+    case DURABILITY_OPERATION:
+        break;
+    default:
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // mutations pending under the previous level are committed under it
+    latch_lock(db_file);
+    int status = wal_commit(db_file, 0);
+    db_file->durability = durability;
+    latch_unlock(db_file);
+    return status;
+}
+
+/********************************************************************//**
+ * Makes all the mutations logged so far durable.
+ */
+int do_sync (struct pictdb_file* db_file)
+{
+    M_REQUIRE_NON_NULL(db_file);
+
+    latch_lock(db_file);
+    const int status = wal_commit(db_file, 1);
+    latch_unlock(db_file);
+    return status;
+}
+
+/********************************************************************//**
+ * Makes pending mutations durable if the durability level requires it.
+ */
+int do_sync_due (struct pictdb_file* db_file)
+{
+    M_REQUIRE_NON_NULL(db_file);
+
+    latch_lock(db_file);
+    const int status = wal_commit_due(db_file);
+    latch_unlock(db_file);
+    return status;
+}
+
+/********************************************************************//**
+ * Finds the metadata index of a valid picture, through the persisted
+ * index when available.
+ */
+int find_pict_index(const struct pictdb_file* db_file, const char* pict_id, uint32_t* index)
+{
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(db_file->metadata);
+    M_REQUIRE_NON_NULL(pict_id);
+    M_REQUIRE_NON_NULL(index);
+
+    int status = index_find(db_file, pict_id, index);
+    if (status != ERR_INVALID_ARGUMENT) {
+        return status;
+    }
+
+    const struct pictdb_columns* columns = db_file->columns;
+    if (columns != NULL) {
+        const uint64_t hash = pict_id_hash(pict_id);
+        for (uint32_t i = columns_match(columns, columns->id_hash, hash, 0); i < columns->max_files;
+             i = columns_match(columns, columns->id_hash, hash, i + 1)) {
+            if (!strncmp(pict_id, db_file->metadata[i].pict_id, MAX_PIC_ID)) {
+                *index = i;
+                return 0;
+            }
+        }
+        return ERR_FILE_NOT_FOUND;
+    }
+
+    for (uint32_t i = 0; i < db_file->header.max_files; ++i) {
+        if (db_file->metadata[i].is_valid == NON_EMPTY &&
+            !strncmp(pict_id, db_file->metadata[i].pict_id, MAX_PIC_ID)) {
+            *index = i;
+            return 0;
+        }
+    }
+    return ERR_FILE_NOT_FOUND;
+}
+
 /********************************************************************//**
  * Closes file included in db_file.
  */
@@ -0,0 +1,597 @@
+/**
+ * @file db_wal.c
+ * @implementation of the write-ahead log of metadata mutations
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "db_wal.h"
+#include "db_columns.h"
+#include "db_latch.h"
+#include "db_io.h"
+#include "db_backend.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define FNV32_OFFSET_BASIS 2166136261u
+#define FNV32_PRIME 16777619u
+
+/********************************************************************//**
+ * Flushes a stream and forces its data to disk.
+ */
+int sync_file(FILE *fp)
+{
+    M_REQUIRE_NON_NULL(fp);
+
+    if (fflush(fp) != 0) {
+        return ERR_IO;
+    }
+#ifdef __APPLE__
+    return fsync(fileno(fp)) == 0 ? 0 : ERR_IO;
+#else
+    return fdatasync(fileno(fp)) == 0 ? 0 : ERR_IO;
+#endif
+}
+
+/********************************************************************//**
+ * Flushes a stream, forcing its data to disk unless the durability level
+ * of the database is DURABILITY_NONE.
+ */
+static int flush_file(const struct pictdb_file *db_file, FILE *fp, int force)
+{
+    if (force || db_file->durability != DURABILITY_NONE) {
+        return sync_file(fp);
+    }
+    return fflush(fp) == 0 ? 0 : ERR_IO;
+}
+
+/********************************************************************//**
+ * Flushes the database, forcing its data to disk unless the durability
+ * level of the database is DURABILITY_NONE.
+ */
+static int flush_database(struct pictdb_file *db_file, int force)
+{
+    return backend_flush(db_file, force || db_file->durability != DURABILITY_NONE);
+}
+
+/********************************************************************//**
+ * Monotonic time in milliseconds.
+ */
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+/********************************************************************//**
+ * Appends the log extension to the database filename.
+ */
+int wal_filename(char *wal_filename, const char *db_filename)
+{
+    M_REQUIRE_NON_NULL(wal_filename);
+    M_REQUIRE_NON_NULL(db_filename);
+
+    if (strlen(db_filename) + strlen(WAL_EXT) >= FILENAME_MAX) {
+        return ERR_INVALID_FILENAME;
+    }
+
+    strcpy(wal_filename, db_filename);
+    strcat(wal_filename, WAL_EXT);
+    return 0;
+}
+
+/********************************************************************//**
+ * FNV-1a checksum of a record, up to its checksum field.
+ */
+static uint32_t record_checksum(const struct pictdb_wal_record *record)
+{
+    const unsigned char *bytes = (const unsigned char *) record;
+    uint32_t checksum = FNV32_OFFSET_BASIS;
+    for (size_t i = 0; i < offsetof(struct pictdb_wal_record, checksum); ++i) {
+        checksum ^= bytes[i];
+        checksum *= FNV32_PRIME;
+    }
+    return checksum;
+}
+
+/********************************************************************//**
+ * Marks a slot to be written at the next checkpoint.
+ */
+static void mark_dirty(struct pictdb_wal *wal, uint32_t index)
+{
+    wal->dirty[index / 64] |= (uint64_t) 1 << (index % 64);
+}
+
+/********************************************************************//**
+ * Whether a slot is to be written at the next checkpoint.
+ */
+static int is_dirty(const struct pictdb_wal *wal, uint32_t index)
+{
+    return (wal->dirty[index / 64] >> (index % 64) & 1) != 0;
+}
+
+/********************************************************************//**
+ * Whether the log header belongs to the database.
+ */
+static int wal_header_matches(const struct pictdb_wal_header *header, uint64_t db_dev, uint64_t db_ino)
+{
+    return !memcmp(header->magic, WAL_MAGIC, WAL_MAGIC_LEN) &&
+           header->db_dev == db_dev && header->db_ino == db_ino;
+}
+
+/********************************************************************//**
+ * Applies every valid record of the log to db_file. Stops at the first
+ * torn or foreign record: nothing after it was ever committed.
+ */
+static uint32_t wal_replay(const char *filename, uint64_t db_dev, uint64_t db_ino, struct pictdb_file *db_file,
+                           struct pictdb_wal *wal)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    uint32_t replayed = 0;
+    uint64_t lsn = 0;
+    struct pictdb_wal_header header;
+
+    if (fread(&header, sizeof(header), 1, fp) == 1 && wal_header_matches(&header, db_dev, db_ino)) {
+        struct pictdb_wal_record record;
+
+        while (fread(&record, sizeof(record), 1, fp) == 1 &&
+               record.magic == WAL_RECORD_MAGIC &&
+               record.checksum == record_checksum(&record) &&
+               record.lsn > lsn &&
+               record.slot < db_file->header.max_files &&
+               record.header.max_files == db_file->header.max_files) {
+
+            latch_tables_begin(db_file);
+            latch_slot_begin(db_file, record.slot);
+            db_file->header = record.header;
+            db_file->metadata[record.slot] = record.metadata;
+            latch_slot_end(db_file, record.slot);
+            columns_update(db_file, record.slot);
+            latch_tables_end(db_file);
+            if (wal != NULL) {
+                mark_dirty(wal, record.slot);
+            }
+            lsn = record.lsn;
+            ++replayed;
+        }
+    }
+
+    fclose(fp);
+    if (wal != NULL) {
+        wal->lsn = lsn;
+    }
+    return replayed;
+}
+
+/********************************************************************//**
+ * Replays the log of a freshly opened database into memory.
+ */
+int wal_open(const char *db_filename, int writable, struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(db_filename);
+    M_REQUIRE_NON_NULL(db_file);
+    M_REQUIRE_NON_NULL(db_file->backend);
+
+    db_file->wal = NULL;
+
+    char filename[FILENAME_MAX];
+    int status = wal_filename(filename, db_filename);
+    if (status != 0) {
+        return status;
+    }
+
+    // a database in memory has no log file, its file (if any) has one
+    const int in_memory = db_file->backend->storage == STORAGE_MEMORY;
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    if (db_file->fpdb != NULL ? fstat(fileno(db_file->fpdb), &st) != 0 : !in_memory) {
+        return ERR_IO;
+    }
+
+    if (!writable) {
+        // read-only handles see committed mutations, in memory only
+        if (db_file->fpdb != NULL) {
+            (void) wal_replay(filename, (uint64_t) st.st_dev, (uint64_t) st.st_ino, db_file, NULL);
+        }
+        return 0;
+    }
+
+    struct pictdb_wal *wal = calloc(1, sizeof(struct pictdb_wal));
+    if (wal == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    wal->dirty = calloc((db_file->header.max_files + 63) / 64, sizeof(uint64_t));
+    wal->queue = calloc(WAL_QUEUE_RECORDS, sizeof(struct pictdb_wal_record));
+    if (wal->dirty == NULL || wal->queue == NULL) {
+        free(wal->queue);
+        free(wal->dirty);
+        free(wal);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    wal->db_dev = (uint64_t) st.st_dev;
+    wal->db_ino = (uint64_t) st.st_ino;
+    wal->last_commit = now_ms();
+    if (db_file->fpdb != NULL) {
+        wal->records = wal_replay(filename, wal->db_dev, wal->db_ino, db_file, wal);
+    }
+    // without a log file name, records only mark the slots to checkpoint
+    if (!in_memory) {
+        strcpy(wal->filename, filename);
+    }
+    db_file->wal = wal;
+
+    if (wal->records > 0) {
+        status = wal_checkpoint(db_file);
+    }
+    // nothing left to recover: a leftover (possibly foreign) log is dropped
+    if (status == 0 && !in_memory) {
+        remove(filename);
+    }
+    return status;
+}
+
+/********************************************************************//**
+ * Creates the log file and writes its header.
+ */
+static int wal_create(struct pictdb_wal *wal)
+{
+    wal->fp = fopen(wal->filename, "w+b");
+    if (wal->fp == NULL) {
+        return ERR_IO;
+    }
+
+    struct pictdb_wal_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WAL_MAGIC, WAL_MAGIC_LEN);
+    header.db_dev = wal->db_dev;
+    header.db_ino = wal->db_ino;
+
+    if (fwrite(&header, sizeof(header), 1, wal->fp) != 1) {
+        fclose(wal->fp);
+        wal->fp = NULL;
+        return ERR_IO;
+    }
+    return 0;
+}
+
+/********************************************************************//**
+ * Logs the current header and the given slot.
+ */
+int wal_log(struct pictdb_file *db_file, uint32_t index)
+{
+    const int status = wal_append(db_file, index);
+    return status != 0 ? status : wal_settle(db_file);
+}
+
+/********************************************************************//**
+ * Logs the current header and the given slot, or nothing.
+ */
+int wal_append(struct pictdb_file *db_file, uint32_t index)
+{
+    M_REQUIRE_NON_NULL(db_file);
+
+    struct pictdb_wal *wal = db_file->wal;
+    if (wal == NULL) {
+        // read-only handle
+        return ERR_IO;
+    }
+    if (index >= db_file->header.max_files) {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // a full queue is written out first, images before it
+    if (wal->queued == WAL_QUEUE_RECORDS && wal_commit(db_file, 0) != 0) {
+        return ERR_IO;
+    }
+
+    struct pictdb_wal_record *record = &wal->queue[wal->queued];
+    memset(record, 0, sizeof(struct pictdb_wal_record));
+    record->magic = WAL_RECORD_MAGIC;
+    record->slot = index;
+    record->lsn = wal->lsn + 1;
+    record->header = db_file->header;
+    record->metadata = db_file->metadata[index];
+    record->checksum = record_checksum(record);
+
+    const int was_dirty = is_dirty(wal, index);
+    wal->queued += 1;
+    wal->lsn = record->lsn;
+    wal->pending += 1;
+    wal->records += 1;
+    mark_dirty(wal, index);
+
+    // each operation is written at once: one that cannot be is not logged
+    if (db_file->durability == DURABILITY_OPERATION && wal_commit(db_file, 0) != 0 && wal->queued > 0) {
+        wal->queued -= 1;
+        wal->lsn -= 1;
+        wal->pending -= 1;
+        wal->records -= 1;
+        if (!was_dirty) {
+            wal->dirty[index / 64] &= ~((uint64_t) 1 << (index % 64));
+        }
+        return ERR_IO;
+    }
+    return 0;
+}
+
+/********************************************************************//**
+ * Takes the file lock around a checkpoint of a database that is not
+ * shared: other processes load the table and the log under a shared lock
+ * (see do_open()), and must not pair the table of a checkpoint with the
+ * log it is emptying. A shared database already holds the lock while it
+ * mutates. Returns whether the lock was taken.
+ */
+static int lock_unshared(const struct pictdb_file *db_file)
+{
+    return db_file->share == NULL && db_file->fpdb != NULL &&
+           flock(fileno(db_file->fpdb), LOCK_EX) == 0;
+}
+
+/********************************************************************//**
+ * Commits and checkpoints the logged records when due.
+ */
+int wal_settle(struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(db_file);
+
+    const struct pictdb_wal *wal = db_file->wal;
+    int status = wal_commit_due(db_file);
+    if (status == 0 && wal != NULL && wal->records >= WAL_CHECKPOINT_RECORDS) {
+        const int locked = lock_unshared(db_file);
+        status = wal_checkpoint(db_file);
+        if (locked) {
+            (void) flock(fileno(db_file->fpdb), LOCK_UN);
+        }
+    }
+    return status;
+}
+
+/********************************************************************//**
+ * Writes the queued records to the log file, creating it if needed. On
+ * failure, the file is cut back: a torn record would hide the ones
+ * written after it from replay.
+ */
+static int write_queue(struct pictdb_wal *wal)
+{
+    if (wal->queued == 0 || wal->filename[0] == '\0') {
+        // without a log file, records only marked the slots to checkpoint
+        wal->queued = 0;
+        return 0;
+    }
+
+    if (wal->fp == NULL) {
+        const int status = wal_create(wal);
+        if (status != 0) {
+            return status;
+        }
+    }
+
+    const long end = ftell(wal->fp);
+    if (end < 0) {
+        return ERR_IO;
+    }
+    if (fwrite(wal->queue, sizeof(struct pictdb_wal_record), wal->queued, wal->fp) != wal->queued ||
+        fflush(wal->fp) != 0) {
+        clearerr(wal->fp);
+        (void) fflush(wal->fp);
+        (void) ftruncate(fileno(wal->fp), (off_t) end);
+        (void) fseek(wal->fp, end, SEEK_SET);
+        return ERR_IO;
+    }
+
+    wal->queued = 0;
+    return 0;
+}
+
+/********************************************************************//**
+ * Makes all logged records durable. The image data they refer to was
+ * appended to the database before: it is synchronized first, and only
+ * then are the queued records written to the log.
+ */
+int wal_commit(struct pictdb_file *db_file, int force)
+{
+    M_REQUIRE_NON_NULL(db_file);
+
+    struct pictdb_wal *wal = db_file->wal;
+    if (wal == NULL || wal->pending == 0) {
+        return 0;
+    }
+
+    if (flush_database(db_file, force) != 0 || write_queue(wal) != 0 ||
+        (wal->fp != NULL && flush_file(db_file, wal->fp, force) != 0)) {
+        return ERR_IO;
+    }
+
+    wal->pending = 0;
+    wal->last_commit = now_ms();
+    return 0;
+}
+
+/********************************************************************//**
+ * Commits pending records if the durability level requires it by now.
+ * Under DURABILITY_NONE, a "commit" only hands the records to the kernel.
+ */
+int wal_commit_due(struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(db_file);
+
+    const struct pictdb_wal *wal = db_file->wal;
+    if (wal == NULL || wal->pending == 0) {
+        return 0;
+    }
+
+    int due = 1;
+    switch (db_file->durability) {
+    case DURABILITY_NONE:
+    case DURABILITY_BATCH:
+        due = wal->pending >= db_file->group_commit;
+        break;
+    case DURABILITY_INTERVAL:
+        due = now_ms() - wal->last_commit >= db_file->sync_interval;
+        break;
+    case DURABILITY_OPERATION:
+        break;
+    default:
+        break;
+    }
+
+    return due ? wal_commit(db_file, 0) : 0;
+}
+
+/********************************************************************//**
+ * Writes the header and dirty slots to the database, then empties the
+ * log. Contiguous dirty slots are written with a single request, and all
+ * requests are submitted as one batch.
+ */
+int wal_checkpoint(struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(db_file);
+
+    struct pictdb_wal *wal = db_file->wal;
+    if (wal == NULL) {
+        return 0;
+    }
+
+    int status = wal_commit(db_file, 0);
+    if (status != 0 || wal->records == 0) {
+        return status;
+    }
+
+    const uint32_t max_files = db_file->header.max_files;
+    size_t runs = 1; // the header
+    for (uint32_t i = 0; i < max_files; ++i) {
+        if (is_dirty(wal, i) && (i == 0 || !is_dirty(wal, i - 1))) {
+            ++runs;
+        }
+    }
+
+    struct pictdb_io_request *requests = calloc(runs, sizeof(struct pictdb_io_request));
+    if (requests == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    requests[0].offset = 0;
+    requests[0].buffer = &db_file->header;
+    requests[0].size = sizeof(struct pictdb_header);
+
+    size_t count = 1;
+    uint32_t i = 0;
+    while (i < max_files) {
+        if (!is_dirty(wal, i)) {
+            ++i;
+            continue;
+        }
+
+        uint32_t end = i + 1;
+        while (end < max_files && is_dirty(wal, end)) {
+            ++end;
+        }
+
+        requests[count].offset = sizeof(struct pictdb_header) + (uint64_t) i * sizeof(struct pict_metadata);
+        requests[count].buffer = &db_file->metadata[i];
+        requests[count].size = (end - i) * sizeof(struct pict_metadata);
+        ++count;
+        i = end;
+    }
+
+    // the requests bypass the stream: its pending bytes go first
+    status = backend_flush(db_file, 0) == 0 ? io_write_batch(db_file, requests, count) : ERR_IO;
+    free(requests);
+
+    if (status == 0) {
+        status = flush_database(db_file, 0);
+    }
+    if (status != 0) {
+        return status;
+    }
+
+    // the table is durable: the log can be emptied
+    memset(wal->dirty, 0, (max_files + 63) / 64 * sizeof(uint64_t));
+    wal->records = 0;
+
+    if (wal->fp != NULL &&
+        (fflush(wal->fp) != 0 ||
+         ftruncate(fileno(wal->fp), (off_t) sizeof(struct pictdb_wal_header)) != 0 ||
+         fseek(wal->fp, 0, SEEK_END) != 0)) {
+        status = ERR_IO;
+    }
+    return status;
+}
+
+/********************************************************************//**
+ * Catches up with the log file after another process held the database:
+ * a log it removed is reopened on the next record, and records it left
+ * behind (it died before its checkpoint) are replayed to be checkpointed
+ * again.
+ */
+int wal_revalidate(struct pictdb_file *db_file)
+{
+    M_REQUIRE_NON_NULL(db_file);
+
+    struct pictdb_wal *wal = db_file->wal;
+    if (wal == NULL) {
+        return 0;
+    }
+
+    struct stat named, opened;
+    const int exists = stat(wal->filename, &named) == 0;
+    if (wal->fp != NULL &&
+        (!exists || fstat(fileno(wal->fp), &opened) != 0 ||
+         named.st_dev != opened.st_dev || named.st_ino != opened.st_ino)) {
+        fclose(wal->fp);
+        wal->fp = NULL;
+    }
+
+    if (exists && (size_t) named.st_size > sizeof(struct pictdb_wal_header)) {
+        const uint64_t lsn = wal->lsn;
+        wal->records += wal_replay(wal->filename, wal->db_dev, wal->db_ino, db_file, wal);
+        wal->lsn = wal->lsn > lsn ? wal->lsn : lsn;
+    }
+
+    // the log may have been emptied meanwhile
+    return wal->fp != NULL && fseek(wal->fp, 0, SEEK_END) != 0 ? ERR_IO : 0;
+}
+
+/********************************************************************//**
+ * Checkpoints, removes the log file and releases the log state. The log
+ * is kept on disk if the checkpoint fails, for the next open to recover.
+ */
+void wal_close(struct pictdb_file *db_file)
+{
+    if (db_file == NULL || db_file->wal == NULL) {
+        return;
+    }
+
+    struct pictdb_wal *wal = db_file->wal;
+    const int locked = lock_unshared(db_file);
+    const int status = db_file->backend != NULL ? wal_checkpoint(db_file) : ERR_IO;
+
+    if (wal->fp != NULL) {
+        fclose(wal->fp);
+        wal->fp = NULL;
+        if (status == 0) {
+            remove(wal->filename);
+        }
+    }
+    if (locked) {
+        (void) flock(fileno(db_file->fpdb), LOCK_UN);
+    }
+
+    free(wal->queue);
+    free(wal->dirty);
+    free(wal);
+    db_file->wal = NULL;
+}
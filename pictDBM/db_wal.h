@@ -0,0 +1,171 @@
+/**
+ * @file db_wal.h
+ * @brief pictDB library: write-ahead log of metadata mutations.
+ *
+ * Every mutation appends the after-image of the header and of the modified
+ * metadata slot to "<dbfilename>.wal". Records are made durable according
+ * to the durability level of the database (after the appended image data:
+ * they wait in memory until then, so that no record reaches the disk
+ * before the image it refers to),
+ * and the metadata table itself is only written at checkpoints, which
+ * coalesce all dirty slots. do_open replays a leftover log, so that a crash
+ * never leaves a half-written slot/header.
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#ifndef PICTDBPRJ_DB_WAL_H
+#define PICTDBPRJ_DB_WAL_H
+
+#include "pictDB.h"
+
+#define WAL_EXT ".wal"
+#define WAL_MAGIC "PDBWAL1"
+#define WAL_MAGIC_LEN 8
+#define WAL_RECORD_MAGIC 0x57414c52u
+#define WAL_CHECKPOINT_RECORDS 1024 // log length triggering a checkpoint
+#define WAL_QUEUE_RECORDS 256 // records held in memory until a commit
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Log file header, identifying the database it belongs to.
+ */
+struct pictdb_wal_header {
+    char magic[WAL_MAGIC_LEN]; /**< WAL_MAGIC */
+    uint64_t db_dev; /**< device of the database file */
+    uint64_t db_ino; /**< inode of the database file */
+    uint64_t unused_64; /**< unused or temporary information */
+};
+
+/**
+ * @brief Log record: after-image of the header and of one slot.
+ */
+struct pictdb_wal_record {
+    uint32_t magic; /**< WAL_RECORD_MAGIC */
+    uint32_t slot; /**< metadata index */
+    uint64_t lsn; /**< log sequence number, strictly increasing */
+    struct pictdb_header header; /**< header after the mutation */
+    struct pict_metadata metadata; /**< slot after the mutation */
+    uint32_t checksum; /**< checksum of all the previous fields */
+    uint32_t unused_32; /**< unused or temporary information */
+};
+
+/**
+ * @brief Log state of a writable database.
+ */
+struct pictdb_wal {
+    char filename[FILENAME_MAX]; /**< log file name */
+    FILE *fp; /**< log file, NULL until the first record */
+    uint64_t db_dev; /**< device of the database file */
+    uint64_t db_ino; /**< inode of the database file */
+    uint64_t lsn; /**< last logged sequence number */
+    uint32_t pending; /**< records logged but not yet durable */
+    struct pictdb_wal_record *queue; /**< records logged but not yet written */
+    uint32_t queued; /**< number of records in queue */
+    uint32_t records; /**< records since the last checkpoint */
+    uint64_t last_commit; /**< monotonic time of the last commit (ms) */
+    uint64_t *dirty; /**< bitmap of slots to write at the next checkpoint */
+};
+
+/**
+ * @brief Flushes a stream and forces its data to disk.
+ *
+ * @param fp The stream to synchronize.
+ */
+int sync_file(FILE *fp);
+
+/**
+ * @brief Builds the log file name of a database.
+ *
+ * @param wal_filename Output buffer of FILENAME_MAX bytes.
+ * @param db_filename Name of the database file.
+ */
+int wal_filename(char *wal_filename, const char *db_filename);
+
+/**
+ * @brief Replays the log of a freshly opened database into memory. For
+ *        writable databases, the replayed slots are checkpointed and
+ *        db_file->wal is set up for further mutations.
+ *
+ * @param db_filename Name of the database file.
+ * @param writable Whether the database was opened for writing.
+ * @param db_file In memory structure with header and metadata.
+ */
+int wal_open(const char *db_filename, int writable, struct pictdb_file *db_file);
+
+/**
+ * @brief Logs the current header and the given slot. Commits as required
+ *        by the durability level and checkpoints when the log is long.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param index The metadata index that changed.
+ */
+int wal_log(struct pictdb_file *db_file, uint32_t index);
+
+/**
+ * @brief First half of wal_log(): logs the current header and the given
+ *        slot. Nothing is logged on failure, so that the caller can undo
+ *        its mutation.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param index The metadata index that changed.
+ */
+int wal_append(struct pictdb_file *db_file, uint32_t index);
+
+/**
+ * @brief Second half of wal_log(): commits as required by the durability
+ *        level and checkpoints when the log is long. Logged records stay
+ *        logged on failure.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+int wal_settle(struct pictdb_file *db_file);
+
+/**
+ * @brief Makes all logged records durable, after the image data. Records
+ *        are only handed to the kernel under DURABILITY_NONE, unless forced.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param force Whether to force data to disk whatever the durability level.
+ */
+int wal_commit(struct pictdb_file *db_file, int force);
+
+/**
+ * @brief Commits pending records if the durability level requires it.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+int wal_commit_due(struct pictdb_file *db_file);
+
+/**
+ * @brief Writes the header and dirty slots to the database, then empties
+ *        the log.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+int wal_checkpoint(struct pictdb_file *db_file);
+
+/**
+ * @brief Catches up with a log file shared with other processes, before
+ *        logging under the file lock (see db_share.h).
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+int wal_revalidate(struct pictdb_file *db_file);
+
+/**
+ * @brief Checkpoints, removes the log file and releases the log state.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+void wal_close(struct pictdb_file *db_file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,6 +7,9 @@
  */
 
 #include "dedup.h"
+#include "db_columns.h"
+#include "db_index.h"
+#include "metrics.h"
 #include <string.h>
 
 /********************************************************************//**
@@ -21,19 +24,35 @@ int do_name_and_content_dedup(struct pictdb_file *db_file, const uint32_t index)
         return ERR_INVALID_ARGUMENT;
     }
 
-    if (db_file->fpdb == NULL) {
+    if (db_file->backend == NULL) {
         return ERR_IO;
     }
 
+    int status = columns_ensure(db_file);
+    if (status != 0) {
+        return status;
+    }
+
+    // Only slots whose hot keys match are compared against the row store
+    const struct pictdb_columns *columns = db_file->columns;
+    const struct pict_metadata *pict = &db_file->metadata[index];
+    const uint64_t hash = pict_id_hash(pict->pict_id);
+
+    for (uint32_t i = columns_match(columns, columns->id_hash, hash, 0); i < columns->max_files;
+         i = columns_match(columns, columns->id_hash, hash, i + 1)) {
+        if (i != index && !strncmp(db_file->metadata[i].pict_id, pict->pict_id, MAX_PIC_ID)) {
+            return ERR_DUPLICATE_ID;
+        }
+    }
+
     uint32_t similar_sha = db_file->header.max_files;
+    const uint64_t prefix = sha_prefix(pict->SHA);
 
-    for (uint32_t i = 0; i < db_file->header.max_files; ++i) {
-        if (i != index && db_file->metadata[i].is_valid == NON_EMPTY) {
-            if (!strncmp(db_file->metadata[i].pict_id, db_file->metadata[index].pict_id, MAX_PIC_ID)) {
-                return ERR_DUPLICATE_ID;
-            } else if (!memcmp(db_file->metadata[i].SHA, db_file->metadata[index].SHA, SHA256_DIGEST_LENGTH)) {
-                similar_sha = i;
-            }
+    for (uint32_t i = columns_match(columns, columns->sha_prefix, prefix, 0);
+         similar_sha == db_file->header.max_files && i < columns->max_files;
+         i = columns_match(columns, columns->sha_prefix, prefix, i + 1)) {
+        if (i != index && !memcmp(db_file->metadata[i].SHA, pict->SHA, SHA256_DIGEST_LENGTH)) {
+            similar_sha = i;
         }
     }
 
@@ -43,20 +62,11 @@ int do_name_and_content_dedup(struct pictdb_file *db_file, const uint32_t index)
         db_file->metadata[index].offset[RES_ORIG] = db_file->metadata[similar_sha].offset[RES_ORIG];
         db_file->metadata[index].size[RES_THUMB] = db_file->metadata[similar_sha].size[RES_THUMB];
         db_file->metadata[index].size[RES_SMALL] = db_file->metadata[similar_sha].size[RES_SMALL];
-
-        if (fseek(db_file->fpdb, sizeof(struct pictdb_header) + index * sizeof(struct pict_metadata), SEEK_SET) != 0 ||
-            fwrite(&db_file->metadata[index], sizeof(struct pict_metadata), 1, db_file->fpdb) != 1) {
-
-            return ERR_IO;
-        }
+        metrics_dedup_hit();
         return 0;
     }
 
+    // the slot is persisted (logged) by the caller once the image is written
     db_file->metadata[index].offset[RES_ORIG] = 0;
-    if (fseek(db_file->fpdb, sizeof(struct pictdb_header) + index * sizeof(struct pict_metadata), SEEK_SET) != 0 ||
-        fwrite(&db_file->metadata[index], sizeof(struct pict_metadata), 1, db_file->fpdb) != 1) {
-        return ERR_IO;
-    }
-
     return 0;
 }
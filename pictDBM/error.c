@@ -18,6 +18,7 @@ const char * const ERROR_MESSAGES[] = {
         "Not implemented",
         "Existing picture ID",
         "Vips error",
+        "Inconsistent database",
         "Debug"
 };
 
@@ -24,6 +24,7 @@ enum error_codes {
     NOT_IMPLEMENTED,
     ERR_DUPLICATE_ID,
     ERR_VIPS,
+    ERR_CORRUPT_DATABASE,
     ERR_DEBUG
 };
 
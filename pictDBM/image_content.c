@@ -7,9 +7,30 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <vips/vips.h>
 
 #include "pictDB.h"
+#include "db_columns.h"
+#include "db_wal.h"
+#include "db_latch.h"
+#include "db_backend.h"
+#include "metrics.h"
+#include "trace.h"
+
+#define JPEG_MARKER 0xFF
+#define JPEG_SOI 0xD8
+#define JPEG_EOI 0xD9
+#define JPEG_SOS 0xDA
+#define JPEG_TEM 0x01
+#define JPEG_RST0 0xD0
+#define JPEG_RST7 0xD7
+#define JPEG_SOF0 0xC0
+#define JPEG_SOF15 0xCF
+#define JPEG_DHT 0xC4
+#define JPEG_JPG 0xC8
+#define JPEG_DAC 0xCC
+#define JPEG_SOF_LEN 7 // segment length, precision, height, width
 
 /********************************************************************//**
  * Compute the aspect ratio from given sizes.
@@ -23,7 +44,43 @@ static inline double resize_ratio(unsigned int current_width, unsigned int curre
 }
 
 /********************************************************************//**
- * Resize given picture in given resolution on the need.
+ * Appends the resized image of a slot and points the slot to it, unless
+ * the slot changed since copy was taken: another thread resized it, or
+ * the picture is gone. Requires the writer lock.
+ */
+static int append_resized(unsigned int res, struct pictdb_file *db_file, uint32_t index,
+                          const struct pict_metadata *copy, const void *image, size_t len)
+{
+    struct pict_metadata *pict = &db_file->metadata[index];
+    if (pict->is_valid == EMPTY || pict->offset[RES_ORIG] != copy->offset[RES_ORIG] ||
+        memcmp(pict->SHA, copy->SHA, SHA256_DIGEST_LENGTH)) {
+        return ERR_INVALID_PICID;
+    }
+    if (pict->offset[res] != 0) {
+        return 0;
+    }
+
+    // readers read the image as soon as the slot points to it
+    uint64_t end_offset = 0;
+    if (backend_append(db_file, image, len, &end_offset) != 0 || backend_flush(db_file, 0) != 0) {
+        return ERR_IO;
+    }
+
+    latch_slot_begin(db_file, index);
+    pict->offset[res] = end_offset;
+    pict->size[res] = (uint32_t) len;
+    latch_slot_end(db_file, index);
+
+    latch_tables_begin(db_file);
+    columns_update(db_file, index);
+    latch_tables_end(db_file);
+
+    return wal_log(db_file, index);
+}
+
+/********************************************************************//**
+ * Resize given picture in given resolution on the need. The original is
+ * read and resized without the writer lock, taken only for the append.
  */
 int lazy_resize(unsigned int res, struct pictdb_file *db_file, size_t index)
 {
@@ -37,20 +94,22 @@ int lazy_resize(unsigned int res, struct pictdb_file *db_file, size_t index)
         return ERR_INVALID_ARGUMENT;
     }
 
-    if (db_file->fpdb == NULL) {
+    if (db_file->backend == NULL) {
         return ERR_IO;
     }
 
-    if (db_file->metadata[index].is_valid == EMPTY) {
+    struct pict_metadata pict;
+    if (latch_read_slot(db_file, (uint32_t) index, &pict) != 0) {
         return ERR_INVALID_PICID;
     }
 
     // If the image_in already exists just returns
-    if (db_file->metadata[index].offset[res] != 0) {
+    if (pict.offset[res] != 0) {
         return 0;
     }
 
-    size_t image_size = db_file->metadata[index].size[RES_ORIG];
+    const uint64_t start_us = metrics_now_us();
+    size_t image_size = pict.size[RES_ORIG];
 
     void *image_in = malloc(image_size);
     if (image_in == NULL) {
@@ -59,55 +118,44 @@ int lazy_resize(unsigned int res, struct pictdb_file *db_file, size_t index)
 
     int status = 0;
 
-    if (fseek(db_file->fpdb, (long) db_file->metadata[index].offset[RES_ORIG], SEEK_SET) != 0 ||
-        fread(image_in, image_size, 1, db_file->fpdb) != 1) {
+    TRACE_START(load_us);
+    if (backend_read(db_file, pict.offset[RES_ORIG], image_in, image_size) != 0) {
 
         status = ERR_IO;
 
     } else {
+        TRACE_STOP(TRACE_RESIZE_LOAD, load_us);
 
         VipsObject *process = VIPS_OBJECT(vips_image_new());
-        double ratio = resize_ratio(db_file->metadata[index].res_orig[0],
-                                    db_file->metadata[index].res_orig[1],
+        double ratio = resize_ratio(pict.res_orig[0],
+                                    pict.res_orig[1],
                                     db_file->header.res_resized[2 * res],
                                     db_file->header.res_resized[2 * res + 1]);
 
         VipsImage **vips_in_image = (VipsImage **) vips_object_local_array(process, 1);
         VipsImage **vips_out_image = (VipsImage **) vips_object_local_array(process, 1);
 
-        long end_offset = 0;
         size_t res_len = 0;
         void *image_out = NULL;
 
+        TRACE_START(encode_us);
         if (vips_jpegload_buffer(image_in, image_size, vips_in_image, NULL) != 0 ||
             vips_resize(*vips_in_image, vips_out_image, ratio, NULL) != 0 ||
             vips_jpegsave_buffer(*vips_out_image, &image_out, &res_len, NULL) != 0) {
-
             status = ERR_VIPS;
+        }
+        TRACE_STOP(TRACE_RESIZE_ENCODE, encode_us);
 
-        } else if (fseek(db_file->fpdb, 0, SEEK_END) != 0 ||
-                   (end_offset = ftell(db_file->fpdb)) == -1 ||
-                   fwrite(image_out, res_len, 1, db_file->fpdb) != 1) {
-
-            status = ERR_IO;
-
-        } else {
-
-            db_file->metadata[index].offset[res] = (uint64_t) end_offset;
-            db_file->metadata[index].size[res] = (uint32_t) res_len;
-
-            if (fseek(db_file->fpdb, 0, SEEK_SET) != 0 ||
-                fwrite(&db_file->header, sizeof(struct pictdb_header), 1, db_file->fpdb) != 1) {
-
-                status = ERR_IO;
-
-                // The metadata is after the header and then at the position idx * size(metadata)
-                // Note that we start at SEEK_CUR to avoid adding the size of the header
-            } else if (fseek(db_file->fpdb, (long) (index * sizeof(struct pict_metadata)), SEEK_CUR) != 0 ||
-                       fwrite(&db_file->metadata[index], sizeof(struct pict_metadata), 1, db_file->fpdb) != 1) {
+        TRACE_START(append_us);
+        if (status == 0) {
+            latch_lock(db_file);
+            status = append_resized(res, db_file, (uint32_t) index, &pict, image_out, res_len);
+            latch_unlock(db_file);
+        }
 
-                status = ERR_IO;
-            }
+        if (status == 0) {
+            TRACE_STOP(TRACE_RESIZE_APPEND, append_us);
+            metrics_resize(res, metrics_now_us() - start_us);
         }
 
         g_free(image_out);
@@ -146,3 +194,59 @@ int get_resolution(uint32_t *height, uint32_t *width, const char *image_buffer,
 
     return status;
 }
+
+/********************************************************************//**
+ * Returns resolution from the frame header of a JPEG image in a database.
+ * Marker segments are skipped by their length, so only a few bytes of
+ * each are read, whatever the size of the image.
+ */
+int get_file_resolution(uint32_t *height, uint32_t *width, const struct pictdb_file *db_file, uint64_t offset,
+                        uint64_t size)
+{
+    M_REQUIRE_NON_NULL(height);
+    M_REQUIRE_NON_NULL(width);
+    M_REQUIRE_NON_NULL(db_file);
+
+    unsigned char bytes[JPEG_SOF_LEN];
+    const uint64_t end = offset + size;
+
+    if (size < 2 || backend_read(db_file, offset, bytes, 2) != 0 ||
+        bytes[0] != JPEG_MARKER || bytes[1] != JPEG_SOI) {
+        return ERR_VIPS;
+    }
+
+    uint64_t pos = offset + 2;
+    while (pos + 2 <= end) {
+        if (backend_read(db_file, pos, bytes, 2) != 0 || bytes[0] != JPEG_MARKER) {
+            return ERR_VIPS;
+        }
+
+        const unsigned char marker = bytes[1];
+        if (marker == JPEG_MARKER) {
+            // fill byte
+            pos += 1;
+            continue;
+        }
+        pos += 2;
+        if (marker == JPEG_TEM || (marker >= JPEG_RST0 && marker <= JPEG_RST7)) {
+            continue;
+        }
+        if (marker == JPEG_EOI || marker == JPEG_SOS || pos + JPEG_SOF_LEN > end) {
+            // no frame header before the image data
+            return ERR_VIPS;
+        }
+
+        if (backend_read(db_file, pos, bytes, JPEG_SOF_LEN) != 0) {
+            return ERR_VIPS;
+        }
+        if (marker >= JPEG_SOF0 && marker <= JPEG_SOF15 &&
+            marker != JPEG_DHT && marker != JPEG_JPG && marker != JPEG_DAC) {
+            *height = (uint32_t) bytes[3] << 8 | bytes[4];
+            *width = (uint32_t) bytes[5] << 8 | bytes[6];
+            return 0;
+        }
+        pos += (uint64_t) bytes[0] << 8 | bytes[1];
+    }
+
+    return ERR_VIPS;
+}
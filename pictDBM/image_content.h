@@ -31,4 +31,17 @@ int lazy_resize(unsigned int res, struct pictdb_file *db_file, size_t index);
  */
 int get_resolution(uint32_t* height, uint32_t* width, const char* image_buffer, size_t image_size);
 
+/**
+ * @brief Gets the resolution of a JPEG image stored in a database, reading
+ *        only its marker segments up to the frame header.
+ *
+ * @param height image height
+ * @param width image width
+ * @param db_file database holding the image
+ * @param offset position of the image in the database
+ * @param size size of the image
+ */
+int get_file_resolution(uint32_t* height, uint32_t* width, const struct pictdb_file* db_file, uint64_t offset,
+                        uint64_t size);
+
 #endif
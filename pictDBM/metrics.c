@@ -0,0 +1,414 @@
+/**
+ * @file metrics.c
+ * @implementation of the per-thread counters and their Prometheus export
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "metrics.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+#define METRICS_LINE_MAX 256
+#define METRICS_OTHER_CODE 0
+
+static const char *const ROUTE_NAMES[NB_METRICS_ROUTES] = {
+    [METRICS_ROUTE_LIST] = "list",
+    [METRICS_ROUTE_READ] = "read",
+    [METRICS_ROUTE_READ_BATCH] = "read_batch",
+    [METRICS_ROUTE_SPRITE] = "sprite",
+    [METRICS_ROUTE_INSERT] = "insert",
+    [METRICS_ROUTE_DELETE] = "delete",
+    [METRICS_ROUTE_QUERY] = "query",
+    [METRICS_ROUTE_METRICS] = "metrics",
+    [METRICS_ROUTE_STATIC] = "static"
+};
+
+static const char *const CACHE_NAMES[NB_METRICS_CACHES] = {
+    [METRICS_CACHE_LIST] = "list",
+    [METRICS_CACHE_SPRITE] = "sprite"
+};
+
+static const char *const RES_NAMES[NB_RES] = {
+    [RES_THUMB] = NAME_RES_THUMBNAIL,
+    [RES_SMALL] = NAME_RES_SMALL,
+    [RES_ORIG] = NAME_RES_ORIGINAL
+};
+
+// status codes sent by the server, others are counted as "other"
+static const int CODES[] = {200, 206, 302, 304, 404, 411, 416, 500, METRICS_OTHER_CODE};
+#define NB_CODES (sizeof(CODES) / sizeof(CODES[0]))
+
+/**
+ * @brief Latency histogram with log-linear buckets: two per power of two.
+ */
+struct histogram {
+    uint64_t buckets[METRICS_BUCKETS + 1]; /**< counts, the last one past all bounds */
+    uint64_t sum_us; /**< sum of the recorded values */
+};
+
+/**
+ * @brief Counters of one thread. Only that thread writes them.
+ */
+struct metrics_shard {
+    uint64_t requests[NB_METRICS_ROUTES][NB_CODES]; /**< requests by route and status code */
+    struct histogram latency[NB_METRICS_ROUTES]; /**< request latency by route */
+    uint64_t bytes_received; /**< bytes read from clients */
+    uint64_t bytes_sent; /**< bytes written to clients */
+    int64_t connections; /**< opened minus closed connections */
+    uint64_t resizes[NB_RES]; /**< resolutions created */
+    struct histogram resize_latency[NB_RES]; /**< resize latency by resolution */
+    uint64_t cache_hits[NB_METRICS_CACHES]; /**< lookups served from a cache */
+    uint64_t cache_misses[NB_METRICS_CACHES]; /**< lookups rebuilding an entry */
+    uint64_t dedup_hits; /**< insertions sharing an existing image */
+    struct metrics_shard *next; /**< shard of another thread */
+};
+
+/**
+ * @brief Chunked text output handed to a writer.
+ */
+struct metrics_output {
+    char chunk[LIST_CHUNK]; /**< pending output */
+    size_t len; /**< bytes pending */
+    list_writer writer; /**< chunk output */
+    void *arg; /**< writer argument */
+    int status; /**< first error returned by the writer */
+};
+
+static struct metrics_shard *s_shards = NULL;
+static __thread struct metrics_shard *t_shard = NULL;
+
+/********************************************************************//**
+ * Monotonic time in microseconds.
+ */
+uint64_t metrics_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+/********************************************************************//**
+ * Returns the shard of the calling thread, registering it on first use.
+ * Shards are pushed on the list with a compare and swap and live as long
+ * as the process. NULL if out of memory: the value is then not recorded.
+ */
+static struct metrics_shard *shard(void)
+{
+    if (t_shard == NULL) {
+        struct metrics_shard *mine = calloc(1, sizeof(struct metrics_shard));
+        if (mine == NULL) {
+            return NULL;
+        }
+
+        mine->next = __atomic_load_n(&s_shards, __ATOMIC_ACQUIRE);
+        while (!__atomic_compare_exchange_n(&s_shards, &mine->next, mine, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+            // mine->next was reloaded by the failed exchange
+        }
+        t_shard = mine;
+    }
+    return t_shard;
+}
+
+/********************************************************************//**
+ * Adds to a counter of the own shard; single writer, so a relaxed store
+ * is enough for scrapes to never see a torn value.
+ */
+static void add(uint64_t *counter, uint64_t value)
+{
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+/********************************************************************//**
+ * Reads a counter of any shard.
+ */
+static uint64_t load(const uint64_t *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/********************************************************************//**
+ * Bucket of a latency: v < 2 goes to 0, then [2^e, 1.5 * 2^e) and
+ * [1.5 * 2^e, 2^(e+1)) get one bucket each.
+ */
+static size_t bucket_of(uint64_t value_us)
+{
+    if (value_us < 2) {
+        return 0;
+    }
+
+    const size_t e = (size_t) (63 - __builtin_clzll(value_us));
+    const size_t index = 2 * e - 1 + ((value_us >> (e - 1)) & 1);
+    return index < METRICS_BUCKETS ? index : METRICS_BUCKETS;
+}
+
+/********************************************************************//**
+ * Exclusive upper bound of a bucket, in microseconds.
+ */
+static uint64_t bucket_bound(size_t index)
+{
+    if (index == 0) {
+        return 2;
+    }
+
+    const size_t e = (index + 1) / 2;
+    return index % 2 == 1 ? (UINT64_C(3) << e) / 2 : UINT64_C(1) << (e + 1);
+}
+
+/********************************************************************//**
+ * Records a value in a histogram of the own shard.
+ */
+static void histogram_record(struct histogram *histogram, uint64_t value_us)
+{
+    add(&histogram->buckets[bucket_of(value_us)], 1);
+    add(&histogram->sum_us, value_us);
+}
+
+void metrics_request(enum metrics_route route, int code, uint64_t duration_us)
+{
+    struct metrics_shard *mine = shard();
+    if (mine == NULL || route >= NB_METRICS_ROUTES) {
+        return;
+    }
+
+    size_t index = 0;
+    while (index + 1 < NB_CODES && CODES[index] != code) {
+        ++index;
+    }
+    add(&mine->requests[route][index], 1);
+    histogram_record(&mine->latency[route], duration_us);
+}
+
+void metrics_bytes(uint64_t received, uint64_t sent)
+{
+    struct metrics_shard *mine = shard();
+    if (mine != NULL) {
+        add(&mine->bytes_received, received);
+        add(&mine->bytes_sent, sent);
+    }
+}
+
+void metrics_connection(int delta)
+{
+    struct metrics_shard *mine = shard();
+    if (mine != NULL) {
+        __atomic_store_n(&mine->connections, mine->connections + delta, __ATOMIC_RELAXED);
+    }
+}
+
+void metrics_resize(unsigned int res, uint64_t duration_us)
+{
+    struct metrics_shard *mine = shard();
+    if (mine != NULL && res < NB_RES) {
+        add(&mine->resizes[res], 1);
+        histogram_record(&mine->resize_latency[res], duration_us);
+    }
+}
+
+void metrics_cache(enum metrics_cache cache, int hit)
+{
+    struct metrics_shard *mine = shard();
+    if (mine != NULL && cache < NB_METRICS_CACHES) {
+        add(hit ? &mine->cache_hits[cache] : &mine->cache_misses[cache], 1);
+    }
+}
+
+void metrics_dedup_hit(void)
+{
+    struct metrics_shard *mine = shard();
+    if (mine != NULL) {
+        add(&mine->dedup_hits, 1);
+    }
+}
+
+/********************************************************************//**
+ * Adds the histogram of a shard to a total.
+ */
+static void histogram_sum(struct histogram *total, const struct histogram *histogram)
+{
+    for (size_t i = 0; i <= METRICS_BUCKETS; ++i) {
+        total->buckets[i] += load(&histogram->buckets[i]);
+    }
+    total->sum_us += load(&histogram->sum_us);
+}
+
+/********************************************************************//**
+ * Sums all shards in total.
+ */
+static void shards_sum(struct metrics_shard *total)
+{
+    memset(total, 0, sizeof(struct metrics_shard));
+
+    for (const struct metrics_shard *s = __atomic_load_n(&s_shards, __ATOMIC_ACQUIRE); s != NULL; s = s->next) {
+        for (size_t r = 0; r < NB_METRICS_ROUTES; ++r) {
+            for (size_t c = 0; c < NB_CODES; ++c) {
+                total->requests[r][c] += load(&s->requests[r][c]);
+            }
+            histogram_sum(&total->latency[r], &s->latency[r]);
+        }
+        for (size_t r = 0; r < NB_RES; ++r) {
+            total->resizes[r] += load(&s->resizes[r]);
+            histogram_sum(&total->resize_latency[r], &s->resize_latency[r]);
+        }
+        for (size_t c = 0; c < NB_METRICS_CACHES; ++c) {
+            total->cache_hits[c] += load(&s->cache_hits[c]);
+            total->cache_misses[c] += load(&s->cache_misses[c]);
+        }
+        total->bytes_received += load(&s->bytes_received);
+        total->bytes_sent += load(&s->bytes_sent);
+        total->connections += __atomic_load_n(&s->connections, __ATOMIC_RELAXED);
+        total->dedup_hits += load(&s->dedup_hits);
+    }
+}
+
+/********************************************************************//**
+ * Appends a formatted line to the output.
+ */
+static void output_printf(struct metrics_output *out, const char *format, ...)
+{
+    if (out->len + METRICS_LINE_MAX > LIST_CHUNK && out->status == 0) {
+        out->status = out->writer(out->arg, out->chunk, out->len);
+        out->len = 0;
+    }
+
+    va_list args;
+    va_start(args, format);
+    const int len = vsnprintf(out->chunk + out->len, METRICS_LINE_MAX, format, args);
+    va_end(args);
+
+    if (len > 0) {
+        out->len += (size_t) len < METRICS_LINE_MAX ? (size_t) len : METRICS_LINE_MAX - 1;
+    }
+}
+
+/********************************************************************//**
+ * Outputs a histogram with the given label, e.g. route="list".
+ */
+static void output_histogram(struct metrics_output *out, const char *name, const char *label,
+                             const struct histogram *histogram)
+{
+    uint64_t count = 0;
+    for (size_t i = 0; i < METRICS_BUCKETS; ++i) {
+        count += histogram->buckets[i];
+        output_printf(out, "%s_bucket{%s,le=\"%.6f\"} %" PRIu64 "\n", name, label,
+                      (double) bucket_bound(i) / 1e6, count);
+    }
+    count += histogram->buckets[METRICS_BUCKETS];
+    output_printf(out, "%s_bucket{%s,le=\"+Inf\"} %" PRIu64 "\n", name, label, count);
+    output_printf(out, "%s_sum{%s} %.6f\n", name, label, (double) histogram->sum_us / 1e6);
+    output_printf(out, "%s_count{%s} %" PRIu64 "\n", name, label, count);
+}
+
+int metrics_format(list_writer writer, void *arg)
+{
+    M_REQUIRE_NON_NULL(writer);
+
+    struct metrics_shard *total = malloc(sizeof(struct metrics_shard));
+    struct metrics_output *out = malloc(sizeof(struct metrics_output));
+    if (total == NULL || out == NULL) {
+        free(total);
+        free(out);
+        return ERR_OUT_OF_MEMORY;
+    }
+    shards_sum(total);
+    out->len = 0;
+    out->writer = writer;
+    out->arg = arg;
+    out->status = 0;
+
+    char label[METRICS_LINE_MAX];
+
+    output_printf(out, "# HELP pictdb_http_requests_total HTTP requests by route and status code.\n");
+    output_printf(out, "# TYPE pictdb_http_requests_total counter\n");
+    for (size_t r = 0; r < NB_METRICS_ROUTES; ++r) {
+        for (size_t c = 0; c < NB_CODES; ++c) {
+            if (total->requests[r][c] == 0) {
+                continue;
+            }
+            if (CODES[c] == METRICS_OTHER_CODE) {
+                output_printf(out, "pictdb_http_requests_total{route=\"%s\",code=\"other\"} %" PRIu64 "\n",
+                              ROUTE_NAMES[r], total->requests[r][c]);
+            } else {
+                output_printf(out, "pictdb_http_requests_total{route=\"%s\",code=\"%d\"} %" PRIu64 "\n",
+                              ROUTE_NAMES[r], CODES[c], total->requests[r][c]);
+            }
+        }
+    }
+
+    output_printf(out, "# HELP pictdb_http_request_duration_seconds Time to handle a request, by route.\n");
+    output_printf(out, "# TYPE pictdb_http_request_duration_seconds histogram\n");
+    for (size_t r = 0; r < NB_METRICS_ROUTES; ++r) {
+        uint64_t requests = 0;
+        for (size_t c = 0; c < NB_CODES; ++c) {
+            requests += total->requests[r][c];
+        }
+        if (requests == 0) {
+            // routes never hit would only add empty buckets
+            continue;
+        }
+        snprintf(label, sizeof(label), "route=\"%s\"", ROUTE_NAMES[r]);
+        output_histogram(out, "pictdb_http_request_duration_seconds", label, &total->latency[r]);
+    }
+
+    output_printf(out, "# HELP pictdb_http_received_bytes_total Bytes read from clients.\n");
+    output_printf(out, "# TYPE pictdb_http_received_bytes_total counter\n");
+    output_printf(out, "pictdb_http_received_bytes_total %" PRIu64 "\n", total->bytes_received);
+    output_printf(out, "# HELP pictdb_http_sent_bytes_total Bytes written to clients.\n");
+    output_printf(out, "# TYPE pictdb_http_sent_bytes_total counter\n");
+    output_printf(out, "pictdb_http_sent_bytes_total %" PRIu64 "\n", total->bytes_sent);
+    output_printf(out, "# HELP pictdb_http_connections Connections currently open.\n");
+    output_printf(out, "# TYPE pictdb_http_connections gauge\n");
+    output_printf(out, "pictdb_http_connections %" PRId64 "\n", total->connections);
+
+    output_printf(out, "# HELP pictdb_resizes_total Resolutions created from originals.\n");
+    output_printf(out, "# TYPE pictdb_resizes_total counter\n");
+    for (size_t r = 0; r < NB_RES; ++r) {
+        if (r != RES_ORIG) {
+            output_printf(out, "pictdb_resizes_total{res=\"%s\"} %" PRIu64 "\n", RES_NAMES[r], total->resizes[r]);
+        }
+    }
+    output_printf(out, "# HELP pictdb_resize_duration_seconds Time to create a resolution.\n");
+    output_printf(out, "# TYPE pictdb_resize_duration_seconds histogram\n");
+    for (size_t r = 0; r < NB_RES; ++r) {
+        if (r != RES_ORIG) {
+            snprintf(label, sizeof(label), "res=\"%s\"", RES_NAMES[r]);
+            output_histogram(out, "pictdb_resize_duration_seconds", label, &total->resize_latency[r]);
+        }
+    }
+
+    output_printf(out, "# HELP pictdb_cache_requests_total Cache lookups by result.\n");
+    output_printf(out, "# TYPE pictdb_cache_requests_total counter\n");
+    for (size_t c = 0; c < NB_METRICS_CACHES; ++c) {
+        output_printf(out, "pictdb_cache_requests_total{cache=\"%s\",result=\"hit\"} %" PRIu64 "\n",
+                      CACHE_NAMES[c], total->cache_hits[c]);
+        output_printf(out, "pictdb_cache_requests_total{cache=\"%s\",result=\"miss\"} %" PRIu64 "\n",
+                      CACHE_NAMES[c], total->cache_misses[c]);
+    }
+    output_printf(out, "# HELP pictdb_cache_hit_ratio Share of cache lookups served without rebuilding.\n");
+    output_printf(out, "# TYPE pictdb_cache_hit_ratio gauge\n");
+    for (size_t c = 0; c < NB_METRICS_CACHES; ++c) {
+        const uint64_t lookups = total->cache_hits[c] + total->cache_misses[c];
+        output_printf(out, "pictdb_cache_hit_ratio{cache=\"%s\"} %.4f\n", CACHE_NAMES[c],
+                      lookups == 0 ? 0.0 : (double) total->cache_hits[c] / (double) lookups);
+    }
+
+    output_printf(out, "# HELP pictdb_dedup_hits_total Insertions sharing an already stored image.\n");
+    output_printf(out, "# TYPE pictdb_dedup_hits_total counter\n");
+    output_printf(out, "pictdb_dedup_hits_total %" PRIu64 "\n", total->dedup_hits);
+
+    if (out->status == 0 && out->len > 0) {
+        out->status = writer(arg, out->chunk, out->len);
+    }
+
+    const int status = out->status;
+    free(total);
+    free(out);
+    return status;
+}
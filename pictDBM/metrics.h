@@ -0,0 +1,104 @@
+/**
+ * @file metrics.h
+ * @brief pictDB library: process wide counters exported in Prometheus
+ *        text format.
+ *
+ * Each thread records into its own shard, registered on first use, so
+ * that recording takes no lock; shards are summed when scraped.
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#ifndef PICTDBPRJ_METRICS_H
+#define PICTDBPRJ_METRICS_H
+
+#include "pictDB.h"
+
+#define METRICS_BUCKETS 47 // latency buckets, the last ones up to ~16.7s, then +Inf
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Server routes, in metric label order.
+ */
+enum metrics_route {
+    METRICS_ROUTE_LIST,
+    METRICS_ROUTE_READ,
+    METRICS_ROUTE_READ_BATCH,
+    METRICS_ROUTE_SPRITE,
+    METRICS_ROUTE_INSERT,
+    METRICS_ROUTE_DELETE,
+    METRICS_ROUTE_QUERY,
+    METRICS_ROUTE_METRICS,
+    METRICS_ROUTE_STATIC,
+    NB_METRICS_ROUTES
+};
+
+/**
+ * @brief Server caches, in metric label order.
+ */
+enum metrics_cache {
+    METRICS_CACHE_LIST,
+    METRICS_CACHE_SPRITE,
+    NB_METRICS_CACHES
+};
+
+/**
+ * @brief Monotonic time in microseconds.
+ */
+uint64_t metrics_now_us(void);
+
+/**
+ * @brief Records a served request.
+ *
+ * @param route Route of the request.
+ * @param code HTTP status code of the response.
+ * @param duration_us Time taken to handle the request.
+ */
+void metrics_request(enum metrics_route route, int code, uint64_t duration_us);
+
+/**
+ * @brief Records bytes received from or sent to clients.
+ */
+void metrics_bytes(uint64_t received, uint64_t sent);
+
+/**
+ * @brief Records an opened (delta 1) or closed (delta -1) connection.
+ */
+void metrics_connection(int delta);
+
+/**
+ * @brief Records the creation of a resolution.
+ *
+ * @param res Created resolution.
+ * @param duration_us Time taken to resize and store it.
+ */
+void metrics_resize(unsigned int res, uint64_t duration_us);
+
+/**
+ * @brief Records a lookup in one of the server caches.
+ */
+void metrics_cache(enum metrics_cache cache, int hit);
+
+/**
+ * @brief Records an insertion whose content was already stored.
+ */
+void metrics_dedup_hit(void);
+
+/**
+ * @brief Sums the shards of all threads and streams them in Prometheus
+ *        text exposition format.
+ *
+ * @param writer Receives the output chunks.
+ * @param arg Opaque argument passed to writer.
+ */
+int metrics_format(list_writer writer, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
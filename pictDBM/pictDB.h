@@ -23,7 +23,9 @@
                     */
 #include <stdio.h> // for FILE
 #include <stdint.h> // for uint32_t, uint64_t
+#include <sys/uio.h> // for struct iovec
 #include <openssl/sha.h> // for SHA256_DIGEST_LENGTH
+#include <openssl/evp.h> // for EVP_MD_CTX
 
 #define CAT_TXT "EPFL PictDB binary"
 
@@ -34,10 +36,16 @@
 #define MAX_THUMB_RES 128
 #define MAX_SMALL_RES 512
 #define MAX_CMD_ARGS 10
+#define MAX_QUERY_PREDICATES 8
 
 #define DEFAULT_MAX_FILES 10
 #define DEFAULT_THUMB_RES 64
 #define DEFAULT_SMALL_RES 256
+#define DEFAULT_GROUP_COMMIT 64 // mutations per commit for DURABILITY_BATCH
+#define DEFAULT_SYNC_INTERVAL 1000 // milliseconds between commits for DURABILITY_INTERVAL
+#define LIST_CHUNK 4096 // bytes per chunk of a streamed listing
+#define MAX_SPRITE_TILES 100 // thumbnails per sprite sheet
+#define UPLOAD_RESERVE_CHUNK (1 << 20) // bytes reserved at a time for a streamed image
 
 /* For is_valid in pictdb_metadata */
 #define EMPTY 0
@@ -102,13 +110,51 @@ struct pict_metadata {
     uint16_t unused_16; /**< unused or temporary information */
 };
 
+/**
+ * @brief When mutations are forced to disk (fdatasync).
+ */
+enum pictdb_durability {
+    DURABILITY_NONE, /**< never, the kernel writes back when it sees fit */
+    DURABILITY_BATCH, /**< every group_commit mutations */
+    DURABILITY_OPERATION, /**< before each mutation returns (default) */
+    DURABILITY_INTERVAL /**< at most every sync_interval milliseconds */
+};
+
+/**
+ * @brief Where the bytes of a database are kept, see db_backend.h.
+ */
+enum pictdb_storage {
+    STORAGE_FILE, /**< the database file, read with pread() (default) */
+    STORAGE_MMAP, /**< the database file, read through a shared mapping */
+    STORAGE_MEMORY /**< memory only, dropped on close */
+};
+
+struct pictdb_index;
+struct pictdb_columns;
+struct pictdb_wal;
+struct pictdb_latch;
+struct pictdb_share;
+struct pictdb_io;
+struct pictdb_backend;
+
 /**
  * @brief Store a database with its header and images.
  */
 struct pictdb_file {
-    FILE *fpdb; /**< disk file */
+    FILE *fpdb; /**< disk file, NULL for STORAGE_MEMORY */
     struct pictdb_header header; /**< database header */
     struct pict_metadata *metadata; /**< images metadata */
+    size_t map_size; /**< size of the header and metadata mapping, 0 if metadata is allocated */
+    struct pictdb_index *index; /**< persisted pict_id index, NULL if absent or stale */
+    struct pictdb_columns *columns; /**< columnar mirror of hot metadata, NULL until first scan */
+    struct pictdb_wal *wal; /**< write-ahead log, NULL for read-only databases */
+    enum pictdb_durability durability; /**< durability level of mutations */
+    uint32_t group_commit; /**< mutations per commit (DURABILITY_BATCH) */
+    uint32_t sync_interval; /**< milliseconds between commits (DURABILITY_INTERVAL) */
+    struct pictdb_latch *latch; /**< writer lock and slot sequences, see db_latch.h */
+    struct pictdb_share *share; /**< coordination with other processes, NULL if not shared */
+    struct pictdb_io *io; /**< io_uring of batched I/O, NULL if unavailable, see db_io.h */
+    struct pictdb_backend *backend; /**< reads and writes of the bytes, see db_backend.h */
 };
 
 /*
@@ -119,6 +165,118 @@ enum do_list_mode {
     JSON /**< json output */
 };
 
+/**
+ * @brief Receives the successive chunks of a streamed listing.
+ *
+ * @param arg Opaque argument given to do_list_json.
+ * @param chunk Bytes to output.
+ * @param len Number of bytes.
+ * @return 0 to continue, an error code to abort the listing.
+ */
+typedef int (*list_writer)(void *arg, const char *chunk, size_t len);
+
+/**
+ * @brief Receives the images of a batch read, in file order.
+ *
+ * @param arg Opaque argument given to do_read_batch.
+ * @param position Rank of the image identifier in the request.
+ * @param image Bytes of the image, only valid during the call.
+ * @param size Size of the image.
+ * @return 0 to continue, an error code to abort the batch.
+ */
+typedef int (*batch_reader)(void *arg, size_t position, const char *image, uint32_t size);
+
+/**
+ * @brief Page of a listing. Pictures are listed in slot order.
+ */
+struct list_page {
+    uint32_t cursor; /**< slot to start from (next_cursor of the previous page) */
+    uint32_t offset; /**< number of pictures to skip after the cursor */
+    uint32_t limit; /**< maximum number of pictures, 0 for no limit */
+    const char *prefix; /**< if set, only matching identifiers, listed in pict_id order */
+    const char *after; /**< identifier to resume after in pict_id order (replaces cursor) */
+};
+
+/**
+ * @brief Position of an image in the database file.
+ */
+struct pict_location {
+    uint64_t offset; /**< first byte of the image in the file */
+    uint32_t size; /**< image size */
+    unsigned char SHA[SHA256_DIGEST_LENGTH]; /**< hash of the original image */
+};
+
+/**
+ * @brief Thumbnail placed on a sprite sheet.
+ */
+struct sprite_tile {
+    char pict_id[MAX_PIC_ID + 1]; /**< picture identifier */
+    uint32_t x; /**< left of the thumbnail on the sheet, in pixels */
+    uint32_t y; /**< top of the thumbnail on the sheet, in pixels */
+    uint32_t width; /**< thumbnail width */
+    uint32_t height; /**< thumbnail height */
+};
+
+/**
+ * @brief Thumbnails of a page composed into a single JPEG image. Each
+ *        thumbnail lies at the top left of a cell of the thumbnail
+ *        resolution, cells fill rows of a near square grid.
+ */
+struct pictdb_sprite {
+    uint32_t db_version; /**< database version the sheet was built from */
+    int more; /**< whether pictures follow the page */
+    uint32_t next_cursor; /**< slot to start the next page from, if more */
+    uint32_t width; /**< sheet width */
+    uint32_t height; /**< sheet height */
+    size_t count; /**< number of tiles */
+    struct sprite_tile *tiles; /**< placement of each thumbnail, in slot order */
+    void *jpeg; /**< encoded sheet, NULL when count is 0 */
+    size_t jpeg_size; /**< size of jpeg */
+};
+
+/**
+ * @brief Range of picture identifiers, in pict_id (strcmp) order. Unset
+ *        (NULL) bounds do not restrict the range.
+ */
+struct pict_range {
+    const char *prefix; /**< identifiers starting with prefix */
+    const char *from; /**< identifiers not lower than from */
+    const char *to; /**< identifiers lower than to */
+    const char *after; /**< identifiers greater than after, to resume a listing */
+};
+
+/**
+ * @brief Metadata field tested by a query predicate.
+ */
+enum query_field {
+    QUERY_WIDTH, /**< original image width */
+    QUERY_HEIGHT, /**< original image height */
+    QUERY_SIZE, /**< byte size of a resolution, 0 when absent */
+    QUERY_OFFSET /**< position of a resolution, 0 when absent */
+};
+
+/**
+ * @brief Comparison of a query predicate.
+ */
+enum query_op {
+    QUERY_LT, /**< lower than */
+    QUERY_LE, /**< lower than or equal */
+    QUERY_EQ, /**< equal */
+    QUERY_NE, /**< not equal */
+    QUERY_GE, /**< greater than or equal */
+    QUERY_GT /**< greater than */
+};
+
+/**
+ * @brief Condition on one metadata field: "field op value".
+ */
+struct query_predicate {
+    enum query_field field; /**< tested field */
+    unsigned int res; /**< resolution of QUERY_SIZE and QUERY_OFFSET */
+    enum query_op op; /**< comparison */
+    uint64_t value; /**< compared value */
+};
+
 /**
  * @brief Prints database header information.
  *
@@ -140,6 +298,102 @@ void print_metadata(const struct pict_metadata *metadata);
  */
 char *do_list(const struct pictdb_file *db_file, enum do_list_mode mode);
 
+/**
+ * @brief Streams a page of pictDB metadata as JSON, without building the
+ *        document in memory: the writer receives chunks of at most
+ *        LIST_CHUNK bytes. The document ends with "next_cursor", the cursor
+ *        of the next page or null when the listing is over. For prefix
+ *        listings, it is the identifier to resume after.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param page Page to list, NULL for all pictures.
+ * @param writer Output of the chunks.
+ * @param arg Opaque argument passed to the writer.
+ */
+int do_list_json(const struct pictdb_file *db_file, const struct list_page *page, list_writer writer, void *arg);
+
+/**
+ * @brief Finds the pictures of a range of identifiers, in pict_id order.
+ *        With an up to date index (see do_index), this costs O(log n + k),
+ *        otherwise the metadata is scanned and the matches sorted.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param range Identifiers to find.
+ * @param slots Output array of metadata indexes.
+ * @param max_count Capacity of slots.
+ * @param count Set to the number of metadata indexes written.
+ */
+int do_find_range(const struct pictdb_file *db_file, const struct pict_range *range, uint32_t *slots,
+                  uint32_t max_count, uint32_t *count);
+
+/**
+ * @brief Finds the valid pictures satisfying all predicates, in slot order.
+ *        The scan runs over the columnar mirror, COLUMN_BLOCK slots at a
+ *        time, and never touches the metadata rows.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param predicates Conditions to satisfy (conjunction).
+ * @param count Number of predicates, 0 to find all pictures.
+ * @param from First slot to consider, to resume a query.
+ * @param slots Output array of metadata indexes.
+ * @param max_count Capacity of slots.
+ * @param found Set to the number of metadata indexes written.
+ */
+int do_query(struct pictdb_file *db_file, const struct query_predicate *predicates, size_t count, uint32_t from,
+             uint32_t *slots, uint32_t max_count, uint32_t *found);
+
+/**
+ * @brief Parses a predicate like "width>4000", "orig_size>=5000000" or
+ *        "thumb_size=0". Fields are width, height and <res>_size or
+ *        <res>_offset; operators are <, <=, =, !=, >= and >.
+ *
+ * @param expr The text of the predicate.
+ * @param predicate Set to the parsed predicate.
+ */
+int parse_predicate(const char *expr, struct query_predicate *predicate);
+
+/**
+ * @brief Streams as JSON the pictures satisfying all predicates, with
+ *        their sizes, like do_list_json. "next_cursor" is the slot to
+ *        resume from (from parameter of do_query), or null.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param predicates Conditions to satisfy (conjunction).
+ * @param count Number of predicates.
+ * @param page Page to list (cursor, offset and limit are used).
+ * @param writer Output of the chunks.
+ * @param arg Opaque argument passed to the writer.
+ */
+int do_query_json(struct pictdb_file *db_file, const struct query_predicate *predicates, size_t count,
+                  const struct list_page *page, list_writer writer, void *arg);
+
+/**
+ * @brief Composes the thumbnails of a page, in slot order, into a sprite
+ *        sheet. Missing thumbnails are created on the way.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param page Pictures to include: cursor, offset and limit (at most
+ *        MAX_SPRITE_TILES, 0 for that many). prefix and after are ignored.
+ * @param sprite Filled sheet, to be released with sprite_free.
+ */
+int do_sprite(struct pictdb_file *db_file, const struct list_page *page, struct pictdb_sprite *sprite);
+
+/**
+ * @brief Releases the content of a sprite sheet.
+ *
+ * @param sprite Sheet filled by do_sprite.
+ */
+void sprite_free(struct pictdb_sprite *sprite);
+
+/**
+ * @brief Streams the placement map of a sprite sheet as JSON.
+ *
+ * @param sprite Sheet filled by do_sprite.
+ * @param writer Receives the output chunks.
+ * @param arg Opaque argument passed to writer.
+ */
+int do_sprite_json(const struct pictdb_sprite *sprite, list_writer writer, void *arg);
+
 /**
  * @brief Creates the database called db_filename. Writes the header and the
  *        preallocated empty metadata array to database file.
@@ -149,7 +403,19 @@ char *do_list(const struct pictdb_file *db_file, enum do_list_mode mode);
 int do_create(const char *filename, struct pictdb_file *db_file);
 
 /**
- * @brief Opens given file, reads header and metadata.
+ * @brief Like do_create, keeping the bytes as storage tells. With
+ *        STORAGE_MEMORY, no file is created and filename is only checked.
+ *
+ * @param filename Name of the database file.
+ * @param storage Where the bytes are kept.
+ * @param db_file In memory structure with header and metadata.
+ */
+int do_create_storage(const char *filename, enum pictdb_storage storage, struct pictdb_file *db_file);
+
+/**
+ * @brief Opens given file, reads header and maps metadata. Metadata pages
+ *        are only read from disk when first accessed. Mutations left in the
+ *        write-ahead log by a crash are recovered.
  *
  * @param filename Name of file to be opened.
  * @param mode File mode to be used (e.g. "rb", "wb").
@@ -157,6 +423,66 @@ int do_create(const char *filename, struct pictdb_file *db_file);
  */
 int do_open(const char *filename, const char *mode, struct pictdb_file *db_file);
 
+/**
+ * @brief Like do_open, keeping the bytes as storage tells. STORAGE_MEMORY
+ *        loads a copy of the file, its log replayed, and never writes the
+ *        file back: mutations (if mode allows them) are dropped on close.
+ *
+ * @param filename Name of file to be opened.
+ * @param mode File mode to be used (e.g. "rb", "wb").
+ * @param storage Where the bytes are kept.
+ * @param db_file In memory structure with header and metadata.
+ */
+int do_open_storage(const char *filename, const char *mode, enum pictdb_storage storage,
+                    struct pictdb_file *db_file);
+
+/**
+ * @brief Sets the durability level honored by insert, delete, resize and
+ *        garbage collection.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param durability The durability level.
+ * @param param Batch size for DURABILITY_BATCH, interval in milliseconds for
+ *        DURABILITY_INTERVAL, ignored otherwise. 0 selects the default.
+ */
+int do_set_durability(struct pictdb_file *db_file, enum pictdb_durability durability, uint32_t param);
+
+/**
+ * @brief Makes all the mutations logged so far durable, whatever the
+ *        durability level.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+int do_sync(struct pictdb_file *db_file);
+
+/**
+ * @brief Makes pending mutations durable if the durability level requires
+ *        it by now. Long running processes call it when idle so that
+ *        DURABILITY_INTERVAL holds without further mutations.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+int do_sync_due(struct pictdb_file *db_file);
+
+/**
+ * @brief Shares an opened database with other processes (see db_share.h):
+ *        writers of all processes are serialized by a file lock, and the
+ *        other processes pick up their mutations with do_refresh().
+ *
+ * @param db_filename Name of the database file.
+ * @param db_file In memory structure with header and metadata.
+ */
+int do_share(const char *db_filename, struct pictdb_file *db_file);
+
+/**
+ * @brief Brings the metadata of a shared database up to date with the
+ *        mutations of the other processes. Costs a single load when there
+ *        are none; does nothing for a database that is not shared.
+ *
+ * @param db_file In memory structure with header and metadata.
+ */
+int do_refresh(struct pictdb_file *db_file);
+
 /**
  * @brief Closes file included in db_file.
  *
@@ -164,6 +490,37 @@ int do_open(const char *filename, const char *mode, struct pictdb_file *db_file)
  */
 void do_close(struct pictdb_file *db_file);
 
+/**
+ * @brief Finds the metadata index of a valid picture.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param pict_id Name of the image to find.
+ * @param index Set to the metadata index of the image when found.
+ * @return 0 on success, ERR_FILE_NOT_FOUND if no such image.
+ */
+int find_pict_index(const struct pictdb_file *db_file, const char *pict_id, uint32_t *index);
+
+/**
+ * @brief Builds the persisted pict_id index ("<db_filename>.idx") of an
+ *        opened database. It is then kept up to date by insert and delete.
+ *
+ * @param db_filename Name of the database file.
+ * @param db_file In memory structure with header and metadata.
+ */
+int do_index(const char *db_filename, struct pictdb_file *db_file);
+
+/**
+ * @brief Verifies the consistency of a database: image count, picture
+ *        identifiers, image positions and the SHA of every original image
+ *        (hashed in parallel). Problems are printed on stdout.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param repair Whether to drop broken pictures and fix the header.
+ * @param threads Number of hashing threads, 0 for one per online CPU.
+ * @return 0 if consistent (or repaired), ERR_CORRUPT_DATABASE otherwise.
+ */
+int do_check(struct pictdb_file *db_file, int repair, unsigned int threads);
+
 /**
  * @brief Deletes an image.
  *
@@ -191,6 +548,91 @@ int resolution_atoi(const char *resolution);
 int do_read(const char *pict_id, unsigned int res, char *image_buffer[], uint32_t *image_size,
             struct pictdb_file *db_file);
 
+/**
+ * @brief Reads an image into a buffer of the caller. Only the first
+ *        capacity bytes are read if the image is larger: a capacity of 0
+ *        queries the size, creating the resolution if needed like any
+ *        read (see do_stat to only look).
+ *
+ * @param pict_id Name of image to be read.
+ * @param res Integer representing the resolution of the image.
+ * @param buffer Output of capacity bytes, may be NULL if capacity is 0.
+ * @param capacity Size of buffer.
+ * @param image_size Set to the size of the whole image, larger than
+ *        capacity if the read was short.
+ * @param db_file In memory structure with header and metadata.
+ */
+int do_read_into(const char *pict_id, unsigned int res, char *buffer, size_t capacity, uint32_t *image_size,
+                 struct pictdb_file *db_file);
+
+/**
+ * @brief Like do_read_into, scattering the image over buffers filled in
+ *        turn.
+ *
+ * @param pict_id Name of image to be read.
+ * @param res Integer representing the resolution of the image.
+ * @param iov The buffers, their total size being the capacity.
+ * @param iovcnt Number of buffers.
+ * @param image_size Set to the size of the whole image.
+ * @param db_file In memory structure with header and metadata.
+ */
+int do_read_iov(const char *pict_id, unsigned int res, const struct iovec iov[], size_t iovcnt,
+                uint32_t *image_size, struct pictdb_file *db_file);
+
+/**
+ * @brief Tells where an image lies from the metadata alone: nothing is
+ *        read nor created.
+ *
+ * @param pict_id Name of image to look at.
+ * @param res Integer representing the resolution of the image.
+ * @param offset Set to the first byte of the image in the file, 0 if the
+ *        resolution does not exist yet.
+ * @param size Set to the image size, 0 if the resolution does not exist
+ *        yet.
+ * @param db_file In memory structure with header and metadata.
+ */
+int do_stat(const char *pict_id, unsigned int res, uint64_t *offset, uint32_t *size,
+            const struct pictdb_file *db_file);
+
+/**
+ * @brief Finds where an image lies in the database file, creating the
+ *        resolution if needed, without reading it.
+ *
+ * @param pict_id Name of image to be located.
+ * @param res Integer representing the resolution of the image.
+ * @param location Filled with the image position, size and SHA.
+ * @param db_file In memory structure with header and metadata.
+ */
+int do_locate(const char *pict_id, unsigned int res, struct pict_location *location, struct pictdb_file *db_file);
+
+/**
+ * @brief Reads length bytes of a located image from start, only those
+ *        bytes are read from disk.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param location Image position filled by do_locate.
+ * @param start First byte to read, relative to the image.
+ * @param length Number of bytes, start + length must not exceed the size.
+ * @param buffer Output of at least length bytes.
+ */
+int do_read_range(struct pictdb_file *db_file, const struct pict_location *location, uint64_t start,
+                  uint32_t length, char *buffer);
+
+/**
+ * @brief Reads several images at one resolution. Identifiers are resolved
+ *        in a single pass over the metadata, then images are read in file
+ *        order. Unknown identifiers are skipped.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param pict_ids Names of the images to be read, may repeat.
+ * @param count Number of names.
+ * @param res Integer representing the resolution of the images.
+ * @param reader Receives each image found.
+ * @param arg Opaque argument passed to reader.
+ */
+int do_read_batch(struct pictdb_file *db_file, const char *pict_ids[], size_t count, unsigned int res,
+                  batch_reader reader, void *arg);
+
 /**
  * @brief Inserts an image.
  *
@@ -201,6 +643,60 @@ int do_read(const char *pict_id, unsigned int res, char *image_buffer[], uint32_
  */
 int do_insert(const char image_buffer[], size_t image_size, const char *pict_id, struct pictdb_file *db_file);
 
+/**
+ * @brief Image streamed into a database, see do_insert_begin.
+ */
+struct pictdb_upload {
+    uint64_t offset; /**< position of the image in the database file */
+    uint64_t reserved; /**< bytes reserved at offset */
+    uint64_t size; /**< bytes written so far */
+    uint64_t max_size; /**< most bytes the image may take */
+    EVP_MD_CTX *sha; /**< running SHA-256 of the image */
+};
+
+/**
+ * @brief Starts streaming an image straight into the database file. Space
+ *        is reserved at the end of the file, UPLOAD_RESERVE_CHUNK bytes at
+ *        a time up to max_size, so that other writes (inserts, resized
+ *        images) go after it meanwhile. An image they catch up with is
+ *        moved to the end of the file.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param max_size Upper bound of the image size.
+ * @param upload Upload state, released by do_insert_end or do_insert_abort.
+ */
+int do_insert_begin(struct pictdb_file *db_file, uint64_t max_size, struct pictdb_upload *upload);
+
+/**
+ * @brief Writes the next bytes of a streamed image and hashes them.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param upload Upload state.
+ * @param data Next bytes of the image.
+ * @param len Number of bytes.
+ */
+int do_insert_append(struct pictdb_file *db_file, struct pictdb_upload *upload, const char *data, size_t len);
+
+/**
+ * @brief Commits a streamed image under pict_id, like do_insert. The
+ *        unused (or, for duplicated content, all the) reserved space is
+ *        given back when nothing was written after it. The upload state is
+ *        released whatever the outcome.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param upload Upload state.
+ * @param pict_id Name of the image.
+ */
+int do_insert_end(struct pictdb_file *db_file, struct pictdb_upload *upload, const char *pict_id);
+
+/**
+ * @brief Drops a streamed image and gives its space back when possible.
+ *
+ * @param db_file In memory structure with header and metadata.
+ * @param upload Upload state.
+ */
+void do_insert_abort(struct pictdb_file *db_file, struct pictdb_upload *upload);
+
 /**
  * @brief Garbage collector for pictDB files
  *
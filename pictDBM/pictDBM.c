@@ -10,6 +10,8 @@
 
 #include "pictDB.h"
 #include "pictDBM_tools.h"
+#include "trace.h"
+#include "dataset.h"
 
 #include <string.h>
 #include <vips/vips.h>
@@ -20,6 +22,21 @@
 #define CREATE_MAX_FILES "-max_files"
 #define CREATE_THUMB_RES "-thumb_res"
 #define CREATE_SMALL_RES "-small_res"
+#define CHECK_REPAIR "--repair"
+#define LIST_PREFIX "--prefix"
+#define TRACE_OPTION "--trace="
+#define GEN_SEED "-seed"
+#define GEN_WIDTH "-width"
+#define GEN_HEIGHT "-height"
+#define GEN_UNIFORM "-uniform"
+#define GEN_QUALITY "-quality"
+#define GEN_NOISE "-noise"
+#define GEN_DUPLICATES "-dup"
+#define GEN_IDS "-ids"
+#define GEN_FILES "-files"
+#define IDS_SEQUENTIAL "seq"
+#define IDS_RANDOM "random"
+#define IDS_ALBUMS "albums"
 
 #define IMG_EXT ".jpg"
 
@@ -36,6 +53,34 @@ struct command_mapping {
     command function; /**< command pointer function */
 };
 
+/********************************************************************//**
+ * Displays the pictures whose pictID starts with prefix, in pictID order.
+ ********************************************************************** */
+static int list_prefix(const struct pictdb_file *db_file, const char *prefix)
+{
+    uint32_t *slots = calloc(db_file->header.max_files + 1, sizeof(uint32_t));
+    if (slots == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    const struct pict_range range = {prefix, NULL, NULL, NULL};
+    uint32_t count = 0;
+    int status = do_find_range(db_file, &range, slots, db_file->header.max_files, &count);
+
+    if (status == 0) {
+        print_header(&db_file->header);
+        for (uint32_t i = 0; i < count; ++i) {
+            print_metadata(&db_file->metadata[slots[i]]);
+        }
+        if (count == 0) {
+            printf("<< no matching picture >>\n");
+        }
+    }
+
+    free(slots);
+    return status;
+}
+
 /********************************************************************//**
  * Opens pictDB file and calls do_list command.
  ********************************************************************** */
@@ -49,11 +94,26 @@ static int do_list_cmd(int argc, char *argv[])
     M_REQUIRE_VALID_FILENAME(argv[1]);
 
     const char *db_filename = argv[1];
+    const char *prefix = NULL;
+
+    if (argc > 2) {
+        if (argc < 4) {
+            return ERR_NOT_ENOUGH_ARGUMENTS;
+        }
+        M_REQUIRE_NON_NULL(argv[2]);
+        M_REQUIRE_NON_NULL(argv[3]);
+        if (strncmp(argv[2], LIST_PREFIX, CMDNAME_MAX) || strlen(argv[3]) > MAX_PIC_ID) {
+            return ERR_INVALID_ARGUMENT;
+        }
+        prefix = argv[3];
+    }
 
     struct pictdb_file myfile;
     int status = do_open(db_filename, "rb", &myfile);
 
-    if (status == 0) {
+    if (status == 0 && prefix != NULL) {
+        status = list_prefix(&myfile, prefix);
+    } else if (status == 0) {
         char *listing = do_list(&myfile, STDOUT);
         if (listing != NULL) {
             // should never happen
@@ -180,15 +240,105 @@ static int create_name(char *filename, const char *pic_id, unsigned int res)
     return 0;
 }
 
+/********************************************************************//**
+ * Opens pictDB file and calls do_check command.
+ ********************************************************************** */
+static int do_check_cmd(int argc, char *argv[])
+{
+    if (argc < 2) {
+        return ERR_NOT_ENOUGH_ARGUMENTS;
+    }
+
+    M_REQUIRE_NON_NULL(argv[1]);
+    M_REQUIRE_VALID_FILENAME(argv[1]);
+
+    const char *db_filename = argv[1];
+    int repair = 0;
+
+    if (argc > 2) {
+        M_REQUIRE_NON_NULL(argv[2]);
+        if (strncmp(argv[2], CHECK_REPAIR, CMDNAME_MAX)) {
+            return ERR_INVALID_ARGUMENT;
+        }
+        repair = 1;
+    }
+
+    struct pictdb_file db_file;
+    int status = do_open(db_filename, repair ? "r+b" : "rb", &db_file);
+
+    if (status == 0) {
+        status = do_check(&db_file, repair, 0);
+    }
+
+    do_close(&db_file);
+    return status;
+}
+
+/********************************************************************//**
+ * Opens pictDB file and displays the pictures satisfying all predicates.
+ ********************************************************************** */
+static int do_query_cmd(int argc, char *argv[])
+{
+    if (argc < 2) {
+        return ERR_NOT_ENOUGH_ARGUMENTS;
+    }
+    if (argc - 2 > MAX_QUERY_PREDICATES) {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    M_REQUIRE_NON_NULL(argv[1]);
+    M_REQUIRE_VALID_FILENAME(argv[1]);
+
+    const char *db_filename = argv[1];
+    struct query_predicate predicates[MAX_QUERY_PREDICATES];
+    const size_t count = (size_t) (argc - 2);
+
+    for (size_t i = 0; i < count; ++i) {
+        M_REQUIRE_NON_NULL(argv[i + 2]);
+        int status = parse_predicate(argv[i + 2], &predicates[i]);
+        if (status != 0) {
+            return status;
+        }
+    }
+
+    struct pictdb_file db_file;
+    int status = do_open(db_filename, "rb", &db_file);
+
+    uint32_t *slots = NULL;
+    if (status == 0) {
+        slots = calloc(db_file.header.max_files + 1, sizeof(uint32_t));
+        status = slots == NULL ? ERR_OUT_OF_MEMORY : 0;
+    }
+
+    uint32_t found = 0;
+    if (status == 0) {
+        status = do_query(&db_file, predicates, count, 0, slots, db_file.header.max_files, &found);
+    }
+
+    for (uint32_t i = 0; status == 0 && i < found; ++i) {
+        print_metadata(&db_file.metadata[slots[i]]);
+    }
+    if (status == 0) {
+        printf("%" PRIu32 " picture(s) found\n", found);
+    }
+
+    free(slots);
+    do_close(&db_file);
+    return status;
+}
+
 /********************************************************************//**
  * Displays some explanations.
  ********************************************************************** */
 static int help(int argc, char *argv[])
 {
     (void) argc, (void) argv;
-    puts("pictDBM [COMMAND] [ARGUMENTS]");
+    puts("pictDBM ["TRACE_OPTION"<sink>] [COMMAND] [ARGUMENTS]");
+    puts("  "TRACE_OPTION"<sink>: times the stages of the command and writes them to stderr.");
+    puts("      sinks are counters, ring (last events, CSV) and chrome (chrome://tracing JSON).");
     puts("  help: displays this help.");
-    puts("  list <dbfilename>: list pictDB content.");
+    puts("  list <dbfilename> ["LIST_PREFIX" <prefix>]: list pictDB content.");
+    puts("      "LIST_PREFIX" lists the pictIDs starting with prefix, in order.");
     puts("  create <dbfilename>: create a new pictDB.");
     puts("      options are:");
     puts("          "CREATE_MAX_FILES" <MAX_FILES>: maximum number of files.");
@@ -208,6 +358,27 @@ static int help(int argc, char *argv[])
     puts("  delete <dbfilename> <pictID>: delete picture pictID from pictDB.");
     puts("  gc <dbfilename> <tmp dbfilename>: performs garbage collecting on pictDB. "
          "Requires a temporary filename for copying the pictDB.");
+    puts("  index <dbfilename>: builds the pictID index of the pictDB to speed up lookups.");
+    puts("  query <dbfilename> [<predicate>...]: list the pictures satisfying all predicates.");
+    puts("      a predicate is <field><op><value>, e.g. width>4000 or thumb_size=0.");
+    puts("      fields are width, height, <res>_size and <res>_offset; ops are <, <=, =, !=, >=, >.");
+    puts("  check <dbfilename> ["CHECK_REPAIR"]: verifies the consistency of the pictDB.");
+    puts("      "CHECK_REPAIR" drops broken pictures and fixes the header.");
+    puts("  gen-dataset <dbfilename> <count> [options]: inserts count synthetic JPEG images, the same for a same seed.");
+    puts("      options are:");
+    printf("          "GEN_SEED" <SEED>: seed of the dataset, default value is %d.\n", DATASET_DEFAULT_SEED);
+    printf("          "GEN_WIDTH" <MIN> <MAX>: width range, default value is %d %d.\n", DATASET_DEFAULT_MIN_WIDTH,
+           DATASET_DEFAULT_MAX_WIDTH);
+    printf("          "GEN_HEIGHT" <MIN> <MAX>: height range, default value is %d %d.\n", DATASET_DEFAULT_MIN_HEIGHT,
+           DATASET_DEFAULT_MAX_HEIGHT);
+    puts("          "GEN_UNIFORM": uniform dimensions, instead of log-uniform (more small images).");
+    printf("          "GEN_QUALITY" <MIN> <MAX>: JPEG quality range, default value is %d %d.\n",
+           DATASET_DEFAULT_MIN_QUALITY, DATASET_DEFAULT_MAX_QUALITY);
+    printf("          "GEN_NOISE" <MIN> <MAX>: noise range, the larger the bigger the files, default value is %d %d.\n",
+           DATASET_DEFAULT_MIN_NOISE, DATASET_DEFAULT_MAX_NOISE);
+    puts("          "GEN_DUPLICATES" <PERCENT>: share of images repeating an earlier one, default value is 0.");
+    puts("          "GEN_IDS" "IDS_SEQUENTIAL"|"IDS_RANDOM"|"IDS_ALBUMS": pictIDs, default value is "IDS_SEQUENTIAL".");
+    puts("          "GEN_FILES": writes <pictID>"IMG_EXT" files in the directory <dbfilename> instead.");
     puts("  interpretor <dbfilename>: run an interpretor to perform above operations on a pictDB file.");
     return 0;
 }
@@ -300,7 +471,7 @@ static int read_disk_image(char *image_buffer[], uint32_t *image_size, const cha
 /********************************************************************//**
  * Writes image from buffer to disk.
  ********************************************************************** */
-static int write_disk_image(char image_buffer[], uint32_t image_size, const char *filename)
+static int write_disk_image(const char image_buffer[], uint32_t image_size, const char *filename)
 {
     M_REQUIRE_NON_NULL(image_buffer);
     M_REQUIRE_NON_NULL(filename);
@@ -422,6 +593,172 @@ static int do_read_cmd(int argc, char *argv[])
     return status;
 }
 
+/**
+ * @brief Destination of the generated dataset.
+ */
+struct dataset_target {
+    struct pictdb_file *db_file; /**< database to insert into, NULL when writing files */
+    const char *directory; /**< directory to write into */
+    uint32_t count; /**< images written */
+    uint32_t duplicates; /**< images repeating an earlier one */
+};
+
+/********************************************************************//**
+ * Inserts a generated image, or writes it to <directory>/<pictID>.jpg.
+ ********************************************************************** */
+static int write_dataset_image(void *arg, const char *pict_id, const char *image, size_t size, int duplicate)
+{
+    struct dataset_target *target = arg;
+    int status = 0;
+
+    if (size > UINT32_MAX) {
+        status = ERR_INVALID_ARGUMENT;
+    } else if (target->db_file != NULL) {
+        status = do_insert(image, size, pict_id, target->db_file);
+    } else {
+        char filename[FILENAME_MAX];
+        if (snprintf(filename, sizeof(filename), "%s/%s" IMG_EXT, target->directory, pict_id) >= FILENAME_MAX) {
+            status = ERR_INVALID_FILENAME;
+        } else {
+            status = write_disk_image(image, (uint32_t) size, filename);
+        }
+    }
+
+    if (status == 0) {
+        ++target->count;
+        target->duplicates += duplicate ? 1 : 0;
+    }
+    return status;
+}
+
+/********************************************************************//**
+ * Parses a range option value: <MIN> <MAX>.
+ ********************************************************************** */
+static int parse_range(int argc, char *argv[], int i, uint32_t max, uint32_t range[2])
+{
+    if (argc <= i + 2) {
+        return ERR_NOT_ENOUGH_ARGUMENTS;
+    }
+    range[0] = atouint32(argv[i + 1]);
+    range[1] = atouint32(argv[i + 2]);
+    return range[0] > range[1] || range[1] > max ? ERR_INVALID_ARGUMENT : 0;
+}
+
+/********************************************************************//**
+ * Generates a synthetic dataset into a pictDB file or a directory.
+ ********************************************************************** */
+static int do_gen_dataset_cmd(int argc, char *argv[])
+{
+    if (argc < 3) {
+        return ERR_NOT_ENOUGH_ARGUMENTS;
+    }
+
+    M_REQUIRE_NON_NULL(argv[1]);
+    M_REQUIRE_NON_NULL(argv[2]);
+    M_REQUIRE_VALID_FILENAME(argv[1]);
+
+    struct dataset_spec spec;
+    dataset_default(&spec, atouint32(argv[2]));
+    if (spec.count == 0) {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    struct dataset_target target = {NULL, NULL, 0, 0};
+    int files = 0;
+    uint32_t range[2] = {0, 0};
+    int status = 0;
+
+    int i = 3;
+    // we skip the function name and first two arguments
+    while (i < argc && status == 0) {
+        if (!strncmp(argv[i], GEN_SEED, CMDNAME_MAX)) {
+            if (argc <= i + 1) {
+                return ERR_NOT_ENOUGH_ARGUMENTS;
+            }
+            spec.seed = strtoull(argv[i + 1], NULL, 10);
+            i += 2;
+        } else if (!strncmp(argv[i], GEN_WIDTH, CMDNAME_MAX)) {
+            status = parse_range(argc, argv, i, DATASET_MAX_SIDE, range);
+            spec.width[0] = (uint16_t) range[0];
+            spec.width[1] = (uint16_t) range[1];
+            i += 3;
+        } else if (!strncmp(argv[i], GEN_HEIGHT, CMDNAME_MAX)) {
+            status = parse_range(argc, argv, i, DATASET_MAX_SIDE, range);
+            spec.height[0] = (uint16_t) range[0];
+            spec.height[1] = (uint16_t) range[1];
+            i += 3;
+        } else if (!strncmp(argv[i], GEN_UNIFORM, CMDNAME_MAX)) {
+            spec.dims = DATASET_DIMS_UNIFORM;
+            i += 1;
+        } else if (!strncmp(argv[i], GEN_QUALITY, CMDNAME_MAX)) {
+            status = parse_range(argc, argv, i, 100, range);
+            spec.quality[0] = (uint8_t) range[0];
+            spec.quality[1] = (uint8_t) range[1];
+            i += 3;
+        } else if (!strncmp(argv[i], GEN_NOISE, CMDNAME_MAX)) {
+            status = parse_range(argc, argv, i, DATASET_MAX_NOISE, range);
+            spec.noise[0] = (uint8_t) range[0];
+            spec.noise[1] = (uint8_t) range[1];
+            i += 3;
+        } else if (!strncmp(argv[i], GEN_DUPLICATES, CMDNAME_MAX)) {
+            if (argc <= i + 1) {
+                return ERR_NOT_ENOUGH_ARGUMENTS;
+            }
+            spec.duplicates = atouint32(argv[i + 1]);
+            i += 2;
+        } else if (!strncmp(argv[i], GEN_IDS, CMDNAME_MAX)) {
+            if (argc <= i + 1) {
+                return ERR_NOT_ENOUGH_ARGUMENTS;
+            }
+            if (!strncmp(argv[i + 1], IDS_SEQUENTIAL, CMDNAME_MAX)) {
+                spec.ids = DATASET_IDS_SEQUENTIAL;
+            } else if (!strncmp(argv[i + 1], IDS_RANDOM, CMDNAME_MAX)) {
+                spec.ids = DATASET_IDS_RANDOM;
+            } else if (!strncmp(argv[i + 1], IDS_ALBUMS, CMDNAME_MAX)) {
+                spec.ids = DATASET_IDS_ALBUMS;
+            } else {
+                return ERR_INVALID_ARGUMENT;
+            }
+            i += 2;
+        } else if (!strncmp(argv[i], GEN_FILES, CMDNAME_MAX)) {
+            files = 1;
+            i += 1;
+        } else {
+            return ERR_INVALID_ARGUMENT;
+        }
+    }
+    if (status != 0) {
+        return status;
+    }
+
+    struct pictdb_file db_file;
+    if (files) {
+        target.directory = argv[1];
+    } else {
+        status = do_open(argv[1], "r+b", &db_file);
+        if (status != 0) {
+            return status;
+        }
+        if (db_file.header.max_files - db_file.header.num_files < spec.count) {
+            do_close(&db_file);
+            return ERR_FULL_DATABASE;
+        }
+        // a bulk load: committing every DEFAULT_GROUP_COMMIT insertions is enough
+        status = do_set_durability(&db_file, DURABILITY_BATCH, DEFAULT_GROUP_COMMIT);
+        target.db_file = &db_file;
+    }
+
+    if (status == 0) {
+        status = dataset_generate(&spec, write_dataset_image, &target);
+    }
+    printf("%" PRIu32 " image(s) written, %" PRIu32 " duplicate(s)\n", target.count, target.duplicates);
+
+    if (target.db_file != NULL) {
+        do_close(&db_file);
+    }
+    return status;
+}
+
 /********************************************************************//**
  * Opens pictDB file and calls do_read command.
  ********************************************************************** */
@@ -450,6 +787,31 @@ int do_gbcollect_cmd(int argc, char *argv[])
     return status;
 }
 
+/********************************************************************//**
+ * Opens pictDB file and calls do_index command.
+ ********************************************************************** */
+static int do_index_cmd(int argc, char *argv[])
+{
+    if (argc < 2) {
+        return ERR_NOT_ENOUGH_ARGUMENTS;
+    }
+
+    M_REQUIRE_NON_NULL(argv[1]);
+    M_REQUIRE_VALID_FILENAME(argv[1]);
+
+    const char *db_filename = argv[1];
+
+    struct pictdb_file db_file;
+    int status = do_open(db_filename, "r+b", &db_file);
+
+    if (status == 0) {
+        status = do_index(db_filename, &db_file);
+    }
+
+    do_close(&db_file);
+    return status;
+}
+
 /********************************************************************//**
  * Displays some explanations.
  ********************************************************************** */
@@ -610,6 +972,10 @@ int main(int argc, char *argv[])
         {"insert",      do_insert_cmd},
         {"read",        do_read_cmd},
         {"gc",          do_gbcollect_cmd},
+        {"index",       do_index_cmd},
+        {"check",       do_check_cmd},
+        {"query",       do_query_cmd},
+        {"gen-dataset", do_gen_dataset_cmd},
         {"interpretor", do_interpretor_cmd},
     };
     const size_t cmd_count = sizeof(commands) / sizeof(commands[0]);
@@ -621,6 +987,16 @@ int main(int argc, char *argv[])
         argc--;
         argv++; // skips command call name
 
+        if (!strncmp(argv[0], TRACE_OPTION, strlen(TRACE_OPTION))) {
+            ret = trace_start(argv[0] + strlen(TRACE_OPTION));
+            argc--;
+            argv++;
+        }
+    }
+
+    if (ret == 0 && argc < 1) {
+        ret = ERR_NOT_ENOUGH_ARGUMENTS;
+    } else if (ret == 0) {
         command selected_cmd = get_cmd(commands, cmd_count, argv[0]);
 
         if (selected_cmd != NULL) {
@@ -635,6 +1011,9 @@ int main(int argc, char *argv[])
         (void) help(argc, argv);
     }
 
+    (void) trace_dump(stderr);
+    trace_stop();
+
     vips_shutdown();
     return ret;
 }
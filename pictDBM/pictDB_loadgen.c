@@ -0,0 +1,1042 @@
+/**
+ * @file pictDB_loadgen.c
+ * @brief HTTP load generator for pictDB_server.
+ *
+ * Replays a weighted mix of reads (per resolution, pictIDs drawn from a
+ * Zipf distribution over the pictures listed at start), listings, multipart
+ * insertions and deletions of the pictures it inserted. It runs either
+ * open loop, at a fixed rate spread over up to N connections, or closed
+ * loop, each of the N connections sending its next request as soon as the
+ * previous one completed. The server closes every connection after its
+ * response, so each request opens a connection of its own.
+ *
+ * Latencies are corrected for coordinated omission: open loop, they are
+ * measured from the time the request was due, not from the time a free
+ * connection could send it; closed loop, the requests a slow response held
+ * back are added as with HdrHistogram's expected interval correction, the
+ * interval being the mean latency of the operation. The service time, from
+ * connection to last byte, is reported as well. Output is CSV:
+ *
+ *     operation,latency,count,errors,ops_per_sec,p50_us,p90_us,p99_us,p999_us,max_us
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "pictDB.h"
+
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_PORT "8000"
+#define DEFAULT_CONNECTIONS 16
+#define DEFAULT_DURATION 10 // seconds
+#define DEFAULT_MIX "read=100"
+#define DEFAULT_RES_MIX NAME_RES_THUMB "=60," NAME_RES_SMALL "=30," NAME_RES_ORIG "=10"
+#define DEFAULT_ZIPF 0.99
+#define DEFAULT_SEED 1
+#define MAX_CONNECTIONS 1024
+#define MAX_MIX_LEN 128
+
+#define OPTION_HOST "-host"
+#define OPTION_PORT "-port"
+#define OPTION_CONNECTIONS "-c"
+#define OPTION_RATE "-rate"
+#define OPTION_DURATION "-d"
+#define OPTION_MIX "-mix"
+#define OPTION_RES "-res"
+#define OPTION_ZIPF "-zipf"
+#define OPTION_IMAGE "-image"
+#define OPTION_SEED "-seed"
+#define OPTION_MAX 16
+
+#define ROUTE_LIST "/pictDB/list"
+#define ROUTE_READ "/pictDB/read"
+#define ROUTE_INSERT "/pictDB/insert"
+#define ROUTE_DELETE "/pictDB/delete"
+#define LIST_LIMIT 100 // pictures per listing request
+#define BOUNDARY "pictDB_loadgen_boundary"
+#define INSERT_ID_FORMAT "load_%ld_%" PRIu64
+#define COMMENT_MAX 32 // JPEG comment segment making each inserted image distinct
+#define INSERTED_MAX 65536 // inserted pictIDs remembered for deletions
+#define JSON_ID "\"id\":\""
+#define MIX_DELIM ","
+#define HTTP_STATUS_PREFIX "HTTP/1."
+
+#define STATUS_LINE_MAX 16
+#define RECV_CHUNK 65536
+#define REQUEST_HEAD_MAX 1024
+#define TIMEOUT_US 30000000ULL
+#define POLL_MS 10
+
+#define SUB_BITS 5 // sub-buckets per power of two: within 3% of the value
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - SUB_BITS + 1) * SUB_BUCKETS)
+
+enum operation {
+    OP_READ,
+    OP_LIST,
+    OP_INSERT,
+    OP_DELETE,
+    NB_OPERATIONS
+};
+
+static const char *const OPERATION_NAMES[NB_OPERATIONS] = {
+    [OP_READ] = "read",
+    [OP_LIST] = "list",
+    [OP_INSERT] = "insert",
+    [OP_DELETE] = "delete"
+};
+
+static const char *const RES_NAMES[NB_RES] = {
+    [RES_THUMB] = NAME_RES_THUMB,
+    [RES_SMALL] = NAME_RES_SMALL,
+    [RES_ORIG] = NAME_RES_ORIG
+};
+
+/**
+ * @brief Log-linear latency histogram, in microseconds.
+ */
+struct histogram {
+    uint64_t counts[HISTOGRAM_BUCKETS]; /**< samples per bucket */
+    uint64_t count; /**< samples */
+    uint64_t max; /**< largest sample */
+    double sum; /**< sum of the samples */
+};
+
+/**
+ * @brief Measures of one operation.
+ */
+struct operation_stats {
+    struct histogram response; /**< from the time the request was due */
+    struct histogram service; /**< from the time the request was started */
+    uint64_t errors; /**< failed requests (no response, or a 4xx/5xx one) */
+};
+
+enum connection_state {
+    CONN_IDLE,
+    CONN_CONNECTING,
+    CONN_SENDING,
+    CONN_RECEIVING
+};
+
+/**
+ * @brief One in flight request.
+ */
+struct connection {
+    int fd; /**< socket */
+    enum connection_state state; /**< progress of the request */
+    enum operation operation; /**< operation of the request */
+    char *request; /**< request bytes */
+    size_t request_len; /**< size of the request */
+    size_t sent; /**< request bytes sent */
+    char status_line[STATUS_LINE_MAX + 1]; /**< start of the response */
+    size_t status_len; /**< bytes in status_line */
+    uint64_t due_us; /**< time the request was due */
+    uint64_t start_us; /**< time the request was started */
+    char pict_id[MAX_PIC_ID + 1]; /**< inserted picture */
+};
+
+/**
+ * @brief Configuration and state of a run.
+ */
+struct loadgen {
+    const char *host; /**< server host */
+    const char *port; /**< server port */
+    struct addrinfo *address; /**< resolved server address */
+    size_t connections; /**< max. concurrent requests */
+    double rate; /**< requests per second, 0 for closed loop */
+    uint64_t duration_us; /**< time requests are started for */
+    uint32_t mix[NB_OPERATIONS]; /**< weight of each operation */
+    uint32_t res_mix[NB_RES]; /**< weight of each read resolution */
+    double zipf; /**< exponent of the pictID distribution, 0 for uniform */
+    uint64_t random; /**< state of the generator */
+
+    char **ids; /**< pictures to read, by popularity */
+    size_t id_count; /**< number of pictures to read */
+    double *zipf_cdf; /**< cumulative distribution of the ranks */
+    char *id_buffer; /**< listing the ids point into */
+
+    char *image; /**< image to insert */
+    size_t image_size; /**< size of the image */
+    uint64_t inserts; /**< insertions started */
+    char (*inserted)[MAX_PIC_ID + 1]; /**< inserted pictIDs, oldest first from inserted_head */
+    size_t inserted_head; /**< oldest inserted pictID */
+    size_t inserted_count; /**< remembered inserted pictIDs */
+
+    struct connection *conns; /**< request slots */
+    struct operation_stats stats[NB_OPERATIONS]; /**< measures */
+    uint64_t last_us; /**< time the last request completed */
+};
+
+/********************************************************************//**
+ * Monotonic time in microseconds.
+ ********************************************************************** */
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000ULL + (uint64_t) ts.tv_nsec / 1000ULL;
+}
+
+/********************************************************************//**
+ * Next value of a xorshift64* generator, so that runs are reproducible.
+ ********************************************************************** */
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+/********************************************************************//**
+ * Uniform real in [0, 1).
+ ********************************************************************** */
+static double unit(uint64_t *state)
+{
+    return (double) (next_random(state) >> 11) / (double) (1ULL << 53);
+}
+
+/********************************************************************//**
+ * Draws an index according to weights.
+ ********************************************************************** */
+static size_t weighted(uint64_t *state, const uint32_t weights[], size_t count)
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < count; ++i) {
+        total += weights[i];
+    }
+
+    uint64_t r = next_random(state) % total;
+    for (size_t i = 0; i < count; ++i) {
+        if (r < weights[i]) {
+            return i;
+        }
+        r -= weights[i];
+    }
+    return count - 1;
+}
+
+/********************************************************************//**
+ * Bucket of a value: exact below SUB_BUCKETS, then SUB_BUCKETS buckets
+ * per power of two.
+ ********************************************************************** */
+static size_t bucket_of(uint64_t value)
+{
+    if (value < SUB_BUCKETS) {
+        return (size_t) value;
+    }
+    const unsigned int shift = (unsigned int) (63 - __builtin_clzll(value)) - SUB_BITS;
+    return ((size_t) (shift + 1) << SUB_BITS) + (size_t) ((value >> shift) - SUB_BUCKETS);
+}
+
+/********************************************************************//**
+ * Middle of the values of a bucket.
+ ********************************************************************** */
+static uint64_t value_of(size_t bucket)
+{
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    const unsigned int shift = (unsigned int) (bucket >> SUB_BITS) - 1;
+    const uint64_t low = ((uint64_t) (bucket & (SUB_BUCKETS - 1)) + SUB_BUCKETS) << shift;
+    return low + ((1ULL << shift) >> 1);
+}
+
+static void histogram_add(struct histogram *histogram, uint64_t value, uint64_t count)
+{
+    histogram->counts[bucket_of(value)] += count;
+    histogram->count += count;
+    histogram->sum += (double) value * (double) count;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+static void histogram_merge(struct histogram *into, const struct histogram *from)
+{
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        into->counts[i] += from->counts[i];
+    }
+    into->count += from->count;
+    into->sum += from->sum;
+    into->max = from->max > into->max ? from->max : into->max;
+}
+
+/********************************************************************//**
+ * Adds the samples a closed loop missed: each sample longer than the
+ * expected interval held back requests that would have waited for it.
+ ********************************************************************** */
+static void histogram_correct(struct histogram *into, const struct histogram *from, uint64_t interval)
+{
+    histogram_merge(into, from);
+    if (interval == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        const uint64_t value = value_of(i);
+        for (uint64_t missing = value > interval ? value - interval : 0; from->counts[i] > 0 && missing >= interval;
+             missing -= interval) {
+            histogram_add(into, missing, from->counts[i]);
+        }
+    }
+}
+
+static uint64_t histogram_percentile(const struct histogram *histogram, double quantile)
+{
+    const uint64_t target = (uint64_t) ceil(quantile * (double) histogram->count);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        seen += histogram->counts[i];
+        if (seen >= target && seen > 0) {
+            const uint64_t value = value_of(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+/********************************************************************//**
+ * Parses a weight list: <name>=<weight>,...
+ ********************************************************************** */
+static int parse_mix(const char *list, const char *const names[], size_t count, uint32_t weights[])
+{
+    char copy[MAX_MIX_LEN];
+    if (strlen(list) >= sizeof(copy)) {
+        return ERR_INVALID_ARGUMENT;
+    }
+    strncpy(copy, list, sizeof(copy));
+    memset(weights, 0, count * sizeof(uint32_t));
+
+    uint64_t total = 0;
+    for (char *token = strtok(copy, MIX_DELIM); token != NULL; token = strtok(NULL, MIX_DELIM)) {
+        char *equal = strchr(token, '=');
+        if (equal == NULL) {
+            return ERR_INVALID_ARGUMENT;
+        }
+        *equal = '\0';
+
+        size_t i = 0;
+        while (i < count && strcmp(token, names[i])) {
+            ++i;
+        }
+        if (i == count) {
+            return ERR_INVALID_ARGUMENT;
+        }
+        weights[i] = (uint32_t) strtoul(equal + 1, NULL, 10);
+        total += weights[i];
+    }
+    return total == 0 ? ERR_INVALID_ARGUMENT : 0;
+}
+
+/********************************************************************//**
+ * Appends the percent-encoding of a query value.
+ ********************************************************************** */
+static size_t url_encode(char *out, size_t size, const char *value)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    size_t len = 0;
+    for (const unsigned char *c = (const unsigned char *) value; *c != '\0' && len + 4 < size; ++c) {
+        if ((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') ||
+            *c == '-' || *c == '_' || *c == '.' || *c == '~') {
+            out[len++] = (char) *c;
+        } else {
+            out[len++] = '%';
+            out[len++] = hex[*c >> 4];
+            out[len++] = hex[*c & 0xF];
+        }
+    }
+    out[len] = '\0';
+    return len;
+}
+
+/********************************************************************//**
+ * Opens a non blocking connection to the server.
+ ********************************************************************** */
+static int open_socket(const struct loadgen *lg, int blocking, int *in_progress)
+{
+    const int fd = socket(lg->address->ai_family, lg->address->ai_socktype, lg->address->ai_protocol);
+    if (fd == -1) {
+        return -1;
+    }
+    if (!blocking && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    *in_progress = 0;
+    if (connect(fd, lg->address->ai_addr, lg->address->ai_addrlen) == -1) {
+        if (blocking || errno != EINPROGRESS) {
+            close(fd);
+            return -1;
+        }
+        *in_progress = 1;
+    }
+    return fd;
+}
+
+/********************************************************************//**
+ * Fetches the pictIDs of the database, in a blocking listing request.
+ ********************************************************************** */
+static int fetch_ids(struct loadgen *lg)
+{
+    int in_progress = 0;
+    const int fd = open_socket(lg, 1, &in_progress);
+    if (fd == -1) {
+        return ERR_IO;
+    }
+
+    char head[REQUEST_HEAD_MAX];
+    const int head_len = snprintf(head, sizeof(head), "GET " ROUTE_LIST " HTTP/1.1\r\nHost: %s\r\n"
+                                  "Connection: close\r\n\r\n", lg->host);
+    int status = send(fd, head, (size_t) head_len, MSG_NOSIGNAL) == head_len ? 0 : ERR_IO;
+
+    size_t len = 0;
+    size_t capacity = RECV_CHUNK;
+    lg->id_buffer = malloc(capacity + 1);
+    status = status == 0 && lg->id_buffer == NULL ? ERR_OUT_OF_MEMORY : status;
+
+    ssize_t received = 1;
+    while (status == 0 && received > 0) {
+        if (len == capacity) {
+            char *bigger = realloc(lg->id_buffer, 2 * capacity + 1);
+            if (bigger == NULL) {
+                status = ERR_OUT_OF_MEMORY;
+                break;
+            }
+            lg->id_buffer = bigger;
+            capacity *= 2;
+        }
+        received = recv(fd, lg->id_buffer + len, capacity - len, 0);
+        if (received < 0) {
+            status = ERR_IO;
+        } else {
+            len += (size_t) received;
+        }
+    }
+    close(fd);
+    if (status != 0) {
+        return status;
+    }
+    lg->id_buffer[len] = '\0';
+
+    for (char *p = strstr(lg->id_buffer, JSON_ID); p != NULL; p = strstr(p + 1, JSON_ID)) {
+        ++lg->id_count;
+    }
+    lg->ids = calloc(lg->id_count + 1, sizeof(char *));
+    if (lg->ids == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    // unescapes each id in place
+    size_t n = 0;
+    for (char *p = strstr(lg->id_buffer, JSON_ID); p != NULL && n < lg->id_count; p = strstr(p, JSON_ID)) {
+        p += strlen(JSON_ID);
+        char *out = p;
+        lg->ids[n++] = p;
+        while (*p != '\0' && *p != '"') {
+            if (*p == '\\' && p[1] != '\0') {
+                ++p;
+            }
+            *out++ = *p++;
+        }
+        if (*p != '\0') {
+            ++p;
+        }
+        *out = '\0';
+    }
+    lg->id_count = n;
+    return 0;
+}
+
+/********************************************************************//**
+ * Shuffles the pictIDs, so that popularity does not follow slot order,
+ * and computes the Zipf distribution of their ranks.
+ ********************************************************************** */
+static int prepare_ids(struct loadgen *lg)
+{
+    for (size_t i = lg->id_count; i > 1; --i) {
+        const size_t j = (size_t) (next_random(&lg->random) % i);
+        char *swap = lg->ids[i - 1];
+        lg->ids[i - 1] = lg->ids[j];
+        lg->ids[j] = swap;
+    }
+
+    lg->zipf_cdf = calloc(lg->id_count + 1, sizeof(double));
+    if (lg->zipf_cdf == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    double total = 0.0;
+    for (size_t i = 0; i < lg->id_count; ++i) {
+        total += 1.0 / pow((double) (i + 1), lg->zipf);
+        lg->zipf_cdf[i] = total;
+    }
+    for (size_t i = 0; i < lg->id_count; ++i) {
+        lg->zipf_cdf[i] /= total;
+    }
+    return 0;
+}
+
+/********************************************************************//**
+ * Draws a pictID to read.
+ ********************************************************************** */
+static const char *draw_id(struct loadgen *lg)
+{
+    const double u = unit(&lg->random);
+    size_t low = 0;
+    size_t high = lg->id_count - 1;
+    while (low < high) {
+        const size_t middle = low + (high - low) / 2;
+        if (lg->zipf_cdf[middle] < u) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return lg->ids[low];
+}
+
+/********************************************************************//**
+ * Builds the multipart insertion of a new image: the image with a
+ * numbered comment segment, so that it is never a duplicate.
+ ********************************************************************** */
+static int build_insert(struct loadgen *lg, struct connection *conn)
+{
+    snprintf(conn->pict_id, sizeof(conn->pict_id), INSERT_ID_FORMAT, (long) getpid(), lg->inserts++);
+
+    char comment[COMMENT_MAX];
+    const size_t comment_len = (size_t) snprintf(comment, sizeof(comment), "pictDB loadgen %" PRIu64, lg->inserts);
+    const size_t segment_len = comment_len + 2;
+
+    char part_head[REQUEST_HEAD_MAX];
+    const int part_len = snprintf(part_head, sizeof(part_head),
+                                  "--" BOUNDARY "\r\n"
+                                  "Content-Disposition: form-data; name=\"up_file\"; filename=\"%s\"\r\n"
+                                  "Content-Type: image/jpeg\r\n\r\n", conn->pict_id);
+    static const char part_tail[] = "\r\n--" BOUNDARY "--\r\n";
+    const size_t body_len = (size_t) part_len + lg->image_size + 4 + comment_len + strlen(part_tail);
+
+    conn->request = malloc(REQUEST_HEAD_MAX + body_len);
+    if (conn->request == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    char *out = conn->request;
+    out += snprintf(out, REQUEST_HEAD_MAX, "POST " ROUTE_INSERT " HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n"
+                    "Content-Type: multipart/form-data; boundary=" BOUNDARY "\r\n"
+                    "Content-Length: %zu\r\n\r\n", lg->host, body_len);
+    memcpy(out, part_head, (size_t) part_len);
+    out += part_len;
+    memcpy(out, lg->image, 2); // SOI
+    out[2] = (char) 0xFF;
+    out[3] = (char) 0xFE;
+    out[4] = (char) (segment_len >> 8);
+    out[5] = (char) (segment_len & 0xFF);
+    memcpy(out + 6, comment, comment_len);
+    out += 6 + comment_len;
+    memcpy(out, lg->image + 2, lg->image_size - 2);
+    out += lg->image_size - 2;
+    memcpy(out, part_tail, strlen(part_tail));
+    out += strlen(part_tail);
+
+    conn->request_len = (size_t) (out - conn->request);
+    return 0;
+}
+
+/********************************************************************//**
+ * Draws the next operation and builds its request.
+ ********************************************************************** */
+static int build_request(struct loadgen *lg, struct connection *conn)
+{
+    enum operation operation = (enum operation) weighted(&lg->random, lg->mix, NB_OPERATIONS);
+    // only the pictures inserted by the run are deleted, read instead when none is left
+    if (operation == OP_DELETE && lg->inserted_count == 0) {
+        operation = lg->id_count > 0 ? OP_READ : OP_LIST;
+    }
+    conn->operation = operation;
+
+    if (operation == OP_INSERT) {
+        return build_insert(lg, conn);
+    }
+
+    conn->request = malloc(REQUEST_HEAD_MAX);
+    if (conn->request == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    char query[REQUEST_HEAD_MAX / 2] = "";
+    switch (operation) {
+    case OP_READ: {
+        const size_t res = weighted(&lg->random, lg->res_mix, NB_RES);
+        char id[3 * MAX_PIC_ID + 1];
+        url_encode(id, sizeof(id), draw_id(lg));
+        snprintf(query, sizeof(query), ROUTE_READ "?res=%s&pict_id=%s", RES_NAMES[res], id);
+        break;
+    }
+    case OP_DELETE: {
+        char id[3 * MAX_PIC_ID + 1];
+        url_encode(id, sizeof(id), lg->inserted[lg->inserted_head]);
+        lg->inserted_head = (lg->inserted_head + 1) % INSERTED_MAX;
+        --lg->inserted_count;
+        snprintf(query, sizeof(query), ROUTE_DELETE "?pict_id=%s", id);
+        break;
+    }
+    case OP_LIST:
+    case OP_INSERT:
+    case NB_OPERATIONS:
+    default:
+        snprintf(query, sizeof(query), ROUTE_LIST "?limit=%d", LIST_LIMIT);
+        break;
+    }
+
+    const int len = snprintf(conn->request, REQUEST_HEAD_MAX, "GET %s HTTP/1.1\r\nHost: %s\r\n"
+                             "Connection: close\r\n\r\n", query, lg->host);
+    conn->request_len = (size_t) len;
+    return 0;
+}
+
+/********************************************************************//**
+ * Records a completed (or failed) request and frees its slot.
+ ********************************************************************** */
+static void finish_request(struct loadgen *lg, struct connection *conn, int failed)
+{
+    const uint64_t end = now_us();
+    conn->status_line[conn->status_len] = '\0';
+
+    int code = 0;
+    if (!failed && !strncmp(conn->status_line, HTTP_STATUS_PREFIX, strlen(HTTP_STATUS_PREFIX)) &&
+        conn->status_len > strlen(HTTP_STATUS_PREFIX) + 2) {
+        code = atoi(conn->status_line + strlen(HTTP_STATUS_PREFIX) + 2);
+    }
+
+    struct operation_stats *stats = &lg->stats[conn->operation];
+    histogram_add(&stats->response, end - conn->due_us, 1);
+    histogram_add(&stats->service, end - conn->start_us, 1);
+    if (code < 200 || code >= 400) {
+        ++stats->errors;
+    } else if (conn->operation == OP_INSERT) {
+        const size_t tail = (lg->inserted_head + lg->inserted_count) % INSERTED_MAX;
+        strncpy(lg->inserted[tail], conn->pict_id, MAX_PIC_ID + 1);
+        if (lg->inserted_count < INSERTED_MAX) {
+            ++lg->inserted_count;
+        } else {
+            lg->inserted_head = (lg->inserted_head + 1) % INSERTED_MAX;
+        }
+    }
+    lg->last_us = end;
+
+    if (conn->fd != -1) {
+        close(conn->fd);
+    }
+    free(conn->request);
+    conn->request = NULL;
+    conn->fd = -1;
+    conn->state = CONN_IDLE;
+}
+
+/********************************************************************//**
+ * Starts a request, due at due_us, on an idle slot.
+ ********************************************************************** */
+static int start_request(struct loadgen *lg, struct connection *conn, uint64_t due_us)
+{
+    conn->due_us = due_us;
+    conn->start_us = now_us();
+    conn->sent = 0;
+    conn->status_len = 0;
+    conn->fd = -1;
+
+    const int status = build_request(lg, conn);
+    if (status != 0) {
+        return status;
+    }
+
+    int in_progress = 0;
+    conn->fd = open_socket(lg, 0, &in_progress);
+    if (conn->fd == -1) {
+        finish_request(lg, conn, 1);
+    } else {
+        conn->state = in_progress ? CONN_CONNECTING : CONN_SENDING;
+    }
+    return 0;
+}
+
+/********************************************************************//**
+ * Moves a request forward once its socket is ready.
+ ********************************************************************** */
+static void advance_request(struct loadgen *lg, struct connection *conn, char *buffer)
+{
+    if (conn->state == CONN_CONNECTING) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error != 0) {
+            finish_request(lg, conn, 1);
+            return;
+        }
+        conn->state = CONN_SENDING;
+    }
+
+    if (conn->state == CONN_SENDING) {
+        const ssize_t sent = send(conn->fd, conn->request + conn->sent, conn->request_len - conn->sent,
+                                  MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                finish_request(lg, conn, 1);
+            }
+            return;
+        }
+        conn->sent += (size_t) sent;
+        if (conn->sent == conn->request_len) {
+            conn->state = CONN_RECEIVING;
+        }
+        return;
+    }
+
+    const ssize_t received = recv(conn->fd, buffer, RECV_CHUNK, 0);
+    if (received < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            finish_request(lg, conn, conn->status_len == 0);
+        }
+    } else if (received == 0) {
+        finish_request(lg, conn, conn->status_len == 0);
+    } else if (conn->status_len < STATUS_LINE_MAX) {
+        const size_t keep = STATUS_LINE_MAX - conn->status_len < (size_t) received ?
+                            STATUS_LINE_MAX - conn->status_len : (size_t) received;
+        memcpy(conn->status_line + conn->status_len, buffer, keep);
+        conn->status_len += keep;
+    }
+}
+
+/********************************************************************//**
+ * Runs the load: starts requests until the duration elapsed, then waits
+ * for those in flight.
+ ********************************************************************** */
+static int run(struct loadgen *lg)
+{
+    struct pollfd *fds = calloc(lg->connections, sizeof(struct pollfd));
+    size_t *slots = calloc(lg->connections, sizeof(size_t));
+    char *buffer = malloc(RECV_CHUNK);
+    if (fds == NULL || slots == NULL || buffer == NULL) {
+        free(fds);
+        free(slots);
+        free(buffer);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    const uint64_t start = now_us();
+    const uint64_t deadline = start + lg->duration_us;
+    const double interval = lg->rate > 0 ? 1e6 / lg->rate : 0.0;
+    uint64_t issued = 0;
+    int status = 0;
+    lg->last_us = start;
+
+    while (status == 0) {
+        uint64_t now = now_us();
+        const int issuing = now < deadline;
+
+        for (size_t i = 0; issuing && i < lg->connections && status == 0; ++i) {
+            if (lg->conns[i].state != CONN_IDLE) {
+                continue;
+            }
+            if (lg->rate > 0) {
+                const uint64_t due = start + (uint64_t) ((double) issued * interval);
+                if (due > now) {
+                    break;
+                }
+                ++issued;
+                status = start_request(lg, &lg->conns[i], due);
+            } else {
+                status = start_request(lg, &lg->conns[i], now_us());
+            }
+        }
+
+        now = now_us();
+        size_t active = 0;
+        for (size_t i = 0; i < lg->connections; ++i) {
+            struct connection *conn = &lg->conns[i];
+            if (conn->state == CONN_IDLE) {
+                continue;
+            }
+            if (now - conn->start_us > TIMEOUT_US) {
+                finish_request(lg, conn, 1);
+                continue;
+            }
+            fds[active].fd = conn->fd;
+            fds[active].events = conn->state == CONN_RECEIVING ? POLLIN : POLLOUT;
+            fds[active].revents = 0;
+            slots[active++] = i;
+        }
+
+        if (!issuing && active == 0) {
+            break;
+        }
+
+        int timeout = POLL_MS;
+        if (issuing && lg->rate > 0) {
+            const uint64_t due = start + (uint64_t) ((double) issued * interval);
+            const uint64_t wait_ms = due > now ? (due - now) / 1000 : 0;
+            timeout = wait_ms < POLL_MS ? (int) wait_ms : POLL_MS;
+        }
+
+        if (poll(fds, active, timeout) < 0 && errno != EINTR) {
+            status = ERR_IO;
+        }
+        for (size_t i = 0; i < active && status == 0; ++i) {
+            if (fds[i].revents != 0) {
+                advance_request(lg, &lg->conns[slots[i]], buffer);
+            }
+        }
+    }
+
+    free(fds);
+    free(slots);
+    free(buffer);
+    return status;
+}
+
+/********************************************************************//**
+ * Prints the report line of one histogram.
+ ********************************************************************** */
+static void report_line(const char *operation, const char *latency, const struct histogram *histogram,
+                        uint64_t sent, uint64_t errors, double seconds)
+{
+    printf("%s,%s,%" PRIu64 ",%" PRIu64 ",%.1f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+           operation, latency, sent, errors, seconds > 0 ? (double) sent / seconds : 0.0,
+           histogram_percentile(histogram, 0.5), histogram_percentile(histogram, 0.9),
+           histogram_percentile(histogram, 0.99), histogram_percentile(histogram, 0.999), histogram->max);
+}
+
+/********************************************************************//**
+ * Prints the corrected and service latencies of each operation, then of
+ * all of them. Counts and rates are those of the requests actually sent,
+ * not of the samples added by the correction.
+ ********************************************************************** */
+static int report(const struct loadgen *lg, uint64_t start)
+{
+    // all corrected, all service, and the corrected one of the current operation
+    struct histogram *all = calloc(3, sizeof(struct histogram));
+    if (all == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    struct histogram *corrected = &all[2];
+
+    const double seconds = (double) (lg->last_us - start) / 1e6;
+    uint64_t errors = 0;
+
+    puts("operation,latency,count,errors,ops_per_sec,p50_us,p90_us,p99_us,p999_us,max_us");
+    for (size_t i = 0; i < NB_OPERATIONS; ++i) {
+        const struct operation_stats *stats = &lg->stats[i];
+        if (stats->service.count == 0) {
+            continue;
+        }
+
+        memset(corrected, 0, sizeof(struct histogram));
+        if (lg->rate > 0) {
+            histogram_merge(corrected, &stats->response);
+        } else {
+            histogram_correct(corrected, &stats->response,
+                              (uint64_t) (stats->service.sum / (double) stats->service.count));
+        }
+
+        report_line(OPERATION_NAMES[i], "corrected", corrected, stats->service.count, stats->errors, seconds);
+        report_line(OPERATION_NAMES[i], "service", &stats->service, stats->service.count, stats->errors, seconds);
+
+        histogram_merge(&all[0], corrected);
+        histogram_merge(&all[1], &stats->service);
+        errors += stats->errors;
+    }
+    report_line("all", "corrected", &all[0], all[1].count, errors, seconds);
+    report_line("all", "service", &all[1], all[1].count, errors, seconds);
+
+    free(all);
+    return 0;
+}
+
+/********************************************************************//**
+ * Reads the image to insert, which must be a JPEG file.
+ ********************************************************************** */
+static int read_image(struct loadgen *lg, const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        return ERR_IO;
+    }
+
+    int status = 0;
+    long size = 0;
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 4 || fseek(file, 0, SEEK_SET) != 0) {
+        status = ERR_IO;
+    } else if ((lg->image = malloc((size_t) size)) == NULL) {
+        status = ERR_OUT_OF_MEMORY;
+    } else if (fread(lg->image, (size_t) size, 1, file) != 1) {
+        status = ERR_IO;
+    } else if ((unsigned char) lg->image[0] != 0xFF || (unsigned char) lg->image[1] != 0xD8) {
+        status = ERR_INVALID_ARGUMENT;
+    } else {
+        lg->image_size = (size_t) size;
+    }
+
+    fclose(file);
+    return status;
+}
+
+/********************************************************************//**
+ * Parses the command line options.
+ ********************************************************************** */
+static int parse_options(struct loadgen *lg, int argc, char *argv[], const char **image)
+{
+    const char *mix = DEFAULT_MIX;
+    const char *res_mix = DEFAULT_RES_MIX;
+
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            return ERR_NOT_ENOUGH_ARGUMENTS;
+        }
+        const char *value = argv[i + 1];
+        if (!strncmp(argv[i], OPTION_HOST, OPTION_MAX)) {
+            lg->host = value;
+        } else if (!strncmp(argv[i], OPTION_PORT, OPTION_MAX)) {
+            lg->port = value;
+        } else if (!strncmp(argv[i], OPTION_CONNECTIONS, OPTION_MAX)) {
+            lg->connections = strtoul(value, NULL, 10);
+        } else if (!strncmp(argv[i], OPTION_RATE, OPTION_MAX)) {
+            lg->rate = strtod(value, NULL);
+        } else if (!strncmp(argv[i], OPTION_DURATION, OPTION_MAX)) {
+            lg->duration_us = (uint64_t) (strtod(value, NULL) * 1e6);
+        } else if (!strncmp(argv[i], OPTION_MIX, OPTION_MAX)) {
+            mix = value;
+        } else if (!strncmp(argv[i], OPTION_RES, OPTION_MAX)) {
+            res_mix = value;
+        } else if (!strncmp(argv[i], OPTION_ZIPF, OPTION_MAX)) {
+            lg->zipf = strtod(value, NULL);
+        } else if (!strncmp(argv[i], OPTION_IMAGE, OPTION_MAX)) {
+            *image = value;
+        } else if (!strncmp(argv[i], OPTION_SEED, OPTION_MAX)) {
+            lg->random = strtoull(value, NULL, 10);
+        } else {
+            return ERR_INVALID_ARGUMENT;
+        }
+    }
+
+    if (lg->connections == 0 || lg->connections > MAX_CONNECTIONS || lg->rate < 0 || lg->duration_us == 0 ||
+        lg->zipf < 0 || lg->random == 0) {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    int status = parse_mix(mix, OPERATION_NAMES, NB_OPERATIONS, lg->mix);
+    if (status == 0) {
+        status = parse_mix(res_mix, RES_NAMES, NB_RES, lg->res_mix);
+    }
+    if (status == 0 && (lg->mix[OP_INSERT] > 0 || lg->mix[OP_DELETE] > 0) && *image == NULL) {
+        status = ERR_NOT_ENOUGH_ARGUMENTS;
+    }
+    return status;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [options]\n", name);
+    fprintf(stderr, "  "OPTION_HOST" <HOST> "OPTION_PORT" <PORT>: server, default value is "DEFAULT_HOST" "
+            DEFAULT_PORT".\n");
+    fprintf(stderr, "  "OPTION_CONNECTIONS" <N>: concurrent requests, default value is %d.\n", DEFAULT_CONNECTIONS);
+    fprintf(stderr, "  "OPTION_RATE" <R>: requests per second (open loop), default is closed loop.\n");
+    fprintf(stderr, "  "OPTION_DURATION" <SECONDS>: duration, default value is %d.\n", DEFAULT_DURATION);
+    fprintf(stderr, "  "OPTION_MIX" <op>=<weight>,...: read, list, insert and delete weights, default value is "
+            DEFAULT_MIX".\n");
+    fprintf(stderr, "  "OPTION_RES" <res>=<weight>,...: read resolution weights, default value is "
+            DEFAULT_RES_MIX".\n");
+    fprintf(stderr, "  "OPTION_ZIPF" <S>: exponent of the pictID popularity, 0 for uniform, default value is %.2f.\n",
+            DEFAULT_ZIPF);
+    fprintf(stderr, "  "OPTION_IMAGE" <FILE>: JPEG image to insert, required by insert and delete.\n");
+    fprintf(stderr, "  "OPTION_SEED" <SEED>: seed of the draws, default value is %d.\n", DEFAULT_SEED);
+}
+
+/********************************************************************//**
+ * MAIN
+ ********************************************************************** */
+int main(int argc, char *argv[])
+{
+    struct loadgen *lg = calloc(1, sizeof(struct loadgen));
+    if (lg == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    lg->host = DEFAULT_HOST;
+    lg->port = DEFAULT_PORT;
+    lg->connections = DEFAULT_CONNECTIONS;
+    lg->duration_us = DEFAULT_DURATION * 1000000ULL;
+    lg->zipf = DEFAULT_ZIPF;
+    lg->random = DEFAULT_SEED;
+
+    const char *image = NULL;
+    int status = parse_options(lg, argc, argv, &image);
+    if (status != 0) {
+        usage(argv[0]);
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (status == 0 && getaddrinfo(lg->host, lg->port, &hints, &lg->address) != 0) {
+        status = ERR_IO;
+    }
+
+    if (status == 0 && image != NULL) {
+        status = read_image(lg, image);
+    }
+    if (status == 0) {
+        lg->inserted = calloc(INSERTED_MAX, sizeof(*lg->inserted));
+        lg->conns = calloc(lg->connections, sizeof(struct connection));
+        status = lg->inserted == NULL || lg->conns == NULL ? ERR_OUT_OF_MEMORY : 0;
+    }
+    if (status == 0) {
+        status = fetch_ids(lg);
+    }
+    if (status == 0) {
+        status = prepare_ids(lg);
+    }
+    if (status == 0 && lg->mix[OP_READ] > 0 && lg->id_count == 0) {
+        fprintf(stderr, "no picture to read\n");
+        status = ERR_FILE_NOT_FOUND;
+    }
+
+    const uint64_t start = now_us();
+    if (status == 0) {
+        fprintf(stderr, "%zu picture(s), %s loop, %zu connection(s)\n", lg->id_count,
+                lg->rate > 0 ? "open" : "closed", lg->connections);
+        status = run(lg);
+    }
+    if (status == 0) {
+        status = report(lg, start);
+    }
+
+    if (status != 0) {
+        fprintf(stderr, "ERROR: %s\n", ERROR_MESSAGES[status]);
+    }
+
+    if (lg->address != NULL) {
+        freeaddrinfo(lg->address);
+    }
+    free(lg->ids);
+    free(lg->id_buffer);
+    free(lg->zipf_cdf);
+    free(lg->image);
+    free(lg->inserted);
+    free(lg->conns);
+    free(lg);
+    return status;
+}
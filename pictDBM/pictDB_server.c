@@ -8,9 +8,20 @@
  * @date 7 May 2016
  */
 
+#define _DEFAULT_SOURCE
+
 #include <vips/vips.h>
 #include "libmongoose/mongoose.h"
 #include "pictDB.h"
+#include "pictDBM_tools.h"
+#include "db_columns.h"
+#include "metrics.h"
+#include "trace.h"
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #define POST_METHOD "POST"
 
@@ -18,20 +29,131 @@
 #define ROUTE_READ "/pictDB/read"
 #define ROUTE_INSERT "/pictDB/insert"
 #define ROUTE_DELETE "/pictDB/delete"
+#define ROUTE_QUERY "/pictDB/query"
+#define ROUTE_READ_BATCH "/pictDB/read_batch"
+#define ROUTE_SPRITE "/pictDB/sprite"
+#define ROUTE_METRICS "/pictDB/metrics"
 
 #define PORT "8000"
+#define DOCUMENT_ROOT "."
+#define MAX_LOOPS 256
+#define MAX_UPLOAD_BYTES (64 << 20) // largest request body accepted by the insert route
+#define TRACE_OPTION "--trace="
+#define SHARED_OPTION "--shared"
+#define PORT_OPTION "--port="
+#define LOOPS_OPTION "--loops="
+#define ROOT_OPTION "--root="
 #define MAX_QUERY_PARAM 5
 
 #define ARG_DELIM "&="
 #define ARG_RES "res"
 #define ARG_PICT_ID "pict_id"
+#define ARG_CURSOR "cursor"
+#define ARG_OFFSET "offset"
+#define ARG_LIMIT "limit"
+#define ARG_PREFIX "prefix"
+#define ARG_AFTER "after"
+#define ARG_WHERE "where"
+#define ARG_FORMAT "format"
+#define FORMAT_JSON "json"
+#define WHERE_DELIM ","
+#define MAX_WHERE_LEN 256
 #define ARGNAME_MAX 16
+#define BATCH_DELIM "\r\n"
+#define BATCH_FRAME_HEADER 8 // position and size, 32-bit big endian
+#define BATCH_ERROR_POSITION UINT32_MAX // position of the frame reporting a failure
+#define MAX_BATCH_IDS 1024 // identifiers per batch read
 
 #define MAX_SPLIT_LEN ((MAX_PIC_ID + 1) * MAX_QUERY_PARAM)
 
+#define LIST_CACHE_ENTRIES 8 // listing pages kept serialized
+#define SPRITE_CACHE_ENTRIES 4 // sprite sheets kept encoded
+#define ETAG_LEN 16
+#define HEADER_IF_NONE_MATCH "If-None-Match"
+#define HEADER_CONTENT_LENGTH "Content-Length"
+#define HEADER_RANGE "Range"
+#define HTTP_STATUS_PREFIX "HTTP/1.1 "
+#define HEADER_IF_RANGE "If-Range"
+
+#define RANGE_UNIT "bytes="
+#define RANGE_DELIM ", "
+#define MAX_RANGES 8 // beyond, the Range header is ignored
+#define MAX_RANGE_SPEC 256
+#define RANGE_PART_HEADER_LEN 160
+#define IMAGE_ETAG_LEN 32
+#define BYTERANGES_BOUNDARY "pictDB_byteranges"
+#define BYTERANGES_END "\r\n--" BYTERANGES_BOUNDARY "--\r\n"
+
+/**
+ * @brief Serialized listing page, valid for one database version.
+ */
+struct list_cache_entry {
+    int filled; /**< whether json holds a page */
+    struct list_page page; /**< page parameters, strings point to the copies below */
+    char prefix[MAX_PIC_ID + 1]; /**< copy of the page prefix */
+    char after[MAX_PIC_ID + 1]; /**< copy of the page resume identifier */
+    uint32_t db_version; /**< database version the page was built from */
+    struct mbuf json; /**< serialized page */
+};
+
+/**
+ * @brief Byte range of an image requested with a Range header.
+ */
+struct byte_range {
+    uint64_t start; /**< first byte */
+    uint32_t length; /**< number of bytes */
+};
+
+/**
+ * @brief Response to a batch read, whose status line waits for the first
+ *        frame.
+ */
+struct batch_response {
+    struct mg_connection *nc; /**< connection answered */
+    int started; /**< whether the status line was sent */
+};
+
+/**
+ * @brief Upload in progress on a connection, kept in its user_data.
+ */
+struct insert_upload {
+    struct pictdb_upload upload; /**< space reserved in the database */
+    uint32_t reserve; /**< request body length, an upper bound of the image size */
+    int started; /**< whether upload holds a reservation */
+    int done; /**< whether a file part was received */
+    int status; /**< first error met, 0 if none */
+    char pict_id[MAX_PIC_ID + 1]; /**< name of the uploaded file */
+    uint64_t start_us; /**< when the request headers arrived */
+};
+
+/**
+ * @brief Command line options.
+ */
+struct server_options {
+    const char *program; /**< argv[0], for VIPS */
+    const char *db_filename; /**< database served */
+    const char *port; /**< listening port */
+    unsigned int loops; /**< event loops, each in its own process */
+    int shared; /**< whether other processes may use the database meanwhile */
+};
+
+/**
+ * @brief Sprite sheet and its placement map, valid for one database version.
+ */
+struct sprite_cache_entry {
+    int filled; /**< whether sprite holds a sheet */
+    struct list_page page; /**< page parameters, without strings */
+    struct pictdb_sprite sprite; /**< encoded sheet */
+    struct mbuf json; /**< serialized placement map */
+};
+
 static int s_sig_received = 0;
-static const struct mg_serve_http_opts s_http_server_opts = {
-    .document_root = "."
+static struct list_cache_entry s_list_cache[LIST_CACHE_ENTRIES];
+static size_t s_list_cache_victim = 0;
+static struct sprite_cache_entry s_sprite_cache[SPRITE_CACHE_ENTRIES];
+static size_t s_sprite_cache_victim = 0;
+static struct mg_serve_http_opts s_http_server_opts = {
+    .document_root = DOCUMENT_ROOT
 };
 
 /********************************************************************//**
@@ -80,34 +202,488 @@ static void mg_error(struct mg_connection* nc, int error)
 }
 
 /********************************************************************//**
- * Handles list route.
+ * Reads an optional unsigned query parameter, value is left untouched
+ * when the parameter is absent.
+ ********************************************************************** */
+static int get_uint_var(struct http_message *hm, const char *name, uint32_t *value)
+{
+    char buffer[ARGNAME_MAX] = "";
+
+    if (mg_get_http_var(&hm->query_string, name, buffer, sizeof(buffer)) <= 0) {
+        return 0;
+    }
+
+    errno = 0;
+    const uint32_t parsed = atouint32(buffer);
+    if (errno != 0) {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    *value = parsed;
+    return 0;
+}
+
+/********************************************************************//**
+ * Compares two optional strings.
+ ********************************************************************** */
+static int same_string(const char *a, const char *b)
+{
+    return a == b || (a != NULL && b != NULL && !strncmp(a, b, MAX_PIC_ID));
+}
+
+/********************************************************************//**
+ * Whether two list requests ask for the same page.
+ ********************************************************************** */
+static int same_page(const struct list_page *a, const struct list_page *b)
+{
+    return a->cursor == b->cursor && a->offset == b->offset && a->limit == b->limit &&
+           same_string(a->prefix, b->prefix) && same_string(a->after, b->after);
+}
+
+/********************************************************************//**
+ * Copies the parameters of a page, strings included, into a cache entry.
+ ********************************************************************** */
+static void list_cache_set_page(struct list_cache_entry *entry, const struct list_page *page)
+{
+    entry->page = *page;
+    if (page->prefix != NULL) {
+        strncpy(entry->prefix, page->prefix, MAX_PIC_ID);
+        entry->prefix[MAX_PIC_ID] = '\0';
+        entry->page.prefix = entry->prefix;
+    }
+    if (page->after != NULL) {
+        strncpy(entry->after, page->after, MAX_PIC_ID);
+        entry->after[MAX_PIC_ID] = '\0';
+        entry->page.after = entry->after;
+    }
+}
+
+/********************************************************************//**
+ * Appends a chunk of the listing to a cache entry.
+ ********************************************************************** */
+static int list_cache_writer(void *arg, const char *chunk, size_t len)
+{
+    return mbuf_append(arg, chunk, len) == len ? 0 : ERR_OUT_OF_MEMORY;
+}
+
+/********************************************************************//**
+ * Returns the serialized page, rebuilding it only when the database
+ * version changed since it was cached. Pages of an outdated version are
+ * replaced first, then entries in turn.
+ ********************************************************************** */
+static int list_cache_get(const struct pictdb_file *db_file, const struct list_page *page, const struct mbuf **json)
+{
+    struct list_cache_entry *entry = NULL;
+
+    for (size_t i = 0; i < LIST_CACHE_ENTRIES && entry == NULL; ++i) {
+        if (s_list_cache[i].filled && same_page(&s_list_cache[i].page, page)) {
+            entry = &s_list_cache[i];
+        }
+    }
+    for (size_t i = 0; i < LIST_CACHE_ENTRIES && entry == NULL; ++i) {
+        if (!s_list_cache[i].filled || s_list_cache[i].db_version != db_file->header.db_version) {
+            entry = &s_list_cache[i];
+        }
+    }
+    if (entry == NULL) {
+        entry = &s_list_cache[s_list_cache_victim];
+        s_list_cache_victim = (s_list_cache_victim + 1) % LIST_CACHE_ENTRIES;
+    }
+
+    const int hit = entry->filled && entry->db_version == db_file->header.db_version;
+    metrics_cache(METRICS_CACHE_LIST, hit);
+    if (!hit) {
+        // keeps the allocation of the previous page
+        entry->filled = 0;
+        entry->json.len = 0;
+
+        const int status = do_list_json(db_file, page, list_cache_writer, &entry->json);
+        if (status != 0) {
+            return status;
+        }
+
+        entry->filled = 1;
+        list_cache_set_page(entry, page);
+        entry->db_version = db_file->header.db_version;
+    }
+
+    *json = &entry->json;
+    return 0;
+}
+
+/********************************************************************//**
+ * Releases the cached listing pages.
+ ********************************************************************** */
+static void list_cache_free(void)
+{
+    for (size_t i = 0; i < LIST_CACHE_ENTRIES; ++i) {
+        mbuf_free(&s_list_cache[i].json);
+        s_list_cache[i].filled = 0;
+    }
+}
+
+/********************************************************************//**
+ * Handles list route. Pages are served from the cache with the database
+ * version as ETag, so that polling clients mostly get 304 responses.
+ * A prefix (or after) parameter lists in pict_id order instead of slots.
  ********************************************************************** */
 static void handle_list_call(struct mg_connection *nc, struct http_message *hm)
 {
-    (void) hm;
+    const struct pictdb_file *db_file = nc->mgr->user_data;
+    struct list_page page = {0, 0, 0, NULL, NULL};
+    char prefix[MAX_PIC_ID + 1] = "";
+    char after[MAX_PIC_ID + 1] = "";
 
-    char* resp = do_list(nc->mgr->user_data, JSON);
+    int status = get_uint_var(hm, ARG_CURSOR, &page.cursor);
+    if (status == 0) {
+        status = get_uint_var(hm, ARG_OFFSET, &page.offset);
+    }
+    if (status == 0) {
+        status = get_uint_var(hm, ARG_LIMIT, &page.limit);
+    }
+    if (status == 0 && mg_get_http_var(&hm->query_string, ARG_PREFIX, prefix, sizeof(prefix)) > 0) {
+        page.prefix = prefix;
+    }
+    if (status == 0 && mg_get_http_var(&hm->query_string, ARG_AFTER, after, sizeof(after)) > 0) {
+        page.after = after;
+    }
+    if (status != 0) {
+        mg_error(nc, status);
+        return;
+    }
 
-    if (resp == NULL) {
-        mg_error(nc, ERR_DEBUG);
+    char etag[ETAG_LEN];
+    snprintf(etag, sizeof(etag), "\"%" PRIu32 "\"", db_file->header.db_version);
+
+    const struct mg_str *if_none_match = mg_get_http_header(hm, HEADER_IF_NONE_MATCH);
+    if (if_none_match != NULL && !mg_vcmp(if_none_match, etag)) {
+        mg_printf(nc,
+                  "HTTP/1.1 304 Not Modified\r\n"
+                  "ETag: %s\r\n"
+                  "Content-Length: 0\r\n"
+                  "\r\n",
+                  etag);
+        nc->flags |= MG_F_SEND_AND_CLOSE;
+        return;
+    }
+
+    const struct mbuf *json = NULL;
+    status = list_cache_get(db_file, &page, &json);
+    if (status != 0) {
+        mg_error(nc, status);
         return;
     }
 
     mg_printf(nc,
               "HTTP/1.1 200 OK\r\n"
               "Content-Type: application/json\r\n"
+              "Cache-Control: no-cache\r\n"
+              "ETag: %s\r\n"
               "Content-Length: %d\r\n"
-              "\r\n"
-              "%s",
-              (int) strlen(resp), resp);
+              "\r\n",
+              etag, (int) json->len);
+    mg_send(nc, json->buf, (int) json->len);
+    nc->flags |= MG_F_SEND_AND_CLOSE;
+}
+
+/********************************************************************//**
+ * Returns the sprite sheet of a page, composing it only when the
+ * database version changed since it was cached. Same replacement as
+ * list_cache_get.
+ ********************************************************************** */
+static int sprite_cache_get(struct pictdb_file *db_file, const struct list_page *page,
+                            const struct sprite_cache_entry **found)
+{
+    struct sprite_cache_entry *entry = NULL;
+
+    for (size_t i = 0; i < SPRITE_CACHE_ENTRIES && entry == NULL; ++i) {
+        if (s_sprite_cache[i].filled && same_page(&s_sprite_cache[i].page, page)) {
+            entry = &s_sprite_cache[i];
+        }
+    }
+    for (size_t i = 0; i < SPRITE_CACHE_ENTRIES && entry == NULL; ++i) {
+        if (!s_sprite_cache[i].filled || s_sprite_cache[i].sprite.db_version != db_file->header.db_version) {
+            entry = &s_sprite_cache[i];
+        }
+    }
+    if (entry == NULL) {
+        entry = &s_sprite_cache[s_sprite_cache_victim];
+        s_sprite_cache_victim = (s_sprite_cache_victim + 1) % SPRITE_CACHE_ENTRIES;
+    }
+
+    const int hit = entry->filled && entry->sprite.db_version == db_file->header.db_version;
+    metrics_cache(METRICS_CACHE_SPRITE, hit);
+    if (!hit) {
+        if (entry->filled) {
+            sprite_free(&entry->sprite);
+        }
+        entry->filled = 0;
+        entry->json.len = 0;
+
+        int status = do_sprite(db_file, page, &entry->sprite);
+        if (status == 0) {
+            status = do_sprite_json(&entry->sprite, list_cache_writer, &entry->json);
+        }
+        if (status != 0) {
+            sprite_free(&entry->sprite);
+            return status;
+        }
+
+        entry->filled = 1;
+        entry->page = *page;
+    }
+
+    *found = entry;
+    return 0;
+}
+
+/********************************************************************//**
+ * Releases the cached sprite sheets.
+ ********************************************************************** */
+static void sprite_cache_free(void)
+{
+    for (size_t i = 0; i < SPRITE_CACHE_ENTRIES; ++i) {
+        if (s_sprite_cache[i].filled) {
+            sprite_free(&s_sprite_cache[i].sprite);
+        }
+        mbuf_free(&s_sprite_cache[i].json);
+        s_sprite_cache[i].filled = 0;
+    }
+}
+
+/********************************************************************//**
+ * Handles sprite route: the thumbnails of a page (cursor, offset, limit
+ * as for list) in a single JPEG image, or with format=json where each
+ * of them lies on it.
+ ********************************************************************** */
+static void handle_sprite_call(struct mg_connection *nc, struct http_message *hm)
+{
+    struct list_page page = {0, 0, 0, NULL, NULL};
+    char format[ARGNAME_MAX] = "";
+
+    int status = get_uint_var(hm, ARG_CURSOR, &page.cursor);
+    if (status == 0) {
+        status = get_uint_var(hm, ARG_OFFSET, &page.offset);
+    }
+    if (status == 0) {
+        status = get_uint_var(hm, ARG_LIMIT, &page.limit);
+    }
+
+    const struct sprite_cache_entry *entry = NULL;
+    if (status == 0) {
+        status = sprite_cache_get(nc->mgr->user_data, &page, &entry);
+    }
+    if (status != 0) {
+        mg_error(nc, status);
+        return;
+    }
+
+    if (mg_get_http_var(&hm->query_string, ARG_FORMAT, format, sizeof(format)) > 0 && !strcmp(format, FORMAT_JSON)) {
+        mg_printf(nc,
+                  "HTTP/1.1 200 OK\r\n"
+                  "Content-Type: application/json\r\n"
+                  "Content-Length: %d\r\n"
+                  "\r\n",
+                  (int) entry->json.len);
+        mg_send(nc, entry->json.buf, (int) entry->json.len);
+    } else if (entry->sprite.count == 0) {
+        mg_error(nc, ERR_FILE_NOT_FOUND);
+        return;
+    } else {
+        mg_printf(nc,
+                  "HTTP/1.1 200 OK\r\n"
+                  "Content-Type: image/jpeg\r\n"
+                  "Content-Length: %d\r\n"
+                  "\r\n",
+                  (int) entry->sprite.jpeg_size);
+        mg_send(nc, entry->sprite.jpeg, (int) entry->sprite.jpeg_size);
+    }
     nc->flags |= MG_F_SEND_AND_CLOSE;
+}
+
+/********************************************************************//**
+ * Sends a chunk of a query result straight to the connection.
+ ********************************************************************** */
+static int query_chunk_writer(void *arg, const char *chunk, size_t len)
+{
+    mg_send_http_chunk(arg, chunk, len);
+    return 0;
+}
+
+/********************************************************************//**
+ * Handles query route: where holds comma separated predicates (see
+ * parse_predicate). The result is streamed with chunked transfer encoding.
+ ********************************************************************** */
+static void handle_query_call(struct mg_connection *nc, struct http_message *hm)
+{
+    struct list_page page = {0, 0, 0, NULL, NULL};
+    struct query_predicate predicates[MAX_QUERY_PREDICATES];
+    size_t count = 0;
+    char where[MAX_WHERE_LEN] = "";
+
+    int status = get_uint_var(hm, ARG_CURSOR, &page.cursor);
+    if (status == 0) {
+        status = get_uint_var(hm, ARG_OFFSET, &page.offset);
+    }
+    if (status == 0) {
+        status = get_uint_var(hm, ARG_LIMIT, &page.limit);
+    }
+    if (status == 0 && mg_get_http_var(&hm->query_string, ARG_WHERE, where, sizeof(where)) > 0) {
+        for (char *expr = strtok(where, WHERE_DELIM); expr != NULL && status == 0; expr = strtok(NULL, WHERE_DELIM)) {
+            status = count < MAX_QUERY_PREDICATES ? parse_predicate(expr, &predicates[count++]) : ERR_INVALID_ARGUMENT;
+        }
+    }
+    if (status != 0) {
+        mg_error(nc, status);
+        return;
+    }
+
+    mg_printf(nc,
+              "HTTP/1.1 200 OK\r\n"
+              "Content-Type: application/json\r\n"
+              "Transfer-Encoding: chunked\r\n"
+              "\r\n");
+
+    status = do_query_json(nc->mgr->user_data, predicates, count, &page, query_chunk_writer, nc);
+    if (status != 0) {
+        fprintf(stderr, "ERROR: %s\n", ERROR_MESSAGES[status]);
+    } else {
+        mg_send_http_chunk(nc, "", 0);
+    }
+    nc->flags |= MG_F_SEND_AND_CLOSE;
+}
+
+/********************************************************************//**
+ * Reads the decimal position starting at text. Unlike strtoull alone,
+ * rejects a sign or blanks in front of the digits. Returns 0 on success,
+ * -1 when text does not start with a digit.
+ ********************************************************************** */
+static int parse_position(const char *text, char **end, uint64_t *position)
+{
+    if (!isdigit((unsigned char) *text)) {
+        return -1;
+    }
+    *position = strtoull(text, end, 10);
+    return 0;
+}
+
+/********************************************************************//**
+ * Parses a Range header against an image of size bytes. Returns the
+ * number of satisfiable ranges, or -1 when the header must be ignored
+ * (other unit, syntax error or more than MAX_RANGES ranges).
+ ********************************************************************** */
+static int parse_ranges(const struct mg_str *header, uint32_t size, struct byte_range ranges[])
+{
+    char spec[MAX_RANGE_SPEC] = "";
+    if (header->len >= sizeof(spec) || header->len < strlen(RANGE_UNIT) ||
+        strncmp(header->p, RANGE_UNIT, strlen(RANGE_UNIT))) {
+        return -1;
+    }
+    strncpy(spec, header->p + strlen(RANGE_UNIT), header->len - strlen(RANGE_UNIT));
+
+    int count = 0;
+    int seen = 0;
+    for (char *range = strtok(spec, RANGE_DELIM); range != NULL; range = strtok(NULL, RANGE_DELIM), seen = 1) {
+        char *end = NULL;
+        uint64_t first = 0;
+        uint64_t last = UINT64_MAX;
+
+        if (*range == '-') {
+            // suffix: the last bytes of the image
+            uint64_t suffix = 0;
+            if (parse_position(range + 1, &end, &suffix) != 0 || *end != '\0') {
+                return -1;
+            }
+            if (suffix == 0) {
+                continue;
+            }
+            first = suffix < size ? size - suffix : 0;
+        } else {
+            if (parse_position(range, &end, &first) != 0 || *end != '-') {
+                return -1;
+            }
+            char *last_start = end + 1;
+            if (*last_start != '\0') {
+                if (parse_position(last_start, &end, &last) != 0 || *end != '\0' || last < first) {
+                    return -1;
+                }
+            }
+        }
+
+        if (first >= size) {
+            continue;
+        }
+        if (count == MAX_RANGES) {
+            return -1;
+        }
+        ranges[count].start = first;
+        ranges[count].length = (uint32_t) ((last < size ? last + 1 : size) - first);
+        ++count;
+    }
+
+    return seen ? count : -1;
+}
+
+/********************************************************************//**
+ * Sends a byte range of a located image, reading only those bytes.
+ ********************************************************************** */
+static int send_range(struct mg_connection *nc, const struct pict_location *location, const struct byte_range *range)
+{
+    char *buffer = malloc(range->length == 0 ? 1 : range->length);
+    if (buffer == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    const int status = do_read_range(nc->mgr->user_data, location, range->start, range->length, buffer);
+    if (status == 0) {
+        mg_send(nc, buffer, (int) range->length);
+    }
+
+    free(buffer);
+    return status;
+}
+
+/********************************************************************//**
+ * Sends several byte ranges as a multipart/byteranges response.
+ ********************************************************************** */
+static int send_byteranges(struct mg_connection *nc, const struct pict_location *location, const char *etag,
+                           const struct byte_range ranges[], int count)
+{
+    char parts[MAX_RANGES][RANGE_PART_HEADER_LEN];
+    uint64_t length = strlen(BYTERANGES_END);
+
+    for (int i = 0; i < count; ++i) {
+        snprintf(parts[i], sizeof(parts[i]),
+                 "\r\n--" BYTERANGES_BOUNDARY "\r\n"
+                 "Content-Type: image/jpeg\r\n"
+                 "Content-Range: bytes %" PRIu64 "-%" PRIu64 "/%" PRIu32 "\r\n"
+                 "\r\n",
+                 ranges[i].start, ranges[i].start + ranges[i].length - 1, location->size);
+        length += strlen(parts[i]) + ranges[i].length;
+    }
+
+    mg_printf(nc,
+              "HTTP/1.1 206 Partial Content\r\n"
+              "Content-Type: multipart/byteranges; boundary=" BYTERANGES_BOUNDARY "\r\n"
+              "Accept-Ranges: bytes\r\n"
+              "ETag: %s\r\n"
+              "Content-Length: %" PRIu64 "\r\n"
+              "\r\n",
+              etag, length);
 
-    free(resp);
-    resp = NULL;
+    int status = 0;
+    for (int i = 0; i < count && status == 0; ++i) {
+        mg_send(nc, parts[i], (int) strlen(parts[i]));
+        status = send_range(nc, location, &ranges[i]);
+    }
+    mg_send(nc, BYTERANGES_END, (int) strlen(BYTERANGES_END));
+    return status;
 }
 
 /********************************************************************//**
- * Handles read route.
+ * Handles read route. Range requests (several ranges included) are
+ * honored unless an If-Range validator does not match the ETag, which
+ * is derived from the picture hash and the resolution.
  ********************************************************************** */
 static void handle_read_call(struct mg_connection *nc, struct http_message *hm)
 {
@@ -139,60 +715,353 @@ static void handle_read_call(struct mg_connection *nc, struct http_message *hm)
     }
 
     const uint32_t resolution = (uint32_t) resolution_parsed;
-    char *image_buffer = NULL;
-    uint32_t image_size = 0;
+    struct pict_location location;
 
-    int status = do_read(pict_id, resolution, &image_buffer, &image_size, nc->mgr->user_data);
+    int status = do_locate(pict_id, resolution, &location, nc->mgr->user_data);
 
     if (status != 0) {
         mg_error(nc, status);
         return;
     }
-    assert(image_buffer != NULL);
 
-    mg_printf(nc,
-              "HTTP/1.1 200 OK\r\n"
-              "Content-Type: image/jpeg\r\n"
-              "Content-Length: %d\r\n"
-              "\r\n",
-              image_size);
-    mg_send(nc, image_buffer, (int) image_size);
+    char etag[IMAGE_ETAG_LEN];
+    snprintf(etag, sizeof(etag), "\"%02x%02x%02x%02x%02x%02x%02x%02x-%" PRIu32 "\"",
+             location.SHA[0], location.SHA[1], location.SHA[2], location.SHA[3],
+             location.SHA[4], location.SHA[5], location.SHA[6], location.SHA[7], resolution);
+
+    struct byte_range ranges[MAX_RANGES];
+    int count = -1;
+    const struct mg_str *range = mg_get_http_header(hm, HEADER_RANGE);
+    const struct mg_str *if_range = mg_get_http_header(hm, HEADER_IF_RANGE);
+    if (range != NULL && (if_range == NULL || !mg_vcmp(if_range, etag))) {
+        count = parse_ranges(range, location.size, ranges);
+    }
+
+    if (count == 0) {
+        mg_printf(nc,
+                  "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                  "Content-Range: bytes */%" PRIu32 "\r\n"
+                  "Content-Length: 0\r\n"
+                  "\r\n",
+                  location.size);
+    } else if (count == 1) {
+        mg_printf(nc,
+                  "HTTP/1.1 206 Partial Content\r\n"
+                  "Content-Type: image/jpeg\r\n"
+                  "Content-Range: bytes %" PRIu64 "-%" PRIu64 "/%" PRIu32 "\r\n"
+                  "Accept-Ranges: bytes\r\n"
+                  "ETag: %s\r\n"
+                  "Content-Length: %" PRIu32 "\r\n"
+                  "\r\n",
+                  ranges[0].start, ranges[0].start + ranges[0].length - 1, location.size, etag, ranges[0].length);
+        status = send_range(nc, &location, &ranges[0]);
+    } else if (count > 1) {
+        status = send_byteranges(nc, &location, etag, ranges, count);
+    } else {
+        const struct byte_range all = {0, location.size};
+        mg_printf(nc,
+                  "HTTP/1.1 200 OK\r\n"
+                  "Content-Type: image/jpeg\r\n"
+                  "Accept-Ranges: bytes\r\n"
+                  "ETag: %s\r\n"
+                  "Content-Length: %" PRIu32 "\r\n"
+                  "\r\n",
+                  etag, location.size);
+        status = send_range(nc, &location, &all);
+    }
+
+    if (status != 0) {
+        // headers are gone already, closing tells the client
+        fprintf(stderr, "ERROR: %s\n", ERROR_MESSAGES[status]);
+        nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+        return;
+    }
     nc->flags |= MG_F_SEND_AND_CLOSE;
+}
 
-    free(image_buffer);
-    image_buffer = NULL;
+/********************************************************************//**
+ * Sends the status line of a batch read, once.
+ ********************************************************************** */
+static void batch_response_begin(struct batch_response *response)
+{
+    if (response->started) {
+        return;
+    }
+    mg_printf(response->nc,
+              "HTTP/1.1 200 OK\r\n"
+              "Content-Type: application/octet-stream\r\n"
+              "Transfer-Encoding: chunked\r\n"
+              "\r\n");
+    response->started = 1;
 }
 
 /********************************************************************//**
- * Handles insert route.
+ * Sends a frame: a position and a size, both 32-bit big endian, then the
+ * bytes.
  ********************************************************************** */
-static void handle_insert_call(struct mg_connection *nc, struct http_message *hm)
+static void batch_send_frame(struct mg_connection *nc, uint32_t position, const char *bytes, uint32_t size)
 {
-    char varname[100] = "";
-    char filename[FILENAME_MAX] = "";
-    const char *data = NULL;
-    size_t data_len = 0;
+    unsigned char header[BATCH_FRAME_HEADER];
+    for (size_t i = 0; i < 4; ++i) {
+        header[i] = (unsigned char) (position >> (24 - 8 * i));
+        header[4 + i] = (unsigned char) (size >> (24 - 8 * i));
+    }
 
-    if (mg_parse_multipart(hm->body.p, hm->body.len, varname, sizeof(varname), filename, sizeof(filename), &data,
-                           &data_len) <= 0) {
+    mg_send_http_chunk(nc, (const char *) header, sizeof(header));
+    mg_send_http_chunk(nc, bytes, size);
+}
 
+/********************************************************************//**
+ * Sends one image of a batch as a frame of its position in the request.
+ * The status line goes with the first one.
+ ********************************************************************** */
+static int batch_frame_writer(void *arg, size_t position, const char *image, uint32_t size)
+{
+    struct batch_response *response = arg;
+    batch_response_begin(response);
+    batch_send_frame(response->nc, (uint32_t) position, image, size);
+    return 0;
+}
+
+/********************************************************************//**
+ * Handles batch read route: the body holds up to MAX_BATCH_IDS pict_ids,
+ * one per line, res the resolution of all images. Found images are
+ * streamed in file order as length-prefixed frames (see
+ * batch_send_frame). A failure before the first frame is answered with an
+ * error status; after it, with a last frame at BATCH_ERROR_POSITION
+ * holding the error message.
+ ********************************************************************** */
+static void handle_read_batch_call(struct mg_connection *nc, struct http_message *hm)
+{
+    char res[ARGNAME_MAX] = "";
+    const int resolution = mg_get_http_var(&hm->query_string, ARG_RES, res, sizeof(res)) > 0 ?
+                           resolution_atoi(res) : -1;
+    if (resolution == -1 || mg_vcmp(&hm->method, POST_METHOD)) {
         mg_error(nc, ERR_INVALID_ARGUMENT);
         return;
     }
 
-    int status = do_insert(data, data_len, filename, nc->mgr->user_data);
-    if (status != 0) {
+    // at most one identifier per line
+    size_t max_count = 1;
+    for (size_t i = 0; i < hm->body.len; ++i) {
+        max_count += hm->body.p[i] == '\n';
+    }
+
+    char *body = malloc(hm->body.len + 1);
+    const char **pict_ids = calloc(max_count, sizeof(const char *));
+    if (body == NULL || pict_ids == NULL) {
+        free(body);
+        free(pict_ids);
+        mg_error(nc, ERR_OUT_OF_MEMORY);
+        return;
+    }
+    memcpy(body, hm->body.p, hm->body.len);
+    body[hm->body.len] = '\0';
+
+    size_t count = 0;
+    int valid = 1;
+    for (char *pict_id = strtok(body, BATCH_DELIM); pict_id != NULL && valid; pict_id = strtok(NULL, BATCH_DELIM)) {
+        valid = count < MAX_BATCH_IDS && strlen(pict_id) <= MAX_PIC_ID;
+        pict_ids[count++] = pict_id;
+    }
+
+    if (!valid) {
+        mg_printf(nc,
+                  "HTTP/1.1 400 Bad Request\r\n"
+                  "Content-Length: 0\r\n"
+                  "\r\n");
+        nc->flags |= MG_F_SEND_AND_CLOSE;
+        free(body);
+        free(pict_ids);
+        return;
+    }
+
+    struct batch_response response = {nc, 0};
+    const int status = do_read_batch(nc->mgr->user_data, pict_ids, count, (unsigned int) resolution,
+                                     batch_frame_writer, &response);
+    if (status != 0 && !response.started) {
         mg_error(nc, status);
+    } else {
+        batch_response_begin(&response);
+        if (status != 0) {
+            fprintf(stderr, "ERROR: %s\n", ERROR_MESSAGES[status]);
+            batch_send_frame(nc, BATCH_ERROR_POSITION, ERROR_MESSAGES[status],
+                             (uint32_t) strlen(ERROR_MESSAGES[status]));
+        }
+        mg_send_http_chunk(nc, "", 0);
+        nc->flags |= MG_F_SEND_AND_CLOSE;
+    }
+
+    free(body);
+    free(pict_ids);
+}
+
+/********************************************************************//**
+ * Status code of the response queued on a connection, 0 if none.
+ ********************************************************************** */
+static int response_code(const struct mg_connection *nc)
+{
+    const struct mbuf *out = &nc->send_mbuf;
+    if (out->len < strlen(HTTP_STATUS_PREFIX) + 3 || strncmp(out->buf, HTTP_STATUS_PREFIX, strlen(HTTP_STATUS_PREFIX))) {
+        return 0;
+    }
+
+    const char *code = out->buf + strlen(HTTP_STATUS_PREFIX);
+    return (code[0] - '0') * 100 + (code[1] - '0') * 10 + (code[2] - '0');
+}
+
+/********************************************************************//**
+ * Records a request whose response is queued on nc.
+ ********************************************************************** */
+static void record_request(const struct mg_connection *nc, enum metrics_route route, uint64_t start_us)
+{
+    metrics_request(route, response_code(nc), metrics_now_us() - start_us);
+}
+
+/********************************************************************//**
+ * Drops the upload a connection may have left half-way.
+ ********************************************************************** */
+static void insert_upload_free(struct mg_connection *nc)
+{
+    struct insert_upload *state = nc->user_data;
+    if (state == NULL) {
         return;
     }
 
-    mg_printf(nc,
-              "HTTP/1.1 302 Found\r\n"
-              "Location: http://localhost:"PORT"/index.html\r\n"
-              "Content-Length: 0\r\n"
-              "\r\n");
-    nc->flags |= MG_F_SEND_AND_CLOSE;
+    if (state->started) {
+        do_insert_abort(nc->mgr->user_data, &state->upload);
+    }
+    free(state);
+    nc->user_data = NULL;
+}
+
+/********************************************************************//**
+ * Starts an upload, whose image may take the whole request body, up to
+ * MAX_UPLOAD_BYTES.
+ ********************************************************************** */
+static void insert_request_begin(struct mg_connection *nc, struct http_message *hm)
+{
+    if (mg_vcmp(&hm->method, POST_METHOD)) {
+        mg_error(nc, ERR_INVALID_COMMAND);
+        return;
+    }
+
+    struct mg_str *header = mg_get_http_header(hm, HEADER_CONTENT_LENGTH);
+    if (header == NULL) {
+        mg_printf(nc,
+                  "HTTP/1.1 411 Length Required\r\n"
+                  "Content-Length: 0\r\n"
+                  "\r\n");
+        nc->flags |= MG_F_SEND_AND_CLOSE;
+        return;
+    }
+
+    char length[ARGNAME_MAX] = "";
+    strncpy(length, header->p, header->len < sizeof(length) ? header->len : sizeof(length) - 1);
+
+    errno = 0;
+    const uint32_t reserve = atouint32(length);
+    if (errno != 0 || reserve == 0) {
+        mg_error(nc, ERR_INVALID_ARGUMENT);
+        return;
+    }
+    if (reserve > MAX_UPLOAD_BYTES) {
+        mg_printf(nc,
+                  "HTTP/1.1 413 Payload Too Large\r\n"
+                  "Content-Length: 0\r\n"
+                  "\r\n");
+        nc->flags |= MG_F_SEND_AND_CLOSE;
+        return;
+    }
+
+    struct insert_upload *state = calloc(1, sizeof(struct insert_upload));
+    if (state == NULL) {
+        mg_error(nc, ERR_OUT_OF_MEMORY);
+        return;
+    }
+
+    state->reserve = reserve;
+    nc->user_data = state;
+}
+
+/********************************************************************//**
+ * Handles insert route: the first file part is streamed to the database
+ * as it arrives, others are ignored.
+ ********************************************************************** */
+static void handle_insert_call(struct mg_connection *nc, int ev, void *ev_data)
+{
+    struct insert_upload *state = nc->user_data;
+    struct pictdb_file *db_file = nc->mgr->user_data;
+    struct mg_http_multipart_part *mp = (struct mg_http_multipart_part *) ev_data;
+
+    const uint64_t now_us = metrics_now_us();
+
+    switch (ev) {
+    case MG_EV_HTTP_REQUEST:
+        // not a multipart body
+        mg_error(nc, ERR_INVALID_ARGUMENT);
+        record_request(nc, METRICS_ROUTE_INSERT, now_us);
+        break;
+    case MG_EV_HTTP_MULTIPART_REQUEST:
+        insert_request_begin(nc, (struct http_message *) ev_data);
+        if (nc->user_data == NULL) {
+            record_request(nc, METRICS_ROUTE_INSERT, now_us);
+        } else {
+            ((struct insert_upload *) nc->user_data)->start_us = now_us;
+        }
+        break;
+    case MG_EV_HTTP_PART_BEGIN:
+        if (state == NULL || state->done || state->status != 0) {
+            break;
+        }
+        if (mp->file_name == NULL || mp->file_name[0] == '\0') {
+            state->status = ERR_INVALID_ARGUMENT;
+            break;
+        }
+        strncpy(state->pict_id, mp->file_name, MAX_PIC_ID);
+        state->status = do_insert_begin(db_file, state->reserve, &state->upload);
+        state->started = state->status == 0;
+        break;
+    case MG_EV_HTTP_PART_DATA:
+        if (state != NULL && state->started && state->status == 0) {
+            state->status = do_insert_append(db_file, &state->upload, mp->data.p, mp->data.len);
+        }
+        break;
+    case MG_EV_HTTP_PART_END:
+        if (state != NULL && state->started) {
+            if (state->status == 0 && mp->status >= 0) {
+                state->status = do_insert_end(db_file, &state->upload, state->pict_id);
+            } else {
+                do_insert_abort(db_file, &state->upload);
+            }
+            state->started = 0;
+            state->done = 1;
+        }
+        break;
+    case MG_EV_HTTP_MULTIPART_REQUEST_END:
+        if (state == NULL) {
+            break;
+        }
+        if (state->status == 0 && !state->done) {
+            state->status = ERR_INVALID_ARGUMENT;
+        }
 
+        if (state->status != 0) {
+            mg_error(nc, state->status);
+        } else {
+            mg_printf(nc,
+                      "HTTP/1.1 302 Found\r\n"
+                      "Location: /index.html\r\n"
+                      "Content-Length: 0\r\n"
+                      "\r\n");
+            nc->flags |= MG_F_SEND_AND_CLOSE;
+        }
+        record_request(nc, METRICS_ROUTE_INSERT, state->start_us);
+        insert_upload_free(nc);
+        break;
+    default:
+        break;
+    }
 }
 
 /********************************************************************//**
@@ -228,13 +1097,39 @@ static void handle_delete_call(struct mg_connection *nc, struct http_message *hm
 
     mg_printf(nc,
               "HTTP/1.1 302 Found\r\n"
-              "Location: http://localhost:"PORT"/index.html\r\n"
+              "Location: /index.html\r\n"
               "Content-Length: 0\r\n"
               "\r\n");
     nc->flags |= MG_F_SEND_AND_CLOSE;
 
 }
 
+/********************************************************************//**
+ * Handles metrics route, in Prometheus text format.
+ ********************************************************************** */
+static void handle_metrics_call(struct mg_connection *nc)
+{
+    struct mbuf text;
+    mbuf_init(&text, LIST_CHUNK);
+
+    const int status = metrics_format(list_cache_writer, &text);
+    if (status != 0) {
+        mbuf_free(&text);
+        mg_error(nc, status);
+        return;
+    }
+
+    mg_printf(nc,
+              "HTTP/1.1 200 OK\r\n"
+              "Content-Type: text/plain; version=0.0.4\r\n"
+              "Content-Length: %d\r\n"
+              "\r\n",
+              (int) text.len);
+    mg_send(nc, text.buf, (int) text.len);
+    nc->flags |= MG_F_SEND_AND_CLOSE;
+    mbuf_free(&text);
+}
+
 /********************************************************************//**
  * Handles termination signals by storing stopping state.
  ********************************************************************** */
@@ -252,69 +1147,268 @@ static void ev_handler(struct mg_connection *nc, int ev, void *ev_data)
     switch (ev) {
     case MG_EV_HTTP_REQUEST: {
         struct http_message *hm = (struct http_message *) ev_data;
+        const uint64_t start_us = metrics_now_us();
+        enum metrics_route route = METRICS_ROUTE_STATIC;
+
+        // picks up the mutations of the other processes sharing the database
+        (void) do_refresh(nc->mgr->user_data);
+
         if (!mg_vcmp(&hm->uri, ROUTE_LIST)) {
+            route = METRICS_ROUTE_LIST;
             handle_list_call(nc, hm);
         } else if (!mg_vcmp(&hm->uri, ROUTE_READ)) {
+            route = METRICS_ROUTE_READ;
             handle_read_call(nc, hm);
-        } else if (!mg_vcmp(&hm->uri, ROUTE_INSERT) && !mg_vcmp(&hm->method, POST_METHOD)) {
-            handle_insert_call(nc, hm);
+        } else if (!mg_vcmp(&hm->uri, ROUTE_READ_BATCH)) {
+            route = METRICS_ROUTE_READ_BATCH;
+            handle_read_batch_call(nc, hm);
+        } else if (!mg_vcmp(&hm->uri, ROUTE_SPRITE)) {
+            route = METRICS_ROUTE_SPRITE;
+            handle_sprite_call(nc, hm);
         } else if (!mg_vcmp(&hm->uri, ROUTE_DELETE)) {
+            route = METRICS_ROUTE_DELETE;
             handle_delete_call(nc, hm);
+        } else if (!mg_vcmp(&hm->uri, ROUTE_QUERY)) {
+            route = METRICS_ROUTE_QUERY;
+            handle_query_call(nc, hm);
+        } else if (!mg_vcmp(&hm->uri, ROUTE_METRICS)) {
+            route = METRICS_ROUTE_METRICS;
+            handle_metrics_call(nc);
         } else {
             mg_serve_http(nc, hm, s_http_server_opts);
         }
+
+        record_request(nc, route, start_us);
         break;
     }
+    case MG_EV_ACCEPT:
+        metrics_connection(1);
+        break;
+    case MG_EV_RECV:
+        metrics_bytes((uint64_t) *(int *) ev_data, 0);
+        break;
+    case MG_EV_SEND:
+        metrics_bytes(0, (uint64_t) *(int *) ev_data);
+        break;
+    case MG_EV_CLOSE:
+        insert_upload_free(nc);
+        if (nc->listener != NULL) {
+            metrics_connection(-1);
+        }
+        break;
     default:
         break;
     }
 }
 
 /********************************************************************//**
- * MAIN
+ * Sets up a manager listening on port, its database left to serve().
  ********************************************************************** */
-int main(int argc, char *argv[])
+static int listen_on(struct mg_mgr *mgr, const char *port)
 {
-    if (VIPS_INIT(argv[0])) {
-        vips_error_exit("unable to start VIPS");
+    mg_mgr_init(mgr, NULL);
+    struct mg_connection *nc = mg_bind(mgr, port, ev_handler);
+    if (nc == NULL) {
+        // port in use or invalid
+        mg_mgr_free(mgr);
+        return ERR_IO;
     }
 
-    if (argc < 2) {
-        return ERR_NOT_ENOUGH_ARGUMENTS;
-    }
+    mg_register_http_endpoint(nc, ROUTE_INSERT, handle_insert_call);
+    mg_set_protocol_http_websocket(nc);
+    return 0;
+}
 
-    M_REQUIRE_VALID_FILENAME(argv[1]);
+/********************************************************************//**
+ * Runs one event loop, on a listening manager and its own handle of the
+ * database, until a termination signal. The manager is freed.
+ ********************************************************************** */
+static int serve(const struct server_options *options, unsigned int loop, struct mg_mgr *mgr)
+{
+    if (VIPS_INIT(options->program)) {
+        vips_error_exit("unable to start VIPS");
+    }
 
-    const char *db_filename = argv[1];
     struct pictdb_file db_file;
-    int status = do_open(db_filename, "r+b", &db_file);
+    int status = do_open(options->db_filename, "r+b", &db_file);
+
+    if (status == 0 && options->shared) {
+        status = do_share(options->db_filename, &db_file);
+    }
 
+    // the server scans on every list and insert: mirror hot metadata right away
     if (status == 0) {
-        print_header(&db_file.header);
+        status = columns_ensure(&db_file);
+    }
 
-        struct mg_mgr mgr;
-        struct mg_connection *nc;
+    if (status == 0) {
+        if (loop == 0) {
+            print_header(&db_file.header);
+        }
 
         signal(SIGTERM, signal_handler);
         signal(SIGINT, signal_handler);
 
-        mg_mgr_init(&mgr, &db_file);
-        nc = mg_bind(&mgr, PORT, ev_handler);
-        if (nc == NULL) {
-            return -1;
+        mgr->user_data = &db_file;
+        while (!s_sig_received) {
+            mg_mgr_poll(mgr, 1000);
+            // honors DURABILITY_INTERVAL when no mutation comes to trigger it
+            (void) do_sync_due(&db_file);
         }
+    }
 
-        mg_set_protocol_http_websocket(nc);
+    mg_mgr_free(mgr);
+    list_cache_free();
+    sprite_cache_free();
 
-        while (!s_sig_received) {
-            mg_mgr_poll(&mgr, 1000);
+    do_close(&db_file);
+    (void) trace_dump(stderr);
+    trace_stop();
+    vips_shutdown();
+
+    return status;
+}
+
+/********************************************************************//**
+ * Forks one process per event loop and waits for them. The listener is
+ * bound before: the loops inherit it and the kernel hands each incoming
+ * connection to one of them. A termination signal received by the parent
+ * is passed on to the loops. Returns the first failure of a loop, 0 if
+ * all of them ended well.
+ ********************************************************************** */
+static int run_loops(const struct server_options *options)
+{
+    pid_t *children = calloc(options->loops, sizeof(pid_t));
+    if (children == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    struct mg_mgr mgr;
+    if (listen_on(&mgr, options->port) != 0) {
+        free(children);
+        return ERR_IO;
+    }
+
+    // not restarted: wait() returns on a signal
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signal_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+
+    int result = 0;
+    unsigned int running = 0;
+    for (unsigned int i = 0; i < options->loops && !s_sig_received; ++i) {
+        children[i] = fork();
+        if (children[i] == 0) {
+            const int status = serve(options, i, &mgr);
+            fflush(NULL);
+            _exit(status);
+        }
+        if (children[i] < 0) {
+            children[i] = 0;
+            result = ERR_OUT_OF_MEMORY;
+            s_sig_received = SIGTERM;
+        } else {
+            ++running;
+        }
+    }
+    // only the loops accept
+    mg_mgr_free(&mgr);
+
+    int forwarded = 0;
+    while (running > 0) {
+        if (s_sig_received && !forwarded) {
+            for (unsigned int i = 0; i < options->loops; ++i) {
+                if (children[i] > 0) {
+                    kill(children[i], SIGTERM);
+                }
+            }
+            forwarded = 1;
         }
 
-        mg_mgr_free(&mgr);
+        int wstatus = 0;
+        const pid_t pid = waitpid(-1, &wstatus, 0);
+        if (pid < 0 && errno != EINTR) {
+            break;
+        }
+        for (unsigned int i = 0; i < options->loops && pid > 0; ++i) {
+            if (children[i] == pid) {
+                children[i] = 0;
+                --running;
+                const int status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : ERR_IO;
+                if (result == 0 && status != 0) {
+                    result = status;
+                }
+            }
+        }
     }
 
-    do_close(&db_file);
-    vips_shutdown();
+    free(children);
+    return result;
+}
 
+/********************************************************************//**
+ * Parses an event loop count.
+ ********************************************************************** */
+static int parse_loops(const char *value, unsigned int *loops)
+{
+    char *end = NULL;
+    const unsigned long number = strtoul(value, &end, 10);
+    if (end == value || *end != '\0' || number == 0 || number > MAX_LOOPS) {
+        return ERR_INVALID_ARGUMENT;
+    }
+    *loops = (unsigned int) number;
     return 0;
 }
+
+/********************************************************************//**
+ * MAIN
+ ********************************************************************** */
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        return ERR_NOT_ENOUGH_ARGUMENTS;
+    }
+
+    M_REQUIRE_VALID_FILENAME(argv[1]);
+
+    struct server_options options;
+    options.program = argv[0];
+    options.db_filename = argv[1];
+    options.port = PORT;
+    options.loops = 1;
+    options.shared = 0;
+
+    for (int i = 2; i < argc; ++i) {
+        if (!strncmp(argv[i], TRACE_OPTION, strlen(TRACE_OPTION))) {
+            // stage timings are written to stderr on shutdown
+            if (trace_start(argv[i] + strlen(TRACE_OPTION)) != 0) {
+                return ERR_INVALID_ARGUMENT;
+            }
+        } else if (!strcmp(argv[i], SHARED_OPTION)) {
+            // other processes (servers, pictDBM) may use the database meanwhile
+            options.shared = 1;
+        } else if (!strncmp(argv[i], PORT_OPTION, strlen(PORT_OPTION)) && argv[i][strlen(PORT_OPTION)] != '\0') {
+            options.port = argv[i] + strlen(PORT_OPTION);
+        } else if (!strncmp(argv[i], LOOPS_OPTION, strlen(LOOPS_OPTION))) {
+            if (parse_loops(argv[i] + strlen(LOOPS_OPTION), &options.loops) != 0) {
+                return ERR_INVALID_ARGUMENT;
+            }
+        } else if (!strncmp(argv[i], ROOT_OPTION, strlen(ROOT_OPTION)) && argv[i][strlen(ROOT_OPTION)] != '\0') {
+            s_http_server_opts.document_root = argv[i] + strlen(ROOT_OPTION);
+        } else {
+            return ERR_INVALID_ARGUMENT;
+        }
+    }
+
+    if (options.loops == 1) {
+        struct mg_mgr mgr;
+        return listen_on(&mgr, options.port) == 0 ? serve(&options, 0, &mgr) : ERR_IO;
+    }
+
+    // each loop opens the database: they coordinate like separate servers
+    options.shared = 1;
+    return run_loops(&options);
+}
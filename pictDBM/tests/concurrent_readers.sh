@@ -0,0 +1,72 @@
+#!/usr/bin/env bash
+#
+# Reader-during-writer check, through the pictDBM CLI.
+#
+# gen-dataset inserts pictures with group commit while read-only handles
+# (list and check) repeatedly open the same database and replay its log.
+# Each of them must see a consistent database: check compares the header
+# with the table and re-hashes every picture, so a header and a table
+# from different commits, or a picture whose bytes are not written yet,
+# make it fail. Once the writer is done, every picture reads back.
+#
+# usage: tests/concurrent_readers.sh [pictDBM binary]
+
+set -u
+
+PICTDBM=$(cd "$(dirname "${1:-./pictDBM}")" && pwd)/$(basename "${1:-./pictDBM}")
+COUNT=900 # below WAL_CHECKPOINT_RECORDS: readers replay the log
+READERS=4
+DATASET="-seed 11 -width 16 64 -height 16 64"
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+
+fail() {
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+# number of pictures a read-only open of db sees
+count() {
+    "$PICTDBM" list db | grep -c "^PICTURE ID"
+}
+
+# checks db until the writer is gone; writes the number of opens that saw
+# pictures to reader.<n>, or fails
+reader() {
+    local overlapped=0
+    while [ ! -f done ]; do
+        "$PICTDBM" check db > /dev/null || { echo "check failed while writing" > "failed.$1"; return; }
+        [ "$(count)" -gt 0 ] && overlapped=$((overlapped + 1))
+    done
+    echo $overlapped > "reader.$1"
+}
+
+mkdir files
+"$PICTDBM" gen-dataset files $COUNT $DATASET -files > /dev/null || fail "gen-dataset -files"
+"$PICTDBM" create db -max_files $((COUNT + 10)) > /dev/null || fail "create"
+
+for n in $(seq 1 $READERS); do
+    reader "$n" &
+done
+"$PICTDBM" gen-dataset db $COUNT $DATASET > /dev/null
+status=$?
+touch done
+wait
+
+[ $status = 0 ] || fail "gen-dataset"
+! ls failed.* > /dev/null 2>&1 || fail "$(cat failed.*)"
+overlapped=0
+for n in $(seq 1 $READERS); do
+    overlapped=$((overlapped + $(cat reader.$n)))
+done
+[ "$overlapped" -gt 0 ] || fail "no reader ran during the insertions"
+
+[ "$(count)" = $COUNT ] || fail "$(count) picture(s) after the insertions"
+"$PICTDBM" check db > /dev/null || fail "check after the insertions"
+for id in img_000000 img_000449 img_000899; do
+    "$PICTDBM" read db $id > /dev/null && cmp -s ${id}_orig.jpg files/$id.jpg || fail "$id does not read back"
+done
+
+echo "concurrent_readers: $overlapped open(s) during the insertions, OK"
@@ -0,0 +1,114 @@
+#!/usr/bin/env bash
+#
+# Crash/replay check of the write-ahead log, through the pictDBM CLI.
+#
+# gen-dataset keeps one handle open and only checkpoints when it closes,
+# so stopping it with SIGKILL leaves a database whose table is stale and
+# a log holding the committed insertions. The log only replays into the
+# database file it was written for (same device and inode), so each case
+# below restores the crash image onto that same file:
+#  - a read-only open replays the log: every picture it lists reads back
+#    intact, and none is listed without the log;
+#  - a torn or corrupted last record is dropped, the ones before it kept;
+#  - a writable open checkpoints: the log is gone and the table holds all
+#    the pictures.
+#
+# usage: tests/crash_replay.sh [pictDBM binary]
+
+set -u
+
+PICTDBM=$(cd "$(dirname "${1:-./pictDBM}")" && pwd)/$(basename "${1:-./pictDBM}")
+COUNT=900 # below WAL_CHECKPOINT_RECORDS: no checkpoint before the kill
+MIN_RECORDS=64 # DEFAULT_GROUP_COMMIT: at least one commit before the kill
+RECORD_SIZE=304 # sizeof(struct pictdb_wal_record)
+DATASET="-seed 7 -width 16 64 -height 16 64"
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+
+fail() {
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+# size of file $1 in bytes
+size() {
+    echo $(($(wc -c < "$1")))
+}
+
+# number of pictures a (read-only) open of $1 sees
+count() {
+    "$PICTDBM" list "$1" | grep -c "^PICTURE ID"
+}
+
+# every picture listed in $1 is the image gen-dataset wrote for its ID
+same_images() {
+    for id in $("$PICTDBM" list "$1" | sed -n 's/^PICTURE ID: //p'); do
+        "$PICTDBM" read "$1" "$id" > /dev/null && cmp -s "${id}_orig.jpg" "files/$id.jpg" ||
+            fail "$id does not read back from $1"
+        rm -f "${id}_orig.jpg"
+    done
+}
+
+# puts the crash image back, keeping the inode of db
+restore() {
+    cp crash db && cp crash.wal db.wal
+}
+
+mkdir files
+"$PICTDBM" gen-dataset files $COUNT $DATASET -files > /dev/null || fail "gen-dataset -files"
+
+# crash the writer once the log holds a few commits
+crashed=0
+for attempt in 1 2 3 4 5; do
+    rm -f db db.wal
+    "$PICTDBM" create db -max_files $((COUNT + 10)) > /dev/null || fail "create"
+    "$PICTDBM" gen-dataset db $COUNT $DATASET > /dev/null &
+    writer=$!
+    while kill -0 $writer 2> /dev/null; do
+        if [ -f db.wal ] && [ "$(size db.wal)" -gt $((MIN_RECORDS * RECORD_SIZE)) ]; then
+            kill -KILL $writer
+            crashed=1
+            break
+        fi
+    done
+    wait $writer 2> /dev/null
+    [ $crashed = 1 ] && [ -f db.wal ] && break
+    crashed=0
+done
+[ $crashed = 1 ] || fail "the writer always finished before being killed"
+cp db crash && cp db.wal crash.wal
+
+# replay
+restore
+recovered=$(count db)
+[ "$recovered" -ge $MIN_RECORDS ] || fail "$recovered picture(s) replayed"
+[ "$recovered" = $((($(size db.wal) - 32) / RECORD_SIZE)) ] || fail "not every record was replayed"
+"$PICTDBM" check db > /dev/null || fail "check after replay"
+rm db.wal
+[ "$(count db)" -lt "$recovered" ] || fail "the log was not needed to list the pictures"
+
+# torn last record
+restore
+head -c $(($(size crash.wal) - 1)) crash.wal > db.wal
+[ "$(count db)" = $((recovered - 1)) ] || fail "a torn record was replayed"
+
+# corrupted last record: a byte of its header after-image (the database
+# name, right after magic, slot and lsn) no longer matches the checksum
+restore
+printf '\377' | dd of=db.wal bs=1 seek=$(($(size db.wal) - RECORD_SIZE + 16)) conv=notrunc 2> /dev/null
+[ "$(count db)" = $((recovered - 1)) ] || fail "a corrupted record was replayed"
+
+# checkpoint: a writable open (read) writes the table and drops the log
+restore
+same_images db
+[ ! -f db.wal ] || fail "the log survived the checkpoint"
+[ "$(count db)" = "$recovered" ] || fail "the checkpoint lost pictures"
+"$PICTDBM" check db > /dev/null || fail "check after checkpoint"
+
+# the recovered database takes new insertions
+"$PICTDBM" insert db extra files/img_000000.jpg || fail "insert after recovery"
+[ "$(count db)" = $((recovered + 1)) ] || fail "insert after recovery not listed"
+
+echo "crash_replay: $recovered picture(s) recovered, OK"
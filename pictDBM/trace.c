@@ -0,0 +1,244 @@
+/**
+ * @file trace.c
+ * @implementation of the timing probes and of the built-in sinks
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#include "trace.h"
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define SINK_COUNTERS "counters"
+#define SINK_RING "ring"
+#define SINK_CHROME "chrome"
+
+static const char *const STAGE_NAMES[NB_TRACE_STAGES] = {
+    [TRACE_INSERT_SLOT] = "insert.slot",
+    [TRACE_INSERT_SHA] = "insert.sha",
+    [TRACE_INSERT_DEDUP] = "insert.dedup",
+    [TRACE_INSERT_WRITE] = "insert.write",
+    [TRACE_INSERT_RESOLUTION] = "insert.resolution",
+    [TRACE_INSERT_METADATA] = "insert.metadata",
+    [TRACE_READ_LOOKUP] = "read.lookup",
+    [TRACE_READ_RESIZE] = "read.resize",
+    [TRACE_READ_BLOB] = "read.blob",
+    [TRACE_RESIZE_LOAD] = "resize.load",
+    [TRACE_RESIZE_ENCODE] = "resize.encode",
+    [TRACE_RESIZE_APPEND] = "resize.append"
+};
+
+/**
+ * @brief Aggregates of each stage.
+ */
+struct trace_counters {
+    uint64_t count[NB_TRACE_STAGES]; /**< times the stage ran */
+    uint64_t total_us[NB_TRACE_STAGES]; /**< time spent in the stage */
+    uint64_t max_us[NB_TRACE_STAGES]; /**< longest run of the stage */
+};
+
+/**
+ * @brief Recorded stage.
+ */
+struct trace_event {
+    enum trace_stage stage; /**< stage */
+    uint32_t thread; /**< small identifier of the recording thread */
+    uint64_t start_us; /**< start time */
+    uint64_t end_us; /**< end time */
+};
+
+/**
+ * @brief Last recorded stages, overwritten oldest first.
+ */
+struct trace_ring {
+    uint64_t next; /**< total number of events recorded */
+    struct trace_event events[TRACE_RING_CAPACITY]; /**< events, by next modulo capacity */
+};
+
+static struct trace_sink s_sink = {NULL, NULL, NULL, NULL};
+static int s_enabled = 0;
+static uint32_t s_threads = 0;
+static __thread uint32_t t_thread = 0;
+
+const char *trace_stage_name(enum trace_stage stage)
+{
+    return stage < NB_TRACE_STAGES ? STAGE_NAMES[stage] : "unknown";
+}
+
+uint64_t trace_begin(void)
+{
+    return __atomic_load_n(&s_enabled, __ATOMIC_ACQUIRE) ? metrics_now_us() : 0;
+}
+
+void trace_end(enum trace_stage stage, uint64_t start_us)
+{
+    if (start_us != 0 && __atomic_load_n(&s_enabled, __ATOMIC_ACQUIRE)) {
+        s_sink.record(s_sink.arg, stage, start_us, metrics_now_us());
+    }
+}
+
+void trace_set_sink(const struct trace_sink *sink)
+{
+    __atomic_store_n(&s_enabled, 0, __ATOMIC_RELEASE);
+    if (s_sink.release != NULL) {
+        s_sink.release(s_sink.arg);
+    }
+    memset(&s_sink, 0, sizeof(s_sink));
+
+    if (sink != NULL && sink->record != NULL) {
+        s_sink = *sink;
+        __atomic_store_n(&s_enabled, 1, __ATOMIC_RELEASE);
+    }
+}
+
+int trace_dump(FILE *out)
+{
+    if (out == NULL || s_sink.dump == NULL) {
+        return 0;
+    }
+    return s_sink.dump(s_sink.arg, out);
+}
+
+void trace_stop(void)
+{
+    trace_set_sink(NULL);
+}
+
+/********************************************************************//**
+ * Identifier of the calling thread, 1 for the first one recording.
+ */
+static uint32_t thread_id(void)
+{
+    if (t_thread == 0) {
+        t_thread = __atomic_add_fetch(&s_threads, 1, __ATOMIC_RELAXED);
+    }
+    return t_thread;
+}
+
+/********************************************************************//**
+ * Counters sink: adds the stage duration.
+ */
+static void counters_record(void *arg, enum trace_stage stage, uint64_t start_us, uint64_t end_us)
+{
+    struct trace_counters *counters = arg;
+    const uint64_t duration = end_us - start_us;
+
+    __atomic_add_fetch(&counters->count[stage], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counters->total_us[stage], duration, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&counters->max_us[stage], __ATOMIC_RELAXED);
+    while (duration > max &&
+           !__atomic_compare_exchange_n(&counters->max_us[stage], &max, duration, 1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED)) {
+        // max was reloaded by the failed exchange
+    }
+}
+
+/********************************************************************//**
+ * Counters sink: one line per stage that ran.
+ */
+static int counters_dump(void *arg, FILE *out)
+{
+    const struct trace_counters *counters = arg;
+
+    fprintf(out, "stage,count,total_us,mean_us,max_us\n");
+    for (size_t i = 0; i < NB_TRACE_STAGES; ++i) {
+        if (counters->count[i] > 0) {
+            fprintf(out, "%s,%" PRIu64 ",%" PRIu64 ",%.1f,%" PRIu64 "\n", STAGE_NAMES[i], counters->count[i],
+                    counters->total_us[i], (double) counters->total_us[i] / (double) counters->count[i],
+                    counters->max_us[i]);
+        }
+    }
+    return ferror(out) ? ERR_IO : 0;
+}
+
+/********************************************************************//**
+ * Ring sink: keeps the event, overwriting the oldest one when full.
+ */
+static void ring_record(void *arg, enum trace_stage stage, uint64_t start_us, uint64_t end_us)
+{
+    struct trace_ring *ring = arg;
+    const uint64_t index = __atomic_fetch_add(&ring->next, 1, __ATOMIC_RELAXED);
+    struct trace_event *event = &ring->events[index % TRACE_RING_CAPACITY];
+
+    event->stage = stage;
+    event->thread = thread_id();
+    event->start_us = start_us;
+    event->end_us = end_us;
+}
+
+/********************************************************************//**
+ * First event still held by a ring, and the number of events held.
+ */
+static uint64_t ring_first(const struct trace_ring *ring, uint64_t *count)
+{
+    const uint64_t next = __atomic_load_n(&ring->next, __ATOMIC_ACQUIRE);
+    *count = next < TRACE_RING_CAPACITY ? next : TRACE_RING_CAPACITY;
+    return next - *count;
+}
+
+/********************************************************************//**
+ * Ring sink: one line per event held, oldest first.
+ */
+static int ring_dump(void *arg, FILE *out)
+{
+    const struct trace_ring *ring = arg;
+    uint64_t count = 0;
+    const uint64_t first = ring_first(ring, &count);
+
+    fprintf(out, "stage,thread,start_us,duration_us\n");
+    for (uint64_t i = first; i < first + count; ++i) {
+        const struct trace_event *event = &ring->events[i % TRACE_RING_CAPACITY];
+        fprintf(out, "%s,%" PRIu32 ",%" PRIu64 ",%" PRIu64 "\n", STAGE_NAMES[event->stage], event->thread,
+                event->start_us, event->end_us - event->start_us);
+    }
+    return ferror(out) ? ERR_IO : 0;
+}
+
+/********************************************************************//**
+ * Chrome sink: the events held as complete ("X") trace events.
+ */
+static int chrome_dump(void *arg, FILE *out)
+{
+    const struct trace_ring *ring = arg;
+    uint64_t count = 0;
+    const uint64_t first = ring_first(ring, &count);
+
+    fprintf(out, "{\"traceEvents\":[");
+    for (uint64_t i = first; i < first + count; ++i) {
+        const struct trace_event *event = &ring->events[i % TRACE_RING_CAPACITY];
+        fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"pictdb\",\"ph\":\"X\",\"pid\":1,\"tid\":%" PRIu32 ","
+                "\"ts\":%" PRIu64 ",\"dur\":%" PRIu64 "}", i == first ? "" : ",\n", STAGE_NAMES[event->stage],
+                event->thread, event->start_us, event->end_us - event->start_us);
+    }
+    fprintf(out, "],\"displayTimeUnit\":\"ms\"}\n");
+    return ferror(out) ? ERR_IO : 0;
+}
+
+int trace_start(const char *name)
+{
+    M_REQUIRE_NON_NULL(name);
+
+    struct trace_sink sink = {NULL, NULL, free, NULL};
+    if (!strcmp(name, SINK_COUNTERS)) {
+        sink.record = counters_record;
+        sink.dump = counters_dump;
+        sink.arg = calloc(1, sizeof(struct trace_counters));
+    } else if (!strcmp(name, SINK_RING) || !strcmp(name, SINK_CHROME)) {
+        sink.record = ring_record;
+        sink.dump = !strcmp(name, SINK_RING) ? ring_dump : chrome_dump;
+        sink.arg = calloc(1, sizeof(struct trace_ring));
+    } else {
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    if (sink.arg == NULL) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    trace_set_sink(&sink);
+    return 0;
+}
@@ -0,0 +1,114 @@
+/**
+ * @file trace.h
+ * @brief pictDB library: timing probes on the stages of inserts and reads.
+ *
+ * Probes cost a branch when no sink is set, and nothing at all when built
+ * with PICTDB_NO_TRACE. A sink receives each timed stage: the built-in ones
+ * aggregate counters, keep the last events in a ring buffer, or keep them
+ * for a Chrome trace (chrome://tracing, Perfetto) JSON dump.
+ *
+ * The sink must be set before the library is used, and is then shared by
+ * all threads.
+ *
+ * @author Aurélien Soccard & Teo Stocco
+ * @date 19 Oct 2026
+ */
+
+#ifndef PICTDBPRJ_TRACE_H
+#define PICTDBPRJ_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define TRACE_RING_CAPACITY 4096 // events kept by the ring and chrome sinks
+
+#ifdef PICTDB_NO_TRACE
+#define TRACE_START(var)
+#define TRACE_STOP(stage, var)
+#else
+#define TRACE_START(var) const uint64_t var = trace_begin()
+#define TRACE_STOP(stage, var) trace_end(stage, var)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Timed stages.
+ */
+enum trace_stage {
+    TRACE_INSERT_SLOT, /**< free slot search */
+    TRACE_INSERT_SHA, /**< hashing of the image */
+    TRACE_INSERT_DEDUP, /**< name and content duplicates scan */
+    TRACE_INSERT_WRITE, /**< append of the image */
+    TRACE_INSERT_RESOLUTION, /**< decoding of the original resolution */
+    TRACE_INSERT_METADATA, /**< header and slot write */
+    TRACE_READ_LOOKUP, /**< pict_id lookup */
+    TRACE_READ_RESIZE, /**< creation of a missing resolution (whole) */
+    TRACE_READ_BLOB, /**< read of the image bytes */
+    TRACE_RESIZE_LOAD, /**< read of the original */
+    TRACE_RESIZE_ENCODE, /**< decode, resize and encode, vips runs them as one pipeline */
+    TRACE_RESIZE_APPEND, /**< append of the resized image and its slot */
+    NB_TRACE_STAGES
+};
+
+/**
+ * @brief Destination of the timed stages.
+ */
+struct trace_sink {
+    /** receives one timed stage, from any thread */
+    void (*record)(void *arg, enum trace_stage stage, uint64_t start_us, uint64_t end_us);
+    /** writes what was recorded, may be NULL */
+    int (*dump)(void *arg, FILE *out);
+    /** releases arg, may be NULL */
+    void (*release)(void *arg);
+    void *arg; /**< opaque argument of the callbacks */
+};
+
+/**
+ * @brief Name of a stage, e.g. "insert.sha".
+ */
+const char *trace_stage_name(enum trace_stage stage);
+
+/**
+ * @brief Sets the sink of the probes, replacing (and releasing) the
+ *        previous one. NULL disables the probes.
+ */
+void trace_set_sink(const struct trace_sink *sink);
+
+/**
+ * @brief Sets one of the built-in sinks.
+ *
+ * @param name "counters", "ring" or "chrome".
+ * @return 0, or ERR_INVALID_ARGUMENT for an unknown name.
+ */
+int trace_start(const char *name);
+
+/**
+ * @brief Writes what the current sink recorded.
+ *
+ * @param out Output file.
+ */
+int trace_dump(FILE *out);
+
+/**
+ * @brief Releases the current sink and disables the probes.
+ */
+void trace_stop(void);
+
+/**
+ * @brief Start time of a probe, 0 when no sink is set. Use TRACE_START.
+ */
+uint64_t trace_begin(void);
+
+/**
+ * @brief Ends a probe started by trace_begin. Use TRACE_STOP.
+ */
+void trace_end(enum trace_stage stage, uint64_t start_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif